@@ -27,6 +27,11 @@
 
 #define COMPUTE_GLOBAL_SIZE(size,local)		(((size)/(local) + (((size) % (local) != 0) ? 1 : 0)) * (local))
 
+/*!
+ * Rounds [x] up to the closest multiple of [a].
+ */
+#define CLUT_ROUND_UP(x,a)			((((x) + (a) - 1) / (a)) * (a))
+
 
 void clut_checkReturn(const char * const function, cl_int value);
 
@@ -38,10 +43,23 @@ cl_device_id *clut_getAllDevices(cl_platform_id platform, cl_device_type t, cl_u
 void * clut_getDeviceInfo(const cl_device_id device, const cl_device_info info, size_t * const size);
 void * clut_getPlatformInfo(const cl_platform_id platform, const cl_platform_info info, size_t * const size);
 
+size_t clut_getDeviceAlignment(const cl_device_id device);
+int clut_hasHostUnifiedMemory(const cl_device_id device);
+cl_device_id clut_getQueueDevice(const cl_command_queue command_queue);
+
 cl_program clut_createProgramFromFile(cl_context context, const char * const file, const char * const flags);
+cl_program clut_createProgramFromSources(cl_context context, const cl_uint count, const char ** const sources, const char * const flags);
+
+cl_program clut_getCachedProgram(cl_context context, const cl_uint count, const char ** const sources, const char * const flags);
+void clut_releaseCachedPrograms(cl_context context);
+cl_kernel clut_acquireCachedKernel(cl_context context, const cl_uint count, const char ** const sources,
+				   const char * const flags, const char * const name);
+void clut_releaseCachedKernel(cl_kernel kernel);
 
 void clut_printProgramBuildLog(const cl_program program);
 
+char * clut_getKernelName(const cl_kernel kernel);
+
 void clut_contextCallback(const char *errinfo, const void *private_info, size_t private_info_size, void *user_data);
 
 cl_double clut_getEventDuration(cl_event event);
@@ -0,0 +1,56 @@
+
+#ifndef __ML_CLUT_ARENA_H
+#define __ML_CLUT_ARENA_H
+
+#include "mlclut.h"
+
+/*!
+ * Device memory arenas.
+ * An arena creates one buffer, and hands out sub-buffers of it, with
+ * origins aligned for every device of the context. Allocating never creates
+ * device memory, and the peak footprint is the arena size.
+ *
+ * CLUT_ARENA_BUMP arenas carve allocations one after the other, and free
+ * them all at once with clut_arenaReset (e.g. once per frame).
+ * CLUT_ARENA_POOL arenas round allocations up to a power of two size class;
+ * freed allocations go to the free list of their class, and are handed out
+ * again as they are, with no OpenCL call.
+ *
+ * The arena owns the sub-buffers: they must not be released with
+ * clReleaseMemObject, and are invalid after clut_arenaReset or
+ * clut_releaseArena (which must not happen while commands use them).
+ * All functions are thread safe.
+ */
+typedef struct clut_arena clut_arena;
+
+typedef enum clut_arena_mode {
+	CLUT_ARENA_BUMP,
+	CLUT_ARENA_POOL
+} clut_arena_mode;
+
+/*!
+ * Sizes are in bytes. [used] counts the (rounded) size of live allocations,
+ * [carved] the part of the arena they were ever taken from, [high_water]
+ * the highest [carved] since the arena was created.
+ */
+typedef struct clut_arena_stats {
+	size_t size;
+	size_t alignment;
+	size_t used;
+	size_t carved;
+	size_t high_water;
+	size_t allocations;
+	size_t failures;
+} clut_arena_stats;
+
+clut_arena * clut_createArena(cl_context context, cl_mem_flags flags, size_t size, clut_arena_mode mode, cl_int *ret);
+void clut_releaseArena(clut_arena *arena);
+
+cl_mem clut_arenaAlloc(clut_arena *arena, size_t size, cl_int *ret);
+cl_int clut_arenaFree(clut_arena *arena, cl_mem mem);
+void clut_arenaReset(clut_arena *arena);
+
+cl_mem clut_getArenaBuffer(clut_arena *arena);
+void clut_getArenaStats(clut_arena *arena, clut_arena_stats *stats);
+
+#endif
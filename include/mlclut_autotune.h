@@ -0,0 +1,52 @@
+
+#ifndef __ML_CLUT_AUTOTUNE_H
+#define __ML_CLUT_AUTOTUNE_H
+
+#include "mlclut.h"
+
+/*!
+ * Work-group size autotuner.
+ * The best local size of a kernel is found by timing candidate local sizes
+ * (limited by CL_KERNEL_WORK_GROUP_SIZE and CL_DEVICE_MAX_WORK_ITEM_SIZES,
+ * multiples of CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, plus the
+ * implementation's own choice), and remembered per device, kernel name and
+ * global size bucket (each dimension rounded up to a power of two).
+ * Results persist in a text file: the one set with
+ * clut_setAutotuneCacheFile, or else the one named by the
+ * CLUT_AUTOTUNE_CACHE environment variable; with neither, they are only
+ * kept in memory.
+ * Tuning runs the kernel several times with its current arguments, on its
+ * live buffers: it is only done by an explicit clut_autotuneKernel, on a
+ * kernel (and arguments) that can be run repeatedly without harm, never
+ * one that works in place or accumulates. clut_enqueueTunedNDRangeKernel
+ * only looks results up, and falls back to the implementation's choice.
+ * Both tuning and tuned launches pad the global size up to a multiple of
+ * the local size, so kernels must check their bounds against the real size.
+ * All functions are thread safe.
+ */
+
+void clut_setAutotuneCacheFile(const char * const filename);
+void clut_releaseAutotuneCache(void);
+
+cl_int clut_autotuneKernel(cl_command_queue command_queue,
+			   cl_kernel kernel,
+			   cl_uint work_dim,
+			   const size_t *global_work_size,
+			   size_t *local_work_size);
+
+int clut_getTunedLocalSize(cl_command_queue command_queue,
+			   cl_kernel kernel,
+			   cl_uint work_dim,
+			   const size_t *global_work_size,
+			   size_t *local_work_size);
+
+cl_int clut_enqueueTunedNDRangeKernel(cl_command_queue command_queue,
+				      cl_kernel kernel,
+				      cl_uint work_dim,
+				      const size_t *global_work_offset,
+				      const size_t *global_work_size,
+				      cl_uint n_wait,
+				      const cl_event *wait_list,
+				      cl_event *event);
+
+#endif
@@ -0,0 +1,51 @@
+
+#ifndef __ML_CLUT_CACHE_H
+#define __ML_CLUT_CACHE_H
+
+#include "mlclut.h"
+
+#include <pthread.h>
+
+/*!
+ * Persistent per device text cache, shared by the autotuner and the storage
+ * policy.
+ * The cache file has one line per value:
+ *   key <TAB> value
+ * where the key is made of tab-separated fields, the first being the device
+ * as written by clut_getDeviceKey, and the value is the text after the last
+ * tab. Lines starting with '#' are ignored. New values are appended; on
+ * load, later lines win.
+ * Values persist in the file set with clut_setCacheFile, or else in the one
+ * named by the [env] environment variable of the cache; with neither, they
+ * are only kept in memory.
+ * A cache is a static clut_cache initialized with CLUT_CACHE_INITIALIZER.
+ * All functions are thread safe.
+ */
+typedef struct clut_cache_entry clut_cache_entry;
+
+typedef struct clut_cache {
+	const char *env;
+	const char *debug;
+	clut_cache_entry *entries;
+	char *file;
+	int loaded;
+	int explicit_file;
+	pthread_mutex_t lock;
+} clut_cache;
+
+#define CLUT_CACHE_INITIALIZER(env, debug)	{(env), (debug), NULL, NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER}
+
+/* sizes of keys and values, terminator included */
+#define CLUT_CACHE_MAX_KEY		1024
+#define CLUT_CACHE_MAX_VALUE		256
+#define CLUT_CACHE_DEVICE_KEY		512
+
+int clut_getDeviceKey(cl_device_id device, char *key, size_t size);
+
+void clut_setCacheFile(clut_cache *cache, const char * const filename);
+void clut_releaseCache(clut_cache *cache);
+
+int clut_cacheLookup(clut_cache *cache, const char *key, char *value, size_t size);
+void clut_cacheStore(clut_cache *cache, const char *key, const char *value);
+
+#endif
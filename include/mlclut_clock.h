@@ -0,0 +1,33 @@
+
+#ifndef __ML_CLUT_CLOCK_H
+#define __ML_CLUT_CLOCK_H
+
+#include "mlclut.h"
+
+/*!
+ * Correlation between the profiling clock of a device (the one behind
+ * CL_PROFILING_COMMAND_*) and the host CLOCK_MONOTONIC, for OpenCL versions
+ * without clGetDeviceAndHostTimer.
+ * Each calibration releases a marker with a user event, and takes the tightest
+ * of a few samples as the offset; the drift is the slope of the offset since
+ * the first calibration. Calibrate on a queue with no other pending work, or
+ * the marker waits behind it and the samples get looser.
+ * All functions are thread safe.
+ */
+typedef struct clut_clock clut_clock;
+
+cl_ulong clut_getHostTime_ns(void);
+
+clut_clock * clut_createClock(cl_command_queue command_queue, unsigned int refresh_ms);
+void clut_releaseClock(clut_clock *clock);
+
+int clut_clockCalibrate(clut_clock *clock);
+int clut_clockUpdate(clut_clock *clock);
+
+cl_device_id clut_clockGetDevice(const clut_clock *clock);
+void clut_clockGetEstimate(clut_clock *clock, cl_long *offset_ns, double *drift);
+
+cl_ulong clut_clockDeviceToHost(clut_clock *clock, cl_ulong device_ns);
+cl_ulong clut_clockHostToDevice(clut_clock *clock, cl_ulong host_ns);
+
+#endif
@@ -0,0 +1,49 @@
+
+#ifndef __ML_CLUT_CONVERT_H
+#define __ML_CLUT_CONVERT_H
+
+#include "mlclut.h"
+#include "mlclut_images.h"
+
+/*!
+ * Swizzle maps for clut_convertSwizzle. Each entry is the index of the source
+ * channel to copy, or CLUT_SWIZZLE_ONE to fill the channel with the maximum
+ * value (i.e. an opaque alpha).
+ */
+#define CLUT_SWIZZLE_ONE	0xFF
+
+extern const cl_uchar clut_swizzle_RGBA_to_BGRA[4];
+extern const cl_uchar clut_swizzle_RGB_to_RGBA[4];
+extern const cl_uchar clut_swizzle_RGBA_to_RGB[4];
+
+cl_int clut_convertU8ToFloat(cl_command_queue command_queue,
+			     cl_mem src, const clut_image_desc *src_desc,
+			     cl_mem dst, const clut_image_desc *dst_desc,
+			     cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+cl_int clut_convertFloatToU8(cl_command_queue command_queue,
+			     cl_mem src, const clut_image_desc *src_desc,
+			     cl_mem dst, const clut_image_desc *dst_desc,
+			     cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+cl_int clut_convertRGBAToGray(cl_command_queue command_queue,
+			      cl_mem src, const clut_image_desc *src_desc,
+			      cl_mem dst, const clut_image_desc *dst_desc,
+			      cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+cl_int clut_convertSwizzle(cl_command_queue command_queue,
+			   cl_mem src, const clut_image_desc *src_desc,
+			   cl_mem dst, const clut_image_desc *dst_desc,
+			   const cl_uchar map[4],
+			   cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+cl_int clut_convertInterleavedToPlanar(cl_command_queue command_queue,
+				       cl_mem src, const clut_image_desc *src_desc,
+				       cl_mem dst, size_t dst_row_pitch,
+				       cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+cl_int clut_convertPlanarToInterleaved(cl_command_queue command_queue,
+				       cl_mem src, size_t src_row_pitch,
+				       cl_mem dst, const clut_image_desc *dst_desc,
+				       cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+cl_int clut_convertImageToU8(cl_command_queue command_queue,
+			     cl_mem image, const clut_image_desc *src_desc,
+			     cl_mem dst, const clut_image_desc *dst_desc,
+			     cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+
+#endif
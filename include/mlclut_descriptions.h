@@ -83,6 +83,7 @@ const char * clut_get_CL_DEVICE_TYPE_Description(const cl_device_type value);
 const char * clut_get_CL_CHANNEL_ORDER_Description(const cl_channel_order value);
 const char * clut_get_CL_CHANNEL_TYPE_Description(const cl_channel_type value);
 const char * clut_get_CL_IMAGE_TYPE_Description(const cl_mem_object_type value);
+const char * clut_get_CL_COMMAND_TYPE_Description(const cl_command_type value);
 
 /* standard types */
 void clut_info_print_String(const void * const value);
@@ -0,0 +1,109 @@
+
+#ifndef __ML_CLUT_FILTERS_H
+#define __ML_CLUT_FILTERS_H
+
+#include "mlclut.h"
+#include "mlclut_images.h"
+
+/*!
+ * Image filters.
+ * Sources and destinations are described by clut_image_desc, and can be
+ * images of any format or interleaved buffers of CL_UNSIGNED_INT8 or
+ * CL_FLOAT channels; source and destination may differ in storage and
+ * type. Pixels are filtered as float4 in the range of the source (0-255
+ * for 8 bit integers, 0-1 for normalized images), and the border is
+ * clamped to the edge.
+ * Stencils are computed on work-group tiles loaded once to local memory,
+ * whose size is chosen from the device work-group size and local memory.
+ * Separable filters run a row pass to a temporary float buffer, with only
+ * the channels both source and destination have, then a column pass to the
+ * destination. The temporary and the weights are kept per context and
+ * reused by later calls, until clut_releaseFilterBuffers or until the
+ * memory accounting evicts them (see mlclut_memory.h).
+ * Filters read with CLUT_ACCESS_GATHER: clut_loadImage and
+ * clut_createImageStorage give them the storage the device reads fastest.
+ */
+
+cl_int clut_filterSeparable(cl_command_queue command_queue,
+			    cl_mem src, const clut_image_desc *src_desc,
+			    cl_mem dst, const clut_image_desc *dst_desc,
+			    cl_uint radius, const cl_float *weights,
+			    cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+cl_int clut_filterGaussian(cl_command_queue command_queue,
+			   cl_mem src, const clut_image_desc *src_desc,
+			   cl_mem dst, const clut_image_desc *dst_desc,
+			   cl_float sigma,
+			   cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+cl_int clut_filterBox(cl_command_queue command_queue,
+		      cl_mem src, const clut_image_desc *src_desc,
+		      cl_mem dst, const clut_image_desc *dst_desc,
+		      cl_uint radius,
+		      cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+cl_int clut_filterErode(cl_command_queue command_queue,
+			cl_mem src, const clut_image_desc *src_desc,
+			cl_mem dst, const clut_image_desc *dst_desc,
+			cl_uint radius,
+			cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+cl_int clut_filterDilate(cl_command_queue command_queue,
+			 cl_mem src, const clut_image_desc *src_desc,
+			 cl_mem dst, const clut_image_desc *dst_desc,
+			 cl_uint radius,
+			 cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+cl_int clut_filterSobel(cl_command_queue command_queue,
+			cl_mem src, const clut_image_desc *src_desc,
+			cl_mem dst, const clut_image_desc *dst_desc,
+			cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+cl_int clut_filterResize(cl_command_queue command_queue,
+			 cl_mem src, const clut_image_desc *src_desc,
+			 cl_mem dst, const clut_image_desc *dst_desc,
+			 cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+void clut_releaseFilterBuffers(cl_context context);
+
+/*!
+ * Filter chains.
+ * A chain is a list of point-wise and small stencil stages, applied in
+ * order. The library generates a single kernel for the whole chain: the
+ * source tile is loaded to local memory once, with a halo as large as the
+ * sum of the stencil radii, point-wise stages are applied in registers, and
+ * each stencil stage works from local memory on a region shrinking by its
+ * radius, so intermediate results never reach global memory.
+ * The source is built through the program cache, once per chain, storage
+ * and device. Near the border, stencils after the first see the clamped
+ * source through the previous stages.
+ * Values are in the range of the source, as for the other filters.
+ */
+typedef enum {
+	CLUT_STAGE_SCALE,	/* v * params[0] + params[1] */
+	CLUT_STAGE_CLAMP,	/* clamp(v, params[0], params[1]) */
+	CLUT_STAGE_THRESHOLD,	/* params[1] where v >= params[0], params[2] elsewhere */
+	CLUT_STAGE_EXPRESSION,	/* expression: OpenCL C float4 expression of v */
+	CLUT_STAGE_BOX,		/* mean over a square of side 2 * radius + 1 */
+	CLUT_STAGE_GAUSSIAN,	/* standard deviation params[0], radius 3 * params[0] if 0 */
+	CLUT_STAGE_ERODE,	/* minimum over a square of side 2 * radius + 1 */
+	CLUT_STAGE_DILATE,	/* maximum over a square of side 2 * radius + 1 */
+	CLUT_STAGE_SOBEL	/* gradient magnitude, radius 1 */
+} clut_stage_type;
+
+typedef struct clut_filter_stage {
+	clut_stage_type type;
+	cl_float params[3];
+	cl_uint radius;
+	const char *expression;
+} clut_filter_stage;
+
+/* maximum sum of the stencil radii of a chain */
+#define CLUT_FILTER_CHAIN_MAX_HALO	8
+
+typedef struct clut_filter_chain clut_filter_chain;
+
+clut_filter_chain * clut_createFilterChain(cl_uint n_stages, const clut_filter_stage *stages, cl_int *ret);
+void clut_releaseFilterChain(clut_filter_chain *chain);
+const char * clut_getFilterChainSource(clut_filter_chain *chain);
+
+cl_int clut_runFilterChain(clut_filter_chain *chain,
+			   cl_command_queue command_queue,
+			   cl_mem src, const clut_image_desc *src_desc,
+			   cl_mem dst, const clut_image_desc *dst_desc,
+			   cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+
+#endif
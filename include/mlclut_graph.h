@@ -0,0 +1,79 @@
+
+#ifndef __ML_CLUT_GRAPH_H
+#define __ML_CLUT_GRAPH_H
+
+#include "mlclut.h"
+
+/*!
+ * Task graphs.
+ * A graph is recorded once, node by node, and then launched any number of
+ * times. Nodes are kernel launches, buffer copies, reads and writes, and
+ * host functions; each node lists the nodes it depends on, which must have
+ * been added before it (so a graph is acyclic by construction). Node ids
+ * are the non-negative values returned by the clut_graphAddX functions.
+ *
+ * At launch, nodes go to the given command queues: a single out-of-order
+ * queue, or several in-order queues, which the scheduler fills keeping
+ * dependency chains on one queue and spreading independent branches.
+ * Dependencies become event wait lists, so independent transfers and
+ * kernels overlap. The schedule is computed on the first launch, and reused
+ * until nodes or queues change.
+ * A launch depends on the previous launch of the same graph, so a graph
+ * launched every frame needs no extra synchronization.
+ *
+ * Kernel arguments are stored in the node, and set right before its launch:
+ * a kernel object must not be launched by other threads while a graph
+ * using it is being launched.
+ * Host functions run from an event callback, so they must not call
+ * blocking OpenCL functions.
+ * Graphs are not thread safe.
+ */
+typedef struct clut_graph clut_graph;
+
+typedef void (*clut_graph_host_function)(void *user_data);
+
+clut_graph * clut_createGraph(void);
+void clut_releaseGraph(clut_graph *graph);
+
+int clut_graphAddKernel(clut_graph *graph,
+			cl_kernel kernel,
+			cl_uint work_dim,
+			const size_t *global_work_offset,
+			const size_t *global_work_size,
+			const size_t *local_work_size,
+			cl_uint n_deps,
+			const int *deps);
+int clut_graphSetKernelArg(clut_graph *graph, int node, cl_uint index, size_t size, const void *value);
+
+int clut_graphAddCopy(clut_graph *graph,
+		      cl_mem src,
+		      cl_mem dst,
+		      size_t src_offset,
+		      size_t dst_offset,
+		      size_t size,
+		      cl_uint n_deps,
+		      const int *deps);
+int clut_graphAddWrite(clut_graph *graph,
+		       cl_mem buffer,
+		       size_t offset,
+		       size_t size,
+		       const void *ptr,
+		       cl_uint n_deps,
+		       const int *deps);
+int clut_graphAddRead(clut_graph *graph,
+		      cl_mem buffer,
+		      size_t offset,
+		      size_t size,
+		      void *ptr,
+		      cl_uint n_deps,
+		      const int *deps);
+int clut_graphAddHost(clut_graph *graph,
+		      clut_graph_host_function function,
+		      void *user_data,
+		      cl_uint n_deps,
+		      const int *deps);
+
+cl_int clut_graphLaunch(clut_graph *graph, cl_uint n_queues, const cl_command_queue *queues, cl_event *event);
+cl_int clut_graphWait(clut_graph *graph);
+
+#endif
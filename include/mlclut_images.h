@@ -1,15 +1,53 @@
+
 #ifndef __ML_CLUT_IMAGES_H
 #define __ML_CLUT_IMAGES_H
 
 #include "mlclut.h"
 #include "mlclut_descriptions.h"
+#include "mlclut_staging.h"
+#include "mlclut_storage.h"
+
+/*!
+ * Describes a 2D image living on a device, either as a cl_image
+ * ([storage] is CL_MEM_OBJECT_IMAGE2D) or as a plain cl_mem buffer
+ * ([storage] is CL_MEM_OBJECT_BUFFER) whose rows start every [row_pitch]
+ * bytes. Pixels are interleaved, with [components] channels of type
+ * [channel_type] each.
+ */
+typedef struct clut_image_desc {
+	cl_mem_object_type storage;
+	size_t width;
+	size_t height;
+	size_t row_pitch;
+	int components;
+	cl_channel_order channel_order;
+	cl_channel_type channel_type;
+} clut_image_desc;
+
+unsigned char * clut_readImageFile(const char * const filename, int *width, int *height, int *components, cl_channel_order *channel_order);
+void clut_freeImageData(unsigned char *data);
 
 cl_mem clut_loadImageFromFile(cl_context context, const char * const filename, int *width, int*height);
+cl_mem clut_loadImageToBuffer(cl_context context, cl_device_id device, const char * const filename, clut_image_desc *desc);
+cl_mem clut_loadImage(cl_context context, cl_device_id device, const char * const filename, clut_image_desc *desc);
+cl_mem clut_loadImageStaged(cl_command_queue command_queue, clut_staging *staging, const char * const filename, clut_image_desc *desc, cl_event *event);
+
+cl_mem clut_createImageBuffer(cl_context context, cl_mem_flags flags, clut_image_desc *desc, size_t alignment);
+cl_mem clut_createImageStorage(cl_context context, cl_device_id device, cl_mem_flags flags, clut_access_class access, clut_image_desc *desc);
 
 int clut_getImageFormatComponents(cl_image_format image_format);
+int clut_getImageDesc(cl_mem image, clut_image_desc *desc);
+size_t clut_getChannelTypeSize(cl_channel_type channel_type);
+
 void clut_saveImageToFile(const char * const filename, cl_command_queue command_queue, cl_mem image);
+int clut_saveImageBufferToFile(const char * const filename, cl_command_queue command_queue, cl_mem buffer, const clut_image_desc *desc);
+int clut_saveImage(const char * const filename, cl_command_queue command_queue, cl_mem mem, const clut_image_desc *desc);
+int clut_saveImageRegionToFile(const char * const filename, cl_command_queue command_queue, cl_mem mem, const clut_image_desc *desc, const size_t origin[2], const size_t region[2]);
+
+unsigned char * clut_mapImageRegion(cl_command_queue command_queue, cl_mem mem, const clut_image_desc *desc, const size_t origin[2], const size_t region[2], size_t *row_pitch);
+void clut_unmapImageRegion(cl_command_queue command_queue, cl_mem mem, unsigned char *mapped);
+unsigned char * clut_readImageRegion(cl_command_queue command_queue, cl_mem mem, const clut_image_desc *desc, const size_t origin[2], const size_t region[2], size_t *row_pitch);
 
 cl_mem clut_getDuplicateEmptyImage(cl_context context, cl_mem image);
 
 #endif
-
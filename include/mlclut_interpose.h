@@ -0,0 +1,120 @@
+
+#ifndef __ML_CLUT_INTERPOSE_H
+#define __ML_CLUT_INTERPOSE_H
+
+#include "mlclut.h"
+#include "mlclut_stats.h"
+#include "mlclut_trace.h"
+
+/*!
+ * Profiling wrappers over clEnqueue*. Each clut_enqueueX has the same
+ * signature and semantics as clEnqueueX.
+ *
+ * Profiling is off unless the CLUT_PROFILE environment variable is set to
+ * something other than "0"; when off, wrappers just forward the call.
+ * When on, each command gets an event (even if the caller passed NULL), its
+ * duration is recorded in the profile statistics (kernels under their
+ * function name, other commands under their command type), and the bytes it
+ * moves are counted. If CLUT_PROFILE_TRACE names a file, commands are also
+ * recorded in a trace. Command queues must be created with
+ * CL_QUEUE_PROFILING_ENABLE.
+ * clut_profileFlush waits for the recorded commands, prints the report and
+ * writes the trace; call it before releasing the command queues, then
+ * clut_releaseProfile. If profiling was turned on by CLUT_PROFILE and never
+ * flushed, the report of the commands completed so far is printed on stderr
+ * at exit, as a best effort: the trace is not written then.
+ *
+ * Compiling a program with -DCLUT_INTERPOSE, after including this header,
+ * turns its clEnqueue* calls into calls to the wrappers.
+ */
+
+/*!
+ * Bytes moved by profiled commands.
+ */
+typedef struct clut_profile_bytes {
+	cl_ulong read;		/* device to host */
+	cl_ulong written;	/* host to device */
+	cl_ulong copied;	/* device to device */
+	cl_ulong mapped;
+	cl_ulong filled;
+} clut_profile_bytes;
+
+int clut_profileEnabled(void);
+void clut_profileEnable(int enable);
+clut_stats * clut_getProfileStats(void);
+clut_trace * clut_getProfileTrace(void);
+void clut_getProfileBytes(clut_profile_bytes *bytes);
+void clut_profileReport(FILE *f);
+int clut_profileFlush(FILE *f);
+void clut_releaseProfile(void);
+
+cl_int clut_enqueueNDRangeKernel(cl_command_queue command_queue, cl_kernel kernel, cl_uint work_dim,
+				 const size_t *global_work_offset, const size_t *global_work_size, const size_t *local_work_size,
+				 cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+
+cl_int clut_enqueueReadBuffer(cl_command_queue command_queue, cl_mem buffer, cl_bool blocking,
+			      size_t offset, size_t size, void *ptr,
+			      cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+cl_int clut_enqueueWriteBuffer(cl_command_queue command_queue, cl_mem buffer, cl_bool blocking,
+			       size_t offset, size_t size, const void *ptr,
+			       cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+cl_int clut_enqueueCopyBuffer(cl_command_queue command_queue, cl_mem src, cl_mem dst,
+			      size_t src_offset, size_t dst_offset, size_t size,
+			      cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+cl_int clut_enqueueFillBuffer(cl_command_queue command_queue, cl_mem buffer,
+			      const void *pattern, size_t pattern_size, size_t offset, size_t size,
+			      cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+
+cl_int clut_enqueueReadBufferRect(cl_command_queue command_queue, cl_mem buffer, cl_bool blocking,
+				  const size_t *buffer_origin, const size_t *host_origin, const size_t *region,
+				  size_t buffer_row_pitch, size_t buffer_slice_pitch,
+				  size_t host_row_pitch, size_t host_slice_pitch, void *ptr,
+				  cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+cl_int clut_enqueueWriteBufferRect(cl_command_queue command_queue, cl_mem buffer, cl_bool blocking,
+				   const size_t *buffer_origin, const size_t *host_origin, const size_t *region,
+				   size_t buffer_row_pitch, size_t buffer_slice_pitch,
+				   size_t host_row_pitch, size_t host_slice_pitch, const void *ptr,
+				   cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+cl_int clut_enqueueCopyBufferRect(cl_command_queue command_queue, cl_mem src, cl_mem dst,
+				  const size_t *src_origin, const size_t *dst_origin, const size_t *region,
+				  size_t src_row_pitch, size_t src_slice_pitch,
+				  size_t dst_row_pitch, size_t dst_slice_pitch,
+				  cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+
+cl_int clut_enqueueReadImage(cl_command_queue command_queue, cl_mem image, cl_bool blocking,
+			     const size_t *origin, const size_t *region, size_t row_pitch, size_t slice_pitch, void *ptr,
+			     cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+cl_int clut_enqueueWriteImage(cl_command_queue command_queue, cl_mem image, cl_bool blocking,
+			      const size_t *origin, const size_t *region, size_t row_pitch, size_t slice_pitch, const void *ptr,
+			      cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+cl_int clut_enqueueCopyImage(cl_command_queue command_queue, cl_mem src, cl_mem dst,
+			     const size_t *src_origin, const size_t *dst_origin, const size_t *region,
+			     cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+
+void * clut_enqueueMapBuffer(cl_command_queue command_queue, cl_mem buffer, cl_bool blocking, cl_map_flags flags,
+			     size_t offset, size_t size,
+			     cl_uint n_wait, const cl_event *wait_list, cl_event *event, cl_int *errcode);
+void * clut_enqueueMapImage(cl_command_queue command_queue, cl_mem image, cl_bool blocking, cl_map_flags flags,
+			    const size_t *origin, const size_t *region, size_t *row_pitch, size_t *slice_pitch,
+			    cl_uint n_wait, const cl_event *wait_list, cl_event *event, cl_int *errcode);
+cl_int clut_enqueueUnmapMemObject(cl_command_queue command_queue, cl_mem mem, void *mapped,
+				  cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+
+#if defined(CLUT_INTERPOSE) && !defined(__ML_CLUT_INTERPOSE_IMPL)
+#define clEnqueueNDRangeKernel		clut_enqueueNDRangeKernel
+#define clEnqueueReadBuffer		clut_enqueueReadBuffer
+#define clEnqueueWriteBuffer		clut_enqueueWriteBuffer
+#define clEnqueueCopyBuffer		clut_enqueueCopyBuffer
+#define clEnqueueFillBuffer		clut_enqueueFillBuffer
+#define clEnqueueReadBufferRect		clut_enqueueReadBufferRect
+#define clEnqueueWriteBufferRect	clut_enqueueWriteBufferRect
+#define clEnqueueCopyBufferRect		clut_enqueueCopyBufferRect
+#define clEnqueueReadImage		clut_enqueueReadImage
+#define clEnqueueWriteImage		clut_enqueueWriteImage
+#define clEnqueueCopyImage		clut_enqueueCopyImage
+#define clEnqueueMapBuffer		clut_enqueueMapBuffer
+#define clEnqueueMapImage		clut_enqueueMapImage
+#define clEnqueueUnmapMemObject		clut_enqueueUnmapMemObject
+#endif
+
+#endif
@@ -0,0 +1,46 @@
+
+#ifndef __ML_CLUT_LAUNCHER_H
+#define __ML_CLUT_LAUNCHER_H
+
+#include "mlclut.h"
+
+/*!
+ * Kernel launchers.
+ * A launcher wraps a kernel, and knows its arguments from the metadata
+ * kept by -cl-kernel-arg-info (in the default build options): arguments
+ * can be bound by name, and are checked against their address qualifier
+ * and type (memory objects for pointers and images, NULL values for local
+ * memory, the size of the type for the others).
+ * The launcher remembers the bytes last bound to each argument, and skips
+ * clSetKernelArg when they don't change, so a per-frame loop only pays for
+ * the arguments that actually change.
+ * The kernel must not get arguments from elsewhere while a launcher wraps
+ * it. Launchers are not thread safe.
+ */
+typedef struct clut_launcher clut_launcher;
+
+clut_launcher * clut_createLauncher(cl_program program, const char * const kernel_name, cl_int *ret);
+clut_launcher * clut_createLauncherForKernel(cl_kernel kernel, cl_int *ret);
+void clut_releaseLauncher(clut_launcher *launcher);
+
+cl_kernel clut_getLauncherKernel(clut_launcher *launcher);
+int clut_getLauncherArgIndex(clut_launcher *launcher, const char * const arg_name);
+
+cl_int clut_launcherSetArg(clut_launcher *launcher, cl_uint index, size_t size, const void *value);
+cl_int clut_launcherBind(clut_launcher *launcher, const char * const arg_name, size_t size, const void *value);
+cl_int clut_launcherBindMem(clut_launcher *launcher, const char * const arg_name, cl_mem mem);
+cl_int clut_launcherBindLocal(clut_launcher *launcher, const char * const arg_name, size_t size);
+
+cl_int clut_launcherEnqueue(clut_launcher *launcher,
+			    cl_command_queue command_queue,
+			    cl_uint work_dim,
+			    const size_t *global_work_offset,
+			    const size_t *global_work_size,
+			    const size_t *local_work_size,
+			    cl_uint n_wait,
+			    const cl_event *wait_list,
+			    cl_event *event);
+
+void clut_getLauncherCounts(clut_launcher *launcher, cl_ulong *set, cl_ulong *skipped);
+
+#endif
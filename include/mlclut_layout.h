@@ -0,0 +1,74 @@
+
+#ifndef __ML_CLUT_LAYOUT_H
+#define __ML_CLUT_LAYOUT_H
+
+#include "mlclut.h"
+#include "mlclut_images.h"
+
+/*!
+ * Planar and cache-blocked float layouts.
+ * A layout buffer holds one plane of cl_float per channel (structure of
+ * arrays), so a kernel reading a channel of consecutive pixels reads
+ * consecutive floats, and CPU devices vectorize at full width. Within a
+ * plane, pixels are:
+ * - CLUT_LAYOUT_PLANAR: row-major, rows padded to whole cachelines;
+ * - CLUT_LAYOUT_TILED: in square tiles of 2^tile_shift pixels a side,
+ *   row-major inside the tile, tiles row-major;
+ * - CLUT_LAYOUT_ZORDER: in the same tiles, in Z (Morton) order inside the
+ *   tile, so square neighbourhoods of any size stay close.
+ * Tiles are as large as fit, for all the channels, in a quarter of
+ * CL_DEVICE_GLOBAL_MEM_CACHE_SIZE, and at least a cacheline wide. Pixels
+ * of partial tiles at the right and bottom border are padding.
+ * Channels are in [0, 1] (8 bit values divided by 255).
+ *
+ * Kernels index layout buffers with CLUT_LAYOUT_INDEX(x, y, c): prepend
+ * clut_getLayoutSource() to their sources, and build them with the options
+ * from clut_getLayoutOptions. clut_getLayoutIndex is the same on the host.
+ */
+typedef enum {
+	CLUT_LAYOUT_PLANAR,
+	CLUT_LAYOUT_TILED,
+	CLUT_LAYOUT_ZORDER
+} clut_layout;
+
+/*!
+ * Pitches are in floats. [row_pitch] is only used by CLUT_LAYOUT_PLANAR,
+ * [tile_shift] and [tiles_x] only by the tiled layouts.
+ */
+typedef struct clut_layout_desc {
+	clut_layout layout;
+	size_t width;
+	size_t height;
+	int components;
+	cl_channel_order channel_order;
+	size_t row_pitch;
+	size_t tile_shift;
+	size_t tiles_x;
+	size_t plane_pitch;
+} clut_layout_desc;
+
+/* tiles never get larger than 2^CLUT_LAYOUT_MAX_TILE_SHIFT pixels a side */
+#define CLUT_LAYOUT_MAX_TILE_SHIFT	8
+
+int clut_getLayoutDesc(cl_device_id device, clut_layout layout,
+		       size_t width, size_t height, int components,
+		       clut_layout_desc *desc);
+size_t clut_getLayoutSize(const clut_layout_desc *desc);
+size_t clut_getLayoutIndex(const clut_layout_desc *desc, size_t x, size_t y, int c);
+
+const char * clut_getLayoutSource(void);
+int clut_getLayoutOptions(const clut_layout_desc *desc, char *options, size_t size);
+
+cl_mem clut_createLayoutBuffer(cl_context context, cl_mem_flags flags, const clut_layout_desc *desc, cl_int *ret);
+
+cl_mem clut_loadImageLayout(cl_command_queue command_queue,
+			    const char * const filename,
+			    clut_layout layout,
+			    clut_layout_desc *desc,
+			    cl_event *event);
+int clut_saveImageLayout(const char * const filename,
+			 cl_command_queue command_queue,
+			 cl_mem buffer,
+			 const clut_layout_desc *desc);
+
+#endif
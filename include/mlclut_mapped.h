@@ -0,0 +1,27 @@
+
+#ifndef __ML_CLUT_MAPPED_H
+#define __ML_CLUT_MAPPED_H
+
+#include "mlclut.h"
+#include "mlclut_staging.h"
+
+/*!
+ * Memory-mapped files.
+ * Files are mapped privately (copy-on-write, so writes never reach the
+ * file) and page aligned. clut_createBufferFromFile wraps the mapping in a
+ * CL_MEM_USE_HOST_PTR buffer on devices sharing memory with the host, with
+ * no copy at all, and otherwise streams it to the device through a pinned
+ * staging ring, so the file is never read into a second host copy.
+ */
+
+void * clut_mapFile(const char * const filename, size_t *size);
+void clut_unmapFile(void *data, size_t size);
+
+cl_mem clut_createBufferFromFile(cl_command_queue command_queue,
+				 cl_mem_flags flags,
+				 const char * const filename,
+				 clut_staging *staging,
+				 size_t *size,
+				 cl_int *ret);
+
+#endif
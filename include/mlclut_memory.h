@@ -0,0 +1,74 @@
+
+#ifndef __ML_CLUT_MEMORY_H
+#define __ML_CLUT_MEMORY_H
+
+#include "mlclut.h"
+
+#include <stdio.h>
+
+/*!
+ * Device memory accounting.
+ * Buffers and images created with clut_createTrackedBuffer and
+ * clut_createTrackedImage (as is every buffer and image the library
+ * creates) are recorded with their size, context, tag and owner until their
+ * destructor callback runs, i.e. until the runtime frees them. Tags are not
+ * copied: use string literals. Owners are only compared.
+ *
+ * Each context has a limit: CLUT_MEMORY_LIMIT_PERCENT percent of the
+ * smallest CL_DEVICE_GLOBAL_MEM_SIZE of its devices, unless overridden by
+ * the CLUT_MEMORY_LIMIT environment variable (bytes) or clut_setMemoryLimit;
+ * a limit set with the latter is kept, with a reference to the context,
+ * until clut_memoryReleaseContext.
+ * An allocation that would pass the limit, or that the runtime refuses for
+ * lack of memory, first calls the registered eviction callbacks, in order,
+ * until they report enough memory released, then is tried again; if it
+ * still doesn't fit, it fails with CL_MEM_OBJECT_ALLOCATION_FAILURE, which
+ * callers can handle, instead of the runtime failing a later command.
+ * Memory released by a callback only counts once the runtime frees it,
+ * which may be when the commands using it complete.
+ * Only callbacks registered with clut_registerEviction are called. The
+ * library registers one, releasing the temporary and weights buffers the
+ * separable filters keep per context. Arenas register none, since freed
+ * sub-buffers give no memory back to the device: register a callback
+ * releasing whole arenas (or anything else cached) to make them evictable.
+ * All functions are thread safe.
+ */
+
+#define CLUT_MEMORY_LIMIT_PERCENT	90
+
+/*!
+ * Eviction callback: should release about [size] bytes of memory of
+ * [context] (e.g. free cached or pooled objects), and return the bytes
+ * actually released. It must not allocate tracked memory.
+ */
+typedef size_t (*clut_memory_evict)(cl_context context, size_t size, void *user_data);
+
+/*!
+ * Sizes are in bytes. [evictions] counts the callbacks that released
+ * memory, [failures] the allocations refused even after evicting.
+ */
+typedef struct clut_memory_stats {
+	size_t limit;
+	size_t used;
+	size_t high_water;
+	size_t objects;
+	size_t evictions;
+	size_t failures;
+} clut_memory_stats;
+
+cl_mem clut_createTrackedBuffer(cl_context context, cl_mem_flags flags, size_t size, void *host_ptr,
+				const char *tag, const void *owner, cl_int *ret);
+cl_mem clut_createTrackedImage(cl_context context, cl_mem_flags flags,
+			       const cl_image_format *image_format, const cl_image_desc *image_desc,
+			       void *host_ptr, const char *tag, const void *owner, cl_int *ret);
+
+cl_int clut_registerEviction(clut_memory_evict evict, void *user_data);
+void clut_unregisterEviction(clut_memory_evict evict, void *user_data);
+
+void clut_setMemoryLimit(cl_context context, size_t limit);
+void clut_memoryReleaseContext(cl_context context);
+void clut_getMemoryStats(cl_context context, clut_memory_stats *stats);
+size_t clut_getOwnerMemory(const void *owner);
+void clut_memoryReport(FILE *f);
+
+#endif
@@ -0,0 +1,54 @@
+
+#ifndef __ML_CLUT_MULTIDEVICE_H
+#define __ML_CLUT_MULTIDEVICE_H
+
+#include "mlclut.h"
+
+/*!
+ * Computes rows [first_row, first_row + n_rows) of a split job on
+ * [command_queue]. [input] and [output] are sub-buffers starting at
+ * [first_row] (either can be NULL if the job has none), with the row pitches
+ * given in the configuration. It must enqueue the work waiting for nothing,
+ * store the event of its last command in [event], and not block.
+ * [device_index] is the index of the queue in the configuration, e.g. to
+ * pick a kernel object owned by that device.
+ * Returns CL_SUCCESS, or an error code that stops the job.
+ */
+typedef cl_int (*clut_split_compute)(cl_command_queue command_queue,
+				     cl_uint device_index,
+				     cl_mem input,
+				     cl_mem output,
+				     size_t first_row,
+				     size_t n_rows,
+				     cl_event *event,
+				     void *user_data);
+
+/*!
+ * A job split by rows over several devices sharing one context.
+ * A 2D range is [rows] rows of [input_row_pitch] / [output_row_pitch] bytes;
+ * a 1D range is [rows] items, with the item sizes as pitches.
+ * Chunks are handed out dynamically (guided self-scheduling): each device
+ * takes, when ready, a share of the remaining rows proportional to its
+ * measured throughput, so faster devices take more and nobody waits at the
+ * end. Chunk boundaries keep sub-buffer origins aligned for every device.
+ * If [speeds] is not NULL it holds one weight per queue (rows per second):
+ * non-zero values seed the split, and it receives the measured throughputs,
+ * so a job run every frame starts balanced.
+ */
+typedef struct clut_split_config {
+	cl_command_queue *queues;	/* one per device */
+	cl_uint n_queues;
+	cl_mem input;			/* optional */
+	size_t input_row_pitch;
+	cl_mem output;			/* optional */
+	size_t output_row_pitch;
+	size_t rows;
+	size_t min_chunk_rows;		/* 0 for a default */
+	clut_split_compute compute;
+	void *user_data;
+	double *speeds;			/* optional, n_queues long */
+} clut_split_config;
+
+cl_int clut_runSplit(const clut_split_config *config, size_t *rows_per_device);
+
+#endif
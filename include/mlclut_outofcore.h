@@ -0,0 +1,66 @@
+
+#ifndef __ML_CLUT_OUTOFCORE_H
+#define __ML_CLUT_OUTOFCORE_H
+
+#include "mlclut.h"
+
+/*!
+ * Computes elements [first, first + n) of an out-of-core job on
+ * [command_queue], from [input] to [output]. [input] holds [n_input]
+ * elements starting at element first - [halo_before] of the host array, so
+ * the element first is at index [halo_before]; [output] holds the [n]
+ * results. It must enqueue the work waiting for [wait_list], store the
+ * event of its last command in [event], and not block.
+ * Returns CL_SUCCESS, or an error code that stops the job.
+ */
+typedef cl_int (*clut_outofcore_compute)(cl_command_queue command_queue,
+					 cl_mem input,
+					 cl_mem output,
+					 size_t first,
+					 size_t n,
+					 size_t halo_before,
+					 size_t n_input,
+					 cl_uint n_wait,
+					 const cl_event *wait_list,
+					 cl_event *event,
+					 void *user_data);
+
+/*!
+ * A job streaming a host array (e.g. a clut_mapFile mapping) larger than
+ * the device memory through the device in chunks.
+ * Three chunks are in flight: while chunk N is computed, chunk N + 1 is
+ * uploaded and chunk N - 1 downloaded. With three queues, uploads, kernels
+ * and downloads run on queues[0], [1] and [2] respectively; with two,
+ * uploads run on queues[0], and kernels and downloads on queues[1], so
+ * uploads overlap the other two. With one in-order queue the job still
+ * runs, serialized: nothing overlaps unless the queue is out-of-order.
+ * Transfers go through pinned host memory.
+ * Each chunk is given [halo] extra input elements on both sides (fewer at
+ * the ends of the array), e.g. some rows of an image split by rows, with
+ * [granularity] the row width; [output] must not overlap [input] then.
+ * A chunk holds a multiple of [granularity] elements (1 if 0), at most
+ * [chunk_elements], or if 0 the most that fit the device (see
+ * clut_getOutOfCoreChunk).
+ */
+typedef struct clut_outofcore_config {
+	cl_command_queue *queues;
+	cl_uint n_queues;
+	const void *input;
+	size_t input_element_size;
+	void *output;
+	size_t output_element_size;
+	size_t n_elements;
+	size_t halo;
+	size_t granularity;
+	size_t chunk_elements;		/* 0 for the device limits */
+	clut_outofcore_compute compute;
+	void *user_data;
+} clut_outofcore_config;
+
+size_t clut_getOutOfCoreChunk(cl_device_id device,
+			      size_t input_element_size, size_t output_element_size,
+			      size_t halo, size_t granularity);
+
+cl_int clut_runOutOfCore(const clut_outofcore_config *config);
+
+#endif
@@ -0,0 +1,60 @@
+
+#ifndef __ML_CLUT_PIPELINE_H
+#define __ML_CLUT_PIPELINE_H
+
+#include "mlclut.h"
+#include "mlclut_images.h"
+#include "mlclut_trace.h"
+
+/*!
+ * The compute stage of a pipeline. It must enqueue the processing of [input]
+ * into [output] (both laid out as [desc]) on [command_queue], waiting for the
+ * [n_wait] events in [wait_list], and store the event of its last command in
+ * [event]. It must not block.
+ * Returns CL_SUCCESS, or an error code that fails the frame.
+ */
+typedef cl_int (*clut_pipeline_compute)(cl_command_queue command_queue,
+					cl_mem input,
+					cl_mem output,
+					const clut_image_desc *desc,
+					cl_uint n_wait,
+					const cl_event *wait_list,
+					cl_event *event,
+					void *user_data);
+
+/*!
+ * Configuration of a pipeline run.
+ * With three or more queues, uploads, kernels and downloads run on
+ * queues[0], [1] and [2] respectively; with two, uploads run on queues[0],
+ * and kernels and downloads on queues[1], so uploads overlap the other two.
+ * With one in-order queue every stage of a frame runs on it, serialized:
+ * nothing overlaps unless the queue is out-of-order.
+ * Zeroed fields take a default value.
+ * If [trace] is set, decode and encode spans (one host track per slot) and
+ * the upload, compute and download commands of each frame are recorded in it.
+ * If [staging] is set, frames fitting one of its slots are uploaded and
+ * downloaded through it (pinned memory), so transfers run at full speed;
+ * it must belong to the pipeline context, with at least two slots per frame
+ * in flight to avoid waiting on encoders.
+ */
+typedef struct clut_pipeline_config {
+	cl_context context;
+	cl_command_queue *queues;
+	cl_uint n_queues;
+	unsigned int in_flight;		/* frames in flight, default 3 */
+	unsigned int n_decoders;	/* decoding threads, default 1 */
+	unsigned int n_encoders;	/* encoding threads, default 1 */
+	cl_mem_object_type storage;	/* CL_MEM_OBJECT_IMAGE2D or CL_MEM_OBJECT_BUFFER, default by policy */
+	clut_access_class access;	/* how compute reads frames, for the policy */
+	clut_pipeline_compute compute;
+	void *user_data;
+	clut_trace *trace;		/* optional */
+	clut_staging *staging;		/* optional */
+} clut_pipeline_config;
+
+int clut_runPipeline(const clut_pipeline_config *config,
+		     const char * const *inputs,
+		     const char * const *outputs,
+		     size_t n_frames);
+
+#endif
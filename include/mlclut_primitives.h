@@ -0,0 +1,69 @@
+
+#ifndef __ML_CLUT_PRIMITIVES_H
+#define __ML_CLUT_PRIMITIVES_H
+
+#include "mlclut.h"
+
+/*!
+ * Data-parallel primitives.
+ * The kernels are embedded in the library, and built per context with the
+ * work-group size, the vector width and the elements per work-item chosen
+ * from the device (maximum work-group size, local memory, preferred vector
+ * width, device type) passed as -D options, so each device gets its own
+ * cached program.
+ * Buffers hold [n] tightly packed elements of the given type; [n] must be
+ * less than 2^32. Temporary buffers are created per call, and released
+ * once the commands using them complete.
+ * When [event] is not NULL it is set to the last command of the primitive.
+ */
+typedef enum {
+	CLUT_PRIM_UINT,
+	CLUT_PRIM_INT,
+	CLUT_PRIM_FLOAT,
+	CLUT_PRIM_UCHAR		/* clut_histogram only */
+} clut_prim_type;
+
+typedef enum {
+	CLUT_REDUCE_SUM,
+	CLUT_REDUCE_MIN,
+	CLUT_REDUCE_MAX
+} clut_reduce_op;
+
+/* writes the reduction of [input] to the first element of [result] */
+cl_int clut_reduce(cl_command_queue command_queue,
+		   clut_prim_type type, clut_reduce_op op,
+		   cl_mem input, size_t n, cl_mem result,
+		   cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+
+/* prefix sums; [output] may be [input] */
+cl_int clut_scan(cl_command_queue command_queue,
+		 clut_prim_type type, cl_bool inclusive,
+		 cl_mem input, cl_mem output, size_t n,
+		 cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+
+/*
+ * copies the elements of [input] whose cl_uint [flags] are not zero to
+ * [output], keeping their order, and their number to [count] (a cl_uint)
+ */
+cl_int clut_compact(cl_command_queue command_queue,
+		    clut_prim_type type,
+		    cl_mem input, cl_mem flags, size_t n,
+		    cl_mem output, cl_mem count,
+		    cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+
+/* stable in-place sort of cl_uint [keys], moving cl_uint [values] (may be NULL) */
+cl_int clut_radixSort(cl_command_queue command_queue,
+		      cl_mem keys, cl_mem values, size_t n,
+		      cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+
+/*
+ * counts the cl_uchar or cl_uint elements of [input] into [bins] cl_uint
+ * counters of [histogram]; values past the last bin fall into it
+ */
+cl_int clut_histogram(cl_command_queue command_queue,
+		      clut_prim_type type,
+		      cl_mem input, size_t n,
+		      cl_uint bins, cl_mem histogram,
+		      cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+
+#endif
@@ -0,0 +1,69 @@
+
+#ifndef __ML_CLUT_ROOFLINE_H
+#define __ML_CLUT_ROOFLINE_H
+
+#include "mlclut.h"
+
+/*!
+ * Peak global memory bandwidth (bytes/s) and single precision throughput
+ * (flop/s) of a device. A zero field is unknown.
+ */
+typedef struct clut_device_peaks {
+	cl_double bandwidth;
+	cl_double flops;
+	int measured;
+} clut_device_peaks;
+
+/*!
+ * Accumulates, per kernel name, the bytes moved and the flops performed by
+ * annotated launches, along with their measured duration, and places each
+ * kernel on the roofline of a device. Events are recorded from completion
+ * callbacks. Command queues must be created with CL_QUEUE_PROFILING_ENABLE.
+ * All functions are thread safe.
+ */
+typedef struct clut_roofline clut_roofline;
+
+typedef enum {
+	CLUT_BOUND_UNKNOWN,	/* a peak the decision needs is unknown */
+	CLUT_BOUND_MEMORY,
+	CLUT_BOUND_COMPUTE
+} clut_roofline_bound;
+
+/*!
+ * Roofline position of one kernel.
+ */
+typedef struct clut_kernel_roofline {
+	char *name;
+	cl_ulong count;
+	cl_double time;		/* total, in seconds */
+	cl_double bandwidth;	/* achieved, bytes/s */
+	cl_double flops;	/* achieved, flop/s */
+	cl_double intensity;	/* flop/byte, HUGE_VAL for flops with no bytes */
+	cl_double efficiency;	/* achieved / attainable at this intensity, 0 if unknown */
+	clut_roofline_bound bound;
+} clut_kernel_roofline;
+
+int clut_getNominalPeaks(cl_device_id device, cl_uint lanes_per_compute_unit, clut_device_peaks *peaks);
+int clut_measurePeaks(cl_command_queue command_queue, clut_device_peaks *peaks);
+
+clut_roofline * clut_createRoofline(void);
+void clut_releaseRoofline(clut_roofline *roofline);
+
+int clut_rooflineRecordEvent(clut_roofline *roofline, cl_event event, const char * const name, cl_ulong bytes, cl_ulong flops);
+cl_int clut_rooflineEnqueueNDRangeKernel(clut_roofline *roofline, cl_ulong bytes, cl_ulong flops,
+					 cl_command_queue command_queue,
+					 cl_kernel kernel,
+					 cl_uint work_dim,
+					 const size_t *global_work_offset,
+					 const size_t *global_work_size,
+					 const size_t *local_work_size,
+					 cl_uint n_wait,
+					 const cl_event *wait_list,
+					 cl_event *event);
+void clut_rooflineWait(clut_roofline *roofline);
+
+clut_kernel_roofline * clut_rooflineSnapshot(clut_roofline *roofline, const clut_device_peaks *peaks, size_t *n_kernels);
+void clut_freeRooflineSnapshot(clut_kernel_roofline *snapshot, size_t n_kernels);
+void clut_rooflinePrint(clut_roofline *roofline, const clut_device_peaks *peaks, FILE *f);
+
+#endif
@@ -0,0 +1,53 @@
+
+#ifndef __ML_CLUT_STAGING_H
+#define __ML_CLUT_STAGING_H
+
+#include "mlclut.h"
+
+/*!
+ * Pinned host staging rings.
+ * A ring is a CL_MEM_ALLOC_HOST_PTR buffer, mapped once for its whole life,
+ * split in equal slots. Transfers from (or to) a slot come from pinned
+ * memory, so the driver can DMA them directly instead of going through an
+ * internal bounce buffer, and non-blocking writes are truly asynchronous.
+ *
+ * Slots are acquired in ring order. A slot goes back to the ring with
+ * clut_stagingRelease, fenced by an event: it is handed out again only after
+ * that event completes. For an upload, acquire a slot, fill it, and write
+ * from it with clut_stagingWriteBuffer or clut_stagingWriteImage, which
+ * release it fenced by the write. For a download, acquire a slot, read into
+ * it, wait, use the data, and release it with no fence.
+ * All functions are thread safe. Transfers can use any command queue of the
+ * context of the ring.
+ */
+typedef struct clut_staging clut_staging;
+
+clut_staging * clut_createStaging(cl_command_queue command_queue, size_t slot_size, unsigned int n_slots, cl_int *ret);
+void clut_releaseStaging(clut_staging *staging);
+
+size_t clut_getStagingSlotSize(clut_staging *staging);
+
+void * clut_stagingAcquire(clut_staging *staging, size_t size, unsigned int *slot);
+void clut_stagingRelease(clut_staging *staging, unsigned int slot, cl_event fence);
+
+cl_int clut_stagingWriteBuffer(clut_staging *staging,
+			       unsigned int slot,
+			       cl_command_queue command_queue,
+			       cl_mem buffer,
+			       size_t offset,
+			       size_t size,
+			       cl_uint n_wait,
+			       const cl_event *wait_list,
+			       cl_event *event);
+cl_int clut_stagingWriteImage(clut_staging *staging,
+			      unsigned int slot,
+			      cl_command_queue command_queue,
+			      cl_mem image,
+			      const size_t origin[3],
+			      const size_t region[3],
+			      size_t row_pitch,
+			      cl_uint n_wait,
+			      const cl_event *wait_list,
+			      cl_event *event);
+
+#endif
@@ -0,0 +1,55 @@
+
+#ifndef __ML_CLUT_STATS_H
+#define __ML_CLUT_STATS_H
+
+#include "mlclut.h"
+
+/*!
+ * Per kernel latency statistics. Durations (START to END, in nanoseconds)
+ * are kept in log-linear histograms, one per kernel name, with a relative
+ * error below 1/32 on every percentile. Events are recorded from completion
+ * callbacks, so the enqueueing thread never waits for them. Command queues
+ * must be created with CL_QUEUE_PROFILING_ENABLE.
+ * All functions are thread safe.
+ */
+typedef struct clut_stats clut_stats;
+
+/*!
+ * A summary of the durations recorded for one kernel, in nanoseconds.
+ */
+typedef struct clut_kernel_stats {
+	char *name;
+	cl_ulong count;
+	cl_double mean;
+	cl_ulong min;
+	cl_ulong p50;
+	cl_ulong p90;
+	cl_ulong p99;
+	cl_ulong max;
+} clut_kernel_stats;
+
+clut_stats * clut_createStats(void);
+void clut_releaseStats(clut_stats *stats);
+
+int clut_statsRecord(clut_stats *stats, const char * const name, cl_ulong duration_ns);
+int clut_statsRecordEvent(clut_stats *stats, cl_event event, const char * const name);
+int clut_statsRecordKernelEvent(clut_stats *stats, cl_event event, cl_kernel kernel);
+void clut_statsWait(clut_stats *stats);
+
+clut_kernel_stats * clut_statsSnapshot(clut_stats *stats, size_t *n_kernels);
+void clut_freeStatsSnapshot(clut_kernel_stats *snapshot, size_t n_kernels);
+void clut_statsReset(clut_stats *stats);
+void clut_statsPrint(clut_stats *stats, FILE *f);
+
+cl_int clut_statsEnqueueNDRangeKernel(clut_stats *stats,
+				      cl_command_queue command_queue,
+				      cl_kernel kernel,
+				      cl_uint work_dim,
+				      const size_t *global_work_offset,
+				      const size_t *global_work_size,
+				      const size_t *local_work_size,
+				      cl_uint n_wait,
+				      const cl_event *wait_list,
+				      cl_event *event);
+
+#endif
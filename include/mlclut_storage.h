@@ -0,0 +1,34 @@
+
+#ifndef __ML_CLUT_STORAGE_H
+#define __ML_CLUT_STORAGE_H
+
+#include "mlclut.h"
+
+/*!
+ * Image or buffer storage policy.
+ * Whether a 2D kernel runs faster reading a cl_image or a padded buffer
+ * depends on the device, and on how the kernel reads: the policy times a
+ * small embedded kernel of each access class on a 1024 x 1024 RGBA image
+ * stored both ways, once per device, and keeps the faster storage.
+ * Devices without image support always get buffers. If the benchmark
+ * fails, the storage is unknown (0) and not stored; the functions following
+ * the policy then use images.
+ * Decisions persist in a text file: the one set with
+ * clut_setStorageCacheFile, or else the one named by the CLUT_STORAGE_CACHE
+ * environment variable; with neither, they are only kept in memory.
+ * clut_loadImage, clut_loadImageStaged, clut_createImageStorage and the
+ * pipeline (when its storage is not set) follow the policy.
+ * All functions are thread safe.
+ */
+typedef enum {
+	CLUT_ACCESS_STREAMING,	/* each work-item reads its own pixels */
+	CLUT_ACCESS_GATHER	/* work-items read 2D neighbourhoods at scattered places */
+} clut_access_class;
+
+cl_mem_object_type clut_getStoragePolicy(cl_context context, cl_device_id device, clut_access_class access);
+void clut_setStoragePolicy(cl_device_id device, clut_access_class access, cl_mem_object_type storage);
+
+void clut_setStorageCacheFile(const char * const filename);
+void clut_releaseStorageCache(void);
+
+#endif
@@ -0,0 +1,40 @@
+
+#ifndef __ML_CLUT_TRACE_H
+#define __ML_CLUT_TRACE_H
+
+#include "mlclut.h"
+#include "mlclut_clock.h"
+
+/*!
+ * An event timeline recorder. Events registered with a trace are resolved
+ * into their QUEUED, SUBMIT, START and END timestamps once complete, and can
+ * be exported as a Chrome trace (also readable by Perfetto), with one track
+ * per command queue. Command queues must be created with
+ * CL_QUEUE_PROFILING_ENABLE.
+ * Host work can be added as spans, and device commands placed next to it
+ * on the host timeline by adding a clock for their device.
+ * All functions are thread safe.
+ */
+typedef struct clut_trace clut_trace;
+
+clut_trace * clut_createTrace(void);
+void clut_releaseTrace(clut_trace *trace);
+
+int clut_traceEvent(clut_trace *trace, cl_event event, const char * const label);
+int clut_traceAddHostSpan(clut_trace *trace, const char * const label, unsigned int track, cl_ulong start_ns, cl_ulong end_ns);
+int clut_traceAddClock(clut_trace *trace, clut_clock *clock);
+void clut_traceCollect(clut_trace *trace, int wait);
+int clut_traceExportChrome(clut_trace *trace, const char * const filename);
+
+cl_int clut_traceEnqueueNDRangeKernel(clut_trace *trace,
+				      cl_command_queue command_queue,
+				      cl_kernel kernel,
+				      cl_uint work_dim,
+				      const size_t *global_work_offset,
+				      const size_t *global_work_size,
+				      const size_t *local_work_size,
+				      cl_uint n_wait,
+				      const cl_event *wait_list,
+				      cl_event *event);
+
+#endif
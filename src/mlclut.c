@@ -17,6 +17,7 @@
 #include <string.h>
 #include <errno.h>
 #include <math.h>
+#include <pthread.h>
 
 #define DEBUG_CLUT	"ml_openCL_utilities"
 
@@ -280,6 +281,120 @@ clean:	free(result);
 error:	return NULL;
 }
 
+/*!
+ * @function clut_getDeviceAlignment
+ * Returns the alignment, in bytes, that buffers on [device] should respect to
+ * be accessed at full speed: the larger of CL_DEVICE_MEM_BASE_ADDR_ALIGN (which
+ * is expressed in bits) and CL_DEVICE_GLOBAL_MEM_CACHELINE_SIZE.
+ * Falls back to 64 bytes if the device can't be queried.
+ */
+size_t clut_getDeviceAlignment(const cl_device_id device)
+{
+	const char * const fname = "clut_getDeviceAlignment";
+	cl_int ret;
+	cl_uint base_align_bits = 0, cacheline = 0;
+	size_t alignment = 64;
+
+	ret = clGetDeviceInfo(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(base_align_bits), &base_align_bits, NULL);
+	if (!clut_returnSuccess(ret)) {
+		Debug_out(DEBUG_CLUT, "%s: unable to get base address alignment: %s.\n",
+			  fname,
+			  clut_getErrorDescription(ret));
+		goto error;
+	}
+	ret = clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_CACHELINE_SIZE, sizeof(cacheline), &cacheline, NULL);
+	if (!clut_returnSuccess(ret)) {
+		Debug_out(DEBUG_CLUT, "%s: unable to get cacheline size: %s.\n",
+			  fname,
+			  clut_getErrorDescription(ret));
+		goto error;
+	}
+
+	alignment = base_align_bits / 8;
+	if (cacheline > alignment) {
+		alignment = cacheline;
+	}
+	if (0 == alignment) {
+		alignment = 64;
+	}
+
+error:	return alignment;
+}
+
+/*!
+ * @function clut_getQueueDevice
+ * Returns the device associated with [command_queue], or NULL on failure.
+ */
+cl_device_id clut_getQueueDevice(const cl_command_queue command_queue)
+{
+	const char * const fname = "clut_getQueueDevice";
+	cl_device_id device = NULL;
+	cl_int ret;
+
+	ret = clGetCommandQueueInfo(command_queue, CL_QUEUE_DEVICE, sizeof(device), &device, NULL);
+	if (!clut_returnSuccess(ret)) {
+		Debug_out(DEBUG_CLUT, "%s: unable to get queue device: %s.\n",
+			  fname,
+			  clut_getErrorDescription(ret));
+		return NULL;
+	}
+	return device;
+}
+
+/*!
+ * @function clut_hasHostUnifiedMemory
+ * Checks if [device] shares its memory with the host, i.e. if mapping a
+ * memory object is cheaper than copying it.
+ */
+int clut_hasHostUnifiedMemory(const cl_device_id device)
+{
+	cl_bool unified = CL_FALSE;
+	cl_int ret;
+
+	ret = clGetDeviceInfo(device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(unified), &unified, NULL);
+	return clut_returnSuccess(ret) && (CL_FALSE != unified);
+}
+
+/*!
+ * @function clut_getKernelName
+ * Returns the function name of [kernel].
+ * @warning Result should be manually freed.
+ */
+char * clut_getKernelName(const cl_kernel kernel)
+{
+	const char * const fname = "clut_getKernelName";
+	size_t size;
+	char *name;
+	cl_int ret;
+
+	ret = clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, 0, NULL, &size);
+	if (!clut_returnSuccess(ret)) {
+		Debug_out(DEBUG_CLUT, "%s: unable to get kernel name size: %s.\n",
+			  fname,
+			  clut_getErrorDescription(ret));
+		goto error;
+	}
+
+	name = calloc(size + 1, 1);
+	if (NULL == name) {
+		Debug_out(DEBUG_CLUT, "%s: calloc failed.\n", fname);
+		goto error;
+	}
+
+	ret = clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, size, name, NULL);
+	if (!clut_returnSuccess(ret)) {
+		Debug_out(DEBUG_CLUT, "%s: unable to get kernel name: %s.\n",
+			  fname,
+			  clut_getErrorDescription(ret));
+		goto clean;
+	}
+
+	return name;
+
+clean:	free(name);
+error:	return NULL;
+}
+
 /*!
  * @function clut_createProgramFromFile
  * Creates and builds a cl_program from the name of a openCL C [file].
@@ -295,7 +410,6 @@ cl_program clut_createProgramFromFile(cl_context context, const char * const fil
 {
 	const char * const fname = "clut_createProgramFromFile";
 	cl_program program = NULL;
-	cl_int ret;
 	if (NULL == file) {
 		Debug_out(DEBUG_CLUT, "%s: NULL pointer argument.\n", fname);
 		goto error;
@@ -308,22 +422,59 @@ cl_program clut_createProgramFromFile(cl_context context, const char * const fil
 		goto error;
 	}
 
+	program = clut_createProgramFromSources(context,
+						Array_length(lines),
+						(const char **) Array_as_C_array(lines),
+						flags);
+
+	Array_free(&lines);
+	Debug_out(DEBUG_CLUT, "%s: Vector freed.\n", fname);
+	return program;
+
+error:	return NULL;
+}
+
+/*!
+ * @function clut_createProgramFromSources
+ * Creates and builds a cl_program from [count] strings of openCL C code, e.g.
+ * the kernels embedded in the library.
+ * @param context
+ * The cl_context that will be associated with the program.
+ * @param count
+ * The number of strings in [sources].
+ * @param sources
+ * The source strings, which are concatenated.
+ * @param flags
+ * An optional pointer to a string of compile flags, appended to the defaults.
+ * @return
+ * NULL on failure, or a built cl_program.
+ */
+cl_program clut_createProgramFromSources(cl_context context,
+					 const cl_uint count,
+					 const char ** const sources,
+					 const char * const flags)
+{
+	const char * const fname = "clut_createProgramFromSources";
+	cl_program program = NULL;
+	cl_int ret;
+	if (NULL == sources) {
+		Debug_out(DEBUG_CLUT, "%s: NULL pointer argument.\n", fname);
+		goto error;
+	}
+
 	/* create program */
-	program = clCreateProgramWithSource(context,
-					    Array_length(lines),
-					    (const char **) Array_as_C_array(lines),
-					    NULL, &ret);
+	program = clCreateProgramWithSource(context, count, sources, NULL, &ret);
 	if (!clut_returnSuccess(ret)) {
 		Debug_out(DEBUG_CLUT, "%s: unable to create program: %s.\n",
 			  fname,
 			  clut_getErrorDescription(ret));
-		goto clean2;
+		goto clean1;
 	}
 	if (NULL == program) {
 		Debug_out(DEBUG_CLUT, "%s: unable to create program: %s.\n",
 			  fname,
 			  clut_getErrorDescription(ret));
-		goto clean1;
+		goto error;
 	}
 	Debug_out(DEBUG_CLUT, "%s: Program source created.\n", fname);
 
@@ -333,7 +484,7 @@ cl_program clut_createProgramFromFile(cl_context context, const char * const fil
 		build_options = calloc(strlen(BUILD_OPTS) + 1 + strlen(flags) + 1, 1);
 		if (NULL == build_options) {
 			Debug_out(DEBUG_CLUT, "%s: unable to allocate build options string.\n", fname);
-			goto clean2;
+			goto clean1;
 		}
 		sprintf(build_options, "%s ", BUILD_OPTS);
 		sprintf(build_options+(strlen(BUILD_OPTS)), "%s", flags);
@@ -341,7 +492,7 @@ cl_program clut_createProgramFromFile(cl_context context, const char * const fil
 		build_options = StringUtils_clone(BUILD_OPTS);
 		if (NULL == build_options) {
 			Debug_out(DEBUG_CLUT, "%s: unable to clone default build options.\n", fname);
-			goto clean2;
+			goto clean1;
 		}
 	}
 	Debug_out(DEBUG_CLUT, "%s: Build flags are: '%s'.\n", fname, build_options);
@@ -357,22 +508,291 @@ cl_program clut_createProgramFromFile(cl_context context, const char * const fil
 			  fname,
 			  clut_getErrorDescription(ret));
 		clut_printProgramBuildLog(program);
-		goto clean3;
+		goto clean2;
 	}
 	Debug_out(DEBUG_CLUT, "%s: Program built.\n", fname);
 
 	free(build_options);
-	Array_free(&lines);
-	Debug_out(DEBUG_CLUT, "%s: Vector freed.\n", fname);
 	return program;
 
-clean3:	free(build_options);
-clean2:	clReleaseProgram(program);
-clean1:	Array_free(&lines);
+clean2:	free(build_options);
+clean1:	clReleaseProgram(program);
 error:	return NULL;
 }
 
 
+/*!
+ Program cache
+ */
+
+/* a kernel not in use, ready to be handed out again */
+struct clut_kernel_cache_entry {
+	cl_kernel kernel;
+	char *name;
+	struct clut_kernel_cache_entry *next;
+};
+
+struct clut_program_cache_entry {
+	cl_context context;
+	unsigned long hash;
+	char *key;
+	cl_program program;
+	struct clut_kernel_cache_entry *kernels;
+	struct clut_program_cache_entry *next;
+};
+
+static struct clut_program_cache_entry *program_cache = NULL;
+static pthread_mutex_t program_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*!
+ * @function clut_getProgramCacheKey
+ * Concatenates [sources] and [flags] in a newly allocated string, and stores
+ * its FNV-1a hash in [hash].
+ */
+static char * clut_getProgramCacheKey(const cl_uint count,
+				      const char ** const sources,
+				      const char * const flags,
+				      unsigned long *hash)
+{
+	size_t length = 1, offset = 0, i;
+	unsigned long h = 2166136261UL;
+	char *key, *c;
+
+	for (i = 0; i < count; ++i) {
+		length += strlen(sources[i]);
+	}
+	if (NULL != flags) {
+		length += strlen(flags);
+	}
+
+	key = malloc(length + 1);
+	if (NULL == key) {
+		return NULL;
+	}
+	for (i = 0; i < count; ++i) {
+		strcpy(key + offset, sources[i]);
+		offset += strlen(sources[i]);
+	}
+	/* a newline can't end a set of flags, so it separates them from the source */
+	key[offset++] = '\n';
+	strcpy(key + offset, (NULL != flags) ? flags : "");
+
+	for (c = key; '\0' != *c; ++c) {
+		h ^= (unsigned char) *c;
+		h *= 16777619UL;
+	}
+	*hash = h;
+	return key;
+}
+
+/*!
+ * @function clut_getProgramCacheEntry
+ * Returns the cache entry of the program built from [sources] and [flags]
+ * for [context], building it if needed; NULL on failure.
+ * Must be called with program_cache_lock held: it is held while building,
+ * so the same program is never built twice.
+ */
+static struct clut_program_cache_entry * clut_getProgramCacheEntry(cl_context context,
+								   const cl_uint count,
+								   const char ** const sources,
+								   const char * const flags)
+{
+	const char * const fname = "clut_getProgramCacheEntry";
+	struct clut_program_cache_entry *entry;
+	unsigned long hash;
+	char *key;
+
+	if (NULL == sources) {
+		Debug_out(DEBUG_CLUT, "%s: NULL pointer argument.\n", fname);
+		goto error1;
+	}
+
+	key = clut_getProgramCacheKey(count, sources, flags, &hash);
+	if (NULL == key) {
+		Debug_out(DEBUG_CLUT, "%s: malloc failed.\n", fname);
+		goto error1;
+	}
+
+	for (entry = program_cache; NULL != entry; entry = entry->next) {
+		if ((entry->context == context) && (entry->hash == hash) && (0 == strcmp(entry->key, key))) {
+			free(key);
+			return entry;
+		}
+	}
+
+	entry = malloc(sizeof(*entry));
+	if (NULL == entry) {
+		Debug_out(DEBUG_CLUT, "%s: malloc failed.\n", fname);
+		goto error2;
+	}
+	entry->program = clut_createProgramFromSources(context, count, sources, flags);
+	if (NULL == entry->program) {
+		goto error3;
+	}
+	Debug_out(DEBUG_CLUT, "%s: caching program with hash %lx.\n", fname, hash);
+
+	clRetainContext(context);
+	entry->context = context;
+	entry->hash = hash;
+	entry->key = key;
+	entry->kernels = NULL;
+	entry->next = program_cache;
+	program_cache = entry;
+	return entry;
+
+error3:	free(entry);
+error2:	free(key);
+error1:	return NULL;
+}
+
+/*!
+ * @function clut_getCachedProgram
+ * Returns a program built from [sources] and [flags] for [context], building
+ * it only the first time it's requested. Programs are identified by their
+ * source, so generated code is cached as well as embedded code.
+ * The cache retains [context], so a later context can't be handed its
+ * programs even if it gets the same address: call
+ * clut_releaseCachedPrograms(context) when done with it, or the context is
+ * never freed.
+ * @warning The program is owned by the cache, don't release it.
+ * @return
+ * NULL on failure, or a built cl_program.
+ */
+cl_program clut_getCachedProgram(cl_context context,
+				 const cl_uint count,
+				 const char ** const sources,
+				 const char * const flags)
+{
+	struct clut_program_cache_entry *entry;
+
+	pthread_mutex_lock(&program_cache_lock);
+	entry = clut_getProgramCacheEntry(context, count, sources, flags);
+	pthread_mutex_unlock(&program_cache_lock);
+	return (NULL != entry) ? entry->program : NULL;
+}
+
+/*!
+ * @function clut_acquireCachedKernel
+ * Returns kernel [name] of the program clut_getCachedProgram gives for
+ * [context], [sources] and [flags], reusing one given back with
+ * clut_releaseCachedKernel if any. A kernel is handed to one caller at a
+ * time, so its arguments can be set without locking.
+ * @warning Result should be given back with clut_releaseCachedKernel.
+ * @return
+ * NULL on failure, or a cl_kernel.
+ */
+cl_kernel clut_acquireCachedKernel(cl_context context,
+				   const cl_uint count,
+				   const char ** const sources,
+				   const char * const flags,
+				   const char * const name)
+{
+	struct clut_program_cache_entry *entry;
+	struct clut_kernel_cache_entry *cached, **link;
+	cl_kernel kernel = NULL;
+	cl_int ret;
+
+	pthread_mutex_lock(&program_cache_lock);
+	entry = clut_getProgramCacheEntry(context, count, sources, flags);
+	if (NULL == entry) {
+		goto end;
+	}
+	for (link = &entry->kernels; NULL != (cached = *link); link = &cached->next) {
+		if (0 == strcmp(cached->name, name)) {
+			*link = cached->next;
+			kernel = cached->kernel;
+			free(cached->name);
+			free(cached);
+			goto end;
+		}
+	}
+	kernel = clCreateKernel(entry->program, name, &ret);
+	if (!clut_returnSuccess(ret)) {
+		Debug_out(DEBUG_CLUT, "clut_acquireCachedKernel: unable to create kernel '%s': %s.\n",
+			  name, clut_getErrorDescription(ret));
+		kernel = NULL;
+	}
+
+end:	pthread_mutex_unlock(&program_cache_lock);
+	return kernel;
+}
+
+/*!
+ * @function clut_releaseCachedKernel
+ * Gives back [kernel], from clut_acquireCachedKernel, for reuse. Commands
+ * already enqueued keep the arguments they were enqueued with. If its
+ * program left the cache meanwhile, the kernel is released.
+ */
+void clut_releaseCachedKernel(cl_kernel kernel)
+{
+	struct clut_program_cache_entry *entry;
+	struct clut_kernel_cache_entry *cached;
+	cl_program program;
+	char *name;
+
+	if (NULL == kernel) {
+		return;
+	}
+	if (!clut_returnSuccess(clGetKernelInfo(kernel, CL_KERNEL_PROGRAM, sizeof(program), &program, NULL)) ||
+	    (NULL == (name = clut_getKernelName(kernel)))) {
+		clReleaseKernel(kernel);
+		return;
+	}
+
+	pthread_mutex_lock(&program_cache_lock);
+	for (entry = program_cache; NULL != entry; entry = entry->next) {
+		if (entry->program == program) {
+			break;
+		}
+	}
+	cached = (NULL != entry) ? malloc(sizeof(*cached)) : NULL;
+	if (NULL != cached) {
+		cached->kernel = kernel;
+		cached->name = name;
+		cached->next = entry->kernels;
+		entry->kernels = cached;
+	}
+	pthread_mutex_unlock(&program_cache_lock);
+
+	if (NULL == cached) {
+		free(name);
+		clReleaseKernel(kernel);
+	}
+}
+
+/*!
+ * @function clut_releaseCachedPrograms
+ * Releases the programs built by clut_getCachedProgram for [context], their
+ * kernels given back with clut_releaseCachedKernel, and the references the
+ * cache holds to it; all of them if [context] is NULL.
+ */
+void clut_releaseCachedPrograms(cl_context context)
+{
+	struct clut_program_cache_entry *entry, **link;
+	struct clut_kernel_cache_entry *cached;
+
+	pthread_mutex_lock(&program_cache_lock);
+	for (link = &program_cache; NULL != (entry = *link); ) {
+		if ((NULL != context) && (entry->context != context)) {
+			link = &entry->next;
+			continue;
+		}
+		*link = entry->next;
+		while (NULL != (cached = entry->kernels)) {
+			entry->kernels = cached->next;
+			clReleaseKernel(cached->kernel);
+			free(cached->name);
+			free(cached);
+		}
+		clReleaseProgram(entry->program);
+		clReleaseContext(entry->context);
+		free(entry->key);
+		free(entry);
+	}
+	pthread_mutex_unlock(&program_cache_lock);
+}
+
+
 /*!
  Program build log
  */
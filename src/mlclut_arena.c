@@ -0,0 +1,502 @@
+/**
+ * @file
+ * @author Michele Laurenti
+ * @language c
+ *
+ * Device memory arenas: sub-buffers of one big buffer.
+ *
+ * Both modes carve from the top of the arena. Every sub-buffer created is
+ * remembered, with whether it is allocated, to be released on reset; an
+ * open addressing hash table maps each one back to its index, for frees. In
+ * pool mode a size class is a power of two multiple of the alignment, and
+ * its free list holds the indices of sub-buffers of exactly that size.
+ */
+
+#include "mlclut_arena.h"
+#include "mlclut_descriptions.h"
+#include "mlclut_memory.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <Debug.h>
+
+#define DEBUG_ARENA	"mlclut_debug_arena"
+
+#define N_CLASSES	(8 * sizeof(size_t))
+
+/* table slots hold index + 1, 0 being empty; twice the capacity, a power of two */
+struct clut_mem_list {
+	cl_mem *mems;
+	unsigned char *allocated;
+	size_t n;
+	size_t capacity;
+	size_t *table;
+};
+
+struct clut_index_list {
+	size_t *indices;
+	size_t n;
+	size_t capacity;
+};
+
+struct clut_arena {
+	cl_mem buffer;
+	clut_arena_mode mode;
+	size_t size;
+	size_t alignment;
+	size_t top;
+	size_t used;
+	size_t high_water;
+	size_t allocations;
+	size_t failures;
+	struct clut_mem_list all;
+	struct clut_index_list free[N_CLASSES];
+	pthread_mutex_t lock;
+};
+
+/**
+ * Function declaration
+ */
+
+static size_t clut_memHash(cl_mem mem, size_t n_slots);
+static void clut_memListInsert(struct clut_mem_list *list, size_t index);
+static int clut_memListPush(struct clut_mem_list *list, cl_mem mem);
+static int clut_indexListPush(struct clut_index_list *list, size_t index);
+static int clut_arenaFind(const clut_arena *arena, cl_mem mem, size_t *index);
+static size_t clut_getContextAlignment(cl_context context);
+static unsigned int clut_arenaClass(const clut_arena *arena, size_t size);
+static cl_mem clut_arenaCarve(clut_arena *arena, size_t size, cl_int *ret);
+
+/**
+ * Function definition
+ */
+
+/*!
+ * @function clut_memHash
+ * Returns the first slot of [mem] in a table of [n_slots] slots.
+ */
+static size_t clut_memHash(cl_mem mem, size_t n_slots)
+{
+	/* handles are aligned pointers: drop the low bits, then mix */
+	uintptr_t h = (uintptr_t) mem >> 4;
+
+	h ^= h >> 16;
+	h *= (uintptr_t) 0x45d9f3bUL;
+	h ^= h >> 16;
+	return (size_t) h & (n_slots - 1);
+}
+
+/*!
+ * @function clut_memListInsert
+ * Adds the sub-buffer at [index] of [list] to its table.
+ */
+static void clut_memListInsert(struct clut_mem_list *list, size_t index)
+{
+	const size_t n_slots = 2 * list->capacity;
+	size_t slot;
+
+	slot = clut_memHash(list->mems[index], n_slots);
+	while (0 != list->table[slot]) {
+		slot = (slot + 1) & (n_slots - 1);
+	}
+	list->table[slot] = index + 1;
+}
+
+/*!
+ * @function clut_memListPush
+ * Appends [mem] to [list], as allocated.
+ * @return
+ * 0 on success, a negative value if out of memory.
+ */
+static int clut_memListPush(struct clut_mem_list *list, cl_mem mem)
+{
+	unsigned char *allocated;
+	cl_mem *tmp;
+	size_t capacity, *table, i;
+
+	if (list->n == list->capacity) {
+		capacity = (0 == list->capacity) ? 16 : 2 * list->capacity;
+		table = calloc(2 * capacity, sizeof(size_t));
+		if (NULL == table) {
+			return -1;
+		}
+		tmp = realloc(list->mems, capacity * sizeof(cl_mem));
+		if (NULL == tmp) {
+			free(table);
+			return -1;
+		}
+		list->mems = tmp;
+		allocated = realloc(list->allocated, capacity);
+		if (NULL == allocated) {
+			free(table);
+			return -1;
+		}
+		list->allocated = allocated;
+		list->capacity = capacity;
+		free(list->table);
+		list->table = table;
+		for (i = 0; i < list->n; ++i) {
+			clut_memListInsert(list, i);
+		}
+	}
+	list->allocated[list->n] = 1;
+	list->mems[list->n] = mem;
+	clut_memListInsert(list, list->n++);
+	return 0;
+}
+
+/*!
+ * @function clut_indexListPush
+ * Appends [index] to [list].
+ * @return
+ * 0 on success, a negative value if out of memory.
+ */
+static int clut_indexListPush(struct clut_index_list *list, size_t index)
+{
+	size_t *tmp;
+	size_t capacity;
+
+	if (list->n == list->capacity) {
+		capacity = (0 == list->capacity) ? 16 : 2 * list->capacity;
+		tmp = realloc(list->indices, capacity * sizeof(size_t));
+		if (NULL == tmp) {
+			return -1;
+		}
+		list->indices = tmp;
+		list->capacity = capacity;
+	}
+	list->indices[list->n++] = index;
+	return 0;
+}
+
+/*!
+ * @function clut_arenaFind
+ * Stores in [index] the position of [mem] among the sub-buffers of [arena].
+ * The arena must be locked.
+ * @return
+ * 1 if found, 0 if [mem] was not created by [arena].
+ */
+static int clut_arenaFind(const clut_arena *arena, cl_mem mem, size_t *index)
+{
+	const size_t n_slots = 2 * arena->all.capacity;
+	size_t slot;
+
+	if (0 == n_slots) {
+		return 0;
+	}
+	/* at most half full, so an empty slot ends the probe */
+	for (slot = clut_memHash(mem, n_slots); 0 != arena->all.table[slot]; slot = (slot + 1) & (n_slots - 1)) {
+		if (arena->all.mems[arena->all.table[slot] - 1] == mem) {
+			*index = arena->all.table[slot] - 1;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*!
+ * @function clut_getContextAlignment
+ * Returns the largest alignment (see clut_getDeviceAlignment) among the
+ * devices of [context], or 0 on failure.
+ */
+static size_t clut_getContextAlignment(cl_context context)
+{
+	cl_device_id *devices;
+	size_t size, alignment = 0, a;
+	cl_uint i, n;
+	cl_int ret;
+
+	ret = clGetContextInfo(context, CL_CONTEXT_DEVICES, 0, NULL, &size);
+	CLUT_CHECK_ERROR(ret, "Unable to get context devices", error1);
+	devices = malloc(size);
+	if (NULL == devices) {
+		goto error1;
+	}
+	ret = clGetContextInfo(context, CL_CONTEXT_DEVICES, size, devices, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to get context devices", error2);
+
+	n = (cl_uint) (size / sizeof(cl_device_id));
+	for (i = 0; i < n; ++i) {
+		a = clut_getDeviceAlignment(devices[i]);
+		if (a > alignment) {
+			alignment = a;
+		}
+	}
+
+error2:	free(devices);
+error1:	return alignment;
+}
+
+/*!
+ * @function clut_createArena
+ * Creates an arena of [size] bytes (rounded up to the alignment), whose
+ * buffer is created with [flags].
+ */
+clut_arena * clut_createArena(cl_context context, cl_mem_flags flags, size_t size, clut_arena_mode mode, cl_int *ret)
+{
+	const char * const fname = "clut_createArena";
+	clut_arena *arena;
+	cl_int err;
+
+	arena = calloc(1, sizeof(*arena));
+	if (NULL == arena) {
+		Debug_out(DEBUG_ARENA, "%s: calloc failed.\n", fname);
+		err = CL_OUT_OF_HOST_MEMORY;
+		goto error1;
+	}
+	arena->mode = mode;
+	arena->alignment = clut_getContextAlignment(context);
+	if (0 == arena->alignment) {
+		Debug_out(DEBUG_ARENA, "%s: unable to get the alignment.\n", fname);
+		err = CL_INVALID_CONTEXT;
+		goto error2;
+	}
+	arena->size = CLUT_ROUND_UP(size, arena->alignment);
+
+	arena->buffer = clut_createTrackedBuffer(context, flags, arena->size, NULL, "arena", arena, &err);
+	CLUT_CHECK_ERROR(err, "Unable to create arena buffer", error2);
+	pthread_mutex_init(&arena->lock, NULL);
+
+	Debug_out(DEBUG_ARENA, "%s: %zu bytes, aligned to %zu.\n", fname, arena->size, arena->alignment);
+	if (NULL != ret) {
+		*ret = CL_SUCCESS;
+	}
+	return arena;
+
+error2:	free(arena);
+error1:	if (NULL != ret) {
+		*ret = err;
+	}
+	return NULL;
+}
+
+/*!
+ * @function clut_arenaReset
+ * Frees every allocation of [arena] at once.
+ */
+void clut_arenaReset(clut_arena *arena)
+{
+	size_t i;
+
+	if (NULL == arena) {
+		return;
+	}
+	pthread_mutex_lock(&arena->lock);
+	for (i = 0; i < arena->all.n; ++i) {
+		clReleaseMemObject(arena->all.mems[i]);
+	}
+	arena->all.n = 0;
+	if (NULL != arena->all.table) {
+		memset(arena->all.table, 0, 2 * arena->all.capacity * sizeof(size_t));
+	}
+	for (i = 0; i < N_CLASSES; ++i) {
+		arena->free[i].n = 0;
+	}
+	arena->top = 0;
+	arena->used = 0;
+	pthread_mutex_unlock(&arena->lock);
+}
+
+/*!
+ * @function clut_releaseArena
+ * Frees every allocation of [arena], and releases it.
+ */
+void clut_releaseArena(clut_arena *arena)
+{
+	size_t i;
+
+	if (NULL == arena) {
+		return;
+	}
+	clut_arenaReset(arena);
+	Debug_out(DEBUG_ARENA, "clut_releaseArena: high water mark %zu of %zu bytes, %zu allocations, %zu failed.\n",
+		  arena->high_water, arena->size, arena->allocations, arena->failures);
+
+	clReleaseMemObject(arena->buffer);
+	free(arena->all.mems);
+	free(arena->all.allocated);
+	free(arena->all.table);
+	for (i = 0; i < N_CLASSES; ++i) {
+		free(arena->free[i].indices);
+	}
+	pthread_mutex_destroy(&arena->lock);
+	free(arena);
+}
+
+/*!
+ * @function clut_arenaClass
+ * Returns the size class of an allocation of [size] bytes: class c holds
+ * alignment << c bytes.
+ */
+static unsigned int clut_arenaClass(const clut_arena *arena, size_t size)
+{
+	unsigned int c = 0;
+
+	while ((c + 1 < N_CLASSES) && ((arena->alignment << c) < size)) {
+		++c;
+	}
+	return c;
+}
+
+/*!
+ * @function clut_arenaCarve
+ * Creates a sub-buffer of [size] bytes at the top of [arena].
+ * The arena must be locked.
+ */
+static cl_mem clut_arenaCarve(clut_arena *arena, size_t size, cl_int *ret)
+{
+	cl_buffer_region region;
+	cl_mem mem;
+
+	if (size > arena->size - arena->top) {
+		*ret = CL_MEM_OBJECT_ALLOCATION_FAILURE;
+		return NULL;
+	}
+	region.origin = arena->top;
+	region.size = size;
+	mem = clCreateSubBuffer(arena->buffer, 0, CL_BUFFER_CREATE_TYPE_REGION, &region, ret);
+	if (!clut_returnSuccess(*ret)) {
+		return NULL;
+	}
+	if (0 != clut_memListPush(&arena->all, mem)) {
+		clReleaseMemObject(mem);
+		*ret = CL_OUT_OF_HOST_MEMORY;
+		return NULL;
+	}
+
+	arena->top += CLUT_ROUND_UP(size, arena->alignment);
+	if (arena->top > arena->high_water) {
+		arena->high_water = arena->top;
+	}
+	return mem;
+}
+
+/*!
+ * @function clut_arenaAlloc
+ * Returns a sub-buffer of at least [size] bytes, or NULL with
+ * CL_MEM_OBJECT_ALLOCATION_FAILURE in [ret] if the arena is full.
+ */
+cl_mem clut_arenaAlloc(clut_arena *arena, size_t size, cl_int *ret)
+{
+	const char * const fname = "clut_arenaAlloc";
+	struct clut_index_list *list;
+	size_t index;
+	cl_mem mem = NULL;
+	cl_int err = CL_SUCCESS;
+	unsigned int c;
+
+	if ((NULL == arena) || (0 == size)) {
+		Debug_out(DEBUG_ARENA, "%s: invalid argument.\n", fname);
+		err = CL_INVALID_VALUE;
+		goto end;
+	}
+
+	pthread_mutex_lock(&arena->lock);
+	if (CLUT_ARENA_POOL == arena->mode) {
+		c = clut_arenaClass(arena, size);
+		size = arena->alignment << c;
+		list = &arena->free[c];
+		if (0 != list->n) {
+			index = list->indices[--list->n];
+			arena->all.allocated[index] = 1;
+			mem = arena->all.mems[index];
+		} else {
+			mem = clut_arenaCarve(arena, size, &err);
+		}
+	} else {
+		mem = clut_arenaCarve(arena, size, &err);
+	}
+	if (NULL != mem) {
+		arena->used += CLUT_ROUND_UP(size, arena->alignment);
+		arena->allocations++;
+	} else {
+		arena->failures++;
+		Debug_out(DEBUG_ARENA, "%s: unable to allocate %zu bytes (%s).\n", fname, size, clut_getErrorDescription(err));
+	}
+	pthread_mutex_unlock(&arena->lock);
+
+end:	if (NULL != ret) {
+		*ret = err;
+	}
+	return mem;
+}
+
+/*!
+ * @function clut_arenaFree
+ * Puts [mem] back in the free list of its class. Only pool arenas free
+ * single allocations: bump arenas are freed by clut_arenaReset.
+ * @return
+ * CL_SUCCESS, or CL_INVALID_MEM_OBJECT if [mem] was not allocated from
+ * [arena] or is already free.
+ */
+cl_int clut_arenaFree(clut_arena *arena, cl_mem mem)
+{
+	const char * const fname = "clut_arenaFree";
+	cl_mem parent;
+	size_t size, index;
+	cl_int ret;
+
+	if ((NULL == arena) || (NULL == mem)) {
+		return CL_INVALID_VALUE;
+	}
+	if (CLUT_ARENA_POOL != arena->mode) {
+		Debug_out(DEBUG_ARENA, "%s: not a pool arena.\n", fname);
+		return CL_INVALID_OPERATION;
+	}
+	ret = clGetMemObjectInfo(mem, CL_MEM_ASSOCIATED_MEMOBJECT, sizeof(parent), &parent, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to get parent buffer", error);
+	ret = clGetMemObjectInfo(mem, CL_MEM_SIZE, sizeof(size), &size, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to get buffer size", error);
+	if (parent != arena->buffer) {
+		Debug_out(DEBUG_ARENA, "%s: buffer not from this arena.\n", fname);
+		return CL_INVALID_MEM_OBJECT;
+	}
+
+	pthread_mutex_lock(&arena->lock);
+	if (!clut_arenaFind(arena, mem, &index) || !arena->all.allocated[index]) {
+		Debug_out(DEBUG_ARENA, "%s: buffer not allocated from this arena, or already free.\n", fname);
+		ret = CL_INVALID_MEM_OBJECT;
+	} else if (0 != clut_indexListPush(&arena->free[clut_arenaClass(arena, size)], index)) {
+		/* forget it, the reset will release it */
+		ret = CL_OUT_OF_HOST_MEMORY;
+	} else {
+		arena->all.allocated[index] = 0;
+		arena->used -= size;
+	}
+	pthread_mutex_unlock(&arena->lock);
+
+error:	return ret;
+}
+
+/*!
+ * @function clut_getArenaBuffer
+ * Returns the buffer all allocations of [arena] are sub-buffers of.
+ */
+cl_mem clut_getArenaBuffer(clut_arena *arena)
+{
+	return (NULL != arena) ? arena->buffer : NULL;
+}
+
+/*!
+ * @function clut_getArenaStats
+ * Stores the current statistics of [arena] in [stats].
+ */
+void clut_getArenaStats(clut_arena *arena, clut_arena_stats *stats)
+{
+	if ((NULL == arena) || (NULL == stats)) {
+		return;
+	}
+	pthread_mutex_lock(&arena->lock);
+	stats->size = arena->size;
+	stats->alignment = arena->alignment;
+	stats->used = arena->used;
+	stats->carved = arena->top;
+	stats->high_water = arena->high_water;
+	stats->allocations = arena->allocations;
+	stats->failures = arena->failures;
+	pthread_mutex_unlock(&arena->lock);
+}
@@ -0,0 +1,332 @@
+/**
+ * @file
+ * @author Michele Laurenti
+ * @language c
+ *
+ * Work-group size autotuner, with a persistent per device cache.
+ *
+ * The cache file has one line per tuned kernel:
+ *   device <TAB> kernel <TAB> work_dim <TAB> bucket sizes <TAB> local sizes
+ * in the format of mlclut_cache.h, and a local size of 0 0 0 means the
+ * implementation's choice (a NULL local size).
+ */
+
+#include "mlclut_autotune.h"
+#include "mlclut_descriptions.h"
+#include "mlclut_interpose.h"
+#include "mlclut_clock.h"
+#include "mlclut_cache.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <Debug.h>
+
+#define DEBUG_AUTOTUNE	"mlclut_debug_autotune"
+
+#define AUTOTUNE_ENV		"CLUT_AUTOTUNE_CACHE"
+#define MAX_NAME		256
+#define MAX_CANDIDATES		128
+#define TUNE_RUNS		3
+
+static clut_cache autotune_cache = CLUT_CACHE_INITIALIZER(AUTOTUNE_ENV, DEBUG_AUTOTUNE);
+
+/**
+ * Function declaration
+ */
+
+static int clut_autotuneKey(cl_command_queue command_queue, cl_kernel kernel,
+			    cl_uint work_dim, const size_t *global_work_size,
+			    char *key, char *kernel_name);
+static size_t clut_autotuneCandidates(cl_command_queue command_queue, cl_kernel kernel,
+				      cl_uint work_dim, const size_t *global_work_size,
+				      size_t candidates[][3]);
+static cl_ulong clut_autotuneTime(cl_command_queue command_queue, cl_kernel kernel,
+				  cl_uint work_dim, const size_t *global_work_size,
+				  const size_t *local_work_size, int profiling);
+
+/**
+ * Function definition
+ */
+
+/*!
+ * @function clut_setAutotuneCacheFile
+ * Makes the autotuner load and store its results in [filename], instead of
+ * the file named by CLUT_AUTOTUNE_CACHE. NULL keeps results in memory only.
+ * Results in memory are discarded.
+ */
+void clut_setAutotuneCacheFile(const char * const filename)
+{
+	clut_setCacheFile(&autotune_cache, filename);
+}
+
+/*!
+ * @function clut_releaseAutotuneCache
+ * Forgets all results in memory, and any file set with
+ * clut_setAutotuneCacheFile. The cache file is left untouched.
+ */
+void clut_releaseAutotuneCache(void)
+{
+	clut_releaseCache(&autotune_cache);
+}
+
+/*!
+ * @function clut_autotuneKey
+ * Writes to [key], CLUT_CACHE_MAX_KEY long, the device, kernel, dimensions
+ * and size bucket fields of the cache line, and the kernel name to
+ * [kernel_name], MAX_NAME long.
+ * @return
+ * 0 on success, a negative value on failure.
+ */
+static int clut_autotuneKey(cl_command_queue command_queue, cl_kernel kernel,
+			    cl_uint work_dim, const size_t *global_work_size,
+			    char *key, char *kernel_name)
+{
+	char device_key[CLUT_CACHE_DEVICE_KEY];
+	size_t bucket[3];
+	cl_uint d;
+
+	if ((1 > work_dim) || (3 < work_dim) ||
+	    (0 != clut_getDeviceKey(clut_getQueueDevice(command_queue), device_key, sizeof(device_key))) ||
+	    !clut_returnSuccess(clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, MAX_NAME, kernel_name, NULL))) {
+		return -1;
+	}
+	kernel_name[MAX_NAME - 1] = '\0';
+
+	for (d = 0; d < 3; ++d) {
+		bucket[d] = 1;
+		if (d < work_dim) {
+			while (bucket[d] < global_work_size[d]) {
+				bucket[d] *= 2;
+			}
+		}
+	}
+
+	snprintf(key, CLUT_CACHE_MAX_KEY, "%s\t%s\t%u\t%zu %zu %zu",
+		 device_key, kernel_name, work_dim, bucket[0], bucket[1], bucket[2]);
+	return 0;
+}
+
+/*!
+ * @function clut_autotuneCandidates
+ * Fills [candidates] (at least MAX_CANDIDATES long) with the local sizes
+ * worth trying, and returns their number. The first candidate is all
+ * zeros, for the implementation's choice.
+ */
+static size_t clut_autotuneCandidates(cl_command_queue command_queue, cl_kernel kernel,
+				      cl_uint work_dim, const size_t *global_work_size,
+				      size_t candidates[][3])
+{
+	size_t max_items[3] = {1, 1, 1}, limits[3] = {1, 1, 1};
+	size_t max_group, multiple = 1, x, y, z, n = 0;
+	cl_device_id device;
+	cl_uint d;
+
+	memset(candidates[n++], 0, 3 * sizeof(size_t));
+
+	device = clut_getQueueDevice(command_queue);
+	if ((NULL == device) ||
+	    !clut_returnSuccess(clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_group), &max_group, NULL)) ||
+	    !clut_returnSuccess(clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(max_items), max_items, NULL))) {
+		return n;
+	}
+	clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(multiple), &multiple, NULL);
+	if ((0 == multiple) || (multiple > max_group)) {
+		multiple = 1;
+	}
+
+	/* no point in local sizes beyond the (rounded up) global size */
+	for (d = 0; d < work_dim; ++d) {
+		while ((limits[d] < global_work_size[d]) && (limits[d] * 2 <= max_items[d])) {
+			limits[d] *= 2;
+		}
+	}
+
+	for (x = 1; x <= limits[0]; x *= 2) {
+		for (y = 1; y <= limits[1]; y *= 2) {
+			for (z = 1; z <= limits[2]; z *= 2) {
+				if ((x * y * z > max_group) ||
+				    (0 != (x * y * z) % multiple) ||
+				    (n == MAX_CANDIDATES)) {
+					continue;
+				}
+				candidates[n][0] = x;
+				candidates[n][1] = y;
+				candidates[n][2] = z;
+				++n;
+			}
+		}
+	}
+
+	return n;
+}
+
+/*!
+ * @function clut_autotuneTime
+ * Runs [kernel] TUNE_RUNS times with [local_work_size] (all zeros for NULL),
+ * padding the global size to a multiple of it, and returns the fastest run
+ * in nanoseconds, 0 on failure. Without profiling, runs are timed on the host.
+ */
+static cl_ulong clut_autotuneTime(cl_command_queue command_queue, cl_kernel kernel,
+				  cl_uint work_dim, const size_t *global_work_size,
+				  const size_t *local_work_size, int profiling)
+{
+	size_t global[3];
+	const size_t *local = (0 != local_work_size[0]) ? local_work_size : NULL;
+	cl_ulong best = 0, duration, started;
+	cl_event event;
+	cl_int ret;
+	cl_uint d;
+	int i;
+
+	for (d = 0; d < work_dim; ++d) {
+		global[d] = (NULL != local) ? COMPUTE_GLOBAL_SIZE(global_work_size[d], local[d]) : global_work_size[d];
+	}
+
+	for (i = 0; i < TUNE_RUNS; ++i) {
+		started = clut_getHostTime_ns();
+		ret = clEnqueueNDRangeKernel(command_queue, kernel, work_dim, NULL, global, local, 0, NULL, &event);
+		if (!clut_returnSuccess(ret)) {
+			/* e.g. out of resources with this local size */
+			return 0;
+		}
+		ret = clWaitForEvents(1, &event);
+		duration = profiling ? clut_getEventDuration_ns(event) : clut_getHostTime_ns() - started;
+		clReleaseEvent(event);
+		if (!clut_returnSuccess(ret)) {
+			return 0;
+		}
+		if ((0 != duration) && ((0 == best) || (duration < best))) {
+			best = duration;
+		}
+	}
+
+	return best;
+}
+
+/*!
+ * @function clut_autotuneKernel
+ * Times [kernel] with each candidate local size over [global_work_size],
+ * stores the fastest in [local_work_size] (all zeros if the implementation's
+ * choice won) and caches it. The kernel arguments must be set, and running
+ * the kernel a few times must be harmless.
+ * @warning Candidates need not divide [global_work_size]: each run pads the
+ * global size to a multiple of the local size, so the kernel must check its
+ * bounds (as with clut_enqueueTunedNDRangeKernel), or it reads and writes
+ * past its buffers while being tuned.
+ * @return
+ * CL_SUCCESS, or an error code if no candidate could run.
+ */
+cl_int clut_autotuneKernel(cl_command_queue command_queue,
+			   cl_kernel kernel,
+			   cl_uint work_dim,
+			   const size_t *global_work_size,
+			   size_t *local_work_size)
+{
+	const char * const fname = "clut_autotuneKernel";
+	size_t candidates[MAX_CANDIDATES][3];
+	char key[CLUT_CACHE_MAX_KEY], kernel_name[MAX_NAME], value[CLUT_CACHE_MAX_VALUE];
+	cl_command_queue_properties properties = 0;
+	cl_ulong best = 0, duration;
+	size_t n, i, winner = 0;
+	cl_uint d;
+
+	if (0 != clut_autotuneKey(command_queue, kernel, work_dim, global_work_size, key, kernel_name)) {
+		Debug_out(DEBUG_AUTOTUNE, "%s: invalid kernel or dimensions.\n", fname);
+		return CL_INVALID_VALUE;
+	}
+	clGetCommandQueueInfo(command_queue, CL_QUEUE_PROPERTIES, sizeof(properties), &properties, NULL);
+
+	n = clut_autotuneCandidates(command_queue, kernel, work_dim, global_work_size, candidates);
+	for (i = 0; i < n; ++i) {
+		duration = clut_autotuneTime(command_queue, kernel, work_dim, global_work_size, candidates[i],
+					     0 != (properties & CL_QUEUE_PROFILING_ENABLE));
+		if ((0 != duration) && ((0 == best) || (duration < best))) {
+			best = duration;
+			winner = i;
+		}
+	}
+	if (0 == best) {
+		Debug_out(DEBUG_AUTOTUNE, "%s: no candidate ran for '%s'.\n", fname, kernel_name);
+		return CL_INVALID_WORK_GROUP_SIZE;
+	}
+
+	for (d = 0; d < work_dim; ++d) {
+		local_work_size[d] = candidates[winner][d];
+	}
+	Debug_out(DEBUG_AUTOTUNE, "%s: '%s' best local size %zu x %zu x %zu (%llu ns, %zu candidates).\n",
+		  fname, kernel_name, candidates[winner][0], candidates[winner][1], candidates[winner][2],
+		  (unsigned long long) best, n);
+
+	snprintf(value, sizeof(value), "%zu %zu %zu", candidates[winner][0], candidates[winner][1], candidates[winner][2]);
+	clut_cacheStore(&autotune_cache, key, value);
+
+	return CL_SUCCESS;
+}
+
+/*!
+ * @function clut_getTunedLocalSize
+ * Looks up the tuned local size of [kernel] for [global_work_size] on the
+ * device of [command_queue], and stores it in [local_work_size] (all zeros
+ * for the implementation's choice).
+ * @return
+ * 1 if found, 0 if the kernel was never tuned for that size bucket.
+ */
+int clut_getTunedLocalSize(cl_command_queue command_queue,
+			   cl_kernel kernel,
+			   cl_uint work_dim,
+			   const size_t *global_work_size,
+			   size_t *local_work_size)
+{
+	char key[CLUT_CACHE_MAX_KEY], kernel_name[MAX_NAME], value[CLUT_CACHE_MAX_VALUE];
+	size_t local[3];
+	cl_uint d;
+
+	if ((0 != clut_autotuneKey(command_queue, kernel, work_dim, global_work_size, key, kernel_name)) ||
+	    !clut_cacheLookup(&autotune_cache, key, value, sizeof(value)) ||
+	    (3 != sscanf(value, "%zu %zu %zu", &local[0], &local[1], &local[2]))) {
+		return 0;
+	}
+	for (d = 0; d < work_dim; ++d) {
+		local_work_size[d] = local[d];
+	}
+	return 1;
+}
+
+/*!
+ * @function clut_enqueueTunedNDRangeKernel
+ * Same as clEnqueueNDRangeKernel, with the local size tuned by a previous
+ * clut_autotuneKernel for the same (device, kernel, size bucket). Kernels
+ * never tuned get the implementation's choice: tuning runs the kernel many
+ * times on its current arguments, so it is never done implicitly. With a
+ * tuned local size the global size is padded with COMPUTE_GLOBAL_SIZE, so
+ * the kernel must check its bounds.
+ */
+cl_int clut_enqueueTunedNDRangeKernel(cl_command_queue command_queue,
+				      cl_kernel kernel,
+				      cl_uint work_dim,
+				      const size_t *global_work_offset,
+				      const size_t *global_work_size,
+				      cl_uint n_wait,
+				      const cl_event *wait_list,
+				      cl_event *event)
+{
+	size_t local[3] = {0, 0, 0}, global[3];
+	cl_uint d;
+
+	if ((1 > work_dim) || (3 < work_dim)) {
+		return CL_INVALID_WORK_DIMENSION;
+	}
+
+	if (!clut_getTunedLocalSize(command_queue, kernel, work_dim, global_work_size, local)) {
+		local[0] = 0;
+	}
+
+	for (d = 0; d < work_dim; ++d) {
+		global[d] = (0 != local[0]) ? COMPUTE_GLOBAL_SIZE(global_work_size[d], local[d]) : global_work_size[d];
+	}
+	return clut_enqueueNDRangeKernel(command_queue, kernel, work_dim, global_work_offset, global,
+					 (0 != local[0]) ? local : NULL,
+					 n_wait, wait_list, event);
+}
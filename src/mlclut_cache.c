@@ -0,0 +1,281 @@
+/**
+ * @file
+ * @author Michele Laurenti
+ * @language c
+ *
+ * Persistent per device text cache, see mlclut_cache.h.
+ *
+ * Entries are kept in a list, newest first, so a lookup finds the latest
+ * value of a key.
+ */
+
+#include "mlclut_cache.h"
+#include "mlclut_descriptions.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <Debug.h>
+#include <StringUtils.h>
+
+#define MAX_NAME		256
+#define MAX_LINE		(CLUT_CACHE_MAX_KEY + CLUT_CACHE_MAX_VALUE)
+
+struct clut_cache_entry {
+	char *key;
+	char value[CLUT_CACHE_MAX_VALUE];
+	struct clut_cache_entry *next;
+};
+
+/**
+ * Function declaration
+ */
+
+static void clut_cacheClear(clut_cache *cache);
+static void clut_cacheLoad(clut_cache *cache);
+static struct clut_cache_entry * clut_cacheFind(clut_cache *cache, const char *key);
+static struct clut_cache_entry * clut_cacheAdd(clut_cache *cache, const char *key, const char *value);
+
+/**
+ * Function definition
+ */
+
+/*!
+ * @function clut_getDeviceKey
+ * Writes "name / driver version" of [device] to [key], [size] bytes long
+ * (CLUT_CACHE_DEVICE_KEY is enough), with tabs and newlines blanked so it
+ * can be a field of a cache line.
+ * @return
+ * 0 on success, a negative value on failure.
+ */
+int clut_getDeviceKey(cl_device_id device, char *key, size_t size)
+{
+	char name[MAX_NAME], version[MAX_NAME];
+	char *c;
+
+	if ((NULL == device) || (NULL == key) || (0 == size) ||
+	    !clut_returnSuccess(clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(name), name, NULL)) ||
+	    !clut_returnSuccess(clGetDeviceInfo(device, CL_DRIVER_VERSION, sizeof(version), version, NULL))) {
+		return -1;
+	}
+	name[MAX_NAME - 1] = version[MAX_NAME - 1] = '\0';
+	snprintf(key, size, "%s / %s", name, version);
+	/* keep the file format parseable */
+	for (c = key; '\0' != *c; ++c) {
+		if (('\t' == *c) || ('\n' == *c)) {
+			*c = ' ';
+		}
+	}
+	return 0;
+}
+
+/*!
+ * @function clut_cacheClear
+ * Forgets all values in memory and the cache file name.
+ * Must be called with the lock held.
+ */
+static void clut_cacheClear(clut_cache *cache)
+{
+	struct clut_cache_entry *entry, *next;
+
+	for (entry = cache->entries; NULL != entry; entry = next) {
+		next = entry->next;
+		free(entry->key);
+		free(entry);
+	}
+	cache->entries = NULL;
+	free(cache->file);
+	cache->file = NULL;
+	cache->loaded = 0;
+}
+
+/*!
+ * @function clut_setCacheFile
+ * Makes [cache] load and store its values in [filename], instead of the
+ * file named by its environment variable. NULL keeps values in memory only.
+ * Values in memory are discarded.
+ */
+void clut_setCacheFile(clut_cache *cache, const char * const filename)
+{
+	pthread_mutex_lock(&cache->lock);
+	clut_cacheClear(cache);
+	if (NULL != filename) {
+		cache->file = StringUtils_clone(filename);
+	}
+	cache->explicit_file = 1;
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/*!
+ * @function clut_releaseCache
+ * Forgets all values in memory, and any file set with clut_setCacheFile.
+ * The cache file is left untouched.
+ */
+void clut_releaseCache(clut_cache *cache)
+{
+	pthread_mutex_lock(&cache->lock);
+	clut_cacheClear(cache);
+	cache->explicit_file = 0;
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/*!
+ * @function clut_cacheFind
+ * Returns the latest entry of [key], NULL if none.
+ * Must be called with the lock held.
+ */
+static struct clut_cache_entry * clut_cacheFind(clut_cache *cache, const char *key)
+{
+	struct clut_cache_entry *entry;
+
+	for (entry = cache->entries; NULL != entry; entry = entry->next) {
+		if (0 == strcmp(entry->key, key)) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/*!
+ * @function clut_cacheAdd
+ * Puts a new entry for [key] at the head of the list.
+ * Must be called with the lock held.
+ * @return
+ * The entry, NULL on failure.
+ */
+static struct clut_cache_entry * clut_cacheAdd(clut_cache *cache, const char *key, const char *value)
+{
+	struct clut_cache_entry *entry;
+
+	entry = malloc(sizeof(struct clut_cache_entry));
+	if (NULL == entry) {
+		return NULL;
+	}
+	entry->key = StringUtils_clone(key);
+	if (NULL == entry->key) {
+		free(entry);
+		return NULL;
+	}
+	snprintf(entry->value, sizeof(entry->value), "%s", value);
+	entry->next = cache->entries;
+	cache->entries = entry;
+	return entry;
+}
+
+/*!
+ * @function clut_cacheLoad
+ * Loads the cache file, the first time. Must be called with the lock held.
+ */
+static void clut_cacheLoad(clut_cache *cache)
+{
+	const char * const fname = "clut_cacheLoad";
+	char line[MAX_LINE], *value;
+	const char *env;
+	size_t n_loaded = 0, length;
+	FILE *f;
+
+	if (cache->loaded) {
+		return;
+	}
+	cache->loaded = 1;
+
+	if ((NULL == cache->file) && !cache->explicit_file) {
+		env = getenv(cache->env);
+		if ((NULL == env) || ('\0' == env[0])) {
+			return;
+		}
+		cache->file = StringUtils_clone(env);
+	}
+	if (NULL == cache->file) {
+		return;
+	}
+
+	f = fopen(cache->file, "r");
+	if (NULL == f) {
+		return;
+	}
+	while (NULL != fgets(line, sizeof(line), f)) {
+		length = strcspn(line, "\n");
+		if (('\n' != line[length]) && !feof(f)) {
+			/* too long: skip the rest of it */
+			while ((NULL != fgets(line, sizeof(line), f)) && (NULL == strchr(line, '\n')));
+			continue;
+		}
+		line[length] = '\0';
+		value = strrchr(line, '\t');
+		if (('#' == line[0]) || (NULL == value) || (value - line >= CLUT_CACHE_MAX_KEY) ||
+		    (strlen(value + 1) >= CLUT_CACHE_MAX_VALUE)) {
+			continue;
+		}
+		*value++ = '\0';
+		if (NULL == clut_cacheAdd(cache, line, value)) {
+			break;
+		}
+		++n_loaded;
+	}
+	fclose(f);
+
+	Debug_out(cache->debug, "%s: loaded %zu entries from '%s'.\n", fname, n_loaded, cache->file);
+}
+
+/*!
+ * @function clut_cacheLookup
+ * Copies the value of [key] to [value], [size] bytes long, loading the
+ * cache file the first time.
+ * @return
+ * 1 if found, 0 if not.
+ */
+int clut_cacheLookup(clut_cache *cache, const char *key, char *value, size_t size)
+{
+	struct clut_cache_entry *entry;
+	int found = 0;
+
+	pthread_mutex_lock(&cache->lock);
+	clut_cacheLoad(cache);
+	entry = clut_cacheFind(cache, key);
+	if (NULL != entry) {
+		snprintf(value, size, "%s", entry->value);
+		found = 1;
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	return found;
+}
+
+/*!
+ * @function clut_cacheStore
+ * Sets the value of [key] in memory, and appends it to the cache file.
+ * Keys must not end with a tab, nor values contain one.
+ */
+void clut_cacheStore(clut_cache *cache, const char *key, const char *value)
+{
+	const char * const fname = "clut_cacheStore";
+	struct clut_cache_entry *entry;
+	FILE *f;
+
+	if ((strlen(key) >= CLUT_CACHE_MAX_KEY) || (strlen(value) >= CLUT_CACHE_MAX_VALUE)) {
+		Debug_out(cache->debug, "%s: key or value too long.\n", fname);
+		return;
+	}
+
+	pthread_mutex_lock(&cache->lock);
+	clut_cacheLoad(cache);
+	entry = clut_cacheFind(cache, key);
+	if (NULL != entry) {
+		snprintf(entry->value, sizeof(entry->value), "%s", value);
+	} else if (NULL == clut_cacheAdd(cache, key, value)) {
+		Debug_out(cache->debug, "%s: malloc failed.\n", fname);
+	}
+
+	if (NULL != cache->file) {
+		f = fopen(cache->file, "a");
+		if (NULL == f) {
+			Debug_out(cache->debug, "%s: unable to open '%s'.\n", fname, cache->file);
+		} else {
+			fprintf(f, "%s\t%s\n", key, value);
+			fclose(f);
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
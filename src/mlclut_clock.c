@@ -0,0 +1,299 @@
+/**
+ * @file
+ * @author Michele Laurenti
+ * @language c
+ *
+ * Host/device clock correlation.
+ *
+ * A sample enqueues a marker behind a user event, reads the host clock, and
+ * completes the user event: the marker cannot start before that host
+ * timestamp, so (marker START - host timestamp) is an upper bound of the
+ * offset between the two clocks, and the smallest bound of a few samples is
+ * the estimate. The estimate is extrapolated with the drift measured between
+ * the first and the latest calibration.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "mlclut_clock.h"
+#include "mlclut_descriptions.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <Debug.h>
+
+#define DEBUG_CLOCK	"mlclut_debug_clock"
+
+#define CALIBRATION_SAMPLES	8
+#define DEFAULT_REFRESH_MS	1000
+
+struct clut_clock {
+	cl_command_queue queue;
+	cl_context context;
+	cl_device_id device;
+	cl_ulong refresh_ns;
+	unsigned int n_calibrations;
+	cl_ulong first_host;
+	cl_long first_offset;
+	cl_ulong last_host;
+	cl_long last_offset;
+	double drift;
+	pthread_mutex_t lock;
+};
+
+/**
+ * Function declaration
+ */
+
+static int clut_clockSample(clut_clock *clock, cl_ulong *host, cl_long *offset);
+
+/**
+ * Function definition
+ */
+
+/*!
+ * @function clut_getHostTime_ns
+ * Returns the host CLOCK_MONOTONIC time, in nanoseconds.
+ */
+cl_ulong clut_getHostTime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (cl_ulong) ts.tv_sec * 1000000000ULL + (cl_ulong) ts.tv_nsec;
+}
+
+/*!
+ * @function clut_createClock
+ * Creates a clock for the device of [command_queue], which must have been
+ * created with CL_QUEUE_PROFILING_ENABLE, and calibrates it.
+ * @param refresh_ms
+ * Minimum time between calibrations done by clut_clockUpdate, 0 for the default.
+ * @warning Result should be released with clut_releaseClock.
+ */
+clut_clock * clut_createClock(cl_command_queue command_queue, unsigned int refresh_ms)
+{
+	const char * const fname = "clut_createClock";
+	clut_clock *clock;
+	cl_int ret;
+
+	clock = calloc(1, sizeof(clut_clock));
+	if (NULL == clock) {
+		Debug_out(DEBUG_CLOCK, "%s: calloc failed.\n", fname);
+		goto error1;
+	}
+
+	ret = clGetCommandQueueInfo(command_queue, CL_QUEUE_CONTEXT, sizeof(clock->context), &clock->context, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to get queue context", error2);
+	clock->device = clut_getQueueDevice(command_queue);
+	if (NULL == clock->device) {
+		goto error2;
+	}
+	ret = clRetainCommandQueue(command_queue);
+	CLUT_CHECK_ERROR(ret, "Unable to retain command queue", error2);
+	clock->queue = command_queue;
+	clock->refresh_ns = (cl_ulong) ((0 != refresh_ms) ? refresh_ms : DEFAULT_REFRESH_MS) * 1000000ULL;
+	pthread_mutex_init(&clock->lock, NULL);
+
+	if (0 != clut_clockCalibrate(clock)) {
+		Debug_out(DEBUG_CLOCK, "%s: calibration failed.\n", fname);
+		goto error3;
+	}
+
+	return clock;
+
+error3:	pthread_mutex_destroy(&clock->lock);
+	clReleaseCommandQueue(clock->queue);
+error2:	free(clock);
+error1:	return NULL;
+}
+
+/*!
+ * @function clut_releaseClock
+ * Releases [clock].
+ */
+void clut_releaseClock(clut_clock *clock)
+{
+	if (NULL == clock) {
+		return;
+	}
+	clReleaseCommandQueue(clock->queue);
+	pthread_mutex_destroy(&clock->lock);
+	free(clock);
+}
+
+/*!
+ * @function clut_clockSample
+ * Takes one sample: stores the host time at which a marker was released in
+ * [host], and (marker START - host time) in [offset].
+ * @return
+ * 0 on success, a negative value on failure.
+ */
+static int clut_clockSample(clut_clock *clock, cl_ulong *host, cl_long *offset)
+{
+	cl_event user, marker = NULL;
+	cl_ulong t0, start;
+	cl_int ret;
+
+	user = clCreateUserEvent(clock->context, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create user event", error1);
+	ret = clEnqueueMarkerWithWaitList(clock->queue, 1, &user, &marker);
+	CLUT_CHECK_ERROR(ret, "Unable to enqueue marker", error2);
+	clFlush(clock->queue);
+
+	t0 = clut_getHostTime_ns();
+	ret = clSetUserEventStatus(user, CL_COMPLETE);
+	CLUT_CHECK_ERROR(ret, "Unable to complete user event", error3);
+	ret = clWaitForEvents(1, &marker);
+	CLUT_CHECK_ERROR(ret, "Unable to wait for marker", error3);
+	ret = clGetEventProfilingInfo(marker, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to get marker start time", error3);
+
+	clReleaseEvent(marker);
+	clReleaseEvent(user);
+
+	if (0 == start) {
+		/* some platforms don't timestamp markers */
+		return -1;
+	}
+	*host = t0;
+	*offset = (cl_long) (start - t0);
+	return 0;
+
+error3:	clReleaseEvent(marker);
+error2:	clSetUserEventStatus(user, CL_COMPLETE);
+	clReleaseEvent(user);
+error1:	return -1;
+}
+
+/*!
+ * @function clut_clockCalibrate
+ * Measures the offset between the device and host clocks now, and updates
+ * the drift estimate.
+ * @return
+ * 0 on success, a negative value on failure.
+ */
+int clut_clockCalibrate(clut_clock *clock)
+{
+	const char * const fname = "clut_clockCalibrate";
+	cl_ulong host, best_host = 0;
+	cl_long offset, best_offset = 0;
+	unsigned int i, n = 0;
+
+	for (i = 0; i < CALIBRATION_SAMPLES; ++i) {
+		if (0 != clut_clockSample(clock, &host, &offset)) {
+			continue;
+		}
+		if ((0 == n) || (offset < best_offset)) {
+			best_offset = offset;
+			best_host = host;
+		}
+		++n;
+	}
+	if (0 == n) {
+		Debug_out(DEBUG_CLOCK, "%s: no valid sample.\n", fname);
+		return -1;
+	}
+
+	pthread_mutex_lock(&clock->lock);
+	if (0 == clock->n_calibrations) {
+		clock->first_host = best_host;
+		clock->first_offset = best_offset;
+	} else if (best_host > clock->first_host) {
+		clock->drift = (double) (best_offset - clock->first_offset) / (double) (best_host - clock->first_host);
+	}
+	clock->last_host = best_host;
+	clock->last_offset = best_offset;
+	clock->n_calibrations++;
+	pthread_mutex_unlock(&clock->lock);
+
+	Debug_out(DEBUG_CLOCK, "%s: offset %lld ns, drift %g, from %u samples.\n",
+		  fname, (long long) best_offset, clock->drift, n);
+
+	return 0;
+}
+
+/*!
+ * @function clut_clockUpdate
+ * Calibrates [clock] again if its last calibration is older than its refresh
+ * period. Meant to be called often, e.g. once per frame.
+ * @return
+ * 0 on success (or if no calibration was due), a negative value on failure.
+ */
+int clut_clockUpdate(clut_clock *clock)
+{
+	cl_ulong last;
+
+	pthread_mutex_lock(&clock->lock);
+	last = clock->last_host;
+	pthread_mutex_unlock(&clock->lock);
+
+	if (clut_getHostTime_ns() - last < clock->refresh_ns) {
+		return 0;
+	}
+	return clut_clockCalibrate(clock);
+}
+
+/*!
+ * @function clut_clockGetDevice
+ * Returns the device of [clock].
+ */
+cl_device_id clut_clockGetDevice(const clut_clock *clock)
+{
+	return clock->device;
+}
+
+/*!
+ * @function clut_clockGetEstimate
+ * Stores the latest offset (device - host, in ns) and drift (ns per ns) of
+ * [clock] in [offset_ns] and [drift]. Either can be NULL.
+ */
+void clut_clockGetEstimate(clut_clock *clock, cl_long *offset_ns, double *drift)
+{
+	pthread_mutex_lock(&clock->lock);
+	if (NULL != offset_ns) {
+		*offset_ns = clock->last_offset;
+	}
+	if (NULL != drift) {
+		*drift = clock->drift;
+	}
+	pthread_mutex_unlock(&clock->lock);
+}
+
+/*!
+ * @function clut_clockDeviceToHost
+ * Converts the device timestamp [device_ns] to host CLOCK_MONOTONIC time.
+ */
+cl_ulong clut_clockDeviceToHost(clut_clock *clock, cl_ulong device_ns)
+{
+	cl_long elapsed;
+	cl_ulong host;
+
+	pthread_mutex_lock(&clock->lock);
+	/* device = host + offset + drift * (host - last_host), solved for host */
+	elapsed = (cl_long) (device_ns - clock->last_host) - clock->last_offset;
+	host = clock->last_host + (cl_ulong) (cl_long) ((double) elapsed / (1.0 + clock->drift));
+	pthread_mutex_unlock(&clock->lock);
+
+	return host;
+}
+
+/*!
+ * @function clut_clockHostToDevice
+ * Converts the host CLOCK_MONOTONIC time [host_ns] to a device timestamp.
+ */
+cl_ulong clut_clockHostToDevice(clut_clock *clock, cl_ulong host_ns)
+{
+	cl_long elapsed;
+	cl_ulong device;
+
+	pthread_mutex_lock(&clock->lock);
+	elapsed = (cl_long) (host_ns - clock->last_host);
+	device = host_ns + (cl_ulong) (clock->last_offset + (cl_long) (clock->drift * (double) elapsed));
+	pthread_mutex_unlock(&clock->lock);
+
+	return device;
+}
@@ -0,0 +1,588 @@
+/**
+ * @file
+ * @author Michele Laurenti
+ * @language c
+ *
+ * On-device pixel format conversions. The kernels are embedded in the
+ * library and built once per context through clut_getCachedProgram, so a
+ * conversion costs a single kernel launch and no host round trip.
+ */
+
+#include "mlclut_convert.h"
+#include "mlclut_interpose.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <Debug.h>
+#include <ArrayUtils.h>
+
+#define DEBUG_CONVERT	"mlclut_debug_convert"
+
+/*!
+ Embedded kernels
+ */
+
+static const char *convert_sources[] =
+{
+	"#define ROW(base,pitch,y,type)	((__global type *) ((__global uchar *) (base) + (size_t) (y) * (pitch)))\n"
+	"\n"
+	"__constant sampler_t clut_nearest = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_NONE | CLK_FILTER_NEAREST;\n"
+	"\n"
+	"__kernel void clut_u8_to_float(__global const uchar *src, const uint src_pitch,\n"
+	"			       __global float *dst, const uint dst_pitch)\n"
+	"{\n"
+	"	const size_t x = get_global_id(0), y = get_global_id(1);\n"
+	"	ROW(dst, dst_pitch, y, float)[x] = ROW(src, src_pitch, y, const uchar)[x] * (1.0f / 255.0f);\n"
+	"}\n"
+	"\n"
+	"__kernel void clut_float_to_u8(__global const float *src, const uint src_pitch,\n"
+	"			       __global uchar *dst, const uint dst_pitch)\n"
+	"{\n"
+	"	const size_t x = get_global_id(0), y = get_global_id(1);\n"
+	"	ROW(dst, dst_pitch, y, uchar)[x] = convert_uchar_sat_rte(ROW(src, src_pitch, y, const float)[x] * 255.0f);\n"
+	"}\n"
+	"\n"
+	"__kernel void clut_rgba_to_gray(__global const uchar *src, const uint src_pitch, const uint src_components,\n"
+	"				__global uchar *dst, const uint dst_pitch, const float4 weights)\n"
+	"{\n"
+	"	const size_t x = get_global_id(0), y = get_global_id(1);\n"
+	"	__global const uchar *p = ROW(src, src_pitch, y, const uchar) + x * src_components;\n"
+	"	const float g = weights.x * p[0] + weights.y * p[1] + weights.z * p[2];\n"
+	"	ROW(dst, dst_pitch, y, uchar)[x] = convert_uchar_sat_rte(g);\n"
+	"}\n"
+	"\n"
+	"__kernel void clut_swizzle(__global const uchar *src, const uint src_pitch, const uint src_components,\n"
+	"			   __global uchar *dst, const uint dst_pitch, const uint dst_components,\n"
+	"			   const uchar4 map)\n"
+	"{\n"
+	"	const size_t x = get_global_id(0), y = get_global_id(1);\n"
+	"	__global const uchar *p = ROW(src, src_pitch, y, const uchar) + x * src_components;\n"
+	"	__global uchar *q = ROW(dst, dst_pitch, y, uchar) + x * dst_components;\n"
+	"	const uchar m[4] = {map.s0, map.s1, map.s2, map.s3};\n"
+	"	uint c;\n"
+	"	for (c = 0; c < dst_components; ++c) {\n"
+	"		q[c] = (0xFF == m[c]) ? 255 : p[m[c]];\n"
+	"	}\n"
+	"}\n",
+
+	"__kernel void clut_interleaved_to_planar(__global const uchar *src, const uint src_pitch, const uint components,\n"
+	"					 __global float *dst, const uint dst_pitch, const uint height)\n"
+	"{\n"
+	"	const size_t x = get_global_id(0), y = get_global_id(1);\n"
+	"	__global const uchar *p = ROW(src, src_pitch, y, const uchar) + x * components;\n"
+	"	uint c;\n"
+	"	for (c = 0; c < components; ++c) {\n"
+	"		ROW(dst, dst_pitch, c * height + y, float)[x] = p[c] * (1.0f / 255.0f);\n"
+	"	}\n"
+	"}\n"
+	"\n"
+	"__kernel void clut_planar_to_interleaved(__global const float *src, const uint src_pitch, const uint height,\n"
+	"					 __global uchar *dst, const uint dst_pitch, const uint components)\n"
+	"{\n"
+	"	const size_t x = get_global_id(0), y = get_global_id(1);\n"
+	"	__global uchar *q = ROW(dst, dst_pitch, y, uchar) + x * components;\n"
+	"	uint c;\n"
+	"	for (c = 0; c < components; ++c) {\n"
+	"		q[c] = convert_uchar_sat_rte(ROW(src, src_pitch, c * height + y, const float)[x] * 255.0f);\n"
+	"	}\n"
+	"}\n"
+	"\n"
+	"#define STORE_PIXEL(q,u,map,components)	\\\n"
+	"	do { \\\n"
+	"		const uchar a[4] = {(u).s0, (u).s1, (u).s2, (u).s3}; \\\n"
+	"		const uchar m[4] = {(map).s0, (map).s1, (map).s2, (map).s3}; \\\n"
+	"		uint c; \\\n"
+	"		for (c = 0; c < (components); ++c) { \\\n"
+	"			(q)[c] = a[m[c]]; \\\n"
+	"		} \\\n"
+	"	} while (0)\n"
+	"\n"
+	"__kernel void clut_image_f_to_u8(__read_only image2d_t src,\n"
+	"				 __global uchar *dst, const uint dst_pitch, const uint components,\n"
+	"				 const uchar4 map)\n"
+	"{\n"
+	"	const int x = get_global_id(0), y = get_global_id(1);\n"
+	"	const uchar4 u = convert_uchar4_sat_rte(read_imagef(src, clut_nearest, (int2) (x, y)) * 255.0f);\n"
+	"	STORE_PIXEL(ROW(dst, dst_pitch, y, uchar) + x * components, u, map, components);\n"
+	"}\n"
+	"\n"
+	"__kernel void clut_image_ui_to_u8(__read_only image2d_t src,\n"
+	"				  __global uchar *dst, const uint dst_pitch, const uint components,\n"
+	"				  const uchar4 map)\n"
+	"{\n"
+	"	const int x = get_global_id(0), y = get_global_id(1);\n"
+	"	const uchar4 u = convert_uchar4_sat(read_imageui(src, clut_nearest, (int2) (x, y)));\n"
+	"	STORE_PIXEL(ROW(dst, dst_pitch, y, uchar) + x * components, u, map, components);\n"
+	"}\n"
+	"\n"
+	"__kernel void clut_image_i_to_u8(__read_only image2d_t src,\n"
+	"				 __global uchar *dst, const uint dst_pitch, const uint components,\n"
+	"				 const uchar4 map)\n"
+	"{\n"
+	"	const int x = get_global_id(0), y = get_global_id(1);\n"
+	"	const uchar4 u = convert_uchar4_sat(read_imagei(src, clut_nearest, (int2) (x, y)));\n"
+	"	STORE_PIXEL(ROW(dst, dst_pitch, y, uchar) + x * components, u, map, components);\n"
+	"}\n",
+};
+
+const cl_uchar clut_swizzle_RGBA_to_BGRA[4] = {2, 1, 0, 3};
+const cl_uchar clut_swizzle_RGB_to_RGBA[4] = {0, 1, 2, CLUT_SWIZZLE_ONE};
+const cl_uchar clut_swizzle_RGBA_to_RGB[4] = {0, 1, 2, 0};
+
+/**
+ * Function declaration
+ */
+
+static cl_kernel clut_getConvertKernel(cl_command_queue command_queue, const char * const name);
+static cl_int clut_enqueueConvertKernel(cl_command_queue command_queue, cl_kernel kernel,
+					size_t width, size_t height,
+					cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+
+/**
+ * Function definition
+ */
+
+/*!
+ * @function clut_getConvertKernel
+ * Acquires the conversion kernel [name] for the context of [command_queue],
+ * building the embedded program the first time.
+ * @warning Result should be given back with clut_releaseCachedKernel.
+ */
+static cl_kernel clut_getConvertKernel(cl_command_queue command_queue, const char * const name)
+{
+	const char * const fname = "clut_getConvertKernel";
+	cl_context context;
+	cl_kernel kernel;
+	cl_int ret;
+
+	ret = clGetCommandQueueInfo(command_queue, CL_QUEUE_CONTEXT, sizeof(context), &context, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to get queue context", error);
+
+	kernel = clut_acquireCachedKernel(context, ARRAY_LEN(convert_sources), convert_sources, NULL, name);
+	if (NULL == kernel) {
+		Debug_out(DEBUG_CONVERT, "%s: unable to get conversion kernel '%s'.\n", fname, name);
+		goto error;
+	}
+
+	return kernel;
+
+error:	return NULL;
+}
+
+/*!
+ * @function clut_enqueueConvertKernel
+ * Launches [kernel] over a [width] x [height] grid, then gives it back.
+ */
+static cl_int clut_enqueueConvertKernel(cl_command_queue command_queue, cl_kernel kernel,
+					size_t width, size_t height,
+					cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	const size_t global[2] = {width, height};
+	cl_int ret;
+
+	ret = clut_enqueueNDRangeKernel(command_queue, kernel, 2, NULL, global, NULL, n_wait, wait_list, event);
+	clut_releaseCachedKernel(kernel);
+	return ret;
+}
+
+/*!
+ * @function clut_setBufferArgs
+ * Sets the (buffer, row pitch) pair shared by all buffer kernels as arguments
+ * [index] and [index] + 1.
+ */
+static cl_int clut_setBufferArgs(cl_kernel kernel,
+				 cl_uint index, cl_mem *buffer, const clut_image_desc *desc)
+{
+	cl_uint pitch = (cl_uint) desc->row_pitch;
+	cl_int ret;
+
+	ret = clSetKernelArg(kernel, index, sizeof(cl_mem), buffer);
+	if (!clut_returnSuccess(ret)) {
+		return ret;
+	}
+	return clSetKernelArg(kernel, index + 1, sizeof(cl_uint), &pitch);
+}
+
+/*!
+ * @function clut_checkDescs
+ * Checks that [src_desc] and [dst_desc] are buffers of the same size, with
+ * the expected channel types.
+ */
+static int clut_checkDescs(const char * const fname,
+			   const clut_image_desc *src_desc, cl_channel_type src_type,
+			   const clut_image_desc *dst_desc, cl_channel_type dst_type)
+{
+	if ((NULL == src_desc) || (NULL == dst_desc)) {
+		Debug_out(DEBUG_CONVERT, "%s: NULL pointer argument.\n", fname);
+		return 0;
+	}
+	if ((CL_MEM_OBJECT_BUFFER != dst_desc->storage) ||
+	    (src_desc->width != dst_desc->width) ||
+	    (src_desc->height != dst_desc->height)) {
+		Debug_out(DEBUG_CONVERT, "%s: destination doesn't match source.\n", fname);
+		return 0;
+	}
+	if ((src_type != src_desc->channel_type) || (dst_type != dst_desc->channel_type)) {
+		Debug_out(DEBUG_CONVERT, "%s: unsupported conversion from '%s' to '%s'.\n",
+			  fname,
+			  clut_get_CL_CHANNEL_TYPE_Description(src_desc->channel_type),
+			  clut_get_CL_CHANNEL_TYPE_Description(dst_desc->channel_type));
+		return 0;
+	}
+	return 1;
+}
+
+/*!
+ * @function clut_convertU8ToFloat
+ * Converts an 8 bit buffer to a float buffer with the same number of
+ * components, normalizing to [0, 1].
+ */
+cl_int clut_convertU8ToFloat(cl_command_queue command_queue,
+			     cl_mem src, const clut_image_desc *src_desc,
+			     cl_mem dst, const clut_image_desc *dst_desc,
+			     cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	const char * const fname = "clut_convertU8ToFloat";
+	cl_kernel kernel;
+	cl_int ret = CL_INVALID_VALUE;
+
+	if (!clut_checkDescs(fname, src_desc, CL_UNSIGNED_INT8, dst_desc, CL_FLOAT) ||
+	    (src_desc->components != dst_desc->components)) {
+		goto error;
+	}
+
+	kernel = clut_getConvertKernel(command_queue, "clut_u8_to_float");
+	if (NULL == kernel) {
+		ret = CL_INVALID_KERNEL_NAME;
+		goto error;
+	}
+	if (!clut_returnSuccess(ret = clut_setBufferArgs(kernel, 0, &src, src_desc)) ||
+	    !clut_returnSuccess(ret = clut_setBufferArgs(kernel, 2, &dst, dst_desc))) {
+		clut_releaseCachedKernel(kernel);
+		goto error;
+	}
+
+	return clut_enqueueConvertKernel(command_queue, kernel,
+					 src_desc->width * src_desc->components, src_desc->height,
+					 n_wait, wait_list, event);
+
+error:	return ret;
+}
+
+/*!
+ * @function clut_convertFloatToU8
+ * Converts a float buffer in [0, 1] to an 8 bit buffer with the same number
+ * of components, clamping out of range values.
+ */
+cl_int clut_convertFloatToU8(cl_command_queue command_queue,
+			     cl_mem src, const clut_image_desc *src_desc,
+			     cl_mem dst, const clut_image_desc *dst_desc,
+			     cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	const char * const fname = "clut_convertFloatToU8";
+	cl_kernel kernel;
+	cl_int ret = CL_INVALID_VALUE;
+
+	if (!clut_checkDescs(fname, src_desc, CL_FLOAT, dst_desc, CL_UNSIGNED_INT8) ||
+	    (src_desc->components != dst_desc->components)) {
+		goto error;
+	}
+
+	kernel = clut_getConvertKernel(command_queue, "clut_float_to_u8");
+	if (NULL == kernel) {
+		ret = CL_INVALID_KERNEL_NAME;
+		goto error;
+	}
+	if (!clut_returnSuccess(ret = clut_setBufferArgs(kernel, 0, &src, src_desc)) ||
+	    !clut_returnSuccess(ret = clut_setBufferArgs(kernel, 2, &dst, dst_desc))) {
+		clut_releaseCachedKernel(kernel);
+		goto error;
+	}
+
+	return clut_enqueueConvertKernel(command_queue, kernel,
+					 src_desc->width * src_desc->components, src_desc->height,
+					 n_wait, wait_list, event);
+
+error:	return ret;
+}
+
+/*!
+ * @function clut_convertRGBAToGray
+ * Converts an 8 bit RGB, RGBA or BGRA buffer to a single channel 8 bit
+ * buffer, with Rec. 601 luma weights.
+ */
+cl_int clut_convertRGBAToGray(cl_command_queue command_queue,
+			      cl_mem src, const clut_image_desc *src_desc,
+			      cl_mem dst, const clut_image_desc *dst_desc,
+			      cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	const char * const fname = "clut_convertRGBAToGray";
+	cl_kernel kernel;
+	cl_int ret = CL_INVALID_VALUE;
+	cl_uint src_components;
+	cl_float4 weights = {{0.299f, 0.587f, 0.114f, 0.0f}};
+
+	if (!clut_checkDescs(fname, src_desc, CL_UNSIGNED_INT8, dst_desc, CL_UNSIGNED_INT8) ||
+	    (3 > src_desc->components) || (1 != dst_desc->components)) {
+		goto error;
+	}
+	if (CL_BGRA == src_desc->channel_order) {
+		weights.s[0] = 0.114f;
+		weights.s[2] = 0.299f;
+	}
+	src_components = src_desc->components;
+
+	kernel = clut_getConvertKernel(command_queue, "clut_rgba_to_gray");
+	if (NULL == kernel) {
+		ret = CL_INVALID_KERNEL_NAME;
+		goto error;
+	}
+	if (!clut_returnSuccess(ret = clut_setBufferArgs(kernel, 0, &src, src_desc)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 2, sizeof(cl_uint), &src_components)) ||
+	    !clut_returnSuccess(ret = clut_setBufferArgs(kernel, 3, &dst, dst_desc)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 5, sizeof(cl_float4), &weights))) {
+		clut_releaseCachedKernel(kernel);
+		goto error;
+	}
+
+	return clut_enqueueConvertKernel(command_queue, kernel,
+					 src_desc->width, src_desc->height,
+					 n_wait, wait_list, event);
+
+error:	return ret;
+}
+
+/*!
+ * @function clut_convertSwizzle
+ * Reorders the channels of an 8 bit buffer. Channel c of [dst] is channel
+ * map[c] of [src], or the maximum value if map[c] is CLUT_SWIZZLE_ONE. This
+ * covers RGB <-> RGBA and RGBA <-> BGRA, among others.
+ */
+cl_int clut_convertSwizzle(cl_command_queue command_queue,
+			   cl_mem src, const clut_image_desc *src_desc,
+			   cl_mem dst, const clut_image_desc *dst_desc,
+			   const cl_uchar map[4],
+			   cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	const char * const fname = "clut_convertSwizzle";
+	cl_kernel kernel;
+	cl_int ret = CL_INVALID_VALUE;
+	cl_uint src_components, dst_components;
+	cl_uchar4 l_map;
+	int i;
+
+	if (!clut_checkDescs(fname, src_desc, CL_UNSIGNED_INT8, dst_desc, CL_UNSIGNED_INT8) ||
+	    (NULL == map) || (4 < dst_desc->components)) {
+		goto error;
+	}
+	for (i = 0; i < dst_desc->components; ++i) {
+		if ((CLUT_SWIZZLE_ONE != map[i]) && (map[i] >= src_desc->components)) {
+			Debug_out(DEBUG_CONVERT, "%s: channel %d is out of range.\n", fname, map[i]);
+			goto error;
+		}
+	}
+	memcpy(l_map.s, map, sizeof(l_map.s));
+	src_components = src_desc->components;
+	dst_components = dst_desc->components;
+
+	kernel = clut_getConvertKernel(command_queue, "clut_swizzle");
+	if (NULL == kernel) {
+		ret = CL_INVALID_KERNEL_NAME;
+		goto error;
+	}
+	if (!clut_returnSuccess(ret = clut_setBufferArgs(kernel, 0, &src, src_desc)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 2, sizeof(cl_uint), &src_components)) ||
+	    !clut_returnSuccess(ret = clut_setBufferArgs(kernel, 3, &dst, dst_desc)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 5, sizeof(cl_uint), &dst_components)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 6, sizeof(cl_uchar4), &l_map))) {
+		clut_releaseCachedKernel(kernel);
+		goto error;
+	}
+
+	return clut_enqueueConvertKernel(command_queue, kernel,
+					 src_desc->width, src_desc->height,
+					 n_wait, wait_list, event);
+
+error:	return ret;
+}
+
+/*!
+ * @function clut_convertInterleavedToPlanar
+ * Splits an interleaved 8 bit buffer into one normalized float plane per
+ * component. Rows of each plane are [dst_row_pitch] bytes apart, and plane c
+ * starts at byte c * height * dst_row_pitch.
+ */
+cl_int clut_convertInterleavedToPlanar(cl_command_queue command_queue,
+				       cl_mem src, const clut_image_desc *src_desc,
+				       cl_mem dst, size_t dst_row_pitch,
+				       cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	const char * const fname = "clut_convertInterleavedToPlanar";
+	cl_kernel kernel;
+	cl_int ret = CL_INVALID_VALUE;
+	cl_uint components, pitch, height;
+
+	if (NULL == src_desc) {
+		Debug_out(DEBUG_CONVERT, "%s: NULL pointer argument.\n", fname);
+		goto error;
+	}
+	if ((CL_UNSIGNED_INT8 != src_desc->channel_type) || (dst_row_pitch < src_desc->width * sizeof(cl_float))) {
+		Debug_out(DEBUG_CONVERT, "%s: invalid source or destination layout.\n", fname);
+		goto error;
+	}
+	components = src_desc->components;
+	pitch = (cl_uint) dst_row_pitch;
+	height = (cl_uint) src_desc->height;
+
+	kernel = clut_getConvertKernel(command_queue, "clut_interleaved_to_planar");
+	if (NULL == kernel) {
+		ret = CL_INVALID_KERNEL_NAME;
+		goto error;
+	}
+	if (!clut_returnSuccess(ret = clut_setBufferArgs(kernel, 0, &src, src_desc)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 2, sizeof(cl_uint), &components)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 3, sizeof(cl_mem), &dst)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 4, sizeof(cl_uint), &pitch)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 5, sizeof(cl_uint), &height))) {
+		clut_releaseCachedKernel(kernel);
+		goto error;
+	}
+
+	return clut_enqueueConvertKernel(command_queue, kernel,
+					 src_desc->width, src_desc->height,
+					 n_wait, wait_list, event);
+
+error:	return ret;
+}
+
+/*!
+ * @function clut_convertPlanarToInterleaved
+ * The inverse of clut_convertInterleavedToPlanar: merges dst_desc->components
+ * float planes into an interleaved 8 bit buffer, clamping out of range values.
+ */
+cl_int clut_convertPlanarToInterleaved(cl_command_queue command_queue,
+				       cl_mem src, size_t src_row_pitch,
+				       cl_mem dst, const clut_image_desc *dst_desc,
+				       cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	const char * const fname = "clut_convertPlanarToInterleaved";
+	cl_kernel kernel;
+	cl_int ret = CL_INVALID_VALUE;
+	cl_uint components, pitch, height;
+
+	if (NULL == dst_desc) {
+		Debug_out(DEBUG_CONVERT, "%s: NULL pointer argument.\n", fname);
+		goto error;
+	}
+	if ((CL_UNSIGNED_INT8 != dst_desc->channel_type) || (src_row_pitch < dst_desc->width * sizeof(cl_float))) {
+		Debug_out(DEBUG_CONVERT, "%s: invalid source or destination layout.\n", fname);
+		goto error;
+	}
+	components = dst_desc->components;
+	pitch = (cl_uint) src_row_pitch;
+	height = (cl_uint) dst_desc->height;
+
+	kernel = clut_getConvertKernel(command_queue, "clut_planar_to_interleaved");
+	if (NULL == kernel) {
+		ret = CL_INVALID_KERNEL_NAME;
+		goto error;
+	}
+	if (!clut_returnSuccess(ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), &src)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 1, sizeof(cl_uint), &pitch)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 2, sizeof(cl_uint), &height)) ||
+	    !clut_returnSuccess(ret = clut_setBufferArgs(kernel, 3, &dst, dst_desc)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 5, sizeof(cl_uint), &components))) {
+		clut_releaseCachedKernel(kernel);
+		goto error;
+	}
+
+	return clut_enqueueConvertKernel(command_queue, kernel,
+					 dst_desc->width, dst_desc->height,
+					 n_wait, wait_list, event);
+
+error:	return ret;
+}
+
+/*!
+ * @function clut_convertImageToU8
+ * Converts a cl_image of any channel type to an interleaved 8 bit buffer.
+ * Normalized and floating point channels are scaled from [0, 1], integer
+ * channels are clamped. Channels are written in the order of [src_desc],
+ * with CL_BGRA and CL_ARGB images converted to RGBA.
+ */
+cl_int clut_convertImageToU8(cl_command_queue command_queue,
+			     cl_mem image, const clut_image_desc *src_desc,
+			     cl_mem dst, const clut_image_desc *dst_desc,
+			     cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	const char * const fname = "clut_convertImageToU8";
+	const char *kernel_name;
+	cl_kernel kernel;
+	cl_int ret = CL_INVALID_VALUE;
+	cl_uint components;
+	/* read_image* always returns (r, g, b, a), with missing channels set to 0 */
+	cl_uchar4 map = {{0, 1, 2, 3}};
+
+	if ((NULL == src_desc) || (NULL == dst_desc)) {
+		Debug_out(DEBUG_CONVERT, "%s: NULL pointer argument.\n", fname);
+		goto error;
+	}
+	if ((CL_MEM_OBJECT_IMAGE2D != src_desc->storage) ||
+	    (CL_MEM_OBJECT_BUFFER != dst_desc->storage) ||
+	    (CL_UNSIGNED_INT8 != dst_desc->channel_type) ||
+	    (src_desc->components != dst_desc->components) ||
+	    (src_desc->width != dst_desc->width) ||
+	    (src_desc->height != dst_desc->height)) {
+		Debug_out(DEBUG_CONVERT, "%s: destination doesn't match source.\n", fname);
+		goto error;
+	}
+
+	switch (src_desc->channel_type) {
+		case CL_UNSIGNED_INT8:
+		case CL_UNSIGNED_INT16:
+		case CL_UNSIGNED_INT32:
+			kernel_name = "clut_image_ui_to_u8";
+			break;
+		case CL_SIGNED_INT8:
+		case CL_SIGNED_INT16:
+		case CL_SIGNED_INT32:
+			kernel_name = "clut_image_i_to_u8";
+			break;
+		default:
+			kernel_name = "clut_image_f_to_u8";
+			break;
+	}
+
+	switch (src_desc->channel_order) {
+		case CL_RA:
+			map.s[1] = 3;
+			break;
+		case CL_A:
+			map.s[0] = 3;
+			break;
+		default:
+			break;
+	}
+	components = src_desc->components;
+
+	kernel = clut_getConvertKernel(command_queue, kernel_name);
+	if (NULL == kernel) {
+		ret = CL_INVALID_KERNEL_NAME;
+		goto error;
+	}
+	if (!clut_returnSuccess(ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), &image)) ||
+	    !clut_returnSuccess(ret = clut_setBufferArgs(kernel, 1, &dst, dst_desc)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 3, sizeof(cl_uint), &components)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 4, sizeof(cl_uchar4), &map))) {
+		clut_releaseCachedKernel(kernel);
+		goto error;
+	}
+
+	return clut_enqueueConvertKernel(command_queue, kernel,
+					 src_desc->width, src_desc->height,
+					 n_wait, wait_list, event);
+
+error:	return ret;
+}
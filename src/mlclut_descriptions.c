@@ -1631,3 +1631,61 @@ const char * clut_get_CL_IMAGE_TYPE_Description(const cl_mem_object_type value)
 	}
 }
 
+
+const char * clut_get_CL_COMMAND_TYPE_Description(const cl_command_type value)
+{
+	switch (value) {
+		case CL_COMMAND_NDRANGE_KERNEL:
+			return "NDRANGE_KERNEL";
+		case CL_COMMAND_TASK:
+			return "TASK";
+		case CL_COMMAND_NATIVE_KERNEL:
+			return "NATIVE_KERNEL";
+		case CL_COMMAND_READ_BUFFER:
+			return "READ_BUFFER";
+		case CL_COMMAND_WRITE_BUFFER:
+			return "WRITE_BUFFER";
+		case CL_COMMAND_COPY_BUFFER:
+			return "COPY_BUFFER";
+		case CL_COMMAND_READ_IMAGE:
+			return "READ_IMAGE";
+		case CL_COMMAND_WRITE_IMAGE:
+			return "WRITE_IMAGE";
+		case CL_COMMAND_COPY_IMAGE:
+			return "COPY_IMAGE";
+		case CL_COMMAND_COPY_IMAGE_TO_BUFFER:
+			return "COPY_IMAGE_TO_BUFFER";
+		case CL_COMMAND_COPY_BUFFER_TO_IMAGE:
+			return "COPY_BUFFER_TO_IMAGE";
+		case CL_COMMAND_MAP_BUFFER:
+			return "MAP_BUFFER";
+		case CL_COMMAND_MAP_IMAGE:
+			return "MAP_IMAGE";
+		case CL_COMMAND_UNMAP_MEM_OBJECT:
+			return "UNMAP_MEM_OBJECT";
+		case CL_COMMAND_MARKER:
+			return "MARKER";
+		case CL_COMMAND_ACQUIRE_GL_OBJECTS:
+			return "ACQUIRE_GL_OBJECTS";
+		case CL_COMMAND_RELEASE_GL_OBJECTS:
+			return "RELEASE_GL_OBJECTS";
+		case CL_COMMAND_READ_BUFFER_RECT:
+			return "READ_BUFFER_RECT";
+		case CL_COMMAND_WRITE_BUFFER_RECT:
+			return "WRITE_BUFFER_RECT";
+		case CL_COMMAND_COPY_BUFFER_RECT:
+			return "COPY_BUFFER_RECT";
+		case CL_COMMAND_USER:
+			return "USER";
+		case CL_COMMAND_BARRIER:
+			return "BARRIER";
+		case CL_COMMAND_MIGRATE_MEM_OBJECTS:
+			return "MIGRATE_MEM_OBJECTS";
+		case CL_COMMAND_FILL_BUFFER:
+			return "FILL_BUFFER";
+		case CL_COMMAND_FILL_IMAGE:
+			return "FILL_IMAGE";
+		default:
+			return "UNKNOWN COMMAND TYPE";
+	}
+}
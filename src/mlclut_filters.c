@@ -0,0 +1,1585 @@
+/**
+ * @file
+ * @author Michele Laurenti
+ * @language c
+ *
+ * Image filters: separable convolutions (gaussian, box, any kernel),
+ * morphology (erode, dilate), Sobel gradient magnitude, and resize.
+ * The kernels are embedded in the library, and specialized through -D build
+ * options for the storage of source and destination and for the tile size
+ * chosen for the device; the program cache keeps one build per combination.
+ */
+
+#include "mlclut_filters.h"
+#include "mlclut_interpose.h"
+#include "mlclut_memory.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <pthread.h>
+
+#include <Debug.h>
+#include <ArrayUtils.h>
+
+#define DEBUG_FILTERS	"mlclut_debug_filters"
+
+/* storage of a filter source or destination, as seen by the kernels */
+#define CLUT_FILTER_IMAGE_FLOAT	0
+#define CLUT_FILTER_IMAGE_UINT	1
+#define CLUT_FILTER_IMAGE_INT	2
+#define CLUT_FILTER_BUFFER_U8	3
+#define CLUT_FILTER_BUFFER_FLOAT	4
+
+/* operator of the separable passes */
+#define CLUT_FILTER_OP_CONVOLVE	0
+#define CLUT_FILTER_OP_MIN	1
+#define CLUT_FILTER_OP_MAX	2
+
+/* weights buffers kept per context */
+#define CLUT_FILTER_MAX_WEIGHTS	16
+
+/*!
+ Embedded kernels
+ SRC_KIND, DST_KIND		storage of source and destination (CLUT_FILTER_*)
+ SRC_COMPONENTS, DST_COMPONENTS	channels of buffer pixels
+ TILE_W, TILE_H			work-group (and tile) size
+ FILTER_OP			operator of the separable passes
+ TMP_COMPONENTS			float channels of the separable temporary
+ */
+
+static const char *filters_sources[] =
+{
+	"#define ROW(base,pitch,y,type)	((__global type *) ((__global uchar *) (base) + (size_t) (y) * (pitch)))\n"
+	"\n"
+	"__constant sampler_t clut_nearest = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;\n"
+	"__constant sampler_t clut_linear = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_LINEAR;\n"
+	"\n"
+	"#if SRC_KIND == 3\n"
+	"#define SRC_T	uchar\n"
+	"#elif SRC_KIND == 4\n"
+	"#define SRC_T	float\n"
+	"#endif\n"
+	"#if SRC_KIND < 3\n"
+	"#define SRC_PARAMS	__read_only image2d_t src\n"
+	"#else\n"
+	"#define SRC_PARAMS	__global const SRC_T *src, const uint src_pitch\n"
+	"#endif\n"
+	"#if SRC_KIND == 0\n"
+	"#define SRC_LOAD(x,y)	read_imagef(src, clut_nearest, (int2) ((x), (y)))\n"
+	"#elif SRC_KIND == 1\n"
+	"#define SRC_LOAD(x,y)	convert_float4(read_imageui(src, clut_nearest, (int2) ((x), (y))))\n"
+	"#elif SRC_KIND == 2\n"
+	"#define SRC_LOAD(x,y)	convert_float4(read_imagei(src, clut_nearest, (int2) ((x), (y))))\n"
+	"#else\n"
+	"#define SRC_LOAD(x,y)	clut_load(ROW(src, src_pitch, (y), const SRC_T) + (x) * SRC_COMPONENTS)\n"
+	"\n"
+	"float4 clut_load(__global const SRC_T *p)\n"
+	"{\n"
+	"	float4 v = (float4) (0.0f, 0.0f, 0.0f, 0.0f);\n"
+	"	v.x = p[0];\n"
+	"#if SRC_COMPONENTS > 1\n"
+	"	v.y = p[1];\n"
+	"#endif\n"
+	"#if SRC_COMPONENTS > 2\n"
+	"	v.z = p[2];\n"
+	"#endif\n"
+	"#if SRC_COMPONENTS > 3\n"
+	"	v.w = p[3];\n"
+	"#endif\n"
+	"	return v;\n"
+	"}\n"
+	"#endif\n"
+	"\n"
+	"#if DST_KIND == 3\n"
+	"#define DST_T	uchar\n"
+	"#define DST_CONVERT(v)	convert_uchar_sat_rte(v)\n"
+	"#elif DST_KIND == 4\n"
+	"#define DST_T	float\n"
+	"#define DST_CONVERT(v)	(v)\n"
+	"#endif\n"
+	"#if DST_KIND < 3\n"
+	"#define DST_PARAMS	__write_only image2d_t dst\n"
+	"#else\n"
+	"#define DST_PARAMS	__global DST_T *dst, const uint dst_pitch\n"
+	"#endif\n"
+	"#if DST_KIND == 0\n"
+	"#define DST_STORE(x,y,v)	write_imagef(dst, (int2) ((x), (y)), (v))\n"
+	"#elif DST_KIND == 1\n"
+	"#define DST_STORE(x,y,v)	write_imageui(dst, (int2) ((x), (y)), convert_uint4_sat_rte(v))\n"
+	"#elif DST_KIND == 2\n"
+	"#define DST_STORE(x,y,v)	write_imagei(dst, (int2) ((x), (y)), convert_int4_sat_rte(v))\n"
+	"#else\n"
+	"#define DST_STORE(x,y,v)	clut_store(ROW(dst, dst_pitch, (y), DST_T) + (x) * DST_COMPONENTS, (v))\n"
+	"\n"
+	"void clut_store(__global DST_T *p, float4 v)\n"
+	"{\n"
+	"	p[0] = DST_CONVERT(v.x);\n"
+	"#if DST_COMPONENTS > 1\n"
+	"	p[1] = DST_CONVERT(v.y);\n"
+	"#endif\n"
+	"#if DST_COMPONENTS > 2\n"
+	"	p[2] = DST_CONVERT(v.z);\n"
+	"#endif\n"
+	"#if DST_COMPONENTS > 3\n"
+	"	p[3] = DST_CONVERT(v.w);\n"
+	"#endif\n"
+	"}\n"
+	"#endif\n",
+
+	"#if FILTER_OP == 1\n"
+	"#define ACC_INIT	((float4) (INFINITY))\n"
+	"#define ACCUMULATE(acc,v,w)	fmin((acc), (v))\n"
+	"#elif FILTER_OP == 2\n"
+	"#define ACC_INIT	((float4) (-INFINITY))\n"
+	"#define ACCUMULATE(acc,v,w)	fmax((acc), (v))\n"
+	"#else\n"
+	"#define ACC_INIT	((float4) (0.0f))\n"
+	"#define ACCUMULATE(acc,v,w)	mad((v), (float4) (w), (acc))\n"
+	"#endif\n"
+	"\n"
+	"/* the temporary keeps only the channels the column pass can use */\n"
+	"void clut_tmp_store(__global float *p, float4 v)\n"
+	"{\n"
+	"	p[0] = v.x;\n"
+	"#if TMP_COMPONENTS > 1\n"
+	"	p[1] = v.y;\n"
+	"#endif\n"
+	"#if TMP_COMPONENTS > 2\n"
+	"	p[2] = v.z;\n"
+	"#endif\n"
+	"#if TMP_COMPONENTS > 3\n"
+	"	p[3] = v.w;\n"
+	"#endif\n"
+	"}\n"
+	"\n"
+	"float4 clut_tmp_load(__global const float *p)\n"
+	"{\n"
+	"	float4 v = (float4) (0.0f, 0.0f, 0.0f, 0.0f);\n"
+	"	v.x = p[0];\n"
+	"#if TMP_COMPONENTS > 1\n"
+	"	v.y = p[1];\n"
+	"#endif\n"
+	"#if TMP_COMPONENTS > 2\n"
+	"	v.z = p[2];\n"
+	"#endif\n"
+	"#if TMP_COMPONENTS > 3\n"
+	"	v.w = p[3];\n"
+	"#endif\n"
+	"	return v;\n"
+	"}\n"
+	"\n"
+	"/* rows of TILE_W pixels, loaded with their halo of radius pixels per side */\n"
+	"__kernel __attribute__((reqd_work_group_size(TILE_W, TILE_H, 1)))\n"
+	"void clut_filter_rows(SRC_PARAMS, const int width, const int height,\n"
+	"		      __global float *tmp, __constant float *weights, const int radius,\n"
+	"		      __local float4 *tile)\n"
+	"{\n"
+	"	const int lx = get_local_id(0), ly = get_local_id(1);\n"
+	"	const int x0 = get_group_id(0) * TILE_W, x = x0 + lx;\n"
+	"	const int y = min((int) get_global_id(1), height - 1);\n"
+	"	const int span = TILE_W + 2 * radius;\n"
+	"	__local float4 *row = tile + ly * span;\n"
+	"	float4 acc = ACC_INIT;\n"
+	"	int i;\n"
+	"\n"
+	"	for (i = lx; i < span; i += TILE_W) {\n"
+	"		row[i] = SRC_LOAD(clamp(x0 + i - radius, 0, width - 1), y);\n"
+	"	}\n"
+	"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+	"	if ((x >= width) || (get_global_id(1) >= height)) {\n"
+	"		return;\n"
+	"	}\n"
+	"	for (i = 0; i <= 2 * radius; ++i) {\n"
+	"		acc = ACCUMULATE(acc, row[lx + i], weights[i]);\n"
+	"	}\n"
+	"	clut_tmp_store(tmp + ((size_t) y * width + x) * TMP_COMPONENTS, acc);\n"
+	"}\n"
+	"\n"
+	"/* columns of TILE_H pixels, loaded with their halo of radius pixels per side */\n"
+	"__kernel __attribute__((reqd_work_group_size(TILE_W, TILE_H, 1)))\n"
+	"void clut_filter_columns(__global const float *tmp, const int width, const int height,\n"
+	"			 DST_PARAMS, __constant float *weights, const int radius,\n"
+	"			 __local float4 *tile)\n"
+	"{\n"
+	"	const int lx = get_local_id(0), ly = get_local_id(1);\n"
+	"	const int y0 = get_group_id(1) * TILE_H, y = y0 + ly;\n"
+	"	const int x = min((int) get_global_id(0), width - 1);\n"
+	"	const int span = TILE_H + 2 * radius;\n"
+	"	float4 acc = ACC_INIT;\n"
+	"	int i;\n"
+	"\n"
+	"	for (i = ly; i < span; i += TILE_H) {\n"
+	"		tile[i * TILE_W + lx] = clut_tmp_load(tmp + ((size_t) clamp(y0 + i - radius, 0, height - 1) * width + x) * TMP_COMPONENTS);\n"
+	"	}\n"
+	"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+	"	if ((get_global_id(0) >= width) || (y >= height)) {\n"
+	"		return;\n"
+	"	}\n"
+	"	for (i = 0; i <= 2 * radius; ++i) {\n"
+	"		acc = ACCUMULATE(acc, tile[(ly + i) * TILE_W + lx], weights[i]);\n"
+	"	}\n"
+	"	DST_STORE(x, y, acc);\n"
+	"}\n",
+
+	"#define TILE(i,j)	tile[(j) * (TILE_W + 2) + (i)]\n"
+	"\n"
+	"__kernel __attribute__((reqd_work_group_size(TILE_W, TILE_H, 1)))\n"
+	"void clut_filter_sobel(SRC_PARAMS, const int width, const int height,\n"
+	"		       DST_PARAMS, __local float4 *tile)\n"
+	"{\n"
+	"	const int lx = get_local_id(0), ly = get_local_id(1);\n"
+	"	const int x0 = get_group_id(0) * TILE_W, y0 = get_group_id(1) * TILE_H;\n"
+	"	const int x = x0 + lx, y = y0 + ly;\n"
+	"	float4 gx, gy;\n"
+	"	int i, j;\n"
+	"\n"
+	"	for (j = ly; j < TILE_H + 2; j += TILE_H) {\n"
+	"		for (i = lx; i < TILE_W + 2; i += TILE_W) {\n"
+	"			TILE(i, j) = SRC_LOAD(clamp(x0 + i - 1, 0, width - 1), clamp(y0 + j - 1, 0, height - 1));\n"
+	"		}\n"
+	"	}\n"
+	"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+	"	if ((x >= width) || (y >= height)) {\n"
+	"		return;\n"
+	"	}\n"
+	"	gx = (TILE(lx + 2, ly) + 2.0f * TILE(lx + 2, ly + 1) + TILE(lx + 2, ly + 2)) -\n"
+	"	     (TILE(lx, ly) + 2.0f * TILE(lx, ly + 1) + TILE(lx, ly + 2));\n"
+	"	gy = (TILE(lx, ly + 2) + 2.0f * TILE(lx + 1, ly + 2) + TILE(lx + 2, ly + 2)) -\n"
+	"	     (TILE(lx, ly) + 2.0f * TILE(lx + 1, ly) + TILE(lx + 2, ly));\n"
+	"	DST_STORE(x, y, sqrt(gx * gx + gy * gy));\n"
+	"}\n"
+	"\n"
+	"/* pixel centers are mapped onto each other; float images use the sampler */\n"
+	"__kernel void clut_filter_resize(SRC_PARAMS, const int src_width, const int src_height,\n"
+	"				 DST_PARAMS, const int dst_width, const int dst_height)\n"
+	"{\n"
+	"	const int x = get_global_id(0), y = get_global_id(1);\n"
+	"	float2 p;\n"
+	"	float4 v;\n"
+	"\n"
+	"	if ((x >= dst_width) || (y >= dst_height)) {\n"
+	"		return;\n"
+	"	}\n"
+	"	p = ((float2) ((float) x, (float) y) + 0.5f) * (float2) ((float) src_width / dst_width, (float) src_height / dst_height);\n"
+	"#if SRC_KIND == 0\n"
+	"	v = read_imagef(src, clut_linear, p);\n"
+	"#else\n"
+	"	{\n"
+	"		const float2 q = p - 0.5f, f = q - floor(q);\n"
+	"		const int x0 = clamp((int) floor(q.x), 0, src_width - 1), x1 = min(x0 + 1, src_width - 1);\n"
+	"		const int y0 = clamp((int) floor(q.y), 0, src_height - 1), y1 = min(y0 + 1, src_height - 1);\n"
+	"		v = mix(mix(SRC_LOAD(x0, y0), SRC_LOAD(x1, y0), f.x),\n"
+	"			mix(SRC_LOAD(x0, y1), SRC_LOAD(x1, y1), f.x), f.y);\n"
+	"	}\n"
+	"#endif\n"
+	"	DST_STORE(x, y, v);\n"
+	"}\n",
+};
+
+/*!
+ * Work-group tile of a stencil kernel.
+ */
+struct clut_filter_tile {
+	cl_uint width;
+	cl_uint height;
+};
+
+/*!
+ * Weights of a separable filter, uploaded once.
+ */
+struct clut_filter_weights {
+	cl_uint n;
+	cl_float *values;
+	cl_mem mem;
+	struct clut_filter_weights *next;
+};
+
+/*!
+ * Buffers the separable filters reuse on a context: the temporary between
+ * the two passes, with the event of the last pass reading it, and the
+ * weights, most recently used first.
+ */
+struct clut_filter_buffers {
+	cl_context context;
+	cl_mem scratch;
+	size_t scratch_size;
+	cl_event scratch_used;
+	struct clut_filter_weights *weights;
+	struct clut_filter_buffers *next;
+};
+
+static struct clut_filter_buffers *filter_buffers = NULL;
+static pthread_mutex_t filter_buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t filter_eviction_once = PTHREAD_ONCE_INIT;
+
+/*!
+ * Fused filter chain: its generated source, and what its launch needs.
+ */
+struct clut_filter_chain {
+	char *source;
+	cl_uint halo;		/* sum of the stencil radii */
+	cl_uint n_tiles;	/* local memory tiles used by the kernel */
+};
+
+/*!
+ * Kernel source being generated.
+ */
+struct clut_source {
+	char *text;
+	size_t length;
+	size_t size;
+};
+
+/**
+ * Function declaration
+ */
+
+static int clut_getFilterKind(const clut_image_desc *desc);
+static int clut_checkFilterDescs(const char * const fname,
+				 const clut_image_desc *src_desc, const clut_image_desc *dst_desc, int same_size);
+static int clut_getFilterTmpComponents(const clut_image_desc *src_desc, const clut_image_desc *dst_desc);
+static int clut_getFilterTile(cl_command_queue command_queue, size_t halo_x, size_t halo_y, size_t n_tiles,
+			      struct clut_filter_tile *tile);
+static cl_kernel clut_getFilterKernel(cl_command_queue command_queue, cl_uint count, const char **sources,
+				      const clut_image_desc *src_desc, const clut_image_desc *dst_desc,
+				      const struct clut_filter_tile *tile, int op, const char * const name);
+static cl_int clut_setFilterMemArgs(cl_kernel kernel, cl_uint *index, cl_mem *mem, const clut_image_desc *desc);
+static void clut_registerFilterEviction(void);
+static size_t clut_evictFilterBuffers(cl_context context, size_t size, void *user_data);
+static struct clut_filter_buffers * clut_getFilterBuffers(cl_context context);
+static cl_mem clut_getFilterWeights(struct clut_filter_buffers *buffers, cl_uint n, const cl_float *weights, cl_int *ret);
+static cl_mem clut_getFilterScratch(struct clut_filter_buffers *buffers, size_t size, cl_int *ret);
+static cl_int clut_filterSeparablePasses(cl_command_queue command_queue,
+					 cl_mem src, const clut_image_desc *src_desc,
+					 cl_mem dst, const clut_image_desc *dst_desc,
+					 int op, cl_uint radius, const cl_float *weights,
+					 cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+static cl_int clut_filterMorphology(const char * const fname, cl_command_queue command_queue,
+				    cl_mem src, const clut_image_desc *src_desc,
+				    cl_mem dst, const clut_image_desc *dst_desc,
+				    int op, cl_uint radius,
+				    cl_uint n_wait, const cl_event *wait_list, cl_event *event);
+static int clut_appendSource(struct clut_source *source, const char * const format, ...);
+static int clut_isStencilStage(const clut_filter_stage *stage);
+static cl_uint clut_getStageRadius(const clut_filter_stage *stage);
+static int clut_writePointStage(struct clut_source *body, const clut_filter_stage *stage, const char * const indent);
+static int clut_writeStencilStage(struct clut_source *header, struct clut_source *body,
+				  const clut_filter_stage *stage, cl_uint index,
+				  const char * const input, const char * const indent);
+static char * clut_generateChainSource(cl_uint n_stages, const clut_filter_stage *stages,
+				       cl_uint halo, cl_uint n_stencils);
+
+/**
+ * Function definition
+ */
+
+/*!
+ * @function clut_getFilterKind
+ * Returns how the kernels access [desc] (a CLUT_FILTER_* value), or -1 if
+ * they can't.
+ */
+static int clut_getFilterKind(const clut_image_desc *desc)
+{
+	if (CL_MEM_OBJECT_IMAGE2D == desc->storage) {
+		switch (desc->channel_type) {
+		case CL_UNSIGNED_INT8:
+		case CL_UNSIGNED_INT16:
+		case CL_UNSIGNED_INT32:
+			return CLUT_FILTER_IMAGE_UINT;
+		case CL_SIGNED_INT8:
+		case CL_SIGNED_INT16:
+		case CL_SIGNED_INT32:
+			return CLUT_FILTER_IMAGE_INT;
+		default:
+			return CLUT_FILTER_IMAGE_FLOAT;
+		}
+	}
+	if ((CL_MEM_OBJECT_BUFFER == desc->storage) && (1 <= desc->components) && (4 >= desc->components)) {
+		if (CL_UNSIGNED_INT8 == desc->channel_type) {
+			return CLUT_FILTER_BUFFER_U8;
+		}
+		if (CL_FLOAT == desc->channel_type) {
+			return CLUT_FILTER_BUFFER_FLOAT;
+		}
+	}
+	return -1;
+}
+
+/*!
+ * @function clut_checkFilterDescs
+ * Checks that the kernels can read [src_desc] and write [dst_desc], and, if
+ * [same_size], that they have the same size.
+ */
+static int clut_checkFilterDescs(const char * const fname,
+				 const clut_image_desc *src_desc, const clut_image_desc *dst_desc, int same_size)
+{
+	if ((NULL == src_desc) || (NULL == dst_desc)) {
+		Debug_out(DEBUG_FILTERS, "%s: NULL pointer argument.\n", fname);
+		return 0;
+	}
+	if ((0 > clut_getFilterKind(src_desc)) || (0 > clut_getFilterKind(dst_desc))) {
+		Debug_out(DEBUG_FILTERS, "%s: unsupported storage or channel type.\n", fname);
+		return 0;
+	}
+	if ((0 == src_desc->width) || (0 == src_desc->height) || (0 == dst_desc->width) || (0 == dst_desc->height) ||
+	    (same_size && ((src_desc->width != dst_desc->width) || (src_desc->height != dst_desc->height)))) {
+		Debug_out(DEBUG_FILTERS, "%s: destination doesn't match source.\n", fname);
+		return 0;
+	}
+	return 1;
+}
+
+/*!
+ * @function clut_getFilterTmpComponents
+ * Returns the channels the separable temporary keeps: those both loaded
+ * from [src_desc] and stored to [dst_desc], images having 4.
+ */
+static int clut_getFilterTmpComponents(const clut_image_desc *src_desc, const clut_image_desc *dst_desc)
+{
+	const int src = (CL_MEM_OBJECT_BUFFER == src_desc->storage) ? src_desc->components : 4;
+	const int dst = (CL_MEM_OBJECT_BUFFER == dst_desc->storage) ? dst_desc->components : 4;
+
+	return (src < dst) ? src : dst;
+}
+
+/*!
+ * @function clut_getFilterTile
+ * Picks the tile of a stencil kernel on the device of [command_queue]: 32x8
+ * work-items on GPUs (a row spans whole memory transactions), 16x8 on other
+ * devices, shrunk to the maximum work-group size, then in height until
+ * [n_tiles] tiles with their [halo_x] and [halo_y] borders fit in local
+ * memory.
+ */
+static int clut_getFilterTile(cl_command_queue command_queue, size_t halo_x, size_t halo_y, size_t n_tiles,
+			      struct clut_filter_tile *tile)
+{
+	const char * const fname = "clut_getFilterTile";
+	cl_device_id device;
+	cl_device_type device_type;
+	cl_ulong local_mem;
+	size_t max_wg;
+
+	device = clut_getQueueDevice(command_queue);
+	if ((NULL == device) ||
+	    !clut_returnSuccess(clGetDeviceInfo(device, CL_DEVICE_TYPE, sizeof(device_type), &device_type, NULL)) ||
+	    !clut_returnSuccess(clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(max_wg), &max_wg, NULL)) ||
+	    !clut_returnSuccess(clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(local_mem), &local_mem, NULL))) {
+		Debug_out(DEBUG_FILTERS, "%s: unable to get device limits.\n", fname);
+		return 0;
+	}
+
+	tile->width = (CL_DEVICE_TYPE_GPU & device_type) ? 32 : 16;
+	tile->height = 8;
+	while (tile->width * tile->height > max_wg) {
+		if (1 < tile->height) {
+			tile->height >>= 1;
+		} else {
+			tile->width >>= 1;
+		}
+	}
+	while ((1 < tile->height) &&
+	       (n_tiles * (tile->width + 2 * halo_x) * (tile->height + 2 * halo_y) * sizeof(cl_float4) > local_mem)) {
+		tile->height >>= 1;
+	}
+	if (n_tiles * (tile->width + 2 * halo_x) * (tile->height + 2 * halo_y) * sizeof(cl_float4) > local_mem) {
+		Debug_out(DEBUG_FILTERS, "%s: a halo of %lux%lu doesn't fit in local memory.\n",
+			  fname, (unsigned long) halo_x, (unsigned long) halo_y);
+		return 0;
+	}
+	return 1;
+}
+
+/*!
+ * @function clut_getFilterKernel
+ * Acquires the filter kernel [name] from [count] [sources] specialized for
+ * [src_desc], [dst_desc], [tile] and [op], building the program the first
+ * time.
+ * @warning Result should be given back with clut_releaseCachedKernel.
+ */
+static cl_kernel clut_getFilterKernel(cl_command_queue command_queue, cl_uint count, const char **sources,
+				      const clut_image_desc *src_desc, const clut_image_desc *dst_desc,
+				      const struct clut_filter_tile *tile, int op, const char * const name)
+{
+	const char * const fname = "clut_getFilterKernel";
+	char flags[256];
+	cl_context context;
+	cl_kernel kernel;
+	cl_int ret;
+
+	ret = clGetCommandQueueInfo(command_queue, CL_QUEUE_CONTEXT, sizeof(context), &context, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to get queue context", error);
+
+	snprintf(flags, sizeof(flags),
+		 "-DSRC_KIND=%d -DSRC_COMPONENTS=%d -DDST_KIND=%d -DDST_COMPONENTS=%d -DTILE_W=%u -DTILE_H=%u -DFILTER_OP=%d"
+		 " -DTMP_COMPONENTS=%d",
+		 clut_getFilterKind(src_desc), src_desc->components,
+		 clut_getFilterKind(dst_desc), dst_desc->components,
+		 tile->width, tile->height, op,
+		 clut_getFilterTmpComponents(src_desc, dst_desc));
+
+	kernel = clut_acquireCachedKernel(context, count, sources, flags, name);
+	if (NULL == kernel) {
+		Debug_out(DEBUG_FILTERS, "%s: unable to get '%s' built with '%s'.\n", fname, name, flags);
+		goto error;
+	}
+
+	return kernel;
+
+error:	return NULL;
+}
+
+/*!
+ * @function clut_setFilterMemArgs
+ * Sets [mem] as argument [index] of [kernel], followed by its row pitch if
+ * it's a buffer, and advances [index] past them.
+ */
+static cl_int clut_setFilterMemArgs(cl_kernel kernel, cl_uint *index, cl_mem *mem, const clut_image_desc *desc)
+{
+	cl_uint pitch = (cl_uint) desc->row_pitch;
+	cl_int ret;
+
+	ret = clSetKernelArg(kernel, (*index)++, sizeof(cl_mem), mem);
+	if (!clut_returnSuccess(ret) || (CL_MEM_OBJECT_BUFFER != desc->storage)) {
+		return ret;
+	}
+	return clSetKernelArg(kernel, (*index)++, sizeof(cl_uint), &pitch);
+}
+
+/*!
+ * @function clut_registerFilterEviction
+ * Lets the memory accounting evict the buffers the filters keep.
+ */
+static void clut_registerFilterEviction(void)
+{
+	if (!clut_returnSuccess(clut_registerEviction(clut_evictFilterBuffers, NULL))) {
+		Debug_out(DEBUG_FILTERS, "clut_registerFilterEviction: unable to register.\n");
+	}
+}
+
+/*!
+ * @function clut_evictFilterBuffers
+ * Eviction callback: releases the temporary and weights buffers kept for
+ * [context], whatever [size], and returns their size. Releases nothing if
+ * a filter is using them, as when its own allocation evicts.
+ */
+static size_t clut_evictFilterBuffers(cl_context context, size_t size, void *user_data)
+{
+	struct clut_filter_buffers *buffers;
+	struct clut_filter_weights *weights;
+	size_t released = 0;
+
+	if (0 != pthread_mutex_trylock(&filter_buffers_lock)) {
+		return 0;
+	}
+	for (buffers = filter_buffers; NULL != buffers; buffers = buffers->next) {
+		if (buffers->context == context) {
+			break;
+		}
+	}
+	if (NULL != buffers) {
+		while (NULL != (weights = buffers->weights)) {
+			buffers->weights = weights->next;
+			released += weights->n * sizeof(cl_float);
+			clReleaseMemObject(weights->mem);
+			free(weights->values);
+			free(weights);
+		}
+		if (NULL != buffers->scratch) {
+			released += buffers->scratch_size;
+			clReleaseMemObject(buffers->scratch);
+			buffers->scratch = NULL;
+			buffers->scratch_size = 0;
+		}
+		if (NULL != buffers->scratch_used) {
+			clReleaseEvent(buffers->scratch_used);
+			buffers->scratch_used = NULL;
+		}
+	}
+	pthread_mutex_unlock(&filter_buffers_lock);
+
+	if (0 != released) {
+		Debug_out(DEBUG_FILTERS, "clut_evictFilterBuffers: released %zu bytes.\n", released);
+	}
+	return released;
+}
+
+/*!
+ * @function clut_getFilterBuffers
+ * Returns the reused buffers of [context], adding them if needed.
+ * Must be called with filter_buffers_lock held.
+ */
+static struct clut_filter_buffers * clut_getFilterBuffers(cl_context context)
+{
+	struct clut_filter_buffers *buffers;
+
+	pthread_once(&filter_eviction_once, clut_registerFilterEviction);
+
+	for (buffers = filter_buffers; NULL != buffers; buffers = buffers->next) {
+		if (buffers->context == context) {
+			return buffers;
+		}
+	}
+	buffers = calloc(1, sizeof(struct clut_filter_buffers));
+	if (NULL == buffers) {
+		Debug_out(DEBUG_FILTERS, "clut_getFilterBuffers: calloc failed.\n");
+		return NULL;
+	}
+	clRetainContext(context);
+	buffers->context = context;
+	buffers->next = filter_buffers;
+	filter_buffers = buffers;
+	return buffers;
+}
+
+/*!
+ * @function clut_getFilterWeights
+ * Returns a buffer holding the [n] [weights], uploading them unless an
+ * earlier filter on the same context did. Only the most recently used
+ * CLUT_FILTER_MAX_WEIGHTS are kept.
+ * Must be called with filter_buffers_lock held.
+ */
+static cl_mem clut_getFilterWeights(struct clut_filter_buffers *buffers, cl_uint n, const cl_float *weights, cl_int *ret)
+{
+	struct clut_filter_weights *cached, **link;
+	cl_uint kept;
+
+	for (link = &buffers->weights; NULL != (cached = *link); link = &cached->next) {
+		if ((cached->n == n) && (0 == memcmp(cached->values, weights, n * sizeof(cl_float)))) {
+			*link = cached->next;
+			goto found;
+		}
+	}
+
+	cached = malloc(sizeof(struct clut_filter_weights));
+	if (NULL == cached) {
+		*ret = CL_OUT_OF_HOST_MEMORY;
+		return NULL;
+	}
+	cached->values = malloc(n * sizeof(cl_float));
+	if (NULL == cached->values) {
+		free(cached);
+		*ret = CL_OUT_OF_HOST_MEMORY;
+		return NULL;
+	}
+	memcpy(cached->values, weights, n * sizeof(cl_float));
+	cached->n = n;
+	cached->mem = clut_createTrackedBuffer(buffers->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+					       n * sizeof(cl_float), cached->values, "filters", NULL, ret);
+	if (!clut_returnSuccess(*ret)) {
+		free(cached->values);
+		free(cached);
+		return NULL;
+	}
+
+	/* drop the least recently used, still alive for the commands using it */
+	for (link = &buffers->weights, kept = 1; NULL != *link; link = &(*link)->next, ++kept) {
+		if (CLUT_FILTER_MAX_WEIGHTS == kept) {
+			struct clut_filter_weights *last = *link;
+			*link = NULL;
+			clReleaseMemObject(last->mem);
+			free(last->values);
+			free(last);
+			break;
+		}
+	}
+
+found:	cached->next = buffers->weights;
+	buffers->weights = cached;
+	*ret = CL_SUCCESS;
+	return cached->mem;
+}
+
+/*!
+ * @function clut_getFilterScratch
+ * Returns the temporary of [buffers], grown to at least [size] bytes. A
+ * temporary being replaced is released first, so that its memory counts as
+ * soon as the commands using it complete.
+ * Must be called with filter_buffers_lock held.
+ */
+static cl_mem clut_getFilterScratch(struct clut_filter_buffers *buffers, size_t size, cl_int *ret)
+{
+	if (buffers->scratch_size >= size) {
+		*ret = CL_SUCCESS;
+		return buffers->scratch;
+	}
+
+	if (NULL != buffers->scratch) {
+		clReleaseMemObject(buffers->scratch);
+		buffers->scratch = NULL;
+		buffers->scratch_size = 0;
+	}
+	if (NULL != buffers->scratch_used) {
+		clReleaseEvent(buffers->scratch_used);
+		buffers->scratch_used = NULL;
+	}
+	buffers->scratch = clut_createTrackedBuffer(buffers->context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS,
+						    size, NULL, "filters", NULL, ret);
+	if (!clut_returnSuccess(*ret)) {
+		buffers->scratch = NULL;
+		return NULL;
+	}
+	buffers->scratch_size = size;
+	return buffers->scratch;
+}
+
+/*!
+ * @function clut_filterSeparablePasses
+ * Runs the row pass of [op] from [src] to a temporary, then the column pass
+ * to [dst], both with the 2 * [radius] + 1 [weights]. The temporary holds
+ * float channels, only as many as both [src] and [dst] have; it and the
+ * weights are reused by later calls on the same context, a row pass waiting
+ * for the column pass that last read the temporary.
+ */
+static cl_int clut_filterSeparablePasses(cl_command_queue command_queue,
+					 cl_mem src, const clut_image_desc *src_desc,
+					 cl_mem dst, const clut_image_desc *dst_desc,
+					 int op, cl_uint radius, const cl_float *weights,
+					 cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	const char * const fname = "clut_filterSeparablePasses";
+	const cl_int width = (cl_int) src_desc->width, height = (cl_int) src_desc->height, r = (cl_int) radius;
+	const size_t tmp_size = src_desc->width * src_desc->height *
+				clut_getFilterTmpComponents(src_desc, dst_desc) * sizeof(cl_float);
+	struct clut_filter_tile row_tile, column_tile;
+	struct clut_filter_buffers *buffers;
+	size_t global[2], local[2];
+	cl_context context;
+	cl_mem tmp, weights_buffer;
+	cl_event *row_wait = NULL, rows_done = NULL, columns_done = NULL;
+	cl_kernel row_kernel = NULL, column_kernel = NULL;
+	cl_uint index, n_row_wait;
+	cl_int ret = CL_INVALID_VALUE;
+
+	if (!clut_getFilterTile(command_queue, radius, 0, 1, &row_tile) ||
+	    !clut_getFilterTile(command_queue, 0, radius, 1, &column_tile)) {
+		goto error1;
+	}
+
+	ret = clGetCommandQueueInfo(command_queue, CL_QUEUE_CONTEXT, sizeof(context), &context, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to get queue context", error1);
+
+	/* kernels first: building them doesn't need the buffers locked */
+	row_kernel = clut_getFilterKernel(command_queue, ARRAY_LEN(filters_sources), filters_sources,
+					  src_desc, dst_desc, &row_tile, op, "clut_filter_rows");
+	column_kernel = clut_getFilterKernel(command_queue, ARRAY_LEN(filters_sources), filters_sources,
+					     src_desc, dst_desc, &column_tile, op, "clut_filter_columns");
+	if ((NULL == row_kernel) || (NULL == column_kernel)) {
+		ret = CL_INVALID_KERNEL_NAME;
+		goto error2;
+	}
+	row_wait = malloc((n_wait + 1) * sizeof(cl_event));
+	if (NULL == row_wait) {
+		ret = CL_OUT_OF_HOST_MEMORY;
+		goto error2;
+	}
+
+	/* held until the column pass is the last user of the temporary */
+	pthread_mutex_lock(&filter_buffers_lock);
+	buffers = clut_getFilterBuffers(context);
+	if (NULL == buffers) {
+		ret = CL_OUT_OF_HOST_MEMORY;
+		goto error3;
+	}
+	weights_buffer = clut_getFilterWeights(buffers, 2 * radius + 1, weights, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create weights buffer", error3);
+	tmp = clut_getFilterScratch(buffers, tmp_size, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create temporary buffer", error3);
+	if (0 < n_wait) {
+		memcpy(row_wait, wait_list, n_wait * sizeof(cl_event));
+	}
+	n_row_wait = n_wait;
+	if (NULL != buffers->scratch_used) {
+		row_wait[n_row_wait++] = buffers->scratch_used;
+	}
+
+	/* rows */
+	index = 0;
+	if (!clut_returnSuccess(ret = clut_setFilterMemArgs(row_kernel, &index, &src, src_desc)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(row_kernel, index++, sizeof(cl_int), &width)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(row_kernel, index++, sizeof(cl_int), &height)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(row_kernel, index++, sizeof(cl_mem), &tmp)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(row_kernel, index++, sizeof(cl_mem), &weights_buffer)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(row_kernel, index++, sizeof(cl_int), &r)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(row_kernel, index++,
+						     (row_tile.width + 2 * radius) * row_tile.height * sizeof(cl_float4), NULL))) {
+		goto error3;
+	}
+	local[0] = row_tile.width;
+	local[1] = row_tile.height;
+	global[0] = CLUT_ROUND_UP(src_desc->width, local[0]);
+	global[1] = CLUT_ROUND_UP(src_desc->height, local[1]);
+	ret = clut_enqueueNDRangeKernel(command_queue, row_kernel, 2, NULL, global, local,
+					n_row_wait, (0 < n_row_wait) ? row_wait : NULL, &rows_done);
+	CLUT_CHECK_ERROR(ret, "Unable to enqueue row pass", error3);
+
+	/* columns */
+	index = 0;
+	if (!clut_returnSuccess(ret = clSetKernelArg(column_kernel, index++, sizeof(cl_mem), &tmp)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(column_kernel, index++, sizeof(cl_int), &width)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(column_kernel, index++, sizeof(cl_int), &height)) ||
+	    !clut_returnSuccess(ret = clut_setFilterMemArgs(column_kernel, &index, &dst, dst_desc)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(column_kernel, index++, sizeof(cl_mem), &weights_buffer)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(column_kernel, index++, sizeof(cl_int), &r)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(column_kernel, index++,
+						     column_tile.width * (column_tile.height + 2 * radius) * sizeof(cl_float4), NULL))) {
+		goto error3;
+	}
+	local[0] = column_tile.width;
+	local[1] = column_tile.height;
+	global[0] = CLUT_ROUND_UP(src_desc->width, local[0]);
+	global[1] = CLUT_ROUND_UP(src_desc->height, local[1]);
+	ret = clut_enqueueNDRangeKernel(command_queue, column_kernel, 2, NULL, global, local, 1, &rows_done, &columns_done);
+	CLUT_CHECK_ERROR(ret, "Unable to enqueue column pass", error3);
+
+	if (NULL != buffers->scratch_used) {
+		clReleaseEvent(buffers->scratch_used);
+	}
+	buffers->scratch_used = columns_done;
+	if (NULL != event) {
+		clRetainEvent(columns_done);
+		*event = columns_done;
+	}
+
+	Debug_out(DEBUG_FILTERS, "%s: radius %u, tiles %ux%u and %ux%u.\n",
+		  fname, radius, row_tile.width, row_tile.height, column_tile.width, column_tile.height);
+
+error3:	pthread_mutex_unlock(&filter_buffers_lock);
+	if (NULL != rows_done) {
+		clReleaseEvent(rows_done);
+	}
+	free(row_wait);
+error2:	clut_releaseCachedKernel(row_kernel);
+	clut_releaseCachedKernel(column_kernel);
+error1:	return ret;
+}
+
+/*!
+ * @function clut_filterSeparable
+ * Convolves [src] into [dst] with the 2 * [radius] + 1 [weights], along the
+ * rows and then along the columns.
+ */
+cl_int clut_filterSeparable(cl_command_queue command_queue,
+			    cl_mem src, const clut_image_desc *src_desc,
+			    cl_mem dst, const clut_image_desc *dst_desc,
+			    cl_uint radius, const cl_float *weights,
+			    cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	const char * const fname = "clut_filterSeparable";
+
+	if (!clut_checkFilterDescs(fname, src_desc, dst_desc, 1) || (NULL == weights)) {
+		return CL_INVALID_VALUE;
+	}
+	return clut_filterSeparablePasses(command_queue, src, src_desc, dst, dst_desc,
+					  CLUT_FILTER_OP_CONVOLVE, radius, weights,
+					  n_wait, wait_list, event);
+}
+
+/*!
+ * @function clut_filterGaussian
+ * Blurs [src] into [dst] with a gaussian of standard deviation [sigma],
+ * truncated at 3 [sigma].
+ */
+cl_int clut_filterGaussian(cl_command_queue command_queue,
+			   cl_mem src, const clut_image_desc *src_desc,
+			   cl_mem dst, const clut_image_desc *dst_desc,
+			   cl_float sigma,
+			   cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	const char * const fname = "clut_filterGaussian";
+	cl_uint radius, i;
+	cl_float *weights, sum = 0.0f;
+	cl_int ret;
+
+	if (!clut_checkFilterDescs(fname, src_desc, dst_desc, 1) || !(0.0f < sigma)) {
+		return CL_INVALID_VALUE;
+	}
+	radius = (cl_uint) ceilf(3.0f * sigma);
+	weights = malloc((2 * radius + 1) * sizeof(cl_float));
+	if (NULL == weights) {
+		return CL_OUT_OF_HOST_MEMORY;
+	}
+	for (i = 0; i <= 2 * radius; ++i) {
+		const float d = (float) i - (float) radius;
+		weights[i] = expf(-d * d / (2.0f * sigma * sigma));
+		sum += weights[i];
+	}
+	for (i = 0; i <= 2 * radius; ++i) {
+		weights[i] /= sum;
+	}
+
+	ret = clut_filterSeparablePasses(command_queue, src, src_desc, dst, dst_desc,
+					 CLUT_FILTER_OP_CONVOLVE, radius, weights,
+					 n_wait, wait_list, event);
+	free(weights);
+	return ret;
+}
+
+/*!
+ * @function clut_filterBox
+ * Averages [src] into [dst] over squares of side 2 * [radius] + 1.
+ */
+cl_int clut_filterBox(cl_command_queue command_queue,
+		      cl_mem src, const clut_image_desc *src_desc,
+		      cl_mem dst, const clut_image_desc *dst_desc,
+		      cl_uint radius,
+		      cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	const char * const fname = "clut_filterBox";
+	cl_float *weights;
+	cl_uint i;
+	cl_int ret;
+
+	if (!clut_checkFilterDescs(fname, src_desc, dst_desc, 1)) {
+		return CL_INVALID_VALUE;
+	}
+	weights = malloc((2 * radius + 1) * sizeof(cl_float));
+	if (NULL == weights) {
+		return CL_OUT_OF_HOST_MEMORY;
+	}
+	for (i = 0; i <= 2 * radius; ++i) {
+		weights[i] = 1.0f / (2 * radius + 1);
+	}
+
+	ret = clut_filterSeparablePasses(command_queue, src, src_desc, dst, dst_desc,
+					 CLUT_FILTER_OP_CONVOLVE, radius, weights,
+					 n_wait, wait_list, event);
+	free(weights);
+	return ret;
+}
+
+/*!
+ * @function clut_filterMorphology
+ * Takes the minimum or maximum ([op]) of [src] over squares of side
+ * 2 * [radius] + 1, which is separable.
+ */
+static cl_int clut_filterMorphology(const char * const fname, cl_command_queue command_queue,
+				    cl_mem src, const clut_image_desc *src_desc,
+				    cl_mem dst, const clut_image_desc *dst_desc,
+				    int op, cl_uint radius,
+				    cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	cl_float *weights;
+	cl_int ret;
+
+	if (!clut_checkFilterDescs(fname, src_desc, dst_desc, 1)) {
+		return CL_INVALID_VALUE;
+	}
+	/* unused by min and max, but the passes take them */
+	weights = calloc(2 * radius + 1, sizeof(cl_float));
+	if (NULL == weights) {
+		return CL_OUT_OF_HOST_MEMORY;
+	}
+
+	ret = clut_filterSeparablePasses(command_queue, src, src_desc, dst, dst_desc,
+					 op, radius, weights,
+					 n_wait, wait_list, event);
+	free(weights);
+	return ret;
+}
+
+/*!
+ * @function clut_filterErode
+ * Erodes [src] into [dst] with a square of side 2 * [radius] + 1.
+ */
+cl_int clut_filterErode(cl_command_queue command_queue,
+			cl_mem src, const clut_image_desc *src_desc,
+			cl_mem dst, const clut_image_desc *dst_desc,
+			cl_uint radius,
+			cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	return clut_filterMorphology("clut_filterErode", command_queue, src, src_desc, dst, dst_desc,
+				     CLUT_FILTER_OP_MIN, radius, n_wait, wait_list, event);
+}
+
+/*!
+ * @function clut_filterDilate
+ * Dilates [src] into [dst] with a square of side 2 * [radius] + 1.
+ */
+cl_int clut_filterDilate(cl_command_queue command_queue,
+			 cl_mem src, const clut_image_desc *src_desc,
+			 cl_mem dst, const clut_image_desc *dst_desc,
+			 cl_uint radius,
+			 cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	return clut_filterMorphology("clut_filterDilate", command_queue, src, src_desc, dst, dst_desc,
+				     CLUT_FILTER_OP_MAX, radius, n_wait, wait_list, event);
+}
+
+/*!
+ * @function clut_filterSobel
+ * Writes to [dst] the magnitude of the Sobel gradient of each channel of
+ * [src].
+ */
+cl_int clut_filterSobel(cl_command_queue command_queue,
+			cl_mem src, const clut_image_desc *src_desc,
+			cl_mem dst, const clut_image_desc *dst_desc,
+			cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	const char * const fname = "clut_filterSobel";
+	struct clut_filter_tile tile;
+	cl_int width, height;
+	size_t global[2], local[2];
+	cl_kernel kernel;
+	cl_uint index = 0;
+	cl_int ret = CL_INVALID_VALUE;
+
+	if (!clut_checkFilterDescs(fname, src_desc, dst_desc, 1) ||
+	    !clut_getFilterTile(command_queue, 1, 1, 1, &tile)) {
+		goto error;
+	}
+	width = (cl_int) src_desc->width;
+	height = (cl_int) src_desc->height;
+
+	kernel = clut_getFilterKernel(command_queue, ARRAY_LEN(filters_sources), filters_sources,
+				      src_desc, dst_desc, &tile, CLUT_FILTER_OP_CONVOLVE, "clut_filter_sobel");
+	if (NULL == kernel) {
+		ret = CL_INVALID_KERNEL_NAME;
+		goto error;
+	}
+	if (!clut_returnSuccess(ret = clut_setFilterMemArgs(kernel, &index, &src, src_desc)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, index++, sizeof(cl_int), &width)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, index++, sizeof(cl_int), &height)) ||
+	    !clut_returnSuccess(ret = clut_setFilterMemArgs(kernel, &index, &dst, dst_desc)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, index++,
+						     (tile.width + 2) * (tile.height + 2) * sizeof(cl_float4), NULL))) {
+		clut_releaseCachedKernel(kernel);
+		goto error;
+	}
+	local[0] = tile.width;
+	local[1] = tile.height;
+	global[0] = CLUT_ROUND_UP(src_desc->width, local[0]);
+	global[1] = CLUT_ROUND_UP(src_desc->height, local[1]);
+	ret = clut_enqueueNDRangeKernel(command_queue, kernel, 2, NULL, global, local, n_wait, wait_list, event);
+	clut_releaseCachedKernel(kernel);
+
+error:	return ret;
+}
+
+/*!
+ * @function clut_filterResize
+ * Resizes [src] to the size of [dst] with bilinear interpolation, done by
+ * the sampler for images of normalized or float channels.
+ */
+cl_int clut_filterResize(cl_command_queue command_queue,
+			 cl_mem src, const clut_image_desc *src_desc,
+			 cl_mem dst, const clut_image_desc *dst_desc,
+			 cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	const char * const fname = "clut_filterResize";
+	struct clut_filter_tile tile;
+	cl_int src_width, src_height, dst_width, dst_height;
+	size_t global[2], local[2];
+	cl_kernel kernel;
+	cl_uint index = 0;
+	cl_int ret = CL_INVALID_VALUE;
+
+	if (!clut_checkFilterDescs(fname, src_desc, dst_desc, 0) ||
+	    !clut_getFilterTile(command_queue, 0, 0, 0, &tile)) {
+		goto error;
+	}
+	src_width = (cl_int) src_desc->width;
+	src_height = (cl_int) src_desc->height;
+	dst_width = (cl_int) dst_desc->width;
+	dst_height = (cl_int) dst_desc->height;
+
+	kernel = clut_getFilterKernel(command_queue, ARRAY_LEN(filters_sources), filters_sources,
+				      src_desc, dst_desc, &tile, CLUT_FILTER_OP_CONVOLVE, "clut_filter_resize");
+	if (NULL == kernel) {
+		ret = CL_INVALID_KERNEL_NAME;
+		goto error;
+	}
+	if (!clut_returnSuccess(ret = clut_setFilterMemArgs(kernel, &index, &src, src_desc)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, index++, sizeof(cl_int), &src_width)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, index++, sizeof(cl_int), &src_height)) ||
+	    !clut_returnSuccess(ret = clut_setFilterMemArgs(kernel, &index, &dst, dst_desc)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, index++, sizeof(cl_int), &dst_width)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, index++, sizeof(cl_int), &dst_height))) {
+		clut_releaseCachedKernel(kernel);
+		goto error;
+	}
+	local[0] = tile.width;
+	local[1] = tile.height;
+	global[0] = CLUT_ROUND_UP(dst_desc->width, local[0]);
+	global[1] = CLUT_ROUND_UP(dst_desc->height, local[1]);
+	ret = clut_enqueueNDRangeKernel(command_queue, kernel, 2, NULL, global, local, n_wait, wait_list, event);
+	clut_releaseCachedKernel(kernel);
+
+error:	return ret;
+}
+
+/*!
+ * @function clut_releaseFilterBuffers
+ * Releases the temporary and weights buffers the separable filters keep for
+ * [context], and the reference they hold to it; all of them if [context] is
+ * NULL. Commands already enqueued keep the buffers they use alive.
+ */
+void clut_releaseFilterBuffers(cl_context context)
+{
+	struct clut_filter_buffers *buffers, **link;
+	struct clut_filter_weights *weights;
+
+	pthread_mutex_lock(&filter_buffers_lock);
+	for (link = &filter_buffers; NULL != (buffers = *link); ) {
+		if ((NULL != context) && (buffers->context != context)) {
+			link = &buffers->next;
+			continue;
+		}
+		*link = buffers->next;
+		while (NULL != (weights = buffers->weights)) {
+			buffers->weights = weights->next;
+			clReleaseMemObject(weights->mem);
+			free(weights->values);
+			free(weights);
+		}
+		if (NULL != buffers->scratch) {
+			clReleaseMemObject(buffers->scratch);
+		}
+		if (NULL != buffers->scratch_used) {
+			clReleaseEvent(buffers->scratch_used);
+		}
+		clReleaseContext(buffers->context);
+		free(buffers);
+	}
+	pthread_mutex_unlock(&filter_buffers_lock);
+}
+
+/*!
+ * @function clut_appendSource
+ * Appends the printf-like [format] to [source], growing it as needed.
+ */
+static int clut_appendSource(struct clut_source *source, const char * const format, ...)
+{
+	va_list args;
+	char *text;
+	size_t size;
+	int n;
+
+	va_start(args, format);
+	n = vsnprintf(NULL, 0, format, args);
+	va_end(args);
+	if (0 > n) {
+		return 0;
+	}
+	if (source->length + n + 1 > source->size) {
+		size = 2 * (source->length + n + 1);
+		text = realloc(source->text, size);
+		if (NULL == text) {
+			return 0;
+		}
+		source->text = text;
+		source->size = size;
+	}
+	va_start(args, format);
+	vsnprintf(source->text + source->length, source->size - source->length, format, args);
+	va_end(args);
+	source->length += n;
+	return 1;
+}
+
+/*!
+ * @function clut_isStencilStage
+ * Checks if [stage] reads its neighbours.
+ */
+static int clut_isStencilStage(const clut_filter_stage *stage)
+{
+	return (CLUT_STAGE_BOX <= stage->type);
+}
+
+/*!
+ * @function clut_getStageRadius
+ * Returns how far [stage] reads from each pixel.
+ */
+static cl_uint clut_getStageRadius(const clut_filter_stage *stage)
+{
+	if (!clut_isStencilStage(stage)) {
+		return 0;
+	}
+	if (CLUT_STAGE_SOBEL == stage->type) {
+		return 1;
+	}
+	if ((CLUT_STAGE_GAUSSIAN == stage->type) && (0 == stage->radius)) {
+		return (cl_uint) ceilf(3.0f * stage->params[0]);
+	}
+	return stage->radius;
+}
+
+/*!
+ * @function clut_writePointStage
+ * Writes to [body] the statement applying the point-wise [stage] to v.
+ */
+static int clut_writePointStage(struct clut_source *body, const clut_filter_stage *stage, const char * const indent)
+{
+	switch (stage->type) {
+	case CLUT_STAGE_SCALE:
+		return clut_appendSource(body, "%sv = mad(v, (float4) (%.9ef), (float4) (%.9ef));\n",
+					 indent, stage->params[0], stage->params[1]);
+	case CLUT_STAGE_CLAMP:
+		return clut_appendSource(body, "%sv = clamp(v, %.9ef, %.9ef);\n",
+					 indent, stage->params[0], stage->params[1]);
+	case CLUT_STAGE_THRESHOLD:
+		return clut_appendSource(body, "%sv = select((float4) (%.9ef), (float4) (%.9ef), isgreaterequal(v, (float4) (%.9ef)));\n",
+					 indent, stage->params[2], stage->params[1], stage->params[0]);
+	case CLUT_STAGE_EXPRESSION:
+		return clut_appendSource(body, "%sv = (%s);\n", indent, stage->expression);
+	default:
+		return 0;
+	}
+}
+
+/*!
+ * @function clut_writeStencilStage
+ * Writes to [body] the block computing v from the neighbours of (i, j) in
+ * the local tile [input], and to [header] the constants it needs. [index]
+ * numbers the stage.
+ */
+static int clut_writeStencilStage(struct clut_source *header, struct clut_source *body,
+				  const clut_filter_stage *stage, cl_uint index,
+				  const char * const input, const char * const indent)
+{
+	const cl_uint radius = clut_getStageRadius(stage);
+	const char *init, *accumulate, *scale = NULL;
+	char weights[64];
+	cl_uint i;
+	float sum = 0.0f, d;
+
+	switch (stage->type) {
+	case CLUT_STAGE_SOBEL:
+		return clut_appendSource(body,
+					 "%s{\n"
+					 "%s\tconst float4 gx = (AT(%s, i + 1, j - 1) + 2.0f * AT(%s, i + 1, j) + AT(%s, i + 1, j + 1)) -\n"
+					 "%s\t\t\t  (AT(%s, i - 1, j - 1) + 2.0f * AT(%s, i - 1, j) + AT(%s, i - 1, j + 1));\n"
+					 "%s\tconst float4 gy = (AT(%s, i - 1, j + 1) + 2.0f * AT(%s, i, j + 1) + AT(%s, i + 1, j + 1)) -\n"
+					 "%s\t\t\t  (AT(%s, i - 1, j - 1) + 2.0f * AT(%s, i, j - 1) + AT(%s, i + 1, j - 1));\n"
+					 "%s\tv = sqrt(gx * gx + gy * gy);\n"
+					 "%s}\n",
+					 indent,
+					 indent, input, input, input,
+					 indent, input, input, input,
+					 indent, input, input, input,
+					 indent, input, input, input,
+					 indent, indent);
+	case CLUT_STAGE_GAUSSIAN:
+		/* separable weights, as a constant table */
+		if (!clut_appendSource(header, "__constant float clut_stage%u_weights[%u] = {", index, 2 * radius + 1)) {
+			return 0;
+		}
+		for (i = 0; i <= 2 * radius; ++i) {
+			d = (float) i - (float) radius;
+			sum += expf(-d * d / (2.0f * stage->params[0] * stage->params[0]));
+		}
+		for (i = 0; i <= 2 * radius; ++i) {
+			d = (float) i - (float) radius;
+			if (!clut_appendSource(header, "%s%.9ef", (0 == i) ? "" : ", ",
+					       expf(-d * d / (2.0f * stage->params[0] * stage->params[0])) / sum)) {
+				return 0;
+			}
+		}
+		if (!clut_appendSource(header, "};\n")) {
+			return 0;
+		}
+		snprintf(weights, sizeof(weights), "clut_stage%u_weights", index);
+		init = "(float4) (0.0f)";
+		accumulate = "v += %s[dx + %u] * %s[dy + %u] * AT(%s, i + dx, j + dy);\n";
+		break;
+	case CLUT_STAGE_BOX:
+		init = "(float4) (0.0f)";
+		accumulate = "v += AT(%s, i + dx, j + dy);\n";
+		scale = "v *= %.9ef;\n";
+		break;
+	case CLUT_STAGE_ERODE:
+		init = "(float4) (INFINITY)";
+		accumulate = "v = fmin(v, AT(%s, i + dx, j + dy));\n";
+		break;
+	case CLUT_STAGE_DILATE:
+		init = "(float4) (-INFINITY)";
+		accumulate = "v = fmax(v, AT(%s, i + dx, j + dy));\n";
+		break;
+	default:
+		return 0;
+	}
+
+	if (!clut_appendSource(body,
+			       "%s{\n"
+			       "%s\tint dx, dy;\n"
+			       "%s\tv = %s;\n"
+			       "%s\tfor (dy = -%u; dy <= %u; ++dy) {\n"
+			       "%s\t\tfor (dx = -%u; dx <= %u; ++dx) {\n"
+			       "%s\t\t\t",
+			       indent, indent, indent, init,
+			       indent, radius, radius,
+			       indent, radius, radius,
+			       indent)) {
+		return 0;
+	}
+	if (CLUT_STAGE_GAUSSIAN == stage->type) {
+		if (!clut_appendSource(body, accumulate, weights, radius, weights, radius, input)) {
+			return 0;
+		}
+	} else if (!clut_appendSource(body, accumulate, input)) {
+		return 0;
+	}
+	if (!clut_appendSource(body, "%s\t\t}\n%s\t}\n", indent, indent)) {
+		return 0;
+	}
+	if ((NULL != scale) &&
+	    (!clut_appendSource(body, "%s\t", indent) ||
+	     !clut_appendSource(body, scale, 1.0f / ((2 * radius + 1) * (2 * radius + 1))))) {
+		return 0;
+	}
+	return clut_appendSource(body, "%s}\n", indent);
+}
+
+/*!
+ * @function clut_generateChainSource
+ * Generates the fused kernel clut_filter_chain for [n_stages] [stages],
+ * [n_stencils] of which are stencils whose radii sum to [halo].
+ * The tile with its halo is loaded to clut_a through the point stages
+ * before the first stencil; each stencil but the last computes, on the
+ * region it leaves valid, its output followed by the point stages up to
+ * the next stencil, ping-ponging between clut_a and clut_b; the last one
+ * computes only each work-item's pixel, which goes to the destination.
+ * @warning Result should be freed.
+ */
+static char * clut_generateChainSource(cl_uint n_stages, const clut_filter_stage *stages,
+				       cl_uint halo, cl_uint n_stencils)
+{
+	struct clut_source header = {NULL, 0, 0}, body = {NULL, 0, 0};
+	const char *input = "clut_a", *output = "clut_b", *swap;
+	cl_uint k = 0, s, remaining = halo;
+	int ok;
+
+	ok = clut_appendSource(&header,
+			       "#define CHAIN_HALO	%u\n"
+			       "#define CHAIN_STRIDE	(TILE_W + 2 * CHAIN_HALO)\n"
+			       "#define CHAIN_ROWS	(TILE_H + 2 * CHAIN_HALO)\n"
+			       "#define AT(tile,i,j)	(tile)[(j) * CHAIN_STRIDE + (i)]\n"
+			       "\n",
+			       halo) &&
+	     clut_appendSource(&body,
+			       "\n"
+			       "__kernel __attribute__((reqd_work_group_size(TILE_W, TILE_H, 1)))\n"
+			       "void clut_filter_chain(SRC_PARAMS, const int width, const int height, DST_PARAMS)\n"
+			       "{\n"
+			       "	const int lx = get_local_id(0), ly = get_local_id(1);\n"
+			       "	const int x0 = get_group_id(0) * TILE_W, y0 = get_group_id(1) * TILE_H;\n"
+			       "	float4 v;\n"
+			       "	int i, j;\n");
+
+	if (ok && (0 == n_stencils)) {
+		ok = clut_appendSource(&body,
+				       "\n"
+				       "	if ((x0 + lx >= width) || (y0 + ly >= height)) {\n"
+				       "		return;\n"
+				       "	}\n"
+				       "	v = SRC_LOAD(x0 + lx, y0 + ly);\n");
+		for (k = 0; ok && (k < n_stages); ++k) {
+			ok = clut_writePointStage(&body, &stages[k], "\t");
+		}
+		ok = ok && clut_appendSource(&body, "	DST_STORE(x0 + lx, y0 + ly, v);\n}\n");
+		goto done;
+	}
+
+	/* load */
+	ok = ok &&
+	     clut_appendSource(&body, "	__local float4 clut_a[CHAIN_STRIDE * CHAIN_ROWS];\n") &&
+	     ((1 == n_stencils) || clut_appendSource(&body, "	__local float4 clut_b[CHAIN_STRIDE * CHAIN_ROWS];\n")) &&
+	     clut_appendSource(&body,
+			       "\n"
+			       "	for (j = ly; j < CHAIN_ROWS; j += TILE_H) {\n"
+			       "		for (i = lx; i < CHAIN_STRIDE; i += TILE_W) {\n"
+			       "			v = SRC_LOAD(clamp(x0 + i - CHAIN_HALO, 0, width - 1), clamp(y0 + j - CHAIN_HALO, 0, height - 1));\n");
+	for (; ok && (k < n_stages) && !clut_isStencilStage(&stages[k]); ++k) {
+		ok = clut_writePointStage(&body, &stages[k], "\t\t\t");
+	}
+	ok = ok && clut_appendSource(&body,
+				     "			AT(clut_a, i, j) = v;\n"
+				     "		}\n"
+				     "	}\n"
+				     "	barrier(CLK_LOCAL_MEM_FENCE);\n");
+
+	/* stencils, each followed by its point stages */
+	for (s = 0; ok && (s < n_stencils); ++s) {
+		remaining -= clut_getStageRadius(&stages[k]);
+		if (s + 1 < n_stencils) {
+			ok = clut_appendSource(&body,
+					       "\n"
+					       "	for (j = CHAIN_HALO - %u + ly; j < CHAIN_HALO + TILE_H + %u; j += TILE_H) {\n"
+					       "		for (i = CHAIN_HALO - %u + lx; i < CHAIN_HALO + TILE_W + %u; i += TILE_W) {\n",
+					       remaining, remaining, remaining, remaining) &&
+			     clut_writeStencilStage(&header, &body, &stages[k], k, input, "\t\t\t");
+			for (++k; ok && (k < n_stages) && !clut_isStencilStage(&stages[k]); ++k) {
+				ok = clut_writePointStage(&body, &stages[k], "\t\t\t");
+			}
+			ok = ok && clut_appendSource(&body,
+						     "			AT(%s, i, j) = v;\n"
+						     "		}\n"
+						     "	}\n"
+						     "	barrier(CLK_LOCAL_MEM_FENCE);\n",
+						     output);
+			swap = input;
+			input = output;
+			output = swap;
+		} else {
+			ok = clut_appendSource(&body,
+					       "\n"
+					       "	if ((x0 + lx >= width) || (y0 + ly >= height)) {\n"
+					       "		return;\n"
+					       "	}\n"
+					       "	i = CHAIN_HALO + lx;\n"
+					       "	j = CHAIN_HALO + ly;\n") &&
+			     clut_writeStencilStage(&header, &body, &stages[k], k, input, "\t");
+			for (++k; ok && (k < n_stages); ++k) {
+				ok = clut_writePointStage(&body, &stages[k], "\t");
+			}
+			ok = ok && clut_appendSource(&body, "	DST_STORE(x0 + lx, y0 + ly, v);\n}\n");
+		}
+	}
+
+done:	ok = ok && clut_appendSource(&header, "%s", body.text);
+	free(body.text);
+	if (!ok) {
+		free(header.text);
+		return NULL;
+	}
+	return header.text;
+}
+
+/*!
+ * @function clut_createFilterChain
+ * Checks [n_stages] [stages], and generates the fused kernel source for
+ * them.
+ * @warning Result should be released with clut_releaseFilterChain.
+ */
+clut_filter_chain * clut_createFilterChain(cl_uint n_stages, const clut_filter_stage *stages, cl_int *ret)
+{
+	const char * const fname = "clut_createFilterChain";
+	clut_filter_chain *chain;
+	cl_uint i, halo = 0, n_stencils = 0;
+	cl_int err;
+
+	err = CL_INVALID_VALUE;
+	if ((0 == n_stages) || (NULL == stages)) {
+		Debug_out(DEBUG_FILTERS, "%s: empty chain.\n", fname);
+		goto error1;
+	}
+	for (i = 0; i < n_stages; ++i) {
+		if ((CLUT_STAGE_SCALE > stages[i].type) || (CLUT_STAGE_SOBEL < stages[i].type) ||
+		    ((CLUT_STAGE_EXPRESSION == stages[i].type) && (NULL == stages[i].expression)) ||
+		    ((CLUT_STAGE_GAUSSIAN == stages[i].type) && !(0.0f < stages[i].params[0])) ||
+		    (clut_isStencilStage(&stages[i]) && (0 == clut_getStageRadius(&stages[i])))) {
+			Debug_out(DEBUG_FILTERS, "%s: invalid stage #%u.\n", fname, i);
+			goto error1;
+		}
+		if (clut_isStencilStage(&stages[i])) {
+			halo += clut_getStageRadius(&stages[i]);
+			++n_stencils;
+		}
+	}
+	if (CLUT_FILTER_CHAIN_MAX_HALO < halo) {
+		Debug_out(DEBUG_FILTERS, "%s: stencil radii sum to %u, more than %u.\n",
+			  fname, halo, CLUT_FILTER_CHAIN_MAX_HALO);
+		goto error1;
+	}
+
+	err = CL_OUT_OF_HOST_MEMORY;
+	chain = malloc(sizeof(clut_filter_chain));
+	if (NULL == chain) {
+		goto error1;
+	}
+	chain->source = clut_generateChainSource(n_stages, stages, halo, n_stencils);
+	if (NULL == chain->source) {
+		goto error2;
+	}
+	chain->halo = halo;
+	chain->n_tiles = (1 < n_stencils) ? 2 : n_stencils;
+
+	Debug_out(DEBUG_FILTERS, "%s: %u stages fused, %u stencils, halo %u.\n", fname, n_stages, n_stencils, halo);
+	if (NULL != ret) {
+		*ret = CL_SUCCESS;
+	}
+	return chain;
+
+error2:	free(chain);
+error1:	if (NULL != ret) {
+		*ret = err;
+	}
+	return NULL;
+}
+
+/*!
+ * @function clut_releaseFilterChain
+ * Releases [chain]; the programs built for it stay in the cache.
+ */
+void clut_releaseFilterChain(clut_filter_chain *chain)
+{
+	if (NULL == chain) {
+		return;
+	}
+	free(chain->source);
+	free(chain);
+}
+
+/*!
+ * @function clut_getFilterChainSource
+ * Returns the generated source of [chain], without the storage macros, or
+ * NULL if [chain] is NULL.
+ */
+const char * clut_getFilterChainSource(clut_filter_chain *chain)
+{
+	return (NULL != chain) ? chain->source : NULL;
+}
+
+/*!
+ * @function clut_runFilterChain
+ * Runs [chain] from [src] to [dst] in a single kernel launch.
+ */
+cl_int clut_runFilterChain(clut_filter_chain *chain,
+			   cl_command_queue command_queue,
+			   cl_mem src, const clut_image_desc *src_desc,
+			   cl_mem dst, const clut_image_desc *dst_desc,
+			   cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	const char * const fname = "clut_runFilterChain";
+	const char *sources[2];
+	struct clut_filter_tile tile;
+	cl_int width, height;
+	size_t global[2], local[2];
+	cl_kernel kernel;
+	cl_uint index = 0;
+	cl_int ret = CL_INVALID_VALUE;
+
+	if ((NULL == chain) || !clut_checkFilterDescs(fname, src_desc, dst_desc, 1) ||
+	    !clut_getFilterTile(command_queue, chain->halo, chain->halo, chain->n_tiles, &tile)) {
+		goto error;
+	}
+	width = (cl_int) src_desc->width;
+	height = (cl_int) src_desc->height;
+
+	/* the storage macros, then the chain */
+	sources[0] = filters_sources[0];
+	sources[1] = chain->source;
+	kernel = clut_getFilterKernel(command_queue, ARRAY_LEN(sources), sources,
+				      src_desc, dst_desc, &tile, CLUT_FILTER_OP_CONVOLVE, "clut_filter_chain");
+	if (NULL == kernel) {
+		ret = CL_INVALID_KERNEL_NAME;
+		goto error;
+	}
+	if (!clut_returnSuccess(ret = clut_setFilterMemArgs(kernel, &index, &src, src_desc)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, index++, sizeof(cl_int), &width)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, index++, sizeof(cl_int), &height)) ||
+	    !clut_returnSuccess(ret = clut_setFilterMemArgs(kernel, &index, &dst, dst_desc))) {
+		clut_releaseCachedKernel(kernel);
+		goto error;
+	}
+	local[0] = tile.width;
+	local[1] = tile.height;
+	global[0] = CLUT_ROUND_UP(src_desc->width, local[0]);
+	global[1] = CLUT_ROUND_UP(src_desc->height, local[1]);
+	ret = clut_enqueueNDRangeKernel(command_queue, kernel, 2, NULL, global, local, n_wait, wait_list, event);
+	clut_releaseCachedKernel(kernel);
+
+error:	return ret;
+}
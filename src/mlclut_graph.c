@@ -0,0 +1,815 @@
+/**
+ * @file
+ * @author Michele Laurenti
+ * @language c
+ *
+ * Task graphs over out-of-order or multiple in-order command queues.
+ *
+ * Nodes are stored in insertion order, which is already topological since
+ * a node only depends on earlier nodes. The schedule sorts them by level
+ * (the length of the longest dependency chain leading to them), so that
+ * independent branches interleave, and assigns each node a queue: the queue
+ * of a dependency that was the last node put there, if any, or else the
+ * least loaded queue. Dependencies on the same in-order queue need no event.
+ */
+
+#include "mlclut_graph.h"
+#include "mlclut_descriptions.h"
+#include "mlclut_interpose.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <Debug.h>
+
+#define DEBUG_GRAPH	"mlclut_debug_graph"
+
+#define INITIAL_NODES	16
+
+enum clut_graph_node_type {
+	CLUT_GRAPH_KERNEL,
+	CLUT_GRAPH_COPY,
+	CLUT_GRAPH_WRITE,
+	CLUT_GRAPH_READ,
+	CLUT_GRAPH_HOST
+};
+
+struct clut_graph_arg {
+	size_t size;
+	void *value;
+	int set;
+};
+
+struct clut_graph_node {
+	enum clut_graph_node_type type;
+	int *deps;
+	cl_uint n_deps;
+	size_t n_successors;
+	size_t level;
+	/* kernels */
+	cl_kernel kernel;
+	cl_uint work_dim;
+	size_t offset[3];
+	size_t global[3];
+	size_t local[3];
+	int has_offset;
+	int has_local;
+	struct clut_graph_arg *args;
+	cl_uint n_args;
+	/* copies, reads and writes */
+	cl_mem src;
+	cl_mem dst;
+	size_t src_offset;
+	size_t dst_offset;
+	size_t size;
+	void *ptr;
+	/* host functions */
+	clut_graph_host_function function;
+	void *user_data;
+	/* schedule */
+	cl_uint queue;
+	cl_event event;
+};
+
+struct clut_graph {
+	struct clut_graph_node *nodes;
+	size_t n_nodes;
+	size_t capacity;
+	cl_uint max_deps;
+	/* schedule */
+	int scheduled;
+	size_t *order;
+	cl_command_queue *queues;
+	cl_uint n_queues;
+	int *in_order;
+	cl_context context;
+	/* previous launch */
+	cl_event *last;
+	size_t n_last;
+	cl_event *wait;
+};
+
+struct clut_graph_host_call {
+	clut_graph_host_function function;
+	void *user_data;
+	cl_event user;
+};
+
+/**
+ * Function declaration
+ */
+
+static int clut_graphAddNode(clut_graph *graph, enum clut_graph_node_type type, cl_uint n_deps, const int *deps);
+static void clut_graphReleaseSchedule(clut_graph *graph);
+static cl_int clut_graphSchedule(clut_graph *graph, cl_uint n_queues, const cl_command_queue *queues);
+static cl_int clut_graphEnqueueHost(clut_graph *graph, struct clut_graph_node *node, cl_uint n_wait);
+static cl_int clut_graphEnqueueNode(clut_graph *graph, struct clut_graph_node *node, cl_uint n_wait);
+static void clut_graphHostCallback(cl_event event, cl_int status, void *user_data);
+
+/**
+ * Function definition
+ */
+
+/*!
+ * @function clut_createGraph
+ * Creates an empty graph.
+ */
+clut_graph * clut_createGraph(void)
+{
+	const char * const fname = "clut_createGraph";
+	clut_graph *graph;
+
+	graph = calloc(1, sizeof(*graph));
+	if (NULL == graph) {
+		Debug_out(DEBUG_GRAPH, "%s: calloc failed.\n", fname);
+		return NULL;
+	}
+	graph->nodes = calloc(INITIAL_NODES, sizeof(struct clut_graph_node));
+	if (NULL == graph->nodes) {
+		Debug_out(DEBUG_GRAPH, "%s: calloc failed.\n", fname);
+		free(graph);
+		return NULL;
+	}
+	graph->capacity = INITIAL_NODES;
+
+	return graph;
+}
+
+/*!
+ * @function clut_releaseGraph
+ * Waits for the last launch of [graph] to complete, and releases it, along
+ * with the references it holds on kernels and memory objects.
+ */
+void clut_releaseGraph(clut_graph *graph)
+{
+	struct clut_graph_node *node;
+	size_t i;
+	cl_uint j;
+
+	if (NULL == graph) {
+		return;
+	}
+	clut_graphWait(graph);
+
+	for (i = 0; i < graph->n_nodes; ++i) {
+		node = &graph->nodes[i];
+		if (NULL != node->event) {
+			clReleaseEvent(node->event);
+		}
+		if (NULL != node->kernel) {
+			clReleaseKernel(node->kernel);
+		}
+		if (NULL != node->src) {
+			clReleaseMemObject(node->src);
+		}
+		if (NULL != node->dst) {
+			clReleaseMemObject(node->dst);
+		}
+		for (j = 0; j < node->n_args; ++j) {
+			free(node->args[j].value);
+		}
+		free(node->args);
+		free(node->deps);
+	}
+	clut_graphReleaseSchedule(graph);
+	free(graph->nodes);
+	free(graph);
+}
+
+/*!
+ * @function clut_graphAddNode
+ * Appends a node of type [type], depending on [deps].
+ * @return
+ * The id of the new node, or -1 on failure.
+ */
+static int clut_graphAddNode(clut_graph *graph, enum clut_graph_node_type type, cl_uint n_deps, const int *deps)
+{
+	const char * const fname = "clut_graphAddNode";
+	struct clut_graph_node *node, *tmp;
+	cl_uint i;
+
+	if ((NULL == graph) || ((0 != n_deps) && (NULL == deps))) {
+		Debug_out(DEBUG_GRAPH, "%s: NULL pointer argument.\n", fname);
+		return -1;
+	}
+	for (i = 0; i < n_deps; ++i) {
+		if ((deps[i] < 0) || ((size_t) deps[i] >= graph->n_nodes)) {
+			Debug_out(DEBUG_GRAPH, "%s: unknown dependency %d.\n", fname, deps[i]);
+			return -1;
+		}
+	}
+
+	if (graph->n_nodes == graph->capacity) {
+		tmp = realloc(graph->nodes, 2 * graph->capacity * sizeof(struct clut_graph_node));
+		if (NULL == tmp) {
+			Debug_out(DEBUG_GRAPH, "%s: realloc failed.\n", fname);
+			return -1;
+		}
+		graph->nodes = tmp;
+		graph->capacity *= 2;
+	}
+
+	node = &graph->nodes[graph->n_nodes];
+	memset(node, 0, sizeof(*node));
+	node->type = type;
+	if (0 != n_deps) {
+		node->deps = malloc(n_deps * sizeof(int));
+		if (NULL == node->deps) {
+			Debug_out(DEBUG_GRAPH, "%s: malloc failed.\n", fname);
+			return -1;
+		}
+		memcpy(node->deps, deps, n_deps * sizeof(int));
+	}
+	node->n_deps = n_deps;
+	for (i = 0; i < n_deps; ++i) {
+		graph->nodes[deps[i]].n_successors++;
+		if (graph->nodes[deps[i]].level + 1 > node->level) {
+			node->level = graph->nodes[deps[i]].level + 1;
+		}
+	}
+	if (n_deps > graph->max_deps) {
+		graph->max_deps = n_deps;
+	}
+	graph->scheduled = 0;
+
+	return (int) graph->n_nodes++;
+}
+
+/*!
+ * @function clut_graphAddKernel
+ * Adds a launch of [kernel]. Arguments set with clut_graphSetKernelArg are
+ * set before each launch; the others keep the value they have in [kernel].
+ * @return
+ * The id of the new node, or -1 on failure.
+ */
+int clut_graphAddKernel(clut_graph *graph,
+			cl_kernel kernel,
+			cl_uint work_dim,
+			const size_t *global_work_offset,
+			const size_t *global_work_size,
+			const size_t *local_work_size,
+			cl_uint n_deps,
+			const int *deps)
+{
+	const char * const fname = "clut_graphAddKernel";
+	struct clut_graph_node *node;
+	cl_uint n_args;
+	cl_int ret;
+	int id;
+
+	if ((NULL == kernel) || (NULL == global_work_size) || (0 == work_dim) || (work_dim > 3)) {
+		Debug_out(DEBUG_GRAPH, "%s: invalid argument.\n", fname);
+		return -1;
+	}
+	ret = clGetKernelInfo(kernel, CL_KERNEL_NUM_ARGS, sizeof(n_args), &n_args, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to get kernel arguments number", error1);
+
+	id = clut_graphAddNode(graph, CLUT_GRAPH_KERNEL, n_deps, deps);
+	if (id < 0) {
+		goto error1;
+	}
+	node = &graph->nodes[id];
+	if (0 != n_args) {
+		node->args = calloc(n_args, sizeof(struct clut_graph_arg));
+		if (NULL == node->args) {
+			Debug_out(DEBUG_GRAPH, "%s: calloc failed.\n", fname);
+			goto error2;
+		}
+	}
+	node->n_args = n_args;
+	node->work_dim = work_dim;
+	memcpy(node->global, global_work_size, work_dim * sizeof(size_t));
+	if (NULL != global_work_offset) {
+		memcpy(node->offset, global_work_offset, work_dim * sizeof(size_t));
+		node->has_offset = 1;
+	}
+	if (NULL != local_work_size) {
+		memcpy(node->local, local_work_size, work_dim * sizeof(size_t));
+		node->has_local = 1;
+	}
+	clRetainKernel(kernel);
+	node->kernel = kernel;
+
+	return id;
+
+error2:	/* undo the node, it is the last one */
+	while (0 != node->n_deps--) {
+		graph->nodes[node->deps[node->n_deps]].n_successors--;
+	}
+	free(node->deps);
+	graph->n_nodes--;
+error1:	return -1;
+}
+
+/*!
+ * @function clut_graphSetKernelArg
+ * Stores argument [index] of kernel node [node]; [value] is copied, and can
+ * be NULL for local memory arguments.
+ * @return
+ * 0 on success, a negative value on failure.
+ */
+int clut_graphSetKernelArg(clut_graph *graph, int node, cl_uint index, size_t size, const void *value)
+{
+	const char * const fname = "clut_graphSetKernelArg";
+	struct clut_graph_arg *arg;
+	void *copy = NULL;
+
+	if ((NULL == graph) || (node < 0) || ((size_t) node >= graph->n_nodes) ||
+	    (CLUT_GRAPH_KERNEL != graph->nodes[node].type) || (index >= graph->nodes[node].n_args)) {
+		Debug_out(DEBUG_GRAPH, "%s: invalid argument.\n", fname);
+		return -1;
+	}
+	if (NULL != value) {
+		copy = malloc(size);
+		if (NULL == copy) {
+			Debug_out(DEBUG_GRAPH, "%s: malloc failed.\n", fname);
+			return -1;
+		}
+		memcpy(copy, value, size);
+	}
+
+	arg = &graph->nodes[node].args[index];
+	free(arg->value);
+	arg->value = copy;
+	arg->size = size;
+	arg->set = 1;
+
+	return 0;
+}
+
+/*!
+ * @function clut_graphAddCopy
+ * Adds a copy of [size] bytes between two buffers.
+ * @return
+ * The id of the new node, or -1 on failure.
+ */
+int clut_graphAddCopy(clut_graph *graph,
+		      cl_mem src,
+		      cl_mem dst,
+		      size_t src_offset,
+		      size_t dst_offset,
+		      size_t size,
+		      cl_uint n_deps,
+		      const int *deps)
+{
+	struct clut_graph_node *node;
+	int id;
+
+	if ((NULL == src) || (NULL == dst)) {
+		return -1;
+	}
+	id = clut_graphAddNode(graph, CLUT_GRAPH_COPY, n_deps, deps);
+	if (id < 0) {
+		return -1;
+	}
+	node = &graph->nodes[id];
+	clRetainMemObject(src);
+	clRetainMemObject(dst);
+	node->src = src;
+	node->dst = dst;
+	node->src_offset = src_offset;
+	node->dst_offset = dst_offset;
+	node->size = size;
+
+	return id;
+}
+
+/*!
+ * @function clut_graphAddWrite
+ * Adds a non-blocking write of [size] bytes from [ptr], which must stay
+ * valid and unchanged until the node completes.
+ * @return
+ * The id of the new node, or -1 on failure.
+ */
+int clut_graphAddWrite(clut_graph *graph,
+		       cl_mem buffer,
+		       size_t offset,
+		       size_t size,
+		       const void *ptr,
+		       cl_uint n_deps,
+		       const int *deps)
+{
+	struct clut_graph_node *node;
+	int id;
+
+	if ((NULL == buffer) || (NULL == ptr)) {
+		return -1;
+	}
+	id = clut_graphAddNode(graph, CLUT_GRAPH_WRITE, n_deps, deps);
+	if (id < 0) {
+		return -1;
+	}
+	node = &graph->nodes[id];
+	clRetainMemObject(buffer);
+	node->dst = buffer;
+	node->dst_offset = offset;
+	node->size = size;
+	node->ptr = (void *) ptr;
+
+	return id;
+}
+
+/*!
+ * @function clut_graphAddRead
+ * Adds a non-blocking read of [size] bytes into [ptr].
+ * @return
+ * The id of the new node, or -1 on failure.
+ */
+int clut_graphAddRead(clut_graph *graph,
+		      cl_mem buffer,
+		      size_t offset,
+		      size_t size,
+		      void *ptr,
+		      cl_uint n_deps,
+		      const int *deps)
+{
+	struct clut_graph_node *node;
+	int id;
+
+	if ((NULL == buffer) || (NULL == ptr)) {
+		return -1;
+	}
+	id = clut_graphAddNode(graph, CLUT_GRAPH_READ, n_deps, deps);
+	if (id < 0) {
+		return -1;
+	}
+	node = &graph->nodes[id];
+	clRetainMemObject(buffer);
+	node->src = buffer;
+	node->src_offset = offset;
+	node->size = size;
+	node->ptr = ptr;
+
+	return id;
+}
+
+/*!
+ * @function clut_graphAddHost
+ * Adds a call to [function], once its dependencies complete. Nodes
+ * depending on it start after it returns.
+ * @return
+ * The id of the new node, or -1 on failure.
+ */
+int clut_graphAddHost(clut_graph *graph,
+		      clut_graph_host_function function,
+		      void *user_data,
+		      cl_uint n_deps,
+		      const int *deps)
+{
+	struct clut_graph_node *node;
+	int id;
+
+	if (NULL == function) {
+		return -1;
+	}
+	id = clut_graphAddNode(graph, CLUT_GRAPH_HOST, n_deps, deps);
+	if (id < 0) {
+		return -1;
+	}
+	node = &graph->nodes[id];
+	node->function = function;
+	node->user_data = user_data;
+
+	return id;
+}
+
+/*!
+ * @function clut_graphReleaseSchedule
+ * Frees the schedule of [graph].
+ */
+static void clut_graphReleaseSchedule(clut_graph *graph)
+{
+	free(graph->order);
+	free(graph->queues);
+	free(graph->in_order);
+	free(graph->last);
+	free(graph->wait);
+	graph->order = NULL;
+	graph->queues = NULL;
+	graph->in_order = NULL;
+	graph->last = NULL;
+	graph->wait = NULL;
+	graph->n_queues = 0;
+	graph->scheduled = 0;
+}
+
+/*!
+ * @function clut_graphSchedule
+ * Computes the launch order of the nodes of [graph], and their queues.
+ */
+static cl_int clut_graphSchedule(clut_graph *graph, cl_uint n_queues, const cl_command_queue *queues)
+{
+	const char * const fname = "clut_graphSchedule";
+	struct clut_graph_node *node, *dep;
+	cl_command_queue_properties properties;
+	size_t *count = NULL, *load = NULL, max_level = 0, i, l;
+	int *tail = NULL;
+	cl_uint q, best, j;
+	cl_int ret;
+
+	clut_graphReleaseSchedule(graph);
+
+	graph->order = malloc(graph->n_nodes * sizeof(size_t));
+	graph->queues = malloc(n_queues * sizeof(cl_command_queue));
+	graph->in_order = malloc(n_queues * sizeof(int));
+	graph->last = malloc(graph->n_nodes * sizeof(cl_event));
+	graph->wait = malloc((graph->max_deps + graph->n_nodes) * sizeof(cl_event));
+	tail = malloc(n_queues * sizeof(int));
+	load = calloc(n_queues, sizeof(size_t));
+	for (i = 0; i < graph->n_nodes; ++i) {
+		if (graph->nodes[i].level > max_level) {
+			max_level = graph->nodes[i].level;
+		}
+	}
+	count = calloc(max_level + 2, sizeof(size_t));
+	if ((NULL == graph->order) || (NULL == graph->queues) || (NULL == graph->in_order) ||
+	    (NULL == graph->last) || (NULL == graph->wait) || (NULL == tail) || (NULL == load) || (NULL == count)) {
+		Debug_out(DEBUG_GRAPH, "%s: malloc failed.\n", fname);
+		ret = CL_OUT_OF_HOST_MEMORY;
+		goto error;
+	}
+
+	memcpy(graph->queues, queues, n_queues * sizeof(cl_command_queue));
+	graph->n_queues = n_queues;
+	for (q = 0; q < n_queues; ++q) {
+		ret = clGetCommandQueueInfo(queues[q], CL_QUEUE_PROPERTIES, sizeof(properties), &properties, NULL);
+		CLUT_CHECK_ERROR(ret, "Unable to get command queue properties", error);
+		graph->in_order[q] = !(properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
+		tail[q] = -1;
+	}
+	ret = clGetCommandQueueInfo(queues[0], CL_QUEUE_CONTEXT, sizeof(graph->context), &graph->context, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to get command queue context", error);
+
+	/* stable counting sort by level */
+	for (i = 0; i < graph->n_nodes; ++i) {
+		count[graph->nodes[i].level + 1]++;
+	}
+	for (l = 1; l <= max_level + 1; ++l) {
+		count[l] += count[l - 1];
+	}
+	for (i = 0; i < graph->n_nodes; ++i) {
+		graph->order[count[graph->nodes[i].level]++] = i;
+	}
+
+	for (i = 0; i < graph->n_nodes; ++i) {
+		node = &graph->nodes[graph->order[i]];
+		best = n_queues;
+		/* continue a chain: a host node's successors can't, its marker completes before it does */
+		for (j = 0; j < node->n_deps; ++j) {
+			dep = &graph->nodes[node->deps[j]];
+			if ((CLUT_GRAPH_HOST != dep->type) && (tail[dep->queue] == node->deps[j])) {
+				best = dep->queue;
+				break;
+			}
+		}
+		if (best == n_queues) {
+			best = 0;
+			for (q = 1; q < n_queues; ++q) {
+				if (load[q] < load[best]) {
+					best = q;
+				}
+			}
+		}
+		node->queue = best;
+		tail[best] = (int) graph->order[i];
+		load[best]++;
+	}
+	for (q = 0; q < n_queues; ++q) {
+		Debug_out(DEBUG_GRAPH, "%s: queue %u gets %zu nodes.\n", fname, q, load[q]);
+	}
+
+	free(count);
+	free(load);
+	free(tail);
+	graph->scheduled = 1;
+	return CL_SUCCESS;
+
+error:	free(count);
+	free(load);
+	free(tail);
+	clut_graphReleaseSchedule(graph);
+	return ret;
+}
+
+/*!
+ * @function clut_graphHostCallback
+ * Runs a host node once its marker completes, then releases its successors.
+ */
+static void clut_graphHostCallback(cl_event event, cl_int status, void *user_data)
+{
+	struct clut_graph_host_call *call = user_data;
+
+	if (CL_COMPLETE == status) {
+		call->function(call->user_data);
+		clSetUserEventStatus(call->user, CL_COMPLETE);
+	} else {
+		/* propagate the failure of a dependency */
+		clSetUserEventStatus(call->user, (status < 0) ? status : CL_INVALID_EVENT);
+	}
+	clReleaseEvent(call->user);
+	free(call);
+}
+
+/*!
+ * @function clut_graphEnqueueHost
+ * Enqueues host node [node]: a marker waiting for its dependencies, whose
+ * callback runs the function and completes a user event standing for the
+ * node.
+ */
+static cl_int clut_graphEnqueueHost(clut_graph *graph, struct clut_graph_node *node, cl_uint n_wait)
+{
+	const char * const fname = "clut_graphEnqueueHost";
+	struct clut_graph_host_call *call;
+	cl_event marker;
+	cl_int ret;
+
+	call = malloc(sizeof(*call));
+	if (NULL == call) {
+		Debug_out(DEBUG_GRAPH, "%s: malloc failed.\n", fname);
+		return CL_OUT_OF_HOST_MEMORY;
+	}
+	call->function = node->function;
+	call->user_data = node->user_data;
+	call->user = clCreateUserEvent(graph->context, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create user event", error1);
+
+	ret = clEnqueueMarkerWithWaitList(graph->queues[node->queue], n_wait, (0 != n_wait) ? graph->wait : NULL, &marker);
+	CLUT_CHECK_ERROR(ret, "Unable to enqueue marker", error2);
+	/* the callback owns one reference, the node the other */
+	clRetainEvent(call->user);
+	node->event = call->user;
+	ret = clSetEventCallback(marker, CL_COMPLETE, clut_graphHostCallback, call);
+	clReleaseEvent(marker);
+	CLUT_CHECK_ERROR(ret, "Unable to set marker callback", error3);
+
+	return CL_SUCCESS;
+
+error3:	clReleaseEvent(call->user);
+error2:	clSetUserEventStatus(call->user, ret);
+	clReleaseEvent(call->user);
+	node->event = NULL;
+error1:	free(call);
+	return ret;
+}
+
+/*!
+ * @function clut_graphEnqueueNode
+ * Enqueues [node], waiting for the first [n_wait] events of the wait list
+ * of [graph].
+ */
+static cl_int clut_graphEnqueueNode(clut_graph *graph, struct clut_graph_node *node, cl_uint n_wait)
+{
+	cl_command_queue queue = graph->queues[node->queue];
+	const cl_event *wait = (0 != n_wait) ? graph->wait : NULL;
+	cl_int ret = CL_SUCCESS;
+	cl_uint i;
+
+	switch (node->type) {
+	case CLUT_GRAPH_KERNEL:
+		for (i = 0; i < node->n_args; ++i) {
+			if (node->args[i].set && !clut_returnSuccess(ret = clSetKernelArg(node->kernel, i, node->args[i].size, node->args[i].value))) {
+				return ret;
+			}
+		}
+		ret = clut_enqueueNDRangeKernel(queue, node->kernel, node->work_dim,
+						node->has_offset ? node->offset : NULL, node->global,
+						node->has_local ? node->local : NULL,
+						n_wait, wait, &node->event);
+		break;
+	case CLUT_GRAPH_COPY:
+		ret = clut_enqueueCopyBuffer(queue, node->src, node->dst, node->src_offset, node->dst_offset, node->size,
+					     n_wait, wait, &node->event);
+		break;
+	case CLUT_GRAPH_WRITE:
+		ret = clut_enqueueWriteBuffer(queue, node->dst, CL_FALSE, node->dst_offset, node->size, node->ptr,
+					      n_wait, wait, &node->event);
+		break;
+	case CLUT_GRAPH_READ:
+		ret = clut_enqueueReadBuffer(queue, node->src, CL_FALSE, node->src_offset, node->size, node->ptr,
+					     n_wait, wait, &node->event);
+		break;
+	case CLUT_GRAPH_HOST:
+		ret = clut_graphEnqueueHost(graph, node, n_wait);
+		break;
+	}
+
+	return ret;
+}
+
+/*!
+ * @function clut_graphLaunch
+ * Launches [graph] on [queues], which must share one context. The launch
+ * waits for the previous one. If [event] is not NULL, it receives an event
+ * completing with the whole launch.
+ * Nothing blocks: the graph is running when this returns.
+ */
+cl_int clut_graphLaunch(clut_graph *graph, cl_uint n_queues, const cl_command_queue *queues, cl_event *event)
+{
+	const char * const fname = "clut_graphLaunch";
+	struct clut_graph_node *node, *dep;
+	cl_uint n_wait, j, q;
+	size_t i;
+	cl_int ret = CL_SUCCESS;
+
+	if ((NULL == graph) || (0 == n_queues) || (NULL == queues)) {
+		Debug_out(DEBUG_GRAPH, "%s: invalid argument.\n", fname);
+		return CL_INVALID_VALUE;
+	}
+	if (0 == graph->n_nodes) {
+		Debug_out(DEBUG_GRAPH, "%s: empty graph.\n", fname);
+		return CL_INVALID_VALUE;
+	}
+	if (graph->scheduled && (graph->n_queues == n_queues)) {
+		for (q = 0; (q < n_queues) && (graph->queues[q] == queues[q]); ++q);
+		graph->scheduled = (q == n_queues);
+	}
+	if (!graph->scheduled) {
+		/* a new schedule may move nodes: the previous launch must be over */
+		clut_graphWait(graph);
+		ret = clut_graphSchedule(graph, n_queues, queues);
+		CLUT_CHECK_ERROR(ret, "Unable to schedule graph", error);
+	}
+
+	/* the sinks of the previous launch gate the roots of this one */
+	graph->n_last = 0;
+	for (i = 0; i < graph->n_nodes; ++i) {
+		node = &graph->nodes[i];
+		if (NULL == node->event) {
+			continue;
+		}
+		if (0 == node->n_successors) {
+			graph->last[graph->n_last++] = node->event;
+		} else {
+			clReleaseEvent(node->event);
+		}
+		node->event = NULL;
+	}
+
+	for (i = 0; i < graph->n_nodes; ++i) {
+		node = &graph->nodes[graph->order[i]];
+		n_wait = 0;
+		if (0 == node->n_deps) {
+			memcpy(graph->wait, graph->last, graph->n_last * sizeof(cl_event));
+			n_wait = (cl_uint) graph->n_last;
+		}
+		for (j = 0; j < node->n_deps; ++j) {
+			dep = &graph->nodes[node->deps[j]];
+			if ((CLUT_GRAPH_HOST != dep->type) && (dep->queue == node->queue) && graph->in_order[node->queue]) {
+				continue;
+			}
+			graph->wait[n_wait++] = dep->event;
+		}
+		ret = clut_graphEnqueueNode(graph, node, n_wait);
+		CLUT_CHECK_ERROR(ret, "Unable to enqueue graph node", error);
+	}
+
+	for (i = 0; i < graph->n_queues; ++i) {
+		clFlush(graph->queues[i]);
+	}
+
+	if (NULL != event) {
+		n_wait = 0;
+		for (i = 0; i < graph->n_nodes; ++i) {
+			if (0 == graph->nodes[i].n_successors) {
+				graph->wait[n_wait++] = graph->nodes[i].event;
+			}
+		}
+		ret = clEnqueueMarkerWithWaitList(graph->queues[0], n_wait, (0 != n_wait) ? graph->wait : NULL, event);
+		CLUT_CHECK_ERROR(ret, "Unable to enqueue graph marker", error);
+		clFlush(graph->queues[0]);
+	}
+
+error:	for (i = 0; i < graph->n_last; ++i) {
+		clReleaseEvent(graph->last[i]);
+	}
+	graph->n_last = 0;
+	return ret;
+}
+
+/*!
+ * @function clut_graphWait
+ * Waits for the last launch of [graph] to complete.
+ * @return
+ * CL_SUCCESS, or the error of a failed node.
+ */
+cl_int clut_graphWait(clut_graph *graph)
+{
+	cl_int ret = CL_SUCCESS, r;
+	size_t i;
+
+	if (NULL == graph) {
+		return CL_INVALID_VALUE;
+	}
+	for (i = 0; i < graph->n_nodes; ++i) {
+		if (NULL == graph->nodes[i].event) {
+			continue;
+		}
+		r = clWaitForEvents(1, &graph->nodes[i].event);
+		if (clut_returnSuccess(ret)) {
+			ret = r;
+		}
+	}
+
+	return ret;
+}
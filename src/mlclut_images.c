@@ -1,7 +1,11 @@
 #include "mlclut_images.h"
+#include "mlclut_interpose.h"
+#include "mlclut_memory.h"
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
 
 #include <pgm.h>
 
@@ -11,216 +15,495 @@
 #include <stb_image.h>
 #include <stb_image_write.h>
 
+#include "mlclut_convert.h"
+
 #include <StringUtils.h>
 #include <Debug.h>
 
 #define DEBUG_IMAGES	"mlclut_debug_images"
 
+/**
+ * Function declaration
+ */
+
+static cl_mem clut_convertToU8Buffer(cl_command_queue command_queue, cl_mem mem, const clut_image_desc *desc, clut_image_desc *dst_desc);
+static unsigned char * clut_decodeImageFile(const char * const filename, clut_image_desc *desc);
+
 /*!
- * @function clut_loadImageFromFile
- * Opens the image at [filename]. Supported image formats are pgm and all the
- * image formats supported by stb_image (github.com/nothings/stb).
- * @param context
- * The context in which the image will be created.
+ * @function clut_readImageFile
+ * Decodes the image at [filename] into host memory. Supported image formats
+ * are pgm and all the image formats supported by stb_image
+ * (github.com/nothings/stb). RGB images are expanded to RGBA, since OpenCL
+ * doesn't like plain RGB images.
+ * @warning Result should be freed with clut_freeImageData.
  * @param filename
  * The filename of the image to be opened.
  * @param width
  * A pointer where the width of the image will be stored. It can be NULL.
  * @param height
  * A pointer where the height of the image will be stored. It can be NULL.
- * @retun
- * NULL on failure, or a valid cl_image.
+ * @param components
+ * A pointer where the number of interleaved components will be stored. It can be NULL.
+ * @param channel_order
+ * A pointer where the matching cl_channel_order will be stored. It can be NULL.
+ * @return
+ * NULL on failure, or a buffer of width * height * components bytes.
  */
-cl_mem clut_loadImageFromFile(cl_context context, const char * const filename, int *width, int *height)
+unsigned char * clut_readImageFile(const char * const filename,
+				   int *width,
+				   int *height,
+				   int *components,
+				   cl_channel_order *channel_order)
 {
-	const char * const fname = "clut_loadImageFromFile";
+	const char * const fname = "clut_readImageFile";
+	int l_width, l_height, l_components, ret;
+	cl_channel_order l_channel_order;
+	unsigned char *img = NULL;
+
 	if (NULL == filename) {
 		Debug_out(DEBUG_IMAGES, "%s: NULL pointer argument.\n", fname);
+		goto error1;
 	}
-	cl_mem result = NULL;
-	int l_width, l_height;
-	unsigned char *img;
-	int ret, is_pgm, components;
-	cl_int cl_ret;
-
-	cl_image_format image_format = {0, 0};
-	cl_image_desc image_desc = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
-	/* load image from file into buffer */
-	if ((is_pgm = StringUtils_endsWith(filename, "pgm"))) {
+	if (StringUtils_endsWith(filename, "pgm")) {
 		/* pgm image, use demetrescu's micro library */
 		ret = pgm_load(&img, &l_height, &l_width, filename);
 		if (0 != ret) {
 			Debug_out(DEBUG_IMAGES, "%s: Unable to open pgm image '%s'.\n", fname, filename);
+			img = NULL;
 			goto error1;
 		}
-		image_format.image_channel_order = CL_R;
-		components = 1;
+		l_channel_order = CL_R;
+		l_components = 1;
 	} else {
 		/* use stb for any other format */
-		int channel_order;
-		img = stbi_load(filename, &l_width, &l_height, &channel_order, 0);
+		int stb_components;
+		img = stbi_load(filename, &l_width, &l_height, &stb_components, 0);
 		if (NULL == img) {
 			Debug_out(DEBUG_IMAGES, "%s: Unable to open image '%s'.\n", fname, filename);
 			goto error1;
 		}
-		switch (channel_order) {
+		switch (stb_components) {
 			case 1:
-				image_format.image_channel_order = CL_R;
-				components = 1;
+				l_channel_order = CL_R;
+				l_components = 1;
 				break;
 			case 2:
-				image_format.image_channel_order = CL_RA;
-				components = 2;
+				l_channel_order = CL_RA;
+				l_components = 2;
 				break;
 			case 3:
 				/* openCL doesn't like plain RGB images
 				 * so, I'll force stb to open RGB images as RGBA */
 				stbi_image_free(img);
-				img = stbi_load(filename, &l_width, &l_height, &channel_order, 4);
+				img = stbi_load(filename, &l_width, &l_height, &stb_components, 4);
 				if (NULL == img) {
 					Debug_out(DEBUG_IMAGES, "%s: Unable to open image '%s'.\n", fname, filename);
 					goto error1;
 				}
-				image_format.image_channel_order = CL_RGBA;
-				components = 4;
+				l_channel_order = CL_RGBA;
+				l_components = 4;
 				break;
 			case 4:
-				image_format.image_channel_order = CL_RGBA;
-				components = 4;
+				l_channel_order = CL_RGBA;
+				l_components = 4;
 				break;
 			default:
-				Debug_out(DEBUG_IMAGES, "%s: Unrecognized stb components number %d.\n", fname, channel_order);
+				Debug_out(DEBUG_IMAGES, "%s: Unrecognized stb components number %d.\n", fname, stb_components);
 				goto error2;
 		}
 	}
-	image_format.image_channel_data_type = CL_UNSIGNED_INT8;
+
+	if (NULL != width) {
+		*width = l_width;
+	}
+	if (NULL != height) {
+		*height = l_height;
+	}
+	if (NULL != components) {
+		*components = l_components;
+	}
+	if (NULL != channel_order) {
+		*channel_order = l_channel_order;
+	}
+	return img;
+
+error2:
+	clut_freeImageData(img);
+error1:
+	return NULL;
+}
+
+/*!
+ * @function clut_freeImageData
+ * Frees a buffer returned by clut_readImageFile. Both the pgm library and stb
+ * (with its default allocator) use malloc.
+ */
+void clut_freeImageData(unsigned char *data)
+{
+	stbi_image_free(data);
+}
+
+/*!
+ * @function clut_decodeImageFile
+ * Decodes the image at [filename] with clut_readImageFile, and describes
+ * its pixels in [desc]: tightly packed rows of 8 bit channels, with no
+ * storage yet.
+ * @warning Result should be freed with clut_freeImageData.
+ * @return
+ * NULL on failure, or a buffer of desc->height * desc->row_pitch bytes.
+ */
+static unsigned char * clut_decodeImageFile(const char * const filename, clut_image_desc *desc)
+{
+	unsigned char *img;
+	int width, height, components;
+	cl_channel_order channel_order;
+
+	img = clut_readImageFile(filename, &width, &height, &components, &channel_order);
+	if (NULL == img) {
+		return NULL;
+	}
+	memset(desc, 0, sizeof(clut_image_desc));
+	desc->width = width;
+	desc->height = height;
+	desc->row_pitch = (size_t) width * components;
+	desc->components = components;
+	desc->channel_order = channel_order;
+	desc->channel_type = CL_UNSIGNED_INT8;
+	return img;
+}
+
+/*!
+ * @function clut_loadImageFromFile
+ * Opens the image at [filename]. Supported image formats are pgm and all the
+ * image formats supported by stb_image (github.com/nothings/stb).
+ * @param context
+ * The context in which the image will be created.
+ * @param filename
+ * The filename of the image to be opened.
+ * @param width
+ * A pointer where the width of the image will be stored. It can be NULL.
+ * @param height
+ * A pointer where the height of the image will be stored. It can be NULL.
+ * @retun
+ * NULL on failure, or a valid cl_image.
+ */
+cl_mem clut_loadImageFromFile(cl_context context, const char * const filename, int *width, int *height)
+{
+	const char * const fname = "clut_loadImageFromFile";
+	if (NULL == filename) {
+		Debug_out(DEBUG_IMAGES, "%s: NULL pointer argument.\n", fname);
+	}
+	cl_mem result = NULL;
+	clut_image_desc desc;
+	unsigned char *img;
+	cl_int cl_ret;
+
+	cl_image_format image_format = {0, 0};
+	cl_image_desc image_desc = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+	/* load image from file into buffer */
+	img = clut_decodeImageFile(filename, &desc);
+	if (NULL == img) {
+		goto error1;
+	}
+	image_format.image_channel_order = desc.channel_order;
+	image_format.image_channel_data_type = desc.channel_type;
 	image_desc.image_type = CL_MEM_OBJECT_IMAGE2D;
-	image_desc.image_width = l_width;
-	image_desc.image_height = l_height;
-	image_desc.image_row_pitch = l_width * components;
+	image_desc.image_width = desc.width;
+	image_desc.image_height = desc.height;
+	image_desc.image_row_pitch = desc.row_pitch;
 
 	Debug_out(DEBUG_IMAGES, "%s: Opening %d x %d image with channel order '%s' and data type '%s'.\n",
 		fname,
-		l_width,
-		l_height,
+		(int) desc.width,
+		(int) desc.height,
 		clut_get_CL_CHANNEL_ORDER_Description(image_format.image_channel_order),
 		clut_get_CL_CHANNEL_TYPE_Description(image_format.image_channel_data_type));
 
 	/* create image */
-	result = clCreateImage(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, &image_format, &image_desc, img, &cl_ret);
+	result = clut_createTrackedImage(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, &image_format, &image_desc, img, "images", NULL, &cl_ret);
 	CLUT_CHECK_ERROR(cl_ret, "Unable to create cl_image", error2);
 	size_t elem_size;
 	cl_ret = clGetImageInfo(result, CL_IMAGE_ELEMENT_SIZE, sizeof(elem_size), &elem_size, NULL);
-	CLUT_CHECK_ERROR(cl_ret, "Unable to get image element size", error1);
+	CLUT_CHECK_ERROR(cl_ret, "Unable to get image element size", error2);
 
 	/* set width and height */
 	if (NULL != width) {
-		*width = l_width;
+		*width = (int) desc.width;
 	}
 	if (NULL != height) {
-		*height = l_height;
+		*height = (int) desc.height;
 	}
 
 error2:
-	if (is_pgm) {
-		free(img);
+	clut_freeImageData(img);
+error1:
+	return result;
+}
+
+/*!
+ * @function clut_loadImageToBuffer
+ * Opens the image at [filename] into a plain cl_mem buffer, for devices that
+ * lack image support. Each row is padded to the alignment returned by
+ * clut_getDeviceAlignment, so that every row starts on a cacheline boundary.
+ * @param context
+ * The context in which the buffer will be created.
+ * @param device
+ * The device whose alignment requirements are honored.
+ * @param filename
+ * The filename of the image to be opened.
+ * @param desc
+ * Where the layout of the buffer will be stored. Can't be NULL.
+ * @return
+ * NULL on failure, or a valid cl_mem buffer of desc->height * desc->row_pitch bytes.
+ */
+cl_mem clut_loadImageToBuffer(cl_context context,
+			      cl_device_id device,
+			      const char * const filename,
+			      clut_image_desc *desc)
+{
+	const char * const fname = "clut_loadImageToBuffer";
+	cl_mem result = NULL;
+	unsigned char *img, *padded;
+	size_t row_size, row_pitch, i;
+	cl_int cl_ret;
+
+	if (NULL == desc) {
+		Debug_out(DEBUG_IMAGES, "%s: NULL pointer argument.\n", fname);
+		goto error1;
+	}
+
+	img = clut_decodeImageFile(filename, desc);
+	if (NULL == img) {
+		goto error1;
+	}
+
+	row_size = desc->row_pitch;
+	row_pitch = CLUT_ROUND_UP(row_size, clut_getDeviceAlignment(device));
+
+	Debug_out(DEBUG_IMAGES, "%s: Opening %d x %d image with channel order '%s' into a buffer with row pitch %zu.\n",
+		fname,
+		(int) desc->width,
+		(int) desc->height,
+		clut_get_CL_CHANNEL_ORDER_Description(desc->channel_order),
+		row_pitch);
+
+	/* pad rows on the host, so the buffer is created in a single copy */
+	if (row_pitch != row_size) {
+		padded = calloc(desc->height, row_pitch);
+		if (NULL == padded) {
+			Debug_out(DEBUG_IMAGES, "%s: Calloc failed.\n", fname);
+			goto error2;
+		}
+		for (i = 0; i < desc->height; ++i) {
+			memcpy(padded + i * row_pitch, img + i * row_size, row_size);
+		}
 	} else {
-		stbi_image_free(img);
+		padded = img;
+	}
+
+	result = clut_createTrackedBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, desc->height * row_pitch, padded, "images", NULL, &cl_ret);
+	CLUT_CHECK_ERROR(cl_ret, "Unable to create image buffer", error3);
+
+	desc->storage = CL_MEM_OBJECT_BUFFER;
+	desc->row_pitch = row_pitch;
+
+error3:
+	if (padded != img) {
+		free(padded);
 	}
+error2:
+	clut_freeImageData(img);
 error1:
 	return result;
 }
 
 /*!
- * @function clut_saveImageToFile
- * Saves a cl_image object to [filename], with png format.
+ * @function clut_loadImage
+ * Opens the image at [filename] as a cl_image or as a padded buffer (see
+ * clut_loadImageToBuffer), whichever the storage policy picks for [device]
+ * and gather access, the usual access of filters.
+ * @param context
+ * The context in which the image will be created.
+ * @param device
+ * The device that will use the image.
  * @param filename
- * The filename to save to.
- * @param command_queue
- * A command queue associated with the context in which the image was created.
- * We need it to copy the image to a buffer before exporting.
- * @param image
- * The image to export.
+ * The filename of the image to be opened.
+ * @param desc
+ * Where the layout of the loaded image will be stored. Can't be NULL.
  * @return
- * Nothing.
+ * NULL on failure, or a valid cl_mem object described by [desc].
  */
-void clut_saveImageToFile(const char * const filename, cl_command_queue command_queue, cl_mem image)
+cl_mem clut_loadImage(cl_context context,
+		      cl_device_id device,
+		      const char * const filename,
+		      clut_image_desc *desc)
 {
-	const char * const fname = "clut_saveImageToFile";
-	if (NULL == filename) {
+	const char * const fname = "clut_loadImage";
+	cl_mem result = NULL;
+
+	if (NULL == desc) {
 		Debug_out(DEBUG_IMAGES, "%s: NULL pointer argument.\n", fname);
+		goto error1;
 	}
-	int ret;
-	cl_int cl_ret;
-	cl_image_format image_format = {0, 0};
-	size_t width, height;
-	int components, row_size;
-	unsigned char *img;
-	size_t elem_size;
 
-	/* get image width, height, and format */
-	cl_ret = clGetImageInfo(image, CL_IMAGE_WIDTH, sizeof(width), &width, NULL);
-	CLUT_CHECK_ERROR(cl_ret, "Unable to get image width", error1);
-	cl_ret = clGetImageInfo(image, CL_IMAGE_HEIGHT, sizeof(height), &height, NULL);
-	CLUT_CHECK_ERROR(cl_ret, "Unable to get image height", error1);
-	cl_ret = clGetImageInfo(image, CL_IMAGE_FORMAT, sizeof(cl_image_format), &image_format, NULL);
-	CLUT_CHECK_ERROR(cl_ret, "Unable to get image format", error1);
+	if (CL_MEM_OBJECT_BUFFER == clut_getStoragePolicy(context, device, CLUT_ACCESS_GATHER)) {
+		Debug_out(DEBUG_IMAGES, "%s: Device prefers buffers, or has no image support.\n", fname);
+		return clut_loadImageToBuffer(context, device, filename, desc);
+	}
 
-	/* stb_image_write wants all channels to be encoded as unsigned chars */
-	if (image_format.image_channel_data_type != CL_UNSIGNED_INT8) {
-		Debug_out(DEBUG_IMAGES, "%s: Invalid image channel data type '%s'.\n", fname,
-			clut_get_CL_CHANNEL_TYPE_Description(image_format.image_channel_data_type));
+	result = clut_loadImageFromFile(context, filename, NULL, NULL);
+	if (NULL == result) {
 		goto error1;
 	}
+	if (0 > clut_getImageDesc(result, desc)) {
+		goto error2;
+	}
+	return result;
 
-	/* choose correct number of components */
-	components = clut_getImageFormatComponents(image_format);
-	if (0 > components) {
-		Debug_out(DEBUG_IMAGES,
-			"%s: Invalid image channel order '%s'.\n",
-			fname,
-			clut_get_CL_CHANNEL_ORDER_Description(image_format.image_channel_order)
-		);
+error2:
+	clReleaseMemObject(result);
+error1:
+	return NULL;
+}
+
+/*!
+ * @function clut_loadImageStaged
+ * Opens the image at [filename] like clut_loadImage, but uploads it with a
+ * non-blocking write from a slot of [staging] (pinned memory) on
+ * [command_queue], so that decoding the next image can overlap the upload.
+ * Images larger than a slot are uploaded from pageable memory, blocking.
+ * @param command_queue
+ * The command queue used for the upload; its device is the one that will
+ * use the image.
+ * @param staging
+ * The staging ring the upload goes through.
+ * @param filename
+ * The filename of the image to be opened.
+ * @param desc
+ * Where the layout of the loaded image will be stored. Can't be NULL.
+ * @param event
+ * Where the event of the upload will be stored, NULL if there is none. It
+ * can be NULL.
+ * @return
+ * NULL on failure, or a valid cl_mem object described by [desc].
+ */
+cl_mem clut_loadImageStaged(cl_command_queue command_queue,
+			    clut_staging *staging,
+			    const char * const filename,
+			    clut_image_desc *desc,
+			    cl_event *event)
+{
+	const char * const fname = "clut_loadImageStaged";
+	cl_mem result = NULL;
+	cl_context context;
+	cl_device_id device;
+	const size_t zero[3] = {0, 0, 0};
+	unsigned char *img, *pinned;
+	size_t row_size, i;
+	unsigned int slot;
+	cl_int cl_ret;
+
+	if (NULL != event) {
+		*event = NULL;
+	}
+	if ((NULL == desc) || (NULL == staging)) {
+		Debug_out(DEBUG_IMAGES, "%s: NULL pointer argument.\n", fname);
 		goto error1;
 	}
+	device = clut_getQueueDevice(command_queue);
+	if (NULL == device) {
+		goto error1;
+	}
+	cl_ret = clGetCommandQueueInfo(command_queue, CL_QUEUE_CONTEXT, sizeof(context), &context, NULL);
+	CLUT_CHECK_ERROR(cl_ret, "Unable to get command queue context", error1);
 
-	/* allocate buffer */
-	img = calloc(width * height, components);
+	img = clut_decodeImageFile(filename, desc);
 	if (NULL == img) {
-		Debug_out(DEBUG_IMAGES, "%s: Calloc failed.\n", fname);
 		goto error1;
 	}
+	row_size = desc->row_pitch;
 
-	Debug_out(DEBUG_IMAGES,
-		"%s: Saving %zu x %zu image with channel order '%s' and data type '%s'.\n",
-		fname,
-		width,
-		height,
-		clut_get_CL_CHANNEL_ORDER_Description(image_format.image_channel_order),
-		clut_get_CL_CHANNEL_TYPE_Description(image_format.image_channel_data_type)
-	);
+	/* create the storage the policy picks, padded rows for buffers */
+	result = clut_createImageStorage(context, device, CL_MEM_READ_WRITE, CLUT_ACCESS_GATHER, desc);
+	if (NULL == result) {
+		goto error2;
+	}
 
-	/* copy image data to buffer */
-	const size_t origin[3] = {0, 0, 0};
-	const size_t region[3] = {width, height, 1};
-	cl_ret = clEnqueueReadImage(command_queue, image, CL_TRUE, origin, region, width * components, 0, img, 0, NULL, NULL);
-	CLUT_CHECK_ERROR(cl_ret, "Read image failed", error2);
-	clFinish(command_queue);
-	Debug_out(DEBUG_IMAGES, "%s: Image read from device.\n", fname);
+	Debug_out(DEBUG_IMAGES, "%s: Opening %d x %d image with channel order '%s' into a %s with row pitch %zu.\n",
+		fname,
+		(int) desc->width,
+		(int) desc->height,
+		clut_get_CL_CHANNEL_ORDER_Description(desc->channel_order),
+		(CL_MEM_OBJECT_BUFFER == desc->storage) ? "buffer" : "image",
+		desc->row_pitch);
 
-	/* save image as png */
-	ret = stbi_write_png(filename, (int) width, (int) height, components, img, width * components);
-	if (0 == ret) {
-		Debug_out(DEBUG_IMAGES, "%s: Write image to file failed.\n", fname);
-		goto error2;
+	/* upload, through the ring if the image fits a slot */
+	if (desc->height * desc->row_pitch <= clut_getStagingSlotSize(staging)) {
+		pinned = clut_stagingAcquire(staging, desc->height * desc->row_pitch, &slot);
+		for (i = 0; i < desc->height; ++i) {
+			memcpy(pinned + i * desc->row_pitch, img + i * row_size, row_size);
+		}
+		if (CL_MEM_OBJECT_BUFFER == desc->storage) {
+			cl_ret = clut_stagingWriteBuffer(staging, slot, command_queue, result, 0, desc->height * desc->row_pitch,
+							 0, NULL, event);
+		} else {
+			const size_t region[3] = {desc->width, desc->height, 1};
+			cl_ret = clut_stagingWriteImage(staging, slot, command_queue, result, zero, region, desc->row_pitch,
+							0, NULL, event);
+		}
+		clFlush(command_queue);
+	} else if (CL_MEM_OBJECT_BUFFER == desc->storage) {
+		const size_t rect[3] = {row_size, desc->height, 1};
+		cl_ret = clut_enqueueWriteBufferRect(command_queue, result, CL_TRUE, zero, zero, rect,
+						     desc->row_pitch, 0, row_size, 0, img, 0, NULL, NULL);
+	} else {
+		const size_t region[3] = {desc->width, desc->height, 1};
+		cl_ret = clut_enqueueWriteImage(command_queue, result, CL_TRUE, zero, region, row_size, 0, img, 0, NULL, NULL);
 	}
-	Debug_out(DEBUG_IMAGES, "%s: Image written to file.\n", fname);
+	CLUT_CHECK_ERROR(cl_ret, "Unable to upload image", error3);
 
+	clut_freeImageData(img);
+	return result;
+
+error3:
+	clReleaseMemObject(result);
+	result = NULL;
 error2:
-	free(img);
+	clut_freeImageData(img);
 error1:
-	return;
+	return result;
+}
+
+/*!
+ * @function clut_saveImageToFile
+ * Saves a cl_image object to [filename], with png format.
+ * @param filename
+ * The filename to save to.
+ * @param command_queue
+ * A command queue associated with the context in which the image was created.
+ * We need it to copy the image to a buffer before exporting.
+ * @param image
+ * The image to export.
+ * @return
+ * Nothing.
+ */
+void clut_saveImageToFile(const char * const filename, cl_command_queue command_queue, cl_mem image)
+{
+	const char * const fname = "clut_saveImageToFile";
+	if (NULL == filename) {
+		Debug_out(DEBUG_IMAGES, "%s: NULL pointer argument.\n", fname);
+	}
+	clut_image_desc desc;
+
+	/* get image width, height, and format */
+	if (0 > clut_getImageDesc(image, &desc)) {
+		Debug_out(DEBUG_IMAGES, "%s: Unable to describe image.\n", fname);
+		return;
+	}
+
+	clut_saveImage(filename, command_queue, image, &desc);
 }
 
 /*!
@@ -255,6 +538,8 @@ int clut_getImageFormatComponents(cl_image_format image_format)
 			components = 3;
 			break;
 		case CL_RGBA:
+		case CL_BGRA:
+		case CL_ARGB:
 			components = 4;
 			break;
 		default:
@@ -269,6 +554,562 @@ error1:
 	return components;
 }
 
+/*!
+ * @function clut_readImageRegion
+ * Reads the [region] of [mem] starting at [origin] (both in pixels, x first)
+ * into a tightly packed host buffer. Images are read with clEnqueueReadImage,
+ * buffers with clEnqueueReadBufferRect, so only the region crosses the bus.
+ * @warning Result should be manually freed.
+ * @param command_queue
+ * A command queue associated with the context in which [mem] was created.
+ * @param mem
+ * The cl_image or buffer to read from.
+ * @param desc
+ * The layout of [mem].
+ * @param origin
+ * The top left corner of the region.
+ * @param region
+ * The width and height of the region.
+ * @param row_pitch
+ * Where the row pitch of the result, in bytes, will be stored. It can be NULL.
+ * @return
+ * NULL on failure, or a buffer of region[1] * row_pitch bytes.
+ */
+unsigned char * clut_readImageRegion(cl_command_queue command_queue,
+				     cl_mem mem,
+				     const clut_image_desc *desc,
+				     const size_t origin[2],
+				     const size_t region[2],
+				     size_t *row_pitch)
+{
+	const char * const fname = "clut_readImageRegion";
+	unsigned char *img;
+	size_t pixel_size, host_pitch;
+	cl_int cl_ret;
+
+	if ((NULL == desc) || (NULL == origin) || (NULL == region)) {
+		Debug_out(DEBUG_IMAGES, "%s: NULL pointer argument.\n", fname);
+		goto error1;
+	}
+	if ((0 == region[0]) || (0 == region[1]) ||
+	    (origin[0] > desc->width) || (region[0] > desc->width - origin[0]) ||
+	    (origin[1] > desc->height) || (region[1] > desc->height - origin[1])) {
+		Debug_out(DEBUG_IMAGES, "%s: Region (%zu, %zu) + (%zu, %zu) is outside of the %zu x %zu image.\n",
+			fname, origin[0], origin[1], region[0], region[1], desc->width, desc->height);
+		goto error1;
+	}
+
+	pixel_size = desc->components * clut_getChannelTypeSize(desc->channel_type);
+	host_pitch = region[0] * pixel_size;
+	img = malloc(region[1] * host_pitch);
+	if (NULL == img) {
+		Debug_out(DEBUG_IMAGES, "%s: Malloc failed.\n", fname);
+		goto error1;
+	}
+
+	if (CL_MEM_OBJECT_BUFFER == desc->storage) {
+		const size_t buffer_origin[3] = {origin[0] * pixel_size, origin[1], 0};
+		const size_t host_origin[3] = {0, 0, 0};
+		const size_t rect[3] = {host_pitch, region[1], 1};
+		cl_ret = clut_enqueueReadBufferRect(command_queue, mem, CL_TRUE,
+						 buffer_origin, host_origin, rect,
+						 desc->row_pitch, 0, host_pitch, 0,
+						 img, 0, NULL, NULL);
+		CLUT_CHECK_ERROR(cl_ret, "Read buffer region failed", error2);
+	} else {
+		const size_t image_origin[3] = {origin[0], origin[1], 0};
+		const size_t rect[3] = {region[0], region[1], 1};
+		cl_ret = clut_enqueueReadImage(command_queue, mem, CL_TRUE, image_origin, rect, host_pitch, 0, img, 0, NULL, NULL);
+		CLUT_CHECK_ERROR(cl_ret, "Read image region failed", error2);
+	}
+	Debug_out(DEBUG_IMAGES, "%s: Read %zu x %zu region from device.\n", fname, region[0], region[1]);
+
+	if (NULL != row_pitch) {
+		*row_pitch = host_pitch;
+	}
+	return img;
+
+error2:
+	free(img);
+error1:
+	return NULL;
+}
+
+/*!
+ * @function clut_mapImageRegion
+ * Maps the [region] of [mem] starting at [origin] for reading, without
+ * copying it when the device shares memory with the host. Rows of the mapped
+ * region are [row_pitch] bytes apart.
+ * @warning The result must be released with clut_unmapImageRegion.
+ * @param row_pitch
+ * Where the row pitch of the mapped region, in bytes, will be stored. Can't be NULL.
+ * @return
+ * NULL on failure, or a pointer to the first pixel of the region.
+ */
+unsigned char * clut_mapImageRegion(cl_command_queue command_queue,
+				    cl_mem mem,
+				    const clut_image_desc *desc,
+				    const size_t origin[2],
+				    const size_t region[2],
+				    size_t *row_pitch)
+{
+	const char * const fname = "clut_mapImageRegion";
+	unsigned char *mapped;
+	size_t pixel_size;
+	cl_int cl_ret;
+
+	if ((NULL == desc) || (NULL == origin) || (NULL == region) || (NULL == row_pitch)) {
+		Debug_out(DEBUG_IMAGES, "%s: NULL pointer argument.\n", fname);
+		goto error1;
+	}
+	if ((0 == region[0]) || (0 == region[1]) ||
+	    (origin[0] > desc->width) || (region[0] > desc->width - origin[0]) ||
+	    (origin[1] > desc->height) || (region[1] > desc->height - origin[1])) {
+		Debug_out(DEBUG_IMAGES, "%s: Region is outside of the image.\n", fname);
+		goto error1;
+	}
+
+	pixel_size = desc->components * clut_getChannelTypeSize(desc->channel_type);
+	if (CL_MEM_OBJECT_BUFFER == desc->storage) {
+		/* map from the first pixel of the region to the last one */
+		const size_t offset = origin[1] * desc->row_pitch + origin[0] * pixel_size;
+		const size_t size = (region[1] - 1) * desc->row_pitch + region[0] * pixel_size;
+		mapped = clut_enqueueMapBuffer(command_queue, mem, CL_TRUE, CL_MAP_READ, offset, size, 0, NULL, NULL, &cl_ret);
+		CLUT_CHECK_ERROR(cl_ret, "Map buffer region failed", error1);
+		*row_pitch = desc->row_pitch;
+	} else {
+		const size_t image_origin[3] = {origin[0], origin[1], 0};
+		const size_t rect[3] = {region[0], region[1], 1};
+		size_t slice_pitch;
+		mapped = clut_enqueueMapImage(command_queue, mem, CL_TRUE, CL_MAP_READ, image_origin, rect,
+					   row_pitch, &slice_pitch, 0, NULL, NULL, &cl_ret);
+		CLUT_CHECK_ERROR(cl_ret, "Map image region failed", error1);
+	}
+	Debug_out(DEBUG_IMAGES, "%s: Mapped %zu x %zu region with row pitch %zu.\n", fname, region[0], region[1], *row_pitch);
+
+	return mapped;
+
+error1:
+	return NULL;
+}
+
+/*!
+ * @function clut_unmapImageRegion
+ * Unmaps a region mapped by clut_mapImageRegion, and waits for the unmap to
+ * complete, so that [mem] can be safely released afterwards.
+ */
+void clut_unmapImageRegion(cl_command_queue command_queue, cl_mem mem, unsigned char *mapped)
+{
+	cl_event unmapped;
+	cl_int cl_ret;
+
+	cl_ret = clut_enqueueUnmapMemObject(command_queue, mem, mapped, 0, NULL, &unmapped);
+	CLUT_CHECK_ERROR(cl_ret, "Unmap failed", error1);
+	clWaitForEvents(1, &unmapped);
+	clReleaseEvent(unmapped);
+
+error1:
+	return;
+}
+
+/*!
+ * @function clut_convertToU8Buffer
+ * Converts [mem] to a tightly packed 8 bit RGBA-ordered buffer on the device.
+ * Images of any channel type, and 8 bit and float buffers are supported.
+ * Buffer channels are reordered with clut_convertSwizzle, as read_image*
+ * does for images.
+ * @warning Result should be released with clReleaseMemObject.
+ * @return
+ * NULL on failure, or a buffer described by [dst_desc].
+ */
+static cl_mem clut_convertToU8Buffer(cl_command_queue command_queue,
+				     cl_mem mem,
+				     const clut_image_desc *desc,
+				     clut_image_desc *dst_desc)
+{
+	const char * const fname = "clut_convertToU8Buffer";
+	/* channel c of RGBA is channel map[c] of BGRA or ARGB */
+	static const cl_uchar BGRA_to_RGBA[4] = {2, 1, 0, 3};
+	static const cl_uchar ARGB_to_RGBA[4] = {1, 2, 3, 0};
+	const cl_uchar *map = NULL;
+	clut_image_desc u8_desc;
+	cl_context context;
+	cl_mem converted, u8 = NULL;
+	cl_int cl_ret;
+
+	if ((CL_MEM_OBJECT_BUFFER == desc->storage) &&
+	    (CL_FLOAT != desc->channel_type) && (CL_UNSIGNED_INT8 != desc->channel_type)) {
+		Debug_out(DEBUG_IMAGES, "%s: Invalid image channel data type '%s'.\n", fname,
+			clut_get_CL_CHANNEL_TYPE_Description(desc->channel_type));
+		goto error1;
+	}
+	if (CL_MEM_OBJECT_BUFFER == desc->storage) {
+		if (CL_BGRA == desc->channel_order) {
+			map = BGRA_to_RGBA;
+		} else if (CL_ARGB == desc->channel_order) {
+			map = ARGB_to_RGBA;
+		}
+	}
+
+	cl_ret = clGetCommandQueueInfo(command_queue, CL_QUEUE_CONTEXT, sizeof(context), &context, NULL);
+	CLUT_CHECK_ERROR(cl_ret, "Unable to get queue context", error1);
+
+	*dst_desc = *desc;
+	dst_desc->channel_type = CL_UNSIGNED_INT8;
+	if ((CL_BGRA == desc->channel_order) || (CL_ARGB == desc->channel_order)) {
+		dst_desc->channel_order = CL_RGBA;
+	}
+	converted = clut_createImageBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, dst_desc, 1);
+	if (NULL == converted) {
+		goto error1;
+	}
+
+	Debug_out(DEBUG_IMAGES, "%s: Converting '%s' data to 8 bit on the device.\n", fname,
+		clut_get_CL_CHANNEL_TYPE_Description(desc->channel_type));
+	if (CL_MEM_OBJECT_BUFFER != desc->storage) {
+		cl_ret = clut_convertImageToU8(command_queue, mem, desc, converted, dst_desc, 0, NULL, NULL);
+	} else if (NULL == map) {
+		cl_ret = clut_convertFloatToU8(command_queue, mem, desc, converted, dst_desc, 0, NULL, NULL);
+	} else if (CL_UNSIGNED_INT8 == desc->channel_type) {
+		cl_ret = clut_convertSwizzle(command_queue, mem, desc, converted, dst_desc, map, 0, NULL, NULL);
+	} else {
+		/* to 8 bit in the source order first, then reorder */
+		u8_desc = *desc;
+		u8_desc.channel_type = CL_UNSIGNED_INT8;
+		u8 = clut_createImageBuffer(context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, &u8_desc, 1);
+		if (NULL == u8) {
+			goto error2;
+		}
+		cl_ret = clut_convertFloatToU8(command_queue, mem, desc, u8, &u8_desc, 0, NULL, NULL);
+		if (clut_returnSuccess(cl_ret)) {
+			cl_ret = clut_convertSwizzle(command_queue, u8, &u8_desc, converted, dst_desc, map, 0, NULL, NULL);
+		}
+		/* released once the commands using it complete */
+		clReleaseMemObject(u8);
+	}
+	CLUT_CHECK_ERROR(cl_ret, "Conversion failed", error2);
+
+	return converted;
+
+error2:
+	clReleaseMemObject(converted);
+error1:
+	return NULL;
+}
+
+/*!
+ * @function clut_saveImageRegionToFile
+ * Saves the [region] of [mem] starting at [origin] to [filename], with png
+ * format. Only the region is read back and encoded.
+ * Data that isn't 8 bit RGBA-ordered is converted on the device first.
+ * On devices with host unified memory the region is mapped instead of
+ * copied, and the encoder reads the mapped memory directly.
+ * @param filename
+ * The filename to save to.
+ * @param command_queue
+ * A command queue associated with the context in which [mem] was created.
+ * @param mem
+ * The cl_image or buffer to export.
+ * @param desc
+ * The layout of [mem].
+ * @param origin
+ * The top left corner of the region, in pixels.
+ * @param region
+ * The width and height of the region, in pixels.
+ * @return
+ * 0 on success, a negative value on failure.
+ */
+int clut_saveImageRegionToFile(const char * const filename,
+			       cl_command_queue command_queue,
+			       cl_mem mem,
+			       const clut_image_desc *desc,
+			       const size_t origin[2],
+			       const size_t region[2])
+{
+	const char * const fname = "clut_saveImageRegionToFile";
+	int ret, result = -1;
+	unsigned char *img, *mapped;
+	size_t row_pitch;
+
+	if ((NULL == filename) || (NULL == desc) || (NULL == origin) || (NULL == region)) {
+		Debug_out(DEBUG_IMAGES, "%s: NULL pointer argument.\n", fname);
+		goto error1;
+	}
+	/* check the region before converting the whole image */
+	if ((0 == region[0]) || (0 == region[1]) ||
+	    (origin[0] > desc->width) || (region[0] > desc->width - origin[0]) ||
+	    (origin[1] > desc->height) || (region[1] > desc->height - origin[1])) {
+		Debug_out(DEBUG_IMAGES, "%s: Region (%zu, %zu) + (%zu, %zu) is outside of the %zu x %zu image.\n",
+			fname, origin[0], origin[1], region[0], region[1], desc->width, desc->height);
+		goto error1;
+	}
+	if ((region[0] > INT_MAX) || (region[1] > INT_MAX)) {
+		Debug_out(DEBUG_IMAGES, "%s: Region too large for the encoder.\n", fname);
+		goto error1;
+	}
+
+	/* stb_image_write wants all channels to be encoded as unsigned chars,
+	 * in RGBA order: anything else is converted on the device */
+	if ((CL_UNSIGNED_INT8 != desc->channel_type) ||
+	    (CL_BGRA == desc->channel_order) ||
+	    (CL_ARGB == desc->channel_order)) {
+		clut_image_desc dst_desc;
+		cl_mem converted = clut_convertToU8Buffer(command_queue, mem, desc, &dst_desc);
+		if (NULL == converted) {
+			goto error1;
+		}
+		result = clut_saveImageRegionToFile(filename, command_queue, converted, &dst_desc, origin, region);
+		clReleaseMemObject(converted);
+		return result;
+	}
+
+	Debug_out(DEBUG_IMAGES,
+		"%s: Saving %zu x %zu region of %zu x %zu image with channel order '%s'.\n",
+		fname,
+		region[0],
+		region[1],
+		desc->width,
+		desc->height,
+		clut_get_CL_CHANNEL_ORDER_Description(desc->channel_order)
+	);
+
+	/* on host unified memory devices, encode straight from the mapped region */
+	mapped = NULL;
+	if (clut_hasHostUnifiedMemory(clut_getQueueDevice(command_queue))) {
+		mapped = clut_mapImageRegion(command_queue, mem, desc, origin, region, &row_pitch);
+	}
+	img = (NULL != mapped) ? mapped : clut_readImageRegion(command_queue, mem, desc, origin, region, &row_pitch);
+	if (NULL == img) {
+		goto error1;
+	}
+
+	/* save image as png */
+	ret = stbi_write_png(filename, (int) region[0], (int) region[1], desc->components, img, (int) row_pitch);
+	if (0 == ret) {
+		Debug_out(DEBUG_IMAGES, "%s: Write image to file failed.\n", fname);
+		goto error2;
+	}
+	Debug_out(DEBUG_IMAGES, "%s: Image written to file.\n", fname);
+	result = 0;
+
+error2:
+	if (NULL != mapped) {
+		clut_unmapImageRegion(command_queue, mem, mapped);
+	} else {
+		free(img);
+	}
+error1:
+	return result;
+}
+
+/*!
+ * @function clut_saveImageBufferToFile
+ * Saves an image stored in a plain buffer, as described by [desc], to
+ * [filename], with png format.
+ * @return
+ * 0 on success, a negative value on failure.
+ */
+int clut_saveImageBufferToFile(const char * const filename,
+			       cl_command_queue command_queue,
+			       cl_mem buffer,
+			       const clut_image_desc *desc)
+{
+	const char * const fname = "clut_saveImageBufferToFile";
+
+	if ((NULL == desc) || (CL_MEM_OBJECT_BUFFER != desc->storage)) {
+		Debug_out(DEBUG_IMAGES, "%s: Invalid buffer description.\n", fname);
+		return -1;
+	}
+
+	return clut_saveImage(filename, command_queue, buffer, desc);
+}
+
+/*!
+ * @function clut_saveImage
+ * Saves [mem], either a cl_image or a buffer as described by [desc], to
+ * [filename], with png format.
+ * @return
+ * 0 on success, a negative value on failure.
+ */
+int clut_saveImage(const char * const filename,
+		   cl_command_queue command_queue,
+		   cl_mem mem,
+		   const clut_image_desc *desc)
+{
+	const char * const fname = "clut_saveImage";
+	const size_t origin[2] = {0, 0};
+	size_t region[2];
+
+	if (NULL == desc) {
+		Debug_out(DEBUG_IMAGES, "%s: NULL pointer argument.\n", fname);
+		return -1;
+	}
+
+	region[0] = desc->width;
+	region[1] = desc->height;
+	return clut_saveImageRegionToFile(filename, command_queue, mem, desc, origin, region);
+}
+
+/*!
+ * @function clut_createImageBuffer
+ * Creates a buffer able to hold an image with the width, height, components
+ * and channel type in [desc]. Rows are padded to [alignment] bytes; the
+ * resulting row pitch and storage are written back to [desc].
+ * @return
+ * NULL on failure, or a valid cl_mem buffer.
+ */
+cl_mem clut_createImageBuffer(cl_context context,
+			      cl_mem_flags flags,
+			      clut_image_desc *desc,
+			      size_t alignment)
+{
+	const char * const fname = "clut_createImageBuffer";
+	cl_mem result = NULL;
+	size_t channel_size;
+	cl_int cl_ret;
+
+	if (NULL == desc) {
+		Debug_out(DEBUG_IMAGES, "%s: NULL pointer argument.\n", fname);
+		goto error1;
+	}
+	channel_size = clut_getChannelTypeSize(desc->channel_type);
+	if ((0 == channel_size) || (0 >= desc->components)) {
+		Debug_out(DEBUG_IMAGES, "%s: Unsupported channel type '%s'.\n", fname,
+			clut_get_CL_CHANNEL_TYPE_Description(desc->channel_type));
+		goto error1;
+	}
+	if (0 == alignment) {
+		alignment = 1;
+	}
+
+	desc->storage = CL_MEM_OBJECT_BUFFER;
+	desc->row_pitch = CLUT_ROUND_UP(desc->width * desc->components * channel_size, alignment);
+
+	result = clut_createTrackedBuffer(context, flags, desc->height * desc->row_pitch, NULL, "images", NULL, &cl_ret);
+	CLUT_CHECK_ERROR(cl_ret, "Unable to create image buffer", error1);
+
+error1:
+	return result;
+}
+
+/*!
+ * @function clut_createImageStorage
+ * Creates storage for an image with the width, height, components, channel
+ * order and channel type in [desc]: a cl_image, or a buffer with rows
+ * padded to the alignment of [device], whichever the storage policy picks
+ * for [device] and [access]. The storage and row pitch are written back to
+ * [desc].
+ * @return
+ * NULL on failure, or a valid cl_mem object described by [desc].
+ */
+cl_mem clut_createImageStorage(cl_context context,
+			       cl_device_id device,
+			       cl_mem_flags flags,
+			       clut_access_class access,
+			       clut_image_desc *desc)
+{
+	const char * const fname = "clut_createImageStorage";
+	cl_image_format image_format = {0, 0};
+	cl_image_desc image_desc = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+	cl_mem result = NULL;
+	cl_int cl_ret;
+
+	if (NULL == desc) {
+		Debug_out(DEBUG_IMAGES, "%s: NULL pointer argument.\n", fname);
+		goto error1;
+	}
+	if (CL_MEM_OBJECT_BUFFER == clut_getStoragePolicy(context, device, access)) {
+		return clut_createImageBuffer(context, flags, desc, clut_getDeviceAlignment(device));
+	}
+
+	image_format.image_channel_order = desc->channel_order;
+	image_format.image_channel_data_type = desc->channel_type;
+	image_desc.image_type = CL_MEM_OBJECT_IMAGE2D;
+	image_desc.image_width = desc->width;
+	image_desc.image_height = desc->height;
+	result = clut_createTrackedImage(context, flags, &image_format, &image_desc, NULL, "images", NULL, &cl_ret);
+	CLUT_CHECK_ERROR(cl_ret, "Unable to create cl_image", error1);
+	desc->storage = CL_MEM_OBJECT_IMAGE2D;
+	desc->row_pitch = desc->width * desc->components * clut_getChannelTypeSize(desc->channel_type);
+
+error1:
+	return result;
+}
+
+/*!
+ * @function clut_getImageDesc
+ * Fills [desc] with the layout of the cl_image [image].
+ * @return
+ * 0 on success, a negative value on failure.
+ */
+int clut_getImageDesc(cl_mem image, clut_image_desc *desc)
+{
+	const char * const fname = "clut_getImageDesc";
+	cl_int cl_ret;
+	cl_image_format image_format = {0, 0};
+	size_t width, height, row_pitch;
+	int components;
+
+	if (NULL == desc) {
+		Debug_out(DEBUG_IMAGES, "%s: NULL pointer argument.\n", fname);
+		goto error1;
+	}
+
+	cl_ret = clGetImageInfo(image, CL_IMAGE_WIDTH, sizeof(width), &width, NULL);
+	CLUT_CHECK_ERROR(cl_ret, "Unable to get image width", error1);
+	cl_ret = clGetImageInfo(image, CL_IMAGE_HEIGHT, sizeof(height), &height, NULL);
+	CLUT_CHECK_ERROR(cl_ret, "Unable to get image height", error1);
+	cl_ret = clGetImageInfo(image, CL_IMAGE_ROW_PITCH, sizeof(row_pitch), &row_pitch, NULL);
+	CLUT_CHECK_ERROR(cl_ret, "Unable to get image row pitch", error1);
+	cl_ret = clGetImageInfo(image, CL_IMAGE_FORMAT, sizeof(cl_image_format), &image_format, NULL);
+	CLUT_CHECK_ERROR(cl_ret, "Unable to get image format", error1);
+
+	components = clut_getImageFormatComponents(image_format);
+	if (0 > components) {
+		goto error1;
+	}
+
+	desc->storage = CL_MEM_OBJECT_IMAGE2D;
+	desc->width = width;
+	desc->height = height;
+	desc->row_pitch = row_pitch;
+	desc->components = components;
+	desc->channel_order = image_format.image_channel_order;
+	desc->channel_type = image_format.image_channel_data_type;
+	return 0;
+
+error1:
+	return -1;
+}
+
+/*!
+ * @function clut_getChannelTypeSize
+ * Returns the size, in bytes, of a single channel of type [channel_type], or
+ * 0 for packed and unknown types.
+ */
+size_t clut_getChannelTypeSize(cl_channel_type channel_type)
+{
+	switch (channel_type) {
+		case CL_SNORM_INT8:
+		case CL_UNORM_INT8:
+		case CL_SIGNED_INT8:
+		case CL_UNSIGNED_INT8:
+			return 1;
+		case CL_SNORM_INT16:
+		case CL_UNORM_INT16:
+		case CL_SIGNED_INT16:
+		case CL_UNSIGNED_INT16:
+		case CL_HALF_FLOAT:
+			return 2;
+		case CL_SIGNED_INT32:
+		case CL_UNSIGNED_INT32:
+		case CL_FLOAT:
+			return 4;
+		default:
+			return 0;
+	}
+}
+
 /*!
  * @clut_getDuplicateEmptyImage
  * Creates an empty cl_image_2d with the same properties as [image].
@@ -299,7 +1140,7 @@ cl_mem clut_getDuplicateEmptyImage(cl_context context, cl_mem image)
 	image_desc.image_width = width;
 	image_desc.image_height = height;
 
-	dup_image = clCreateImage(context, CL_MEM_WRITE_ONLY, &image_format, &image_desc, NULL, &cl_ret);
+	dup_image = clut_createTrackedImage(context, CL_MEM_WRITE_ONLY, &image_format, &image_desc, NULL, "images", NULL, &cl_ret);
 	CLUT_CHECK_ERROR(cl_ret, "Unable to create duplicate image", error1);
 
 error1:
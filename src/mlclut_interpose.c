@@ -0,0 +1,568 @@
+/**
+ * @file
+ * @author Michele Laurenti
+ * @language c
+ *
+ * Profiling wrappers over clEnqueue*, switched on by the CLUT_PROFILE
+ * environment variable. See mlclut_interpose.h.
+ */
+
+#define __ML_CLUT_INTERPOSE_IMPL
+
+#include "mlclut_interpose.h"
+#include "mlclut_descriptions.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <Debug.h>
+#include <StringUtils.h>
+
+#define DEBUG_INTERPOSE	"mlclut_debug_interpose"
+
+#define PROFILE_ENV		"CLUT_PROFILE"
+#define PROFILE_TRACE_ENV	"CLUT_PROFILE_TRACE"
+
+enum clut_profile_kind {
+	PROFILE_NONE,
+	PROFILE_READ,
+	PROFILE_WRITE,
+	PROFILE_COPY,
+	PROFILE_MAP,
+	PROFILE_FILL
+};
+
+static pthread_once_t profile_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static int profile_enabled = 0;
+static int profile_atexit = 0;
+static int profile_from_env = 0;
+static int profile_unflushed = 0;
+static clut_stats *profile_stats = NULL;
+static clut_trace *profile_trace = NULL;
+static char *profile_trace_file = NULL;
+static clut_profile_bytes profile_bytes;
+
+/**
+ * Function declaration
+ */
+
+static void clut_profileInit(void);
+static void clut_profileAtExit(void);
+static void clut_profileSet(int enable);
+static int clut_profileOn(void);
+static cl_event * clut_profileBegin(cl_event *event, cl_event *local);
+static void clut_profileEnd(cl_int ret, cl_command_type type, cl_kernel kernel,
+			    enum clut_profile_kind kind, cl_ulong bytes,
+			    cl_event *event, cl_event local);
+static cl_ulong clut_profileImageBytes(cl_mem image, const size_t *region);
+
+/**
+ * Function definition
+ */
+
+/*!
+ * @function clut_profileAtExit
+ * Fallback for programs that never call clut_profileFlush: if profiling was
+ * turned on by CLUT_PROFILE and commands were recorded since the last flush,
+ * prints what was recorded so far on stderr.
+ * The OpenCL runtime may already be torn down, so no OpenCL call is made:
+ * commands still pending are missing, and the trace is not written.
+ */
+static void clut_profileAtExit(void)
+{
+	int unflushed;
+
+	pthread_mutex_lock(&profile_lock);
+	unflushed = profile_unflushed;
+	pthread_mutex_unlock(&profile_lock);
+	if (!profile_from_env || !unflushed || (NULL == profile_stats)) {
+		return;
+	}
+	clut_profileReport(stderr);
+	if (NULL != profile_trace) {
+		fprintf(stderr, "clut profile: trace not written, call clut_profileFlush before releasing the context.\n");
+	}
+}
+
+/*!
+ * @function clut_profileFlush
+ * Waits for all profiled commands, prints the report to [f] (if not NULL)
+ * and writes the trace to the file named by CLUT_PROFILE_TRACE, if set.
+ * Must be called while the command queues are still alive, after their
+ * commands have been flushed; the handler run at exit can't wait for them.
+ * @return
+ * 0 on success, a negative value if the trace couldn't be written.
+ */
+int clut_profileFlush(FILE *f)
+{
+	const char * const fname = "clut_profileFlush";
+	int result = 0;
+
+	if (NULL == clut_getProfileStats()) {
+		return 0;
+	}
+	clut_statsWait(profile_stats);
+	if (NULL != f) {
+		clut_profileReport(f);
+	}
+	if ((NULL != profile_trace) && (NULL != profile_trace_file)) {
+		result = clut_traceExportChrome(profile_trace, profile_trace_file);
+		if (0 == result) {
+			Debug_out(DEBUG_INTERPOSE, "%s: trace written to '%s'.\n", fname, profile_trace_file);
+		}
+	}
+
+	pthread_mutex_lock(&profile_lock);
+	profile_unflushed = 0;
+	pthread_mutex_unlock(&profile_lock);
+	return result;
+}
+
+/*!
+ * @function clut_releaseProfile
+ * Turns profiling off and releases the statistics and the trace, without
+ * reporting them: call clut_profileFlush first to keep them.
+ * No profiled command may be in the process of being enqueued.
+ */
+void clut_releaseProfile(void)
+{
+	clut_stats *stats;
+	clut_trace *trace;
+
+	pthread_once(&profile_once, clut_profileInit);
+
+	pthread_mutex_lock(&profile_lock);
+	profile_enabled = 0;
+	profile_unflushed = 0;
+	stats = profile_stats;
+	trace = profile_trace;
+	profile_stats = NULL;
+	profile_trace = NULL;
+	free(profile_trace_file);
+	profile_trace_file = NULL;
+	memset(&profile_bytes, 0, sizeof(profile_bytes));
+	pthread_mutex_unlock(&profile_lock);
+
+	clut_releaseStats(stats);
+	clut_releaseTrace(trace);
+}
+
+/*!
+ * @function clut_profileInit
+ * Reads the environment, once.
+ */
+static void clut_profileInit(void)
+{
+	const char *value;
+
+	value = getenv(PROFILE_ENV);
+	if ((NULL == value) || ('\0' == value[0]) || (0 == strcmp(value, "0"))) {
+		return;
+	}
+
+	value = getenv(PROFILE_TRACE_ENV);
+	if ((NULL != value) && ('\0' != value[0])) {
+		profile_trace_file = StringUtils_clone(value);
+		profile_trace = clut_createTrace();
+	}
+
+	profile_from_env = 1;
+	clut_profileSet(1);
+}
+
+/*!
+ * @function clut_profileOn
+ * Returns 1 if profiling is on.
+ */
+static int clut_profileOn(void)
+{
+	pthread_once(&profile_once, clut_profileInit);
+	return profile_enabled;
+}
+
+/*!
+ * @function clut_profileEnabled
+ * Returns 1 if enqueue profiling is on, 0 otherwise.
+ */
+int clut_profileEnabled(void)
+{
+	return clut_profileOn();
+}
+
+/*!
+ * @function clut_profileEnable
+ * Turns enqueue profiling on or off, regardless of CLUT_PROFILE.
+ * Data recorded so far is kept.
+ */
+void clut_profileEnable(int enable)
+{
+	pthread_once(&profile_once, clut_profileInit);
+	clut_profileSet(enable);
+}
+
+/*!
+ * @function clut_profileSet
+ * Turns profiling on or off, creating the statistics the first time.
+ */
+static void clut_profileSet(int enable)
+{
+	const char * const fname = "clut_profileSet";
+
+	pthread_mutex_lock(&profile_lock);
+	if (enable && (NULL == profile_stats)) {
+		profile_stats = clut_createStats();
+		if (NULL == profile_stats) {
+			Debug_out(DEBUG_INTERPOSE, "%s: unable to create stats.\n", fname);
+			pthread_mutex_unlock(&profile_lock);
+			return;
+		}
+	}
+	if (enable && !profile_atexit) {
+		profile_atexit = (0 == atexit(clut_profileAtExit));
+	}
+	profile_enabled = (0 != enable);
+	pthread_mutex_unlock(&profile_lock);
+}
+
+/*!
+ * @function clut_getProfileStats
+ * Returns the statistics fed by the wrappers, NULL if profiling was never on.
+ */
+clut_stats * clut_getProfileStats(void)
+{
+	clut_profileOn();
+	return profile_stats;
+}
+
+/*!
+ * @function clut_getProfileTrace
+ * Returns the trace fed by the wrappers, NULL if CLUT_PROFILE_TRACE is not set.
+ */
+clut_trace * clut_getProfileTrace(void)
+{
+	clut_profileOn();
+	return profile_trace;
+}
+
+/*!
+ * @function clut_getProfileBytes
+ * Copies the byte counters of the wrappers to [bytes].
+ */
+void clut_getProfileBytes(clut_profile_bytes *bytes)
+{
+	pthread_mutex_lock(&profile_lock);
+	*bytes = profile_bytes;
+	pthread_mutex_unlock(&profile_lock);
+}
+
+/*!
+ * @function clut_profileReport
+ * Prints the durations and the byte counters recorded by the wrappers to [f].
+ */
+void clut_profileReport(FILE *f)
+{
+	clut_profile_bytes bytes;
+
+	if (NULL == clut_getProfileStats()) {
+		return;
+	}
+	clut_getProfileBytes(&bytes);
+
+	clut_statsPrint(profile_stats, f);
+	fprintf(f, "bytes read: %llu, written: %llu, copied: %llu, mapped: %llu, filled: %llu.\n",
+		(unsigned long long) bytes.read,
+		(unsigned long long) bytes.written,
+		(unsigned long long) bytes.copied,
+		(unsigned long long) bytes.mapped,
+		(unsigned long long) bytes.filled);
+}
+
+/*!
+ * @function clut_profileBegin
+ * Returns the event pointer to pass to the wrapped call: [event] itself if
+ * profiling is off, [local] otherwise.
+ */
+static cl_event * clut_profileBegin(cl_event *event, cl_event *local)
+{
+	*local = NULL;
+	return clut_profileOn() ? local : event;
+}
+
+/*!
+ * @function clut_profileEnd
+ * Records a command enqueued with [local] as event (if profiling was on when
+ * it was enqueued), and hands the event to the caller or releases it.
+ */
+static void clut_profileEnd(cl_int ret, cl_command_type type, cl_kernel kernel,
+			    enum clut_profile_kind kind, cl_ulong bytes,
+			    cl_event *event, cl_event local)
+{
+	char *name = NULL;
+
+	if (NULL == local) {
+		return;
+	}
+
+	if (clut_returnSuccess(ret)) {
+		if (NULL != kernel) {
+			name = clut_getKernelName(kernel);
+		}
+		clut_statsRecordEvent(profile_stats, local, (NULL != name) ? name : clut_get_CL_COMMAND_TYPE_Description(type));
+		if (NULL != profile_trace) {
+			clut_traceEvent(profile_trace, local, name);
+		}
+		free(name);
+
+		pthread_mutex_lock(&profile_lock);
+		profile_unflushed = 1;
+		switch (kind) {
+			case PROFILE_READ:
+				profile_bytes.read += bytes;
+				break;
+			case PROFILE_WRITE:
+				profile_bytes.written += bytes;
+				break;
+			case PROFILE_COPY:
+				profile_bytes.copied += bytes;
+				break;
+			case PROFILE_MAP:
+				profile_bytes.mapped += bytes;
+				break;
+			case PROFILE_FILL:
+				profile_bytes.filled += bytes;
+				break;
+			default:
+				break;
+		}
+		pthread_mutex_unlock(&profile_lock);
+	}
+
+	if (NULL != event) {
+		*event = local;
+	} else {
+		clReleaseEvent(local);
+	}
+}
+
+/*!
+ * @function clut_profileImageBytes
+ * Returns the size in bytes of [region] of [image].
+ */
+static cl_ulong clut_profileImageBytes(cl_mem image, const size_t *region)
+{
+	size_t element_size = 0;
+
+	if (!clut_returnSuccess(clGetImageInfo(image, CL_IMAGE_ELEMENT_SIZE, sizeof(element_size), &element_size, NULL))) {
+		return 0;
+	}
+	return (cl_ulong) element_size * region[0] * region[1] * region[2];
+}
+
+cl_int clut_enqueueNDRangeKernel(cl_command_queue command_queue, cl_kernel kernel, cl_uint work_dim,
+				 const size_t *global_work_offset, const size_t *global_work_size, const size_t *local_work_size,
+				 cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	cl_event local;
+	cl_int ret;
+
+	ret = clEnqueueNDRangeKernel(command_queue, kernel, work_dim,
+				     global_work_offset, global_work_size, local_work_size,
+				     n_wait, wait_list, clut_profileBegin(event, &local));
+	clut_profileEnd(ret, CL_COMMAND_NDRANGE_KERNEL, kernel, PROFILE_NONE, 0, event, local);
+	return ret;
+}
+
+cl_int clut_enqueueReadBuffer(cl_command_queue command_queue, cl_mem buffer, cl_bool blocking,
+			      size_t offset, size_t size, void *ptr,
+			      cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	cl_event local;
+	cl_int ret;
+
+	ret = clEnqueueReadBuffer(command_queue, buffer, blocking, offset, size, ptr,
+				  n_wait, wait_list, clut_profileBegin(event, &local));
+	clut_profileEnd(ret, CL_COMMAND_READ_BUFFER, NULL, PROFILE_READ, size, event, local);
+	return ret;
+}
+
+cl_int clut_enqueueWriteBuffer(cl_command_queue command_queue, cl_mem buffer, cl_bool blocking,
+			       size_t offset, size_t size, const void *ptr,
+			       cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	cl_event local;
+	cl_int ret;
+
+	ret = clEnqueueWriteBuffer(command_queue, buffer, blocking, offset, size, ptr,
+				   n_wait, wait_list, clut_profileBegin(event, &local));
+	clut_profileEnd(ret, CL_COMMAND_WRITE_BUFFER, NULL, PROFILE_WRITE, size, event, local);
+	return ret;
+}
+
+cl_int clut_enqueueCopyBuffer(cl_command_queue command_queue, cl_mem src, cl_mem dst,
+			      size_t src_offset, size_t dst_offset, size_t size,
+			      cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	cl_event local;
+	cl_int ret;
+
+	ret = clEnqueueCopyBuffer(command_queue, src, dst, src_offset, dst_offset, size,
+				  n_wait, wait_list, clut_profileBegin(event, &local));
+	clut_profileEnd(ret, CL_COMMAND_COPY_BUFFER, NULL, PROFILE_COPY, size, event, local);
+	return ret;
+}
+
+cl_int clut_enqueueFillBuffer(cl_command_queue command_queue, cl_mem buffer,
+			      const void *pattern, size_t pattern_size, size_t offset, size_t size,
+			      cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	cl_event local;
+	cl_int ret;
+
+	ret = clEnqueueFillBuffer(command_queue, buffer, pattern, pattern_size, offset, size,
+				  n_wait, wait_list, clut_profileBegin(event, &local));
+	clut_profileEnd(ret, CL_COMMAND_FILL_BUFFER, NULL, PROFILE_FILL, size, event, local);
+	return ret;
+}
+
+cl_int clut_enqueueReadBufferRect(cl_command_queue command_queue, cl_mem buffer, cl_bool blocking,
+				  const size_t *buffer_origin, const size_t *host_origin, const size_t *region,
+				  size_t buffer_row_pitch, size_t buffer_slice_pitch,
+				  size_t host_row_pitch, size_t host_slice_pitch, void *ptr,
+				  cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	cl_event local;
+	cl_int ret;
+
+	ret = clEnqueueReadBufferRect(command_queue, buffer, blocking, buffer_origin, host_origin, region,
+				      buffer_row_pitch, buffer_slice_pitch, host_row_pitch, host_slice_pitch, ptr,
+				      n_wait, wait_list, clut_profileBegin(event, &local));
+	clut_profileEnd(ret, CL_COMMAND_READ_BUFFER_RECT, NULL, PROFILE_READ,
+			(cl_ulong) region[0] * region[1] * region[2], event, local);
+	return ret;
+}
+
+cl_int clut_enqueueWriteBufferRect(cl_command_queue command_queue, cl_mem buffer, cl_bool blocking,
+				   const size_t *buffer_origin, const size_t *host_origin, const size_t *region,
+				   size_t buffer_row_pitch, size_t buffer_slice_pitch,
+				   size_t host_row_pitch, size_t host_slice_pitch, const void *ptr,
+				   cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	cl_event local;
+	cl_int ret;
+
+	ret = clEnqueueWriteBufferRect(command_queue, buffer, blocking, buffer_origin, host_origin, region,
+				       buffer_row_pitch, buffer_slice_pitch, host_row_pitch, host_slice_pitch, ptr,
+				       n_wait, wait_list, clut_profileBegin(event, &local));
+	clut_profileEnd(ret, CL_COMMAND_WRITE_BUFFER_RECT, NULL, PROFILE_WRITE,
+			(cl_ulong) region[0] * region[1] * region[2], event, local);
+	return ret;
+}
+
+cl_int clut_enqueueCopyBufferRect(cl_command_queue command_queue, cl_mem src, cl_mem dst,
+				  const size_t *src_origin, const size_t *dst_origin, const size_t *region,
+				  size_t src_row_pitch, size_t src_slice_pitch,
+				  size_t dst_row_pitch, size_t dst_slice_pitch,
+				  cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	cl_event local;
+	cl_int ret;
+
+	ret = clEnqueueCopyBufferRect(command_queue, src, dst, src_origin, dst_origin, region,
+				      src_row_pitch, src_slice_pitch, dst_row_pitch, dst_slice_pitch,
+				      n_wait, wait_list, clut_profileBegin(event, &local));
+	clut_profileEnd(ret, CL_COMMAND_COPY_BUFFER_RECT, NULL, PROFILE_COPY,
+			(cl_ulong) region[0] * region[1] * region[2], event, local);
+	return ret;
+}
+
+cl_int clut_enqueueReadImage(cl_command_queue command_queue, cl_mem image, cl_bool blocking,
+			     const size_t *origin, const size_t *region, size_t row_pitch, size_t slice_pitch, void *ptr,
+			     cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	cl_event local;
+	cl_int ret;
+
+	ret = clEnqueueReadImage(command_queue, image, blocking, origin, region, row_pitch, slice_pitch, ptr,
+				 n_wait, wait_list, clut_profileBegin(event, &local));
+	clut_profileEnd(ret, CL_COMMAND_READ_IMAGE, NULL, PROFILE_READ,
+			(NULL != local) ? clut_profileImageBytes(image, region) : 0, event, local);
+	return ret;
+}
+
+cl_int clut_enqueueWriteImage(cl_command_queue command_queue, cl_mem image, cl_bool blocking,
+			      const size_t *origin, const size_t *region, size_t row_pitch, size_t slice_pitch, const void *ptr,
+			      cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	cl_event local;
+	cl_int ret;
+
+	ret = clEnqueueWriteImage(command_queue, image, blocking, origin, region, row_pitch, slice_pitch, ptr,
+				  n_wait, wait_list, clut_profileBegin(event, &local));
+	clut_profileEnd(ret, CL_COMMAND_WRITE_IMAGE, NULL, PROFILE_WRITE,
+			(NULL != local) ? clut_profileImageBytes(image, region) : 0, event, local);
+	return ret;
+}
+
+cl_int clut_enqueueCopyImage(cl_command_queue command_queue, cl_mem src, cl_mem dst,
+			     const size_t *src_origin, const size_t *dst_origin, const size_t *region,
+			     cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	cl_event local;
+	cl_int ret;
+
+	ret = clEnqueueCopyImage(command_queue, src, dst, src_origin, dst_origin, region,
+				 n_wait, wait_list, clut_profileBegin(event, &local));
+	clut_profileEnd(ret, CL_COMMAND_COPY_IMAGE, NULL, PROFILE_COPY,
+			(NULL != local) ? clut_profileImageBytes(src, region) : 0, event, local);
+	return ret;
+}
+
+void * clut_enqueueMapBuffer(cl_command_queue command_queue, cl_mem buffer, cl_bool blocking, cl_map_flags flags,
+			     size_t offset, size_t size,
+			     cl_uint n_wait, const cl_event *wait_list, cl_event *event, cl_int *errcode)
+{
+	cl_event local;
+	cl_int ret;
+	void *mapped;
+
+	mapped = clEnqueueMapBuffer(command_queue, buffer, blocking, flags, offset, size,
+				    n_wait, wait_list, clut_profileBegin(event, &local), &ret);
+	clut_profileEnd(ret, CL_COMMAND_MAP_BUFFER, NULL, PROFILE_MAP, size, event, local);
+	if (NULL != errcode) {
+		*errcode = ret;
+	}
+	return mapped;
+}
+
+void * clut_enqueueMapImage(cl_command_queue command_queue, cl_mem image, cl_bool blocking, cl_map_flags flags,
+			    const size_t *origin, const size_t *region, size_t *row_pitch, size_t *slice_pitch,
+			    cl_uint n_wait, const cl_event *wait_list, cl_event *event, cl_int *errcode)
+{
+	cl_event local;
+	cl_int ret;
+	void *mapped;
+
+	mapped = clEnqueueMapImage(command_queue, image, blocking, flags, origin, region, row_pitch, slice_pitch,
+				   n_wait, wait_list, clut_profileBegin(event, &local), &ret);
+	clut_profileEnd(ret, CL_COMMAND_MAP_IMAGE, NULL, PROFILE_MAP,
+			(NULL != local) ? clut_profileImageBytes(image, region) : 0, event, local);
+	if (NULL != errcode) {
+		*errcode = ret;
+	}
+	return mapped;
+}
+
+cl_int clut_enqueueUnmapMemObject(cl_command_queue command_queue, cl_mem mem, void *mapped,
+				  cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	cl_event local;
+	cl_int ret;
+
+	ret = clEnqueueUnmapMemObject(command_queue, mem, mapped,
+				      n_wait, wait_list, clut_profileBegin(event, &local));
+	clut_profileEnd(ret, CL_COMMAND_UNMAP_MEM_OBJECT, NULL, PROFILE_NONE, 0, event, local);
+	return ret;
+}
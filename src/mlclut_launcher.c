@@ -0,0 +1,437 @@
+/**
+ * @file
+ * @author Michele Laurenti
+ * @language c
+ *
+ * Kernel launchers: arguments bound by name, type checked, and set only when
+ * they change.
+ */
+
+#include "mlclut_launcher.h"
+#include "mlclut_descriptions.h"
+#include "mlclut_interpose.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <Debug.h>
+#include <ArrayUtils.h>
+
+#define DEBUG_LAUNCHER	"mlclut_debug_launcher"
+
+struct clut_launcher_arg {
+	char *name;
+	char *type_name;
+	cl_kernel_arg_address_qualifier address;
+	size_t type_size;	/* 0 if unknown */
+	int bound;
+	size_t size;
+	void *value;		/* last bound bytes, NULL for local memory */
+};
+
+struct clut_launcher {
+	cl_kernel kernel;
+	char *name;
+	cl_uint n_args;
+	int has_info;
+	struct clut_launcher_arg *args;
+	cl_ulong set;
+	cl_ulong skipped;
+};
+
+struct clut_type_size {
+	const char *name;
+	size_t size;
+};
+
+static const struct clut_type_size type_sizes[] = {
+	{"char", 1}, {"uchar", 1},
+	{"short", 2}, {"ushort", 2}, {"half", 2},
+	{"int", 4}, {"uint", 4}, {"float", 4},
+	{"long", 8}, {"ulong", 8}, {"double", 8},
+	{"sampler_t", sizeof(cl_sampler)}
+};
+
+/**
+ * Function declaration
+ */
+
+static size_t clut_getArgTypeSize(const char * const type_name);
+static char * clut_getKernelArgString(cl_kernel kernel, cl_uint index, cl_kernel_arg_info info);
+static struct clut_launcher_arg * clut_launcherFindArg(clut_launcher *launcher, const char * const arg_name, cl_uint *index);
+
+/**
+ * Function definition
+ */
+
+/*!
+ * @function clut_getArgTypeSize
+ * Returns the size of an argument of OpenCL C type [type_name] (as given
+ * by CL_KERNEL_ARG_TYPE_NAME), or 0 if unknown (e.g. structs).
+ */
+static size_t clut_getArgTypeSize(const char * const type_name)
+{
+	size_t base = 0, len = 0, n = 1, i;
+
+	if ((NULL != strchr(type_name, '*')) || (0 == strncmp(type_name, "image", 5))) {
+		return sizeof(cl_mem);
+	}
+	while (('\0' != type_name[len]) && !(('0' <= type_name[len]) && (type_name[len] <= '9'))) {
+		++len;
+	}
+	for (i = 0; i < ARRAY_LEN(type_sizes); ++i) {
+		if ((strlen(type_sizes[i].name) == len) && (0 == strncmp(type_sizes[i].name, type_name, len))) {
+			base = type_sizes[i].size;
+			break;
+		}
+	}
+	if ('\0' != type_name[len]) {
+		n = (size_t) atoi(type_name + len);
+		n = (3 == n) ? 4 : n;	/* 3-vectors take the space of 4 */
+	}
+	return base * n;
+}
+
+/*!
+ * @function clut_getKernelArgString
+ * Returns the string [info] of argument [index] of [kernel], or NULL.
+ * @warning Result should be manually freed.
+ */
+static char * clut_getKernelArgString(cl_kernel kernel, cl_uint index, cl_kernel_arg_info info)
+{
+	size_t size;
+	char *result;
+
+	if (!clut_returnSuccess(clGetKernelArgInfo(kernel, index, info, 0, NULL, &size))) {
+		return NULL;
+	}
+	result = calloc(size + 1, 1);
+	if (NULL == result) {
+		return NULL;
+	}
+	if (!clut_returnSuccess(clGetKernelArgInfo(kernel, index, info, size, result, NULL))) {
+		free(result);
+		return NULL;
+	}
+	return result;
+}
+
+/*!
+ * @function clut_createLauncherForKernel
+ * Creates a launcher for [kernel], which it retains.
+ * Without argument metadata (program not built with -cl-kernel-arg-info),
+ * arguments can only be set by index, unchecked.
+ */
+clut_launcher * clut_createLauncherForKernel(cl_kernel kernel, cl_int *ret)
+{
+	const char * const fname = "clut_createLauncherForKernel";
+	clut_launcher *launcher;
+	struct clut_launcher_arg *arg;
+	cl_int err;
+	cl_uint i;
+
+	launcher = calloc(1, sizeof(*launcher));
+	if (NULL == launcher) {
+		Debug_out(DEBUG_LAUNCHER, "%s: calloc failed.\n", fname);
+		err = CL_OUT_OF_HOST_MEMORY;
+		goto error1;
+	}
+	err = clGetKernelInfo(kernel, CL_KERNEL_NUM_ARGS, sizeof(launcher->n_args), &launcher->n_args, NULL);
+	CLUT_CHECK_ERROR(err, "Unable to get kernel arguments number", error2);
+	launcher->args = calloc(launcher->n_args + 1, sizeof(struct clut_launcher_arg));
+	if (NULL == launcher->args) {
+		Debug_out(DEBUG_LAUNCHER, "%s: calloc failed.\n", fname);
+		err = CL_OUT_OF_HOST_MEMORY;
+		goto error2;
+	}
+	launcher->name = clut_getKernelName(kernel);
+
+	launcher->has_info = 1;
+	for (i = 0; i < launcher->n_args; ++i) {
+		arg = &launcher->args[i];
+		arg->name = clut_getKernelArgString(kernel, i, CL_KERNEL_ARG_NAME);
+		arg->type_name = clut_getKernelArgString(kernel, i, CL_KERNEL_ARG_TYPE_NAME);
+		if ((NULL == arg->name) || (NULL == arg->type_name) ||
+		    !clut_returnSuccess(clGetKernelArgInfo(kernel, i, CL_KERNEL_ARG_ADDRESS_QUALIFIER,
+							   sizeof(arg->address), &arg->address, NULL))) {
+			launcher->has_info = 0;
+			continue;
+		}
+		arg->type_size = clut_getArgTypeSize(arg->type_name);
+	}
+	if (!launcher->has_info) {
+		Debug_out(DEBUG_LAUNCHER, "%s: no argument metadata for '%s', binding by name disabled.\n",
+			  fname, (NULL != launcher->name) ? launcher->name : "?");
+	}
+
+	clRetainKernel(kernel);
+	launcher->kernel = kernel;
+	if (NULL != ret) {
+		*ret = CL_SUCCESS;
+	}
+	return launcher;
+
+error2:	free(launcher);
+error1:	if (NULL != ret) {
+		*ret = err;
+	}
+	return NULL;
+}
+
+/*!
+ * @function clut_createLauncher
+ * Creates kernel [kernel_name] of [program], and a launcher for it.
+ */
+clut_launcher * clut_createLauncher(cl_program program, const char * const kernel_name, cl_int *ret)
+{
+	clut_launcher *launcher;
+	cl_kernel kernel;
+	cl_int err;
+
+	kernel = clCreateKernel(program, kernel_name, &err);
+	CLUT_CHECK_ERROR(err, "Unable to create kernel", error);
+
+	launcher = clut_createLauncherForKernel(kernel, ret);
+	clReleaseKernel(kernel);
+	return launcher;
+
+error:	if (NULL != ret) {
+		*ret = err;
+	}
+	return NULL;
+}
+
+/*!
+ * @function clut_releaseLauncher
+ * Releases [launcher] and its reference to the kernel.
+ */
+void clut_releaseLauncher(clut_launcher *launcher)
+{
+	cl_uint i;
+
+	if (NULL == launcher) {
+		return;
+	}
+	Debug_out(DEBUG_LAUNCHER, "clut_releaseLauncher: '%s' set %llu arguments, skipped %llu.\n",
+		  (NULL != launcher->name) ? launcher->name : "?",
+		  (unsigned long long) launcher->set, (unsigned long long) launcher->skipped);
+	for (i = 0; i < launcher->n_args; ++i) {
+		free(launcher->args[i].name);
+		free(launcher->args[i].type_name);
+		free(launcher->args[i].value);
+	}
+	free(launcher->args);
+	free(launcher->name);
+	clReleaseKernel(launcher->kernel);
+	free(launcher);
+}
+
+cl_kernel clut_getLauncherKernel(clut_launcher *launcher)
+{
+	return (NULL != launcher) ? launcher->kernel : NULL;
+}
+
+/*!
+ * @function clut_launcherFindArg
+ * Returns the argument named [arg_name], and stores its index in [index].
+ */
+static struct clut_launcher_arg * clut_launcherFindArg(clut_launcher *launcher, const char * const arg_name, cl_uint *index)
+{
+	cl_uint i;
+
+	if ((NULL == launcher) || (NULL == arg_name) || !launcher->has_info) {
+		return NULL;
+	}
+	for (i = 0; i < launcher->n_args; ++i) {
+		if (0 == strcmp(launcher->args[i].name, arg_name)) {
+			*index = i;
+			return &launcher->args[i];
+		}
+	}
+	Debug_out(DEBUG_LAUNCHER, "clut_launcherFindArg: '%s' has no argument '%s'.\n",
+		  (NULL != launcher->name) ? launcher->name : "?", arg_name);
+	return NULL;
+}
+
+/*!
+ * @function clut_getLauncherArgIndex
+ * Returns the index of argument [arg_name], or -1 if there's none.
+ */
+int clut_getLauncherArgIndex(clut_launcher *launcher, const char * const arg_name)
+{
+	cl_uint index;
+
+	return (NULL != clut_launcherFindArg(launcher, arg_name, &index)) ? (int) index : -1;
+}
+
+/*!
+ * @function clut_launcherSetArg
+ * Sets argument [index] like clSetKernelArg, unless it already holds the
+ * same [size] bytes.
+ */
+cl_int clut_launcherSetArg(clut_launcher *launcher, cl_uint index, size_t size, const void *value)
+{
+	struct clut_launcher_arg *arg;
+	void *copy = NULL;
+	cl_int ret;
+
+	if ((NULL == launcher) || (index >= launcher->n_args)) {
+		return CL_INVALID_ARG_INDEX;
+	}
+	arg = &launcher->args[index];
+	if (arg->bound && (arg->size == size) &&
+	    (((NULL == value) && (NULL == arg->value)) ||
+	     ((NULL != value) && (NULL != arg->value) && (0 == memcmp(arg->value, value, size))))) {
+		launcher->skipped++;
+		return CL_SUCCESS;
+	}
+
+	if (NULL != value) {
+		copy = ((arg->size == size) && (NULL != arg->value)) ? arg->value : malloc(size);
+		if (NULL == copy) {
+			return CL_OUT_OF_HOST_MEMORY;
+		}
+	}
+	ret = clSetKernelArg(launcher->kernel, index, size, value);
+	if (!clut_returnSuccess(ret)) {
+		if (copy != arg->value) {
+			free(copy);
+		}
+		arg->bound = 0;
+		return ret;
+	}
+	if (copy != arg->value) {
+		free(arg->value);
+	}
+	if (NULL != value) {
+		memcpy(copy, value, size);
+	}
+	arg->value = copy;
+	arg->size = size;
+	arg->bound = 1;
+	launcher->set++;
+
+	return CL_SUCCESS;
+}
+
+/*!
+ * @function clut_launcherBind
+ * Sets the argument named [arg_name], after checking [size] and [value]
+ * against its declaration.
+ * @return
+ * CL_SUCCESS, CL_INVALID_ARG_INDEX if there is no such argument,
+ * CL_INVALID_ARG_SIZE or CL_INVALID_ARG_VALUE on mismatch, or the error of
+ * clSetKernelArg.
+ */
+cl_int clut_launcherBind(clut_launcher *launcher, const char * const arg_name, size_t size, const void *value)
+{
+	const char * const fname = "clut_launcherBind";
+	struct clut_launcher_arg *arg;
+	cl_uint index;
+
+	arg = clut_launcherFindArg(launcher, arg_name, &index);
+	if (NULL == arg) {
+		return CL_INVALID_ARG_INDEX;
+	}
+
+	switch (arg->address) {
+	case CL_KERNEL_ARG_ADDRESS_LOCAL:
+		if (NULL != value) {
+			Debug_out(DEBUG_LAUNCHER, "%s: '%s' is __local, it takes a size and no value.\n", fname, arg_name);
+			return CL_INVALID_ARG_VALUE;
+		}
+		break;
+	case CL_KERNEL_ARG_ADDRESS_GLOBAL:
+	case CL_KERNEL_ARG_ADDRESS_CONSTANT:
+		if (sizeof(cl_mem) != size) {
+			Debug_out(DEBUG_LAUNCHER, "%s: '%s' (%s) takes a cl_mem.\n", fname, arg_name, arg->type_name);
+			return CL_INVALID_ARG_SIZE;
+		}
+		break;
+	default:
+		if (NULL == value) {
+			Debug_out(DEBUG_LAUNCHER, "%s: '%s' (%s) needs a value.\n", fname, arg_name, arg->type_name);
+			return CL_INVALID_ARG_VALUE;
+		}
+		if ((0 != arg->type_size) && (arg->type_size != size)) {
+			Debug_out(DEBUG_LAUNCHER, "%s: '%s' is %s, %zu bytes, not %zu.\n",
+				  fname, arg_name, arg->type_name, arg->type_size, size);
+			return CL_INVALID_ARG_SIZE;
+		}
+		break;
+	}
+
+	return clut_launcherSetArg(launcher, index, size, value);
+}
+
+/*!
+ * @function clut_launcherBindMem
+ * Binds [mem] to the buffer or image argument named [arg_name].
+ */
+cl_int clut_launcherBindMem(clut_launcher *launcher, const char * const arg_name, cl_mem mem)
+{
+	return clut_launcherBind(launcher, arg_name, sizeof(cl_mem), &mem);
+}
+
+/*!
+ * @function clut_launcherBindLocal
+ * Gives [size] bytes of local memory to the __local argument [arg_name].
+ */
+cl_int clut_launcherBindLocal(clut_launcher *launcher, const char * const arg_name, size_t size)
+{
+	return clut_launcherBind(launcher, arg_name, size, NULL);
+}
+
+/*!
+ * @function clut_launcherEnqueue
+ * Enqueues the kernel of [launcher], like clEnqueueNDRangeKernel, after
+ * checking that every argument is bound.
+ */
+cl_int clut_launcherEnqueue(clut_launcher *launcher,
+			    cl_command_queue command_queue,
+			    cl_uint work_dim,
+			    const size_t *global_work_offset,
+			    const size_t *global_work_size,
+			    const size_t *local_work_size,
+			    cl_uint n_wait,
+			    const cl_event *wait_list,
+			    cl_event *event)
+{
+	const char * const fname = "clut_launcherEnqueue";
+	cl_uint i;
+
+	if (NULL == launcher) {
+		return CL_INVALID_KERNEL;
+	}
+	for (i = 0; i < launcher->n_args; ++i) {
+		if (!launcher->args[i].bound) {
+			Debug_out(DEBUG_LAUNCHER, "%s: argument %u ('%s') of '%s' is not bound.\n", fname, i,
+				  (NULL != launcher->args[i].name) ? launcher->args[i].name : "?",
+				  (NULL != launcher->name) ? launcher->name : "?");
+			return CL_INVALID_KERNEL_ARGS;
+		}
+	}
+
+	return clut_enqueueNDRangeKernel(command_queue, launcher->kernel, work_dim,
+					 global_work_offset, global_work_size, local_work_size,
+					 n_wait, wait_list, event);
+}
+
+/*!
+ * @function clut_getLauncherCounts
+ * Stores how many arguments [launcher] set, and how many it skipped because
+ * they were unchanged.
+ */
+void clut_getLauncherCounts(clut_launcher *launcher, cl_ulong *set, cl_ulong *skipped)
+{
+	if (NULL == launcher) {
+		return;
+	}
+	if (NULL != set) {
+		*set = launcher->set;
+	}
+	if (NULL != skipped) {
+		*skipped = launcher->skipped;
+	}
+}
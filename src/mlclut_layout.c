@@ -0,0 +1,456 @@
+/**
+ * @file
+ * @author Michele Laurenti
+ * @language c
+ *
+ * Planar and cache-blocked float layouts, and the load and save paths
+ * converting them from and to 8 bit interleaved images. See mlclut_layout.h.
+ *
+ * layout_sources[0] is the indexing prelude handed to user kernels, built
+ * with the -D options of a descriptor; layout_sources[1] holds the
+ * conversion kernels, one work-item per pixel.
+ */
+
+#include "mlclut_layout.h"
+#include "mlclut_descriptions.h"
+#include "mlclut_interpose.h"
+#include "mlclut_memory.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <Debug.h>
+#include <ArrayUtils.h>
+
+#define DEBUG_LAYOUT		"mlclut_debug_layout"
+
+/* used when the device doesn't report its cache */
+#define DEFAULT_CACHE_SIZE	(32 * 1024)
+#define DEFAULT_CACHELINE	64
+/* the tile of every channel takes at most 1 / CACHE_FRACTION of the cache */
+#define CACHE_FRACTION		4
+#define MAX_OPTIONS		256
+
+static const char *layout_sources[] = {
+	"#define CLUT_LAYOUT_PLANAR	0\n"
+	"#define CLUT_LAYOUT_TILED	1\n"
+	"#define CLUT_LAYOUT_ZORDER	2\n"
+	"\n"
+	"#define CLUT_TILE_MASK		((1u << CLUT_TILE_SHIFT) - 1u)\n"
+	"#define CLUT_TILE_BASE(x, y)	((((size_t) ((uint) (y) >> CLUT_TILE_SHIFT)) * CLUT_TILES_X + ((uint) (x) >> CLUT_TILE_SHIFT)) \\\n"
+	"				 << (2 * CLUT_TILE_SHIFT))\n"
+	"\n"
+	"/* spreads the 8 low bits of v to the even bits */\n"
+	"uint clut_layout_spread(uint v)\n"
+	"{\n"
+	"	v = (v | (v << 4)) & 0x0f0fu;\n"
+	"	v = (v | (v << 2)) & 0x3333u;\n"
+	"	v = (v | (v << 1)) & 0x5555u;\n"
+	"	return v;\n"
+	"}\n"
+	"\n"
+	"#if CLUT_LAYOUT == CLUT_LAYOUT_PLANAR\n"
+	"#define CLUT_PIXEL_INDEX(x, y)	((size_t) (y) * CLUT_ROW_PITCH + (x))\n"
+	"#elif CLUT_LAYOUT == CLUT_LAYOUT_TILED\n"
+	"#define CLUT_PIXEL_INDEX(x, y)	(CLUT_TILE_BASE(x, y) + \\\n"
+	"				 ((((uint) (y) & CLUT_TILE_MASK) << CLUT_TILE_SHIFT) | ((uint) (x) & CLUT_TILE_MASK)))\n"
+	"#else\n"
+	"#define CLUT_PIXEL_INDEX(x, y)	(CLUT_TILE_BASE(x, y) + \\\n"
+	"				 ((clut_layout_spread((uint) (y) & CLUT_TILE_MASK) << 1) | \\\n"
+	"				  clut_layout_spread((uint) (x) & CLUT_TILE_MASK)))\n"
+	"#endif\n"
+	"\n"
+	"#define CLUT_LAYOUT_INDEX(x, y, c)	((size_t) (c) * CLUT_PLANE_PITCH + CLUT_PIXEL_INDEX(x, y))\n",
+
+	"__kernel void clut_layout_from_u8(__global const uchar *src, int width, int height, int components,\n"
+	"				  __global float *dst)\n"
+	"{\n"
+	"	const int x = get_global_id(0), y = get_global_id(1);\n"
+	"	int c;\n"
+	"\n"
+	"	if ((x >= width) || (y >= height)) {\n"
+	"		return;\n"
+	"	}\n"
+	"	src += ((size_t) y * width + x) * components;\n"
+	"	for (c = 0; c < components; ++c) {\n"
+	"		dst[CLUT_LAYOUT_INDEX(x, y, c)] = src[c] * (1.0f / 255.0f);\n"
+	"	}\n"
+	"}\n"
+	"\n"
+	"__kernel void clut_layout_to_u8(__global const float *src, int width, int height, int components,\n"
+	"				__global uchar *dst, int dst_pitch)\n"
+	"{\n"
+	"	const int x = get_global_id(0), y = get_global_id(1);\n"
+	"	int c;\n"
+	"\n"
+	"	if ((x >= width) || (y >= height)) {\n"
+	"		return;\n"
+	"	}\n"
+	"	dst += (size_t) y * dst_pitch + (size_t) x * components;\n"
+	"	for (c = 0; c < components; ++c) {\n"
+	"		dst[c] = convert_uchar_sat_rte(src[CLUT_LAYOUT_INDEX(x, y, c)] * 255.0f);\n"
+	"	}\n"
+	"}\n"
+};
+
+/**
+ * Function declaration
+ */
+
+static size_t clut_layoutSpread(size_t v);
+static cl_kernel clut_getLayoutKernel(cl_context context, const clut_layout_desc *desc, const char * const name);
+
+/**
+ * Function definition
+ */
+
+/*!
+ * @function clut_layoutSpread
+ * Spreads the 8 low bits of [v] to the even bits, as clut_layout_spread.
+ */
+static size_t clut_layoutSpread(size_t v)
+{
+	v = (v | (v << 4)) & 0x0f0f;
+	v = (v | (v << 2)) & 0x3333;
+	v = (v | (v << 1)) & 0x5555;
+	return v;
+}
+
+/*!
+ * @function clut_getLayoutDesc
+ * Fills [desc] for a [width] x [height] image of [components] channels in
+ * [layout] on [device]: rows and tiles are sized from its cache size and
+ * cacheline.
+ * @return
+ * 0 on success, a negative value on failure.
+ */
+int clut_getLayoutDesc(cl_device_id device, clut_layout layout,
+		       size_t width, size_t height, int components,
+		       clut_layout_desc *desc)
+{
+	const char * const fname = "clut_getLayoutDesc";
+	cl_ulong cache_size = 0;
+	cl_uint cacheline = 0;
+	size_t line_floats, budget, side, shift;
+
+	if ((NULL == desc) || (0 == width) || (0 == height) || (0 >= components) ||
+	    (CLUT_LAYOUT_ZORDER < layout)) {
+		Debug_out(DEBUG_LAYOUT, "%s: invalid argument.\n", fname);
+		return -1;
+	}
+	clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_CACHE_SIZE, sizeof(cache_size), &cache_size, NULL);
+	clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_CACHELINE_SIZE, sizeof(cacheline), &cacheline, NULL);
+	if (0 == cache_size) {
+		cache_size = DEFAULT_CACHE_SIZE;
+	}
+	if (0 == cacheline) {
+		cacheline = DEFAULT_CACHELINE;
+	}
+	line_floats = (cacheline >= sizeof(cl_float)) ? cacheline / sizeof(cl_float) : 1;
+
+	memset(desc, 0, sizeof(clut_layout_desc));
+	desc->layout = layout;
+	desc->width = width;
+	desc->height = height;
+	desc->components = components;
+	desc->channel_order = (1 == components) ? CL_R : ((2 == components) ? CL_RA : CL_RGBA);
+
+	if (CLUT_LAYOUT_PLANAR == layout) {
+		desc->row_pitch = CLUT_ROUND_UP(width, line_floats);
+		desc->plane_pitch = CLUT_ROUND_UP(desc->row_pitch * height, line_floats);
+		return 0;
+	}
+
+	/* at least a cacheline wide, and as large as fits the cache budget */
+	for (shift = 0; ((size_t) 1 << shift) < line_floats; ++shift);
+	budget = (size_t) (cache_size / CACHE_FRACTION);
+	while (shift < CLUT_LAYOUT_MAX_TILE_SHIFT) {
+		side = (size_t) 2 << shift;
+		if ((side * side * components * sizeof(cl_float) > budget) ||
+		    ((side >> 1) >= width && (side >> 1) >= height)) {
+			break;
+		}
+		++shift;
+	}
+	if (CLUT_LAYOUT_MAX_TILE_SHIFT < shift) {
+		shift = CLUT_LAYOUT_MAX_TILE_SHIFT;
+	}
+	side = (size_t) 1 << shift;
+	desc->tile_shift = shift;
+	desc->tiles_x = (width + side - 1) >> shift;
+	desc->plane_pitch = (desc->tiles_x * ((height + side - 1) >> shift)) << (2 * shift);
+
+	Debug_out(DEBUG_LAYOUT, "%s: %zu x %zu tiles of %zu pixels a side (%lu bytes of cache, %u per line).\n",
+		  fname, desc->tiles_x, (height + side - 1) >> shift, side, (unsigned long) cache_size, cacheline);
+	return 0;
+}
+
+/*!
+ * @function clut_getLayoutSize
+ * Returns the size, in bytes, of a buffer in the layout of [desc].
+ */
+size_t clut_getLayoutSize(const clut_layout_desc *desc)
+{
+	return desc->plane_pitch * desc->components * sizeof(cl_float);
+}
+
+/*!
+ * @function clut_getLayoutIndex
+ * Returns the index of channel [c] of pixel ([x], [y]) in a float buffer
+ * laid out as [desc], as CLUT_LAYOUT_INDEX does in kernels.
+ */
+size_t clut_getLayoutIndex(const clut_layout_desc *desc, size_t x, size_t y, int c)
+{
+	const size_t shift = desc->tile_shift, mask = ((size_t) 1 << shift) - 1;
+	size_t pixel;
+
+	switch (desc->layout) {
+		case CLUT_LAYOUT_PLANAR:
+			pixel = y * desc->row_pitch + x;
+			break;
+		case CLUT_LAYOUT_TILED:
+			pixel = ((((y >> shift) * desc->tiles_x) + (x >> shift)) << (2 * shift)) +
+				(((y & mask) << shift) | (x & mask));
+			break;
+		default:
+			pixel = ((((y >> shift) * desc->tiles_x) + (x >> shift)) << (2 * shift)) +
+				((clut_layoutSpread(y & mask) << 1) | clut_layoutSpread(x & mask));
+			break;
+	}
+	return (size_t) c * desc->plane_pitch + pixel;
+}
+
+/*!
+ * @function clut_getLayoutSource
+ * Returns the OpenCL C prelude defining CLUT_LAYOUT_INDEX, to be put before
+ * the sources of kernels reading or writing layout buffers.
+ */
+const char * clut_getLayoutSource(void)
+{
+	return layout_sources[0];
+}
+
+/*!
+ * @function clut_getLayoutOptions
+ * Writes to [options], [size] bytes long, the build options the prelude
+ * needs for [desc].
+ * @return
+ * 0 on success, a negative value if [options] is too short.
+ */
+int clut_getLayoutOptions(const clut_layout_desc *desc, char *options, size_t size)
+{
+	int length;
+
+	length = snprintf(options, size,
+			  "-DCLUT_LAYOUT=%d -DCLUT_ROW_PITCH=%lu -DCLUT_TILE_SHIFT=%lu -DCLUT_TILES_X=%lu -DCLUT_PLANE_PITCH=%lu",
+			  (int) desc->layout, (unsigned long) desc->row_pitch, (unsigned long) desc->tile_shift,
+			  (unsigned long) desc->tiles_x, (unsigned long) desc->plane_pitch);
+	return ((0 > length) || ((size_t) length >= size)) ? -1 : 0;
+}
+
+/*!
+ * @function clut_getLayoutKernel
+ * Acquires the conversion kernel [name] built for [desc], NULL on failure.
+ * @warning Result should be given back with clut_releaseCachedKernel.
+ */
+static cl_kernel clut_getLayoutKernel(cl_context context, const clut_layout_desc *desc, const char * const name)
+{
+	char options[MAX_OPTIONS];
+
+	if (0 != clut_getLayoutOptions(desc, options, sizeof(options))) {
+		return NULL;
+	}
+	return clut_acquireCachedKernel(context, ARRAY_LEN(layout_sources), layout_sources, options, name);
+}
+
+/*!
+ * @function clut_createLayoutBuffer
+ * Creates a buffer with [flags] for an image laid out as [desc].
+ * @warning Result should be released with clReleaseMemObject.
+ */
+cl_mem clut_createLayoutBuffer(cl_context context, cl_mem_flags flags, const clut_layout_desc *desc, cl_int *ret)
+{
+	if ((NULL == desc) || (0 == desc->plane_pitch)) {
+		if (NULL != ret) {
+			*ret = CL_INVALID_VALUE;
+		}
+		return NULL;
+	}
+	return clut_createTrackedBuffer(context, flags, clut_getLayoutSize(desc), NULL, "layout", NULL, ret);
+}
+
+/*!
+ * @function clut_loadImageLayout
+ * Opens the image at [filename] into a float buffer in [layout], sized for
+ * the device of [command_queue], and stores its layout in [desc]. The file
+ * is uploaded as is and converted on the device; the padding of tiled
+ * layouts is zeroed.
+ * @param event
+ * Where the event of the conversion will be stored. It can be NULL.
+ * @return
+ * NULL on failure, or a valid cl_mem buffer laid out as [desc].
+ */
+cl_mem clut_loadImageLayout(cl_command_queue command_queue,
+			    const char * const filename,
+			    clut_layout layout,
+			    clut_layout_desc *desc,
+			    cl_event *event)
+{
+	const char * const fname = "clut_loadImageLayout";
+	const cl_float zero = 0.0f;
+	cl_mem result = NULL, src;
+	cl_context context;
+	cl_device_id device;
+	cl_channel_order channel_order;
+	cl_kernel kernel;
+	cl_event filled = NULL;
+	unsigned char *img;
+	int width, height, components;
+	size_t global[2];
+	cl_uint index = 0;
+	cl_int ret;
+
+	if (NULL != event) {
+		*event = NULL;
+	}
+	device = clut_getQueueDevice(command_queue);
+	if ((NULL == desc) || (NULL == device)) {
+		Debug_out(DEBUG_LAYOUT, "%s: invalid argument.\n", fname);
+		goto error1;
+	}
+	ret = clGetCommandQueueInfo(command_queue, CL_QUEUE_CONTEXT, sizeof(context), &context, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to get command queue context", error1);
+
+	img = clut_readImageFile(filename, &width, &height, &components, &channel_order);
+	if (NULL == img) {
+		goto error1;
+	}
+	if (0 != clut_getLayoutDesc(device, layout, width, height, components, desc)) {
+		goto error2;
+	}
+	desc->channel_order = channel_order;
+
+	src = clut_createTrackedBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+				       (size_t) width * height * components, img, "layout", NULL, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create upload buffer", error2);
+	result = clut_createLayoutBuffer(context, CL_MEM_READ_WRITE, desc, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create layout buffer", error3);
+	kernel = clut_getLayoutKernel(context, desc, "clut_layout_from_u8");
+	if (NULL == kernel) {
+		Debug_out(DEBUG_LAYOUT, "%s: unable to build the conversion kernel.\n", fname);
+		goto error4;
+	}
+
+	if (desc->plane_pitch != (size_t) width * height) {
+		ret = clut_enqueueFillBuffer(command_queue, result, &zero, sizeof(zero), 0, clut_getLayoutSize(desc),
+					     0, NULL, &filled);
+		CLUT_CHECK_ERROR(ret, "Unable to clear layout padding", error5);
+	}
+	if (!clut_returnSuccess(ret = clSetKernelArg(kernel, index++, sizeof(cl_mem), &src)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, index++, sizeof(cl_int), &width)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, index++, sizeof(cl_int), &height)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, index++, sizeof(cl_int), &components)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, index++, sizeof(cl_mem), &result))) {
+		goto error6;
+	}
+	global[0] = width;
+	global[1] = height;
+	ret = clut_enqueueNDRangeKernel(command_queue, kernel, 2, NULL, global, NULL,
+					(NULL != filled) ? 1 : 0, (NULL != filled) ? &filled : NULL, event);
+	CLUT_CHECK_ERROR(ret, "Unable to enqueue layout conversion", error6);
+
+	Debug_out(DEBUG_LAYOUT, "%s: '%s' (%d x %d, %d channels) loaded in layout %d.\n",
+		  fname, filename, width, height, components, (int) layout);
+
+	if (NULL != filled) {
+		clReleaseEvent(filled);
+	}
+	clut_releaseCachedKernel(kernel);
+	/* the runtime keeps the upload buffer until the conversion is done */
+	clReleaseMemObject(src);
+	clut_freeImageData(img);
+	return result;
+
+error6:	if (NULL != filled) {
+		clReleaseEvent(filled);
+	}
+error5:	clut_releaseCachedKernel(kernel);
+error4:	clReleaseMemObject(result);
+	result = NULL;
+error3:	clReleaseMemObject(src);
+error2:	clut_freeImageData(img);
+error1:	return result;
+}
+
+/*!
+ * @function clut_saveImageLayout
+ * Saves [buffer], laid out as [desc], to [filename] with png format,
+ * converting it to 8 bit interleaved pixels on the device first.
+ * @return
+ * 0 on success, a negative value on failure.
+ */
+int clut_saveImageLayout(const char * const filename,
+			 cl_command_queue command_queue,
+			 cl_mem buffer,
+			 const clut_layout_desc *desc)
+{
+	const char * const fname = "clut_saveImageLayout";
+	const cl_int width = (NULL != desc) ? (cl_int) desc->width : 0;
+	const cl_int height = (NULL != desc) ? (cl_int) desc->height : 0;
+	clut_image_desc image_desc;
+	cl_context context;
+	cl_kernel kernel;
+	cl_event converted;
+	cl_mem u8;
+	cl_int ret, pitch;
+	size_t global[2];
+	cl_uint index = 0;
+	int result = -1;
+
+	if ((NULL == desc) || (0 == desc->plane_pitch)) {
+		Debug_out(DEBUG_LAYOUT, "%s: invalid argument.\n", fname);
+		goto error1;
+	}
+	ret = clGetCommandQueueInfo(command_queue, CL_QUEUE_CONTEXT, sizeof(context), &context, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to get command queue context", error1);
+
+	memset(&image_desc, 0, sizeof(image_desc));
+	image_desc.width = desc->width;
+	image_desc.height = desc->height;
+	image_desc.components = desc->components;
+	image_desc.channel_order = desc->channel_order;
+	image_desc.channel_type = CL_UNSIGNED_INT8;
+	u8 = clut_createImageBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, &image_desc, 1);
+	if (NULL == u8) {
+		goto error1;
+	}
+	kernel = clut_getLayoutKernel(context, desc, "clut_layout_to_u8");
+	if (NULL == kernel) {
+		Debug_out(DEBUG_LAYOUT, "%s: unable to build the conversion kernel.\n", fname);
+		goto error2;
+	}
+	pitch = (cl_int) image_desc.row_pitch;
+	if (!clut_returnSuccess(clSetKernelArg(kernel, index++, sizeof(cl_mem), &buffer)) ||
+	    !clut_returnSuccess(clSetKernelArg(kernel, index++, sizeof(cl_int), &width)) ||
+	    !clut_returnSuccess(clSetKernelArg(kernel, index++, sizeof(cl_int), &height)) ||
+	    !clut_returnSuccess(clSetKernelArg(kernel, index++, sizeof(cl_int), &desc->components)) ||
+	    !clut_returnSuccess(clSetKernelArg(kernel, index++, sizeof(cl_mem), &u8)) ||
+	    !clut_returnSuccess(clSetKernelArg(kernel, index++, sizeof(cl_int), &pitch))) {
+		goto error3;
+	}
+	global[0] = desc->width;
+	global[1] = desc->height;
+	ret = clut_enqueueNDRangeKernel(command_queue, kernel, 2, NULL, global, NULL, 0, NULL, &converted);
+	CLUT_CHECK_ERROR(ret, "Unable to enqueue layout conversion", error3);
+	/* the queue may be out-of-order */
+	ret = clWaitForEvents(1, &converted);
+	clReleaseEvent(converted);
+	CLUT_CHECK_ERROR(ret, "Layout conversion failed", error3);
+
+	result = clut_saveImageBufferToFile(filename, command_queue, u8, &image_desc);
+
+error3:	clut_releaseCachedKernel(kernel);
+error2:	clReleaseMemObject(u8);
+error1:	return result;
+}
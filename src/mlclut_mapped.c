@@ -0,0 +1,253 @@
+/**
+ * @file
+ * @author Michele Laurenti
+ * @language c
+ *
+ * Memory-mapped files, and device buffers created from them.
+ * A zero-copy buffer keeps the mapping alive, and unmaps it from its
+ * destructor callback.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "mlclut_mapped.h"
+#include "mlclut_descriptions.h"
+#include "mlclut_memory.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <Debug.h>
+
+#define DEBUG_MAPPED	"mlclut_debug_mapped"
+
+/* staging ring used when the caller gives none */
+#define DEFAULT_SLOT_SIZE	(4 * 1024 * 1024)
+#define DEFAULT_SLOTS		4
+
+/*!
+ * Mapping owned by a zero-copy buffer.
+ */
+struct clut_mapping {
+	void *data;
+	size_t size;
+};
+
+/**
+ * Function declaration
+ */
+
+static void clut_unmapFileCallback(cl_mem mem, void *user_data);
+static cl_int clut_streamFile(cl_command_queue command_queue, cl_mem buffer,
+			      const unsigned char *data, size_t size, clut_staging *staging);
+
+/**
+ * Function definition
+ */
+
+/*!
+ * @function clut_mapFile
+ * Maps [filename], and stores its size in [size].
+ * @return
+ * The page aligned mapping, or NULL on failure or for empty files.
+ * @warning Result should be released with clut_unmapFile.
+ */
+void * clut_mapFile(const char * const filename, size_t *size)
+{
+	const char * const fname = "clut_mapFile";
+	struct stat st;
+	void *data;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (0 > fd) {
+		Debug_out(DEBUG_MAPPED, "%s: unable to open '%s'.\n", fname, filename);
+		goto error1;
+	}
+	if ((0 != fstat(fd, &st)) || (0 >= st.st_size)) {
+		Debug_out(DEBUG_MAPPED, "%s: '%s' is empty or not a regular file.\n", fname, filename);
+		goto error2;
+	}
+	/* private and writable: a USE_HOST_PTR buffer may be written by kernels */
+	data = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (MAP_FAILED == data) {
+		Debug_out(DEBUG_MAPPED, "%s: unable to map '%s'.\n", fname, filename);
+		goto error2;
+	}
+	/* the mapping holds its own reference to the file */
+	close(fd);
+
+	*size = (size_t) st.st_size;
+	return data;
+
+error2:	close(fd);
+error1:	return NULL;
+}
+
+/*!
+ * @function clut_unmapFile
+ * Unmaps [data], a mapping of [size] bytes returned by clut_mapFile.
+ */
+void clut_unmapFile(void *data, size_t size)
+{
+	if (NULL != data) {
+		munmap(data, size);
+	}
+}
+
+/*!
+ * @function clut_unmapFileCallback
+ * Destructor of zero-copy buffers: unmaps the file they used.
+ */
+static void clut_unmapFileCallback(cl_mem mem, void *user_data)
+{
+	struct clut_mapping *mapping = (struct clut_mapping *) user_data;
+
+	clut_unmapFile(mapping->data, mapping->size);
+	free(mapping);
+}
+
+/*!
+ * @function clut_streamFile
+ * Uploads [size] bytes of [data] to [buffer] a slot of [staging] at a time,
+ * so reading the mapping (i.e. the file) overlaps the transfers, and waits
+ * for the upload to complete.
+ */
+static cl_int clut_streamFile(cl_command_queue command_queue, cl_mem buffer,
+			      const unsigned char *data, size_t size, clut_staging *staging)
+{
+	const size_t slot_size = clut_getStagingSlotSize(staging);
+	const size_t n_chunks = (size + slot_size - 1) / slot_size;
+	size_t offset, chunk, n_events = 0, i;
+	cl_event *events;
+	unsigned int slot;
+	void *pinned;
+	cl_int ret = CL_SUCCESS, wait;
+
+	events = malloc((n_chunks + 1) * sizeof(cl_event));
+	if (NULL == events) {
+		return CL_OUT_OF_HOST_MEMORY;
+	}
+	for (offset = 0; offset < size; offset += chunk) {
+		chunk = (size - offset < slot_size) ? size - offset : slot_size;
+		pinned = clut_stagingAcquire(staging, chunk, &slot);
+		if (NULL == pinned) {
+			ret = CL_OUT_OF_RESOURCES;
+			break;
+		}
+		memcpy(pinned, data + offset, chunk);
+		ret = clut_stagingWriteBuffer(staging, slot, command_queue, buffer, offset, chunk, 0, NULL, &events[n_events]);
+		if (!clut_returnSuccess(ret)) {
+			break;
+		}
+		++n_events;
+	}
+	/* the writes may run out of order: wait for all of them, and nothing else */
+	if (0 != n_events) {
+		wait = clWaitForEvents((cl_uint) n_events, events);
+		if (clut_returnSuccess(ret)) {
+			ret = wait;
+		}
+	}
+	for (i = 0; i < n_events; ++i) {
+		clReleaseEvent(events[i]);
+	}
+	free(events);
+	return ret;
+}
+
+/*!
+ * @function clut_createBufferFromFile
+ * Creates a buffer with [flags] holding [filename] in the context of
+ * [command_queue], and stores its size in [size]. On host unified memory
+ * devices the buffer uses the mapping of the file; elsewhere the file is
+ * streamed through [staging], or through a temporary ring if NULL.
+ * @warning Result should be released with clReleaseMemObject.
+ */
+cl_mem clut_createBufferFromFile(cl_command_queue command_queue,
+				 cl_mem_flags flags,
+				 const char * const filename,
+				 clut_staging *staging,
+				 size_t *size,
+				 cl_int *ret)
+{
+	const char * const fname = "clut_createBufferFromFile";
+	struct clut_mapping *mapping;
+	clut_staging *ring = staging;
+	cl_device_id device;
+	cl_context context;
+	cl_mem buffer;
+	cl_int err;
+
+	err = CL_INVALID_VALUE;
+	device = clut_getQueueDevice(command_queue);
+	if ((NULL == device) || (NULL == filename) || (NULL == size)) {
+		goto error1;
+	}
+	err = clGetCommandQueueInfo(command_queue, CL_QUEUE_CONTEXT, sizeof(context), &context, NULL);
+	CLUT_CHECK_ERROR(err, "Unable to get queue context", error1);
+
+	err = CL_OUT_OF_HOST_MEMORY;
+	mapping = malloc(sizeof(struct clut_mapping));
+	if (NULL == mapping) {
+		goto error1;
+	}
+	mapping->data = clut_mapFile(filename, &mapping->size);
+	if (NULL == mapping->data) {
+		err = CL_INVALID_VALUE;
+		goto error2;
+	}
+	*size = mapping->size;
+
+	if (clut_hasHostUnifiedMemory(device)) {
+		buffer = clut_createTrackedBuffer(context, flags | CL_MEM_USE_HOST_PTR, mapping->size, mapping->data, "mapped", NULL, &err);
+		CLUT_CHECK_ERROR(err, "Unable to create buffer on the file mapping", error3);
+		err = clSetMemObjectDestructorCallback(buffer, clut_unmapFileCallback, mapping);
+		CLUT_CHECK_ERROR(err, "Unable to set buffer destructor", error4);
+		Debug_out(DEBUG_MAPPED, "%s: '%s' (%lu bytes) used in place.\n",
+			  fname, filename, (unsigned long) mapping->size);
+		if (NULL != ret) {
+			*ret = CL_SUCCESS;
+		}
+		return buffer;
+	}
+
+	buffer = clut_createTrackedBuffer(context, flags, mapping->size, NULL, "mapped", NULL, &err);
+	CLUT_CHECK_ERROR(err, "Unable to create buffer", error3);
+	if (NULL == ring) {
+		ring = clut_createStaging(command_queue, DEFAULT_SLOT_SIZE, DEFAULT_SLOTS, &err);
+		CLUT_CHECK_ERROR(err, "Unable to create staging ring", error4);
+	}
+	/* sequential reads: let the kernel read ahead */
+	posix_madvise(mapping->data, mapping->size, POSIX_MADV_SEQUENTIAL);
+	err = clut_streamFile(command_queue, buffer, mapping->data, mapping->size, ring);
+	if (ring != staging) {
+		clut_releaseStaging(ring);
+	}
+	if (!clut_returnSuccess(err)) {
+		goto error4;
+	}
+	Debug_out(DEBUG_MAPPED, "%s: '%s' (%lu bytes) streamed to the device.\n",
+		  fname, filename, (unsigned long) mapping->size);
+
+	clut_unmapFile(mapping->data, mapping->size);
+	free(mapping);
+	if (NULL != ret) {
+		*ret = CL_SUCCESS;
+	}
+	return buffer;
+
+error4:	clReleaseMemObject(buffer);
+error3:	clut_unmapFile(mapping->data, mapping->size);
+error2:	free(mapping);
+error1:	if (NULL != ret) {
+		*ret = err;
+	}
+	return NULL;
+}
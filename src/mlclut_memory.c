@@ -0,0 +1,673 @@
+/**
+ * @file
+ * @author Michele Laurenti
+ * @language c
+ *
+ * Device memory accounting and eviction. See mlclut_memory.h.
+ *
+ * Every tracked object has a record in a global list, removed by the
+ * destructor callback of the object. Per-context totals live in a second
+ * list, whose entries are freed when their last object goes (unless they
+ * hold a limit set by the user: those retain their context, so no later
+ * context can get its address and inherit the limit). An allocation first reserves its size in
+ * its context, so concurrent allocations can't pass the limit together, and
+ * adjusts it to the size reported by the runtime once created.
+ * Eviction callbacks are called with no lock held, since releasing objects
+ * may run destructor callbacks on the calling thread.
+ */
+
+#include "mlclut_memory.h"
+#include "mlclut_descriptions.h"
+#include "mlclut_images.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <Debug.h>
+
+#define DEBUG_MEMORY		"mlclut_debug_memory"
+
+#define MEMORY_LIMIT_ENV	"CLUT_MEMORY_LIMIT"
+#define MAX_EVICTIONS		32
+#define NO_LIMIT		((size_t) -1)
+
+struct clut_memory_context {
+	cl_context context;
+	int explicit_limit;
+	clut_memory_stats stats;
+	struct clut_memory_context *next;
+};
+
+struct clut_memory_object {
+	cl_mem mem;
+	struct clut_memory_context *record;
+	size_t size;
+	const char *tag;
+	const void *owner;
+	struct clut_memory_object *prev;
+	struct clut_memory_object *next;
+};
+
+struct clut_memory_eviction {
+	clut_memory_evict evict;
+	void *user_data;
+};
+
+struct clut_memory_tag {
+	const char *tag;
+	size_t size;
+	size_t objects;
+};
+
+static pthread_once_t memory_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t memory_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t memory_env_limit = 0;
+static struct clut_memory_context *memory_contexts = NULL;
+static struct clut_memory_object *memory_objects = NULL;
+static struct clut_memory_eviction memory_evictions[MAX_EVICTIONS];
+static unsigned int memory_n_evictions = 0;
+
+/**
+ * Function declaration
+ */
+
+static void clut_memoryInit(void);
+static size_t clut_memoryDefaultLimit(cl_context context);
+static struct clut_memory_context * clut_memoryGetContext(cl_context context, int create);
+static void clut_memoryForget(struct clut_memory_context *record);
+static int clut_memoryFits(const struct clut_memory_context *record, size_t size);
+static int clut_memoryIsShortage(cl_int ret);
+static size_t clut_memoryEvict(cl_context context, size_t size);
+static cl_int clut_memoryReserve(cl_context context, size_t size, struct clut_memory_context **record);
+static void clut_memoryUnreserve(struct clut_memory_context *record, size_t size, int failed);
+static cl_int clut_memoryTrack(struct clut_memory_context *record, cl_mem mem, size_t reserved,
+			       const char *tag, const void *owner);
+static void clut_memoryDestructor(cl_mem mem, void *user_data);
+static size_t clut_memoryImageSize(const cl_image_format *image_format, const cl_image_desc *image_desc);
+static cl_mem clut_memoryCreate(cl_context context, cl_mem_flags flags, size_t size,
+				const cl_image_format *image_format, const cl_image_desc *image_desc,
+				void *host_ptr, const char *tag, const void *owner, cl_int *ret);
+
+/**
+ * Function definition
+ */
+
+/*!
+ * @function clut_memoryInit
+ * Reads the environment, once.
+ */
+static void clut_memoryInit(void)
+{
+	const char *value;
+
+	value = getenv(MEMORY_LIMIT_ENV);
+	if ((NULL != value) && ('\0' != value[0])) {
+		memory_env_limit = (size_t) strtoull(value, NULL, 10);
+	}
+}
+
+/*!
+ * @function clut_memoryDefaultLimit
+ * Returns the limit of [context] from the environment, or from the global
+ * memory of its devices, or NO_LIMIT if they can't be queried.
+ */
+static size_t clut_memoryDefaultLimit(cl_context context)
+{
+	cl_device_id *devices;
+	cl_ulong global_size, smallest = 0;
+	size_t size, i;
+
+	if (0 != memory_env_limit) {
+		return memory_env_limit;
+	}
+	if (CL_SUCCESS != clGetContextInfo(context, CL_CONTEXT_DEVICES, 0, NULL, &size) || (0 == size)) {
+		return NO_LIMIT;
+	}
+	devices = malloc(size);
+	if (NULL == devices) {
+		return NO_LIMIT;
+	}
+	if (CL_SUCCESS == clGetContextInfo(context, CL_CONTEXT_DEVICES, size, devices, NULL)) {
+		for (i = 0; i < size / sizeof(cl_device_id); ++i) {
+			if ((CL_SUCCESS == clGetDeviceInfo(devices[i], CL_DEVICE_GLOBAL_MEM_SIZE,
+							   sizeof(global_size), &global_size, NULL)) &&
+			    ((0 == smallest) || (global_size < smallest))) {
+				smallest = global_size;
+			}
+		}
+	}
+	free(devices);
+	if (0 == smallest) {
+		return NO_LIMIT;
+	}
+	smallest = smallest / 100 * CLUT_MEMORY_LIMIT_PERCENT;
+	return ((size_t) smallest != smallest) ? NO_LIMIT : (size_t) smallest;
+}
+
+/*!
+ * @function clut_memoryGetContext
+ * Returns the record of [context], creating it if [create] is not 0.
+ * Called with memory_lock held.
+ */
+static struct clut_memory_context * clut_memoryGetContext(cl_context context, int create)
+{
+	struct clut_memory_context *record;
+
+	for (record = memory_contexts; NULL != record; record = record->next) {
+		if (record->context == context) {
+			return record;
+		}
+	}
+	if (!create) {
+		return NULL;
+	}
+	record = calloc(1, sizeof(*record));
+	if (NULL == record) {
+		return NULL;
+	}
+	record->context = context;
+	record->stats.limit = clut_memoryDefaultLimit(context);
+	record->next = memory_contexts;
+	memory_contexts = record;
+	Debug_out(DEBUG_MEMORY, "clut_memoryGetContext: context %p, limit %zu bytes.\n",
+		  (void *) context, record->stats.limit);
+	return record;
+}
+
+/*!
+ * @function clut_memoryForget
+ * Frees [record] if it has no object and no limit set by the user.
+ * Called with memory_lock held.
+ */
+static void clut_memoryForget(struct clut_memory_context *record)
+{
+	struct clut_memory_context **link;
+
+	if ((0 != record->stats.objects) || record->explicit_limit) {
+		return;
+	}
+	for (link = &memory_contexts; NULL != *link; link = &(*link)->next) {
+		if (*link == record) {
+			*link = record->next;
+			free(record);
+			return;
+		}
+	}
+}
+
+/*!
+ * @function clut_memoryFits
+ * Returns 1 if [size] more bytes fit the limit of [record].
+ */
+static int clut_memoryFits(const struct clut_memory_context *record, size_t size)
+{
+	if (NO_LIMIT == record->stats.limit) {
+		return 1;
+	}
+	return (record->stats.used < record->stats.limit) && (size <= record->stats.limit - record->stats.used);
+}
+
+/*!
+ * @function clut_memoryIsShortage
+ * Returns 1 if [ret] tells the runtime ran out of memory.
+ */
+static int clut_memoryIsShortage(cl_int ret)
+{
+	return (CL_MEM_OBJECT_ALLOCATION_FAILURE == ret) || (CL_OUT_OF_RESOURCES == ret);
+}
+
+/*!
+ * @function clut_memoryEvict
+ * Calls the eviction callbacks until they release [size] bytes of
+ * [context].
+ * @return
+ * The bytes released.
+ */
+static size_t clut_memoryEvict(cl_context context, size_t size)
+{
+	struct clut_memory_eviction evictions[MAX_EVICTIONS];
+	struct clut_memory_context *record;
+	size_t freed = 0, released, count = 0;
+	unsigned int n, i;
+
+	pthread_mutex_lock(&memory_lock);
+	n = memory_n_evictions;
+	memcpy(evictions, memory_evictions, n * sizeof(struct clut_memory_eviction));
+	pthread_mutex_unlock(&memory_lock);
+
+	for (i = 0; (i < n) && (freed < size); ++i) {
+		released = evictions[i].evict(context, size - freed, evictions[i].user_data);
+		if (0 < released) {
+			freed += released;
+			++count;
+		}
+	}
+
+	pthread_mutex_lock(&memory_lock);
+	record = clut_memoryGetContext(context, 0);
+	if (NULL != record) {
+		record->stats.evictions += count;
+	}
+	pthread_mutex_unlock(&memory_lock);
+
+	Debug_out(DEBUG_MEMORY, "clut_memoryEvict: %zu of %zu bytes released by %zu callbacks.\n",
+		  freed, size, count);
+	return freed;
+}
+
+/*!
+ * @function clut_memoryReserve
+ * Counts [size] bytes as used in [context], evicting first if they don't
+ * fit its limit, and stores its record in [record]. A reservation holds the
+ * record as an object does.
+ */
+static cl_int clut_memoryReserve(cl_context context, size_t size, struct clut_memory_context **record)
+{
+	const char * const fname = "clut_memoryReserve";
+	struct clut_memory_context *r;
+	size_t need;
+
+	pthread_once(&memory_once, clut_memoryInit);
+	pthread_mutex_lock(&memory_lock);
+	r = clut_memoryGetContext(context, 1);
+	if (NULL == r) {
+		pthread_mutex_unlock(&memory_lock);
+		return CL_OUT_OF_HOST_MEMORY;
+	}
+	++r->stats.objects;
+
+	if (!clut_memoryFits(r, size)) {
+		/* evicting can't help */
+		if (size > r->stats.limit) {
+			goto error1;
+		}
+		need = r->stats.used + size - r->stats.limit;
+		pthread_mutex_unlock(&memory_lock);
+		clut_memoryEvict(context, need);
+		pthread_mutex_lock(&memory_lock);
+		/* the destructors of the released objects already updated used */
+		if (!clut_memoryFits(r, size)) {
+			goto error1;
+		}
+	}
+
+	r->stats.used += size;
+	if (r->stats.used > r->stats.high_water) {
+		r->stats.high_water = r->stats.used;
+	}
+	pthread_mutex_unlock(&memory_lock);
+	*record = r;
+	return CL_SUCCESS;
+
+error1:	Debug_out(DEBUG_MEMORY, "%s: %zu bytes don't fit (%zu of %zu used).\n",
+		  fname, size, r->stats.used, r->stats.limit);
+	++r->stats.failures;
+	--r->stats.objects;
+	clut_memoryForget(r);
+	pthread_mutex_unlock(&memory_lock);
+	return CL_MEM_OBJECT_ALLOCATION_FAILURE;
+}
+
+/*!
+ * @function clut_memoryUnreserve
+ * Gives back a reservation of [size] bytes that wasn't used.
+ */
+static void clut_memoryUnreserve(struct clut_memory_context *record, size_t size, int failed)
+{
+	pthread_mutex_lock(&memory_lock);
+	record->stats.used -= size;
+	--record->stats.objects;
+	if (failed) {
+		++record->stats.failures;
+	}
+	clut_memoryForget(record);
+	pthread_mutex_unlock(&memory_lock);
+}
+
+/*!
+ * @function clut_memoryTrack
+ * Turns the reservation of [reserved] bytes into a record of [mem], and
+ * sets the destructor callback removing it.
+ */
+static cl_int clut_memoryTrack(struct clut_memory_context *record, cl_mem mem, size_t reserved,
+			       const char *tag, const void *owner)
+{
+	struct clut_memory_object *object;
+	size_t size = reserved;
+	cl_int ret;
+
+	object = malloc(sizeof(struct clut_memory_object));
+	if (NULL == object) {
+		return CL_OUT_OF_HOST_MEMORY;
+	}
+	/* images may take more than their pixels */
+	clGetMemObjectInfo(mem, CL_MEM_SIZE, sizeof(size), &size, NULL);
+	object->mem = mem;
+	object->record = record;
+	object->size = size;
+	object->tag = tag;
+	object->owner = owner;
+	object->prev = NULL;
+
+	pthread_mutex_lock(&memory_lock);
+	object->next = memory_objects;
+	if (NULL != memory_objects) {
+		memory_objects->prev = object;
+	}
+	memory_objects = object;
+	record->stats.used = record->stats.used - reserved + size;
+	if (record->stats.used > record->stats.high_water) {
+		record->stats.high_water = record->stats.used;
+	}
+	pthread_mutex_unlock(&memory_lock);
+
+	ret = clSetMemObjectDestructorCallback(mem, clut_memoryDestructor, object);
+	if (CL_SUCCESS != ret) {
+		pthread_mutex_lock(&memory_lock);
+		if (NULL != object->prev) {
+			object->prev->next = object->next;
+		} else {
+			memory_objects = object->next;
+		}
+		if (NULL != object->next) {
+			object->next->prev = object->prev;
+		}
+		record->stats.used = record->stats.used - size + reserved;
+		pthread_mutex_unlock(&memory_lock);
+		free(object);
+	}
+	return ret;
+}
+
+/*!
+ * @function clut_memoryDestructor
+ * Destructor callback of tracked objects: removes their record.
+ */
+static void clut_memoryDestructor(cl_mem mem, void *user_data)
+{
+	struct clut_memory_object *object = (struct clut_memory_object *) user_data;
+
+	pthread_mutex_lock(&memory_lock);
+	if (NULL != object->prev) {
+		object->prev->next = object->next;
+	} else {
+		memory_objects = object->next;
+	}
+	if (NULL != object->next) {
+		object->next->prev = object->prev;
+	}
+	object->record->stats.used -= object->size;
+	--object->record->stats.objects;
+	clut_memoryForget(object->record);
+	pthread_mutex_unlock(&memory_lock);
+	free(object);
+}
+
+/*!
+ * @function clut_memoryImageSize
+ * Returns the size of the pixels of an image, the estimate reserved before
+ * creating it.
+ */
+static size_t clut_memoryImageSize(const cl_image_format *image_format, const cl_image_desc *image_desc)
+{
+	const int components = clut_getImageFormatComponents(*image_format);
+	size_t pixel = clut_getChannelTypeSize(image_format->image_channel_data_type);
+
+	/* packed and unknown formats */
+	if ((0 == pixel) || (0 >= components)) {
+		pixel = 4;
+	} else {
+		pixel *= (size_t) components;
+	}
+	return pixel * image_desc->image_width *
+	       ((0 != image_desc->image_height) ? image_desc->image_height : 1) *
+	       ((0 != image_desc->image_depth) ? image_desc->image_depth : 1) *
+	       ((0 != image_desc->image_array_size) ? image_desc->image_array_size : 1);
+}
+
+/*!
+ * @function clut_memoryCreate
+ * Creates a tracked image of [image_format] and [image_desc], or a buffer
+ * of [size] bytes if [image_format] is NULL. If the runtime is out of
+ * memory, evicts [size] bytes and tries once more.
+ */
+static cl_mem clut_memoryCreate(cl_context context, cl_mem_flags flags, size_t size,
+				const cl_image_format *image_format, const cl_image_desc *image_desc,
+				void *host_ptr, const char *tag, const void *owner, cl_int *ret)
+{
+	struct clut_memory_context *record;
+	cl_mem mem = NULL;
+	int attempt;
+	cl_int err;
+
+	err = clut_memoryReserve(context, size, &record);
+	CLUT_CHECK_ERROR(err, "Unable to reserve device memory", error1);
+	for (attempt = 0; attempt < 2; ++attempt) {
+		if (NULL != image_format) {
+			mem = clCreateImage(context, flags, image_format, image_desc, host_ptr, &err);
+		} else {
+			mem = clCreateBuffer(context, flags, size, host_ptr, &err);
+		}
+		if ((0 < attempt) || !clut_memoryIsShortage(err)) {
+			break;
+		}
+		/* the runtime knows better than the limit: make room, and try again */
+		clut_memoryEvict(context, size);
+	}
+	CLUT_CHECK_ERROR(err, "Unable to create memory object", error2);
+	err = clut_memoryTrack(record, mem, size, tag, owner);
+	CLUT_CHECK_ERROR(err, "Unable to track memory object", error3);
+
+	if (NULL != ret) {
+		*ret = CL_SUCCESS;
+	}
+	return mem;
+
+error3:	clReleaseMemObject(mem);
+error2:	clut_memoryUnreserve(record, size, clut_memoryIsShortage(err));
+error1:	if (NULL != ret) {
+		*ret = err;
+	}
+	return NULL;
+}
+
+/*!
+ * @function clut_createTrackedBuffer
+ * clCreateBuffer, recording the buffer under [tag] and [owner].
+ * @warning Result should be released with clReleaseMemObject.
+ */
+cl_mem clut_createTrackedBuffer(cl_context context, cl_mem_flags flags, size_t size, void *host_ptr,
+				const char *tag, const void *owner, cl_int *ret)
+{
+	return clut_memoryCreate(context, flags, size, NULL, NULL, host_ptr, tag, owner, ret);
+}
+
+/*!
+ * @function clut_createTrackedImage
+ * clCreateImage, recording the image under [tag] and [owner]. Images
+ * created from a buffer use its memory, and aren't recorded.
+ * @warning Result should be released with clReleaseMemObject.
+ */
+cl_mem clut_createTrackedImage(cl_context context, cl_mem_flags flags,
+			       const cl_image_format *image_format, const cl_image_desc *image_desc,
+			       void *host_ptr, const char *tag, const void *owner, cl_int *ret)
+{
+	if ((NULL == image_format) || (NULL == image_desc) || (NULL != image_desc->buffer)) {
+		return clCreateImage(context, flags, image_format, image_desc, host_ptr, ret);
+	}
+	return clut_memoryCreate(context, flags, clut_memoryImageSize(image_format, image_desc),
+				 image_format, image_desc, host_ptr, tag, owner, ret);
+}
+
+/*!
+ * @function clut_registerEviction
+ * Adds [evict] to the callbacks called, with [user_data], when memory is
+ * short. Callbacks are called in registration order.
+ */
+cl_int clut_registerEviction(clut_memory_evict evict, void *user_data)
+{
+	cl_int ret = CL_SUCCESS;
+
+	if (NULL == evict) {
+		return CL_INVALID_VALUE;
+	}
+	pthread_mutex_lock(&memory_lock);
+	if (MAX_EVICTIONS <= memory_n_evictions) {
+		ret = CL_OUT_OF_RESOURCES;
+	} else {
+		memory_evictions[memory_n_evictions].evict = evict;
+		memory_evictions[memory_n_evictions].user_data = user_data;
+		++memory_n_evictions;
+	}
+	pthread_mutex_unlock(&memory_lock);
+	return ret;
+}
+
+/*!
+ * @function clut_unregisterEviction
+ * Removes the callback registered with [evict] and [user_data]. It may
+ * still be running, or be called once more, by allocations in progress.
+ */
+void clut_unregisterEviction(clut_memory_evict evict, void *user_data)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&memory_lock);
+	for (i = 0; i < memory_n_evictions; ++i) {
+		if ((memory_evictions[i].evict == evict) && (memory_evictions[i].user_data == user_data)) {
+			--memory_n_evictions;
+			memmove(memory_evictions + i, memory_evictions + i + 1,
+				(memory_n_evictions - i) * sizeof(struct clut_memory_eviction));
+			break;
+		}
+	}
+	pthread_mutex_unlock(&memory_lock);
+}
+
+/*!
+ * @function clut_setMemoryLimit
+ * Sets the limit of [context] to [limit] bytes, or back to the default if
+ * 0. Objects already created are kept even past the limit.
+ * A limit set here retains [context] until clut_memoryReleaseContext, or
+ * clut_setMemoryLimit with 0, is called.
+ */
+void clut_setMemoryLimit(cl_context context, size_t limit)
+{
+	struct clut_memory_context *record;
+	int release = 0;
+
+	pthread_once(&memory_once, clut_memoryInit);
+	pthread_mutex_lock(&memory_lock);
+	record = clut_memoryGetContext(context, 0 != limit);
+	if (NULL != record) {
+		if ((0 != limit) && !record->explicit_limit) {
+			clRetainContext(context);
+		}
+		release = record->explicit_limit && (0 == limit);
+		record->explicit_limit = (0 != limit);
+		record->stats.limit = (0 != limit) ? limit : clut_memoryDefaultLimit(context);
+		clut_memoryForget(record);
+	}
+	pthread_mutex_unlock(&memory_lock);
+	if (release) {
+		clReleaseContext(context);
+	}
+}
+
+/*!
+ * @function clut_memoryReleaseContext
+ * Drops the limit set on [context] with clut_setMemoryLimit, and the
+ * reference to it. Call it before releasing a context with such a limit.
+ */
+void clut_memoryReleaseContext(cl_context context)
+{
+	clut_setMemoryLimit(context, 0);
+}
+
+/*!
+ * @function clut_getMemoryStats
+ * Stores the totals of [context] in [stats].
+ */
+void clut_getMemoryStats(cl_context context, clut_memory_stats *stats)
+{
+	struct clut_memory_context *record;
+
+	pthread_once(&memory_once, clut_memoryInit);
+	pthread_mutex_lock(&memory_lock);
+	record = clut_memoryGetContext(context, 0);
+	if (NULL != record) {
+		*stats = record->stats;
+	} else {
+		memset(stats, 0, sizeof(clut_memory_stats));
+		stats->limit = clut_memoryDefaultLimit(context);
+	}
+	pthread_mutex_unlock(&memory_lock);
+}
+
+/*!
+ * @function clut_getOwnerMemory
+ * Returns the bytes of the live objects created for [owner].
+ */
+size_t clut_getOwnerMemory(const void *owner)
+{
+	struct clut_memory_object *object;
+	size_t size = 0;
+
+	pthread_mutex_lock(&memory_lock);
+	for (object = memory_objects; NULL != object; object = object->next) {
+		if (object->owner == owner) {
+			size += object->size;
+		}
+	}
+	pthread_mutex_unlock(&memory_lock);
+	return size;
+}
+
+/*!
+ * @function clut_memoryReport
+ * Prints the totals of every context, and the live objects by tag, to [f].
+ */
+void clut_memoryReport(FILE *f)
+{
+	struct clut_memory_context *record;
+	struct clut_memory_object *object;
+	struct clut_memory_tag *tags = NULL, *grown;
+	size_t n_tags = 0, i;
+	const char *tag;
+
+	pthread_mutex_lock(&memory_lock);
+	for (record = memory_contexts; NULL != record; record = record->next) {
+		fprintf(f, "context %p: %zu bytes used of %zu (high water %zu), %zu objects, %zu evictions, %zu failures.\n",
+			(void *) record->context, record->stats.used, record->stats.limit, record->stats.high_water,
+			record->stats.objects, record->stats.evictions, record->stats.failures);
+	}
+	for (object = memory_objects; NULL != object; object = object->next) {
+		tag = (NULL != object->tag) ? object->tag : "untagged";
+		for (i = 0; i < n_tags; ++i) {
+			if (0 == strcmp(tags[i].tag, tag)) {
+				break;
+			}
+		}
+		if (i == n_tags) {
+			grown = realloc(tags, (n_tags + 1) * sizeof(struct clut_memory_tag));
+			if (NULL == grown) {
+				break;
+			}
+			tags = grown;
+			tags[n_tags].tag = tag;
+			tags[n_tags].size = 0;
+			tags[n_tags].objects = 0;
+			++n_tags;
+		}
+		tags[i].size += object->size;
+		++tags[i].objects;
+	}
+	pthread_mutex_unlock(&memory_lock);
+
+	for (i = 0; i < n_tags; ++i) {
+		fprintf(f, "  %-16s %12zu bytes in %zu objects\n", tags[i].tag, tags[i].size, tags[i].objects);
+	}
+	free(tags);
+}
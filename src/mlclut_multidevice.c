@@ -0,0 +1,359 @@
+/**
+ * @file
+ * @author Michele Laurenti
+ * @language c
+ *
+ * Splitting a row range over several devices.
+ *
+ * One host thread drives each queue, keeping IN_FLIGHT chunks enqueued so
+ * the device never waits for the host. Chunks come from a shared cursor;
+ * each chunk is (remaining rows) * (device share) / GUIDED_FACTOR rows, so
+ * chunks shrink as the job nears its end, and the last chunks of every
+ * device finish at about the same time. A device's share is its measured
+ * throughput (rows per second, between consecutive completions) over the
+ * total.
+ */
+
+#include "mlclut_multidevice.h"
+#include "mlclut_descriptions.h"
+#include "mlclut_clock.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <Debug.h>
+
+#define DEBUG_MULTIDEVICE	"mlclut_debug_multidevice"
+
+#define IN_FLIGHT		2
+#define GUIDED_FACTOR		2
+#define DEFAULT_CHUNKS		32	/* per device, for the default minimum chunk */
+
+struct clut_split_chunk {
+	size_t first;
+	size_t n;
+	cl_mem input;
+	cl_mem output;
+	cl_event event;
+	cl_ulong enqueued;
+};
+
+struct clut_split {
+	const clut_split_config *config;
+	size_t next_row;
+	size_t granularity;
+	size_t min_rows;
+	double *speeds;
+	size_t *done;
+	cl_int status;
+	pthread_mutex_t lock;
+};
+
+struct clut_split_worker {
+	struct clut_split *split;
+	cl_uint index;
+};
+
+/**
+ * Function declaration
+ */
+
+static size_t clut_gcd(size_t a, size_t b);
+static size_t clut_splitGranularity(size_t pitch, size_t alignment);
+static int clut_splitTake(struct clut_split *s, cl_uint index, struct clut_split_chunk *chunk);
+static cl_int clut_splitEnqueue(struct clut_split *s, cl_uint index, struct clut_split_chunk *chunk);
+static void clut_splitRelease(struct clut_split_chunk *chunk);
+static void * clut_splitWorker(void *arg);
+
+/**
+ * Function definition
+ */
+
+static size_t clut_gcd(size_t a, size_t b)
+{
+	size_t t;
+
+	while (0 != b) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/*!
+ * @function clut_splitGranularity
+ * Returns the smallest number of rows of [pitch] bytes spanning a multiple
+ * of [alignment] bytes.
+ */
+static size_t clut_splitGranularity(size_t pitch, size_t alignment)
+{
+	if (0 == pitch) {
+		return 1;
+	}
+	return alignment / clut_gcd(pitch, alignment);
+}
+
+/*!
+ * @function clut_splitTake
+ * Takes the next chunk for device [index].
+ * @return
+ * 1 if a chunk was taken, 0 if no rows are left or the job failed.
+ */
+static int clut_splitTake(struct clut_split *s, cl_uint index, struct clut_split_chunk *chunk)
+{
+	const cl_uint n_devices = s->config->n_queues;
+	const size_t granularity = (0 < s->granularity) ? s->granularity : 1;
+	double total = 0, share;
+	size_t remaining, n;
+	cl_uint i;
+	int known = 1;
+
+	pthread_mutex_lock(&s->lock);
+	remaining = s->config->rows - s->next_row;
+	if ((0 == remaining) || !clut_returnSuccess(s->status)) {
+		pthread_mutex_unlock(&s->lock);
+		return 0;
+	}
+
+	for (i = 0; i < n_devices; ++i) {
+		total += s->speeds[i];
+		known = known && (0 < s->speeds[i]);
+	}
+	share = known ? s->speeds[index] / total : 1.0 / n_devices;
+
+	n = (size_t) (remaining * share / GUIDED_FACTOR);
+	if (n < s->min_rows) {
+		n = s->min_rows;
+	}
+	/* near the end both may be 0: always take at least one granule */
+	if (n < granularity) {
+		n = granularity;
+	}
+	n = CLUT_ROUND_UP(n, granularity);
+	if (n > remaining) {
+		n = remaining;
+	}
+
+	chunk->first = s->next_row;
+	chunk->n = n;
+	s->next_row += n;
+	pthread_mutex_unlock(&s->lock);
+
+	return 1;
+}
+
+/*!
+ * @function clut_splitRelease
+ * Releases the sub-buffers and the event of [chunk].
+ */
+static void clut_splitRelease(struct clut_split_chunk *chunk)
+{
+	if (NULL != chunk->event) {
+		clReleaseEvent(chunk->event);
+	}
+	if (NULL != chunk->input) {
+		clReleaseMemObject(chunk->input);
+	}
+	if (NULL != chunk->output) {
+		clReleaseMemObject(chunk->output);
+	}
+	memset(chunk, 0, sizeof(*chunk));
+}
+
+/*!
+ * @function clut_splitEnqueue
+ * Creates the sub-buffers of [chunk], and enqueues its computation on
+ * device [index].
+ */
+static cl_int clut_splitEnqueue(struct clut_split *s, cl_uint index, struct clut_split_chunk *chunk)
+{
+	const clut_split_config *config = s->config;
+	cl_command_queue queue = config->queues[index];
+	cl_buffer_region region;
+	cl_int ret = CL_SUCCESS;
+
+	chunk->input = chunk->output = NULL;
+	chunk->event = NULL;
+
+	if (NULL != config->input) {
+		region.origin = chunk->first * config->input_row_pitch;
+		region.size = chunk->n * config->input_row_pitch;
+		chunk->input = clCreateSubBuffer(config->input, 0, CL_BUFFER_CREATE_TYPE_REGION, &region, &ret);
+		CLUT_CHECK_ERROR(ret, "Unable to create input sub-buffer", error);
+	}
+	if (NULL != config->output) {
+		region.origin = chunk->first * config->output_row_pitch;
+		region.size = chunk->n * config->output_row_pitch;
+		chunk->output = clCreateSubBuffer(config->output, 0, CL_BUFFER_CREATE_TYPE_REGION, &region, &ret);
+		CLUT_CHECK_ERROR(ret, "Unable to create output sub-buffer", error);
+	}
+
+	chunk->enqueued = clut_getHostTime_ns();
+	ret = config->compute(queue, index, chunk->input, chunk->output,
+			      chunk->first, chunk->n, &chunk->event, config->user_data);
+	CLUT_CHECK_ERROR(ret, "Unable to enqueue chunk", error);
+	clFlush(queue);
+
+	return CL_SUCCESS;
+
+error:	clut_splitRelease(chunk);
+	return ret;
+}
+
+/*!
+ * @function clut_splitWorker
+ * Drives one device: keeps up to IN_FLIGHT chunks enqueued, and updates the
+ * device throughput as they complete.
+ */
+static void * clut_splitWorker(void *arg)
+{
+	struct clut_split_worker *w = arg;
+	struct clut_split *s = w->split;
+	struct clut_split_chunk pending[IN_FLIGHT], *chunk;
+	unsigned int head = 0, n_pending = 0;
+	cl_ulong now, last_completion = 0, since;
+	double rate;
+	cl_int ret;
+
+	memset(pending, 0, sizeof(pending));
+
+	for (;;) {
+		while (n_pending < IN_FLIGHT) {
+			chunk = &pending[(head + n_pending) % IN_FLIGHT];
+			if (!clut_splitTake(s, w->index, chunk)) {
+				break;
+			}
+			ret = clut_splitEnqueue(s, w->index, chunk);
+			if (!clut_returnSuccess(ret)) {
+				pthread_mutex_lock(&s->lock);
+				s->status = ret;
+				pthread_mutex_unlock(&s->lock);
+				break;
+			}
+			++n_pending;
+		}
+		if (0 == n_pending) {
+			break;
+		}
+
+		chunk = &pending[head];
+		ret = clWaitForEvents(1, &chunk->event);
+		now = clut_getHostTime_ns();
+
+		pthread_mutex_lock(&s->lock);
+		if (clut_returnSuccess(ret)) {
+			/* throughput between completions, so queued chunks don't count twice */
+			since = (chunk->enqueued > last_completion) ? chunk->enqueued : last_completion;
+			if (now > since) {
+				rate = chunk->n * 1e9 / (now - since);
+				s->speeds[w->index] = (0 < s->speeds[w->index]) ? 0.5 * (s->speeds[w->index] + rate) : rate;
+			}
+			s->done[w->index] += chunk->n;
+		} else {
+			s->status = ret;
+		}
+		pthread_mutex_unlock(&s->lock);
+
+		last_completion = now;
+		clut_splitRelease(chunk);
+		head = (head + 1) % IN_FLIGHT;
+		--n_pending;
+	}
+
+	return NULL;
+}
+
+/*!
+ * @function clut_runSplit
+ * Runs the job described by [config] over all its queues, and returns when
+ * every row is done. If [rows_per_device] is not NULL, it receives the rows
+ * computed by each device.
+ * @return
+ * CL_SUCCESS, or the first error met (rows not yet handed out are skipped).
+ */
+cl_int clut_runSplit(const clut_split_config *config, size_t *rows_per_device)
+{
+	const char * const fname = "clut_runSplit";
+	struct clut_split s;
+	struct clut_split_worker *workers = NULL;
+	pthread_t *threads = NULL;
+	size_t alignment, a, g_in, g_out;
+	cl_device_id device;
+	cl_uint i, n_started = 0;
+
+	if ((NULL == config) || (NULL == config->queues) || (0 == config->n_queues) || (NULL == config->compute)) {
+		Debug_out(DEBUG_MULTIDEVICE, "%s: invalid configuration.\n", fname);
+		return CL_INVALID_VALUE;
+	}
+
+	memset(&s, 0, sizeof(s));
+	s.config = config;
+	s.status = CL_SUCCESS;
+
+	/* sub-buffer origins must suit every device */
+	alignment = 1;
+	for (i = 0; i < config->n_queues; ++i) {
+		device = clut_getQueueDevice(config->queues[i]);
+		a = (NULL != device) ? clut_getDeviceAlignment(device) : 0;
+		if (a > alignment) {
+			alignment = a;
+		}
+	}
+	g_in = (NULL != config->input) ? clut_splitGranularity(config->input_row_pitch, alignment) : 1;
+	g_out = (NULL != config->output) ? clut_splitGranularity(config->output_row_pitch, alignment) : 1;
+	s.granularity = g_in / clut_gcd(g_in, g_out) * g_out;
+	s.min_rows = (0 != config->min_chunk_rows) ? config->min_chunk_rows : config->rows / (DEFAULT_CHUNKS * config->n_queues);
+
+	s.speeds = calloc(config->n_queues, sizeof(double));
+	s.done = calloc(config->n_queues, sizeof(size_t));
+	workers = calloc(config->n_queues, sizeof(struct clut_split_worker));
+	threads = calloc(config->n_queues, sizeof(pthread_t));
+	if ((NULL == s.speeds) || (NULL == s.done) || (NULL == workers) || (NULL == threads)) {
+		Debug_out(DEBUG_MULTIDEVICE, "%s: calloc failed.\n", fname);
+		s.status = CL_OUT_OF_HOST_MEMORY;
+		goto clean;
+	}
+	if (NULL != config->speeds) {
+		memcpy(s.speeds, config->speeds, config->n_queues * sizeof(double));
+	}
+	pthread_mutex_init(&s.lock, NULL);
+
+	for (i = 0; i < config->n_queues; ++i) {
+		workers[i].split = &s;
+		workers[i].index = i;
+		if (0 != pthread_create(&threads[i], NULL, clut_splitWorker, &workers[i])) {
+			Debug_out(DEBUG_MULTIDEVICE, "%s: unable to start worker %u.\n", fname, i);
+			break;
+		}
+		++n_started;
+	}
+	if (0 == n_started) {
+		/* nobody to do the work, do it here */
+		clut_splitWorker(&workers[0]);
+	}
+	for (i = 0; i < n_started; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	pthread_mutex_destroy(&s.lock);
+
+	for (i = 0; i < config->n_queues; ++i) {
+		Debug_out(DEBUG_MULTIDEVICE, "%s: device %u computed %zu rows at %.0f rows/s.\n",
+			  fname, i, s.done[i], s.speeds[i]);
+	}
+	if (NULL != rows_per_device) {
+		memcpy(rows_per_device, s.done, config->n_queues * sizeof(size_t));
+	}
+	if (NULL != config->speeds) {
+		memcpy(config->speeds, s.speeds, config->n_queues * sizeof(double));
+	}
+
+clean:
+	free(threads);
+	free(workers);
+	free(s.done);
+	free(s.speeds);
+	return s.status;
+}
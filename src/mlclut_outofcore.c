@@ -0,0 +1,367 @@
+/**
+ * @file
+ * @author Michele Laurenti
+ * @language c
+ *
+ * Out-of-core execution: a host array streamed through the device in
+ * chunks.
+ *
+ * Each of the SLOTS slots has an input and an output device buffer, and
+ * their pinned host copies, CL_MEM_ALLOC_HOST_PTR buffers of the same size
+ * mapped once (separate buffers, so none exceeds the maximum allocation
+ * size). A chunk is copied to its pinned input, uploaded, computed
+ * and downloaded to its pinned output with non-blocking commands chained by
+ * events; its results are copied to the host array only when its slot is
+ * needed again, three chunks later, so the host copies overlap the device
+ * work of the other two slots.
+ */
+
+#include "mlclut_outofcore.h"
+#include "mlclut_descriptions.h"
+#include "mlclut_interpose.h"
+#include "mlclut_memory.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <Debug.h>
+
+#define DEBUG_OUTOFCORE		"mlclut_debug_outofcore"
+
+#define SLOTS			3
+/* only 1 / MEMORY_FRACTION of the device memory goes to the chunks */
+#define MEMORY_FRACTION		2
+
+struct clut_ooc_slot {
+	cl_mem input;
+	cl_mem output;
+	cl_mem pinned_input;
+	cl_mem pinned_output;
+	unsigned char *host_input;
+	unsigned char *host_output;
+	size_t first;
+	size_t n;
+	cl_event downloaded;
+};
+
+struct clut_ooc {
+	const clut_outofcore_config *config;
+	cl_command_queue upload;
+	cl_command_queue compute;
+	cl_command_queue download;
+	size_t chunk;
+	cl_uint n_slots;
+	struct clut_ooc_slot slots[SLOTS];
+};
+
+/**
+ * Function declaration
+ */
+
+static cl_int clut_oocCreateSlots(struct clut_ooc *ooc, cl_context context);
+static void clut_oocUnmap(cl_command_queue command_queue, cl_mem pinned, void *mapped);
+static void clut_oocReleaseSlots(struct clut_ooc *ooc);
+static cl_int clut_oocRetire(struct clut_ooc *ooc, struct clut_ooc_slot *slot);
+static cl_int clut_oocEnqueue(struct clut_ooc *ooc, struct clut_ooc_slot *slot, size_t first, size_t n);
+
+/**
+ * Function definition
+ */
+
+/*!
+ * @function clut_getOutOfCoreChunk
+ * Returns the largest multiple of [granularity] elements such that SLOTS
+ * chunks, with their halos and pinned copies, fit in a fraction of the global
+ * memory of [device], and no chunk buffer exceeds its maximum allocation size.
+ * @return
+ * The number of elements, or 0 if not even one granule fits.
+ */
+size_t clut_getOutOfCoreChunk(cl_device_id device,
+			      size_t input_element_size, size_t output_element_size,
+			      size_t halo, size_t granularity)
+{
+	const char * const fname = "clut_getOutOfCoreChunk";
+	const cl_ulong halo_elements = 2 * (cl_ulong) halo;
+	cl_ulong global_size, max_alloc, budget, chunk, limit;
+	cl_int ret;
+
+	if ((0 == input_element_size) || (0 == output_element_size)) {
+		return 0;
+	}
+	if (0 == granularity) {
+		granularity = 1;
+	}
+	ret = clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(global_size), &global_size, NULL);
+	if (CL_SUCCESS == ret) {
+		ret = clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, NULL);
+	}
+	if (CL_SUCCESS != ret) {
+		Debug_out(DEBUG_OUTOFCORE, "%s: unable to get device memory sizes.\n", fname);
+		return 0;
+	}
+
+	/*
+	 * each slot holds (chunk + 2 * halo) input and chunk output elements,
+	 * twice: in the device buffers and in their pinned copies, which are
+	 * tracked against the same context limit
+	 */
+	budget = global_size / MEMORY_FRACTION / (2 * SLOTS);
+	if (budget <= halo_elements * input_element_size) {
+		return 0;
+	}
+	chunk = (budget - halo_elements * input_element_size) / (input_element_size + output_element_size);
+	limit = max_alloc / input_element_size;
+	if (limit <= halo_elements) {
+		return 0;
+	}
+	if (chunk > limit - halo_elements) {
+		chunk = limit - halo_elements;
+	}
+	limit = max_alloc / output_element_size;
+	if (chunk > limit) {
+		chunk = limit;
+	}
+	chunk -= chunk % granularity;
+
+	Debug_out(DEBUG_OUTOFCORE, "%s: %lu elements per chunk (%lu bytes of memory, %lu per allocation).\n",
+		  fname, (unsigned long) chunk, (unsigned long) global_size, (unsigned long) max_alloc);
+	return (size_t) chunk;
+}
+
+/*!
+ * @function clut_oocCreateSlots
+ * Creates the buffers of the slots, and maps their pinned host copies.
+ */
+static cl_int clut_oocCreateSlots(struct clut_ooc *ooc, cl_context context)
+{
+	const clut_outofcore_config *config = ooc->config;
+	const size_t input_size = (ooc->chunk + 2 * config->halo) * config->input_element_size;
+	const size_t output_size = ooc->chunk * config->output_element_size;
+	struct clut_ooc_slot *slot;
+	cl_uint i;
+	cl_int ret;
+
+	for (i = 0; i < ooc->n_slots; ++i) {
+		slot = &ooc->slots[i];
+		slot->pinned_input = clut_createTrackedBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+							      input_size, NULL, "outofcore", config, &ret);
+		CLUT_CHECK_ERROR(ret, "Unable to create pinned input buffer", error1);
+		slot->host_input = clut_enqueueMapBuffer(ooc->upload, slot->pinned_input, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE,
+							 0, input_size, 0, NULL, NULL, &ret);
+		CLUT_CHECK_ERROR(ret, "Unable to map pinned input buffer", error1);
+		slot->pinned_output = clut_createTrackedBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+							       output_size, NULL, "outofcore", config, &ret);
+		CLUT_CHECK_ERROR(ret, "Unable to create pinned output buffer", error1);
+		slot->host_output = clut_enqueueMapBuffer(ooc->upload, slot->pinned_output, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE,
+							  0, output_size, 0, NULL, NULL, &ret);
+		CLUT_CHECK_ERROR(ret, "Unable to map pinned output buffer", error1);
+		slot->input = clut_createTrackedBuffer(context, CL_MEM_READ_ONLY, input_size, NULL, "outofcore", config, &ret);
+		CLUT_CHECK_ERROR(ret, "Unable to create chunk input buffer", error1);
+		slot->output = clut_createTrackedBuffer(context, CL_MEM_WRITE_ONLY, output_size, NULL, "outofcore", config, &ret);
+		CLUT_CHECK_ERROR(ret, "Unable to create chunk output buffer", error1);
+	}
+	return CL_SUCCESS;
+
+error1:	return ret;
+}
+
+/*!
+ * @function clut_oocUnmap
+ * Unmaps [mapped] from [pinned], if mapped, and releases [pinned].
+ */
+static void clut_oocUnmap(cl_command_queue command_queue, cl_mem pinned, void *mapped)
+{
+	cl_event unmapped = NULL;
+
+	if (NULL == pinned) {
+		return;
+	}
+	if (NULL != mapped) {
+		if (clut_returnSuccess(clut_enqueueUnmapMemObject(command_queue, pinned, mapped, 0, NULL, &unmapped))) {
+			clWaitForEvents(1, &unmapped);
+			clReleaseEvent(unmapped);
+		}
+	}
+	clReleaseMemObject(pinned);
+}
+
+/*!
+ * @function clut_oocReleaseSlots
+ * Releases whatever clut_oocCreateSlots created. No command may be pending.
+ */
+static void clut_oocReleaseSlots(struct clut_ooc *ooc)
+{
+	struct clut_ooc_slot *slot;
+	cl_uint i;
+
+	for (i = 0; i < ooc->n_slots; ++i) {
+		slot = &ooc->slots[i];
+		if (NULL != slot->downloaded) {
+			clReleaseEvent(slot->downloaded);
+		}
+		if (NULL != slot->input) {
+			clReleaseMemObject(slot->input);
+		}
+		if (NULL != slot->output) {
+			clReleaseMemObject(slot->output);
+		}
+		clut_oocUnmap(ooc->upload, slot->pinned_input, slot->host_input);
+		clut_oocUnmap(ooc->upload, slot->pinned_output, slot->host_output);
+	}
+}
+
+/*!
+ * @function clut_oocRetire
+ * Waits for the chunk in [slot], if any, and copies its results to the
+ * output array.
+ */
+static cl_int clut_oocRetire(struct clut_ooc *ooc, struct clut_ooc_slot *slot)
+{
+	const size_t element_size = ooc->config->output_element_size;
+	cl_int ret;
+
+	if (NULL == slot->downloaded) {
+		return CL_SUCCESS;
+	}
+	ret = clWaitForEvents(1, &slot->downloaded);
+	clReleaseEvent(slot->downloaded);
+	slot->downloaded = NULL;
+	CLUT_CHECK_ERROR(ret, "Chunk failed", error1);
+	memcpy((unsigned char *) ooc->config->output + slot->first * element_size,
+	       slot->host_output, slot->n * element_size);
+	return CL_SUCCESS;
+
+error1:	return ret;
+}
+
+/*!
+ * @function clut_oocEnqueue
+ * Copies elements [first, first + n) of the input array and their halo to
+ * the pinned input of [slot], and enqueues their upload, compute and
+ * download, which is not waited for.
+ */
+static cl_int clut_oocEnqueue(struct clut_ooc *ooc, struct clut_ooc_slot *slot, size_t first, size_t n)
+{
+	const clut_outofcore_config *config = ooc->config;
+	const size_t element_size = config->input_element_size;
+	const size_t before = (first < config->halo) ? first : config->halo;
+	const size_t rest = config->n_elements - first - n;
+	const size_t after = (rest < config->halo) ? rest : config->halo;
+	const size_t n_input = before + n + after;
+	cl_event uploaded = NULL, computed = NULL;
+	cl_int ret;
+
+	memcpy(slot->host_input, (const unsigned char *) config->input + (first - before) * element_size,
+	       n_input * element_size);
+	ret = clut_enqueueWriteBuffer(ooc->upload, slot->input, CL_FALSE, 0, n_input * element_size,
+				      slot->host_input, 0, NULL, &uploaded);
+	CLUT_CHECK_ERROR(ret, "Unable to upload chunk", error1);
+	ret = config->compute(ooc->compute, slot->input, slot->output, first, n, before, n_input,
+			      1, &uploaded, &computed, config->user_data);
+	CLUT_CHECK_ERROR(ret, "Unable to compute chunk", error2);
+	if (NULL == computed) {
+		Debug_out(DEBUG_OUTOFCORE, "clut_oocEnqueue: compute returned no event.\n");
+		ret = CL_INVALID_EVENT;
+		goto error2;
+	}
+	ret = clut_enqueueReadBuffer(ooc->download, slot->output, CL_FALSE, 0, n * config->output_element_size,
+				     slot->host_output, 1, &computed, &slot->downloaded);
+	CLUT_CHECK_ERROR(ret, "Unable to download chunk", error3);
+	slot->first = first;
+	slot->n = n;
+
+	/* the next stage may be on another queue: start this chunk now */
+	clFlush(ooc->upload);
+	clFlush(ooc->compute);
+	clFlush(ooc->download);
+	clReleaseEvent(computed);
+	clReleaseEvent(uploaded);
+	return CL_SUCCESS;
+
+error3:	if (NULL != computed) {
+		clReleaseEvent(computed);
+	}
+error2:	clReleaseEvent(uploaded);
+error1:	return ret;
+}
+
+/*!
+ * @function clut_runOutOfCore
+ * Runs the job described by [config], and waits for it: on success the
+ * whole output array is written.
+ */
+cl_int clut_runOutOfCore(const clut_outofcore_config *config)
+{
+	const char * const fname = "clut_runOutOfCore";
+	struct clut_ooc ooc;
+	cl_device_id device;
+	cl_context context;
+	size_t granularity, first, n, n_chunks, c;
+	cl_uint i;
+	cl_int ret;
+
+	if ((NULL == config) || (NULL == config->queues) || (0 == config->n_queues) ||
+	    (NULL == config->input) || (NULL == config->output) || (NULL == config->compute) ||
+	    (0 == config->input_element_size) || (0 == config->output_element_size) ||
+	    (0 == config->n_elements)) {
+		Debug_out(DEBUG_OUTOFCORE, "%s: invalid configuration.\n", fname);
+		return CL_INVALID_VALUE;
+	}
+	memset(&ooc, 0, sizeof(ooc));
+	ooc.config = config;
+	ooc.upload = config->queues[0];
+	ooc.compute = config->queues[(config->n_queues > 1) ? 1 : 0];
+	/* with two queues, keep queues[0] for uploads only */
+	ooc.download = (config->n_queues > 2) ? config->queues[2] : ooc.compute;
+
+	device = clut_getQueueDevice(ooc.compute);
+	ret = clGetCommandQueueInfo(ooc.compute, CL_QUEUE_CONTEXT, sizeof(context), &context, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to get queue context", error1);
+
+	granularity = (0 == config->granularity) ? 1 : config->granularity;
+	if (0 == config->chunk_elements) {
+		ooc.chunk = clut_getOutOfCoreChunk(device, config->input_element_size, config->output_element_size,
+						   config->halo, granularity);
+	} else {
+		ooc.chunk = config->chunk_elements - config->chunk_elements % granularity;
+	}
+	if (0 == ooc.chunk) {
+		Debug_out(DEBUG_OUTOFCORE, "%s: no chunk of %lu elements fits the device.\n",
+			  fname, (unsigned long) granularity);
+		ret = CL_INVALID_BUFFER_SIZE;
+		goto error1;
+	}
+	if (ooc.chunk > config->n_elements) {
+		ooc.chunk = config->n_elements;
+	}
+	n_chunks = (config->n_elements + ooc.chunk - 1) / ooc.chunk;
+	ooc.n_slots = (n_chunks < SLOTS) ? (cl_uint) n_chunks : SLOTS;
+
+	ret = clut_oocCreateSlots(&ooc, context);
+	CLUT_CHECK_ERROR(ret, "Unable to create chunk buffers", error2);
+
+	Debug_out(DEBUG_OUTOFCORE, "%s: %lu elements in %lu chunks of %lu.\n", fname,
+		  (unsigned long) config->n_elements, (unsigned long) n_chunks, (unsigned long) ooc.chunk);
+	for (c = 0, first = 0; c < n_chunks; ++c, first += n) {
+		n = (config->n_elements - first < ooc.chunk) ? config->n_elements - first : ooc.chunk;
+		ret = clut_oocRetire(&ooc, &ooc.slots[c % SLOTS]);
+		CLUT_CHECK_ERROR(ret, "Unable to retire chunk", error3);
+		ret = clut_oocEnqueue(&ooc, &ooc.slots[c % SLOTS], first, n);
+		CLUT_CHECK_ERROR(ret, "Unable to enqueue chunk", error3);
+	}
+	/* the last chunks, oldest first */
+	for (i = 0; i < SLOTS; ++i) {
+		ret = clut_oocRetire(&ooc, &ooc.slots[(n_chunks + i) % SLOTS]);
+		CLUT_CHECK_ERROR(ret, "Unable to retire chunk", error3);
+	}
+
+	clut_oocReleaseSlots(&ooc);
+	return CL_SUCCESS;
+
+error3:	clFinish(ooc.upload);
+	clFinish(ooc.compute);
+	clFinish(ooc.download);
+error2:	clut_oocReleaseSlots(&ooc);
+error1:	return ret;
+}
@@ -0,0 +1,619 @@
+/**
+ * @file
+ * @author Michele Laurenti
+ * @language c
+ *
+ * Streaming frame pipeline: decode -> upload -> compute -> download -> encode.
+ *
+ * Frames live in a fixed number of slots. Decoder threads fill free slots
+ * from files, the calling thread enqueues upload, compute and download for
+ * decoded slots without blocking, and encoder threads wait for each download
+ * and write the result to a png file before freeing the slot. With enough
+ * slots in flight every stage works on a different frame at the same time.
+ */
+
+#include "mlclut_pipeline.h"
+#include "mlclut_interpose.h"
+#include "mlclut_memory.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <stb_image_write.h>
+
+#include <Debug.h>
+
+#define DEBUG_PIPELINE	"mlclut_debug_pipeline"
+
+#define DEFAULT_IN_FLIGHT	3
+
+enum clut_slot_state {
+	SLOT_FREE,
+	SLOT_DECODING,
+	SLOT_DECODED,
+	SLOT_SUBMITTING,
+	SLOT_SUBMITTED,
+	SLOT_ENCODING
+};
+
+struct clut_pipeline_slot {
+	enum clut_slot_state state;
+	size_t frame;
+	clut_image_desc desc;
+	unsigned char *pixels;
+	unsigned char *result;
+	size_t result_size;
+	unsigned char *encoded;
+	size_t encoded_pitch;
+	unsigned int download_stage;
+	int staged;
+	clut_image_desc storage_desc;
+	cl_mem input;
+	cl_mem output;
+	cl_event downloaded;
+};
+
+struct clut_pipeline {
+	const clut_pipeline_config *config;
+	const char * const *inputs;
+	const char * const *outputs;
+	size_t n_frames;
+	size_t next_decode;
+	size_t n_finished;
+	size_t n_failed;
+	cl_mem_object_type storage;
+	size_t alignment;
+	struct clut_pipeline_slot *slots;
+	unsigned int n_slots;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+};
+
+/**
+ * Function declaration
+ */
+
+static void * clut_pipelineDecoder(void *arg);
+static void * clut_pipelineEncoder(void *arg);
+static void clut_pipelineSubmitter(struct clut_pipeline *p);
+static cl_int clut_pipelineSubmit(struct clut_pipeline *p, struct clut_pipeline_slot *slot);
+static void clut_pipelineFailFrame(struct clut_pipeline *p, struct clut_pipeline_slot *slot);
+
+/**
+ * Function definition
+ */
+
+/*!
+ * @function clut_pipelineFailFrame
+ * Marks the frame in [slot] as failed and frees the slot.
+ * Must be called with the pipeline lock held.
+ */
+static void clut_pipelineFailFrame(struct clut_pipeline *p, struct clut_pipeline_slot *slot)
+{
+	Debug_out(DEBUG_PIPELINE, "clut_pipelineFailFrame: frame %zu ('%s') failed.\n",
+		  slot->frame, p->inputs[slot->frame]);
+	if (NULL != slot->pixels) {
+		clut_freeImageData(slot->pixels);
+		slot->pixels = NULL;
+	}
+	slot->state = SLOT_FREE;
+	++p->n_failed;
+	++p->n_finished;
+	pthread_cond_broadcast(&p->changed);
+}
+
+/*!
+ * @function clut_pipelineDecoder
+ * Decoder thread: decodes the next frame into a free slot until all frames
+ * have been decoded.
+ */
+static void * clut_pipelineDecoder(void *arg)
+{
+	struct clut_pipeline *p = arg;
+	struct clut_pipeline_slot *slot;
+	unsigned char *pixels;
+	int width, height, components;
+	cl_channel_order channel_order;
+	cl_ulong started;
+	unsigned int i;
+
+	pthread_mutex_lock(&p->lock);
+	while (p->next_decode < p->n_frames) {
+		for (slot = NULL, i = 0; i < p->n_slots; ++i) {
+			if (SLOT_FREE == p->slots[i].state) {
+				slot = &p->slots[i];
+				break;
+			}
+		}
+		if (NULL == slot) {
+			pthread_cond_wait(&p->changed, &p->lock);
+			continue;
+		}
+
+		slot->state = SLOT_DECODING;
+		slot->frame = p->next_decode++;
+		pthread_mutex_unlock(&p->lock);
+
+		started = clut_getHostTime_ns();
+		pixels = clut_readImageFile(p->inputs[slot->frame], &width, &height, &components, &channel_order);
+		if (NULL != p->config->trace) {
+			clut_traceAddHostSpan(p->config->trace, "decode", (unsigned int) (slot - p->slots), started, clut_getHostTime_ns());
+		}
+
+		pthread_mutex_lock(&p->lock);
+		if (NULL == pixels) {
+			clut_pipelineFailFrame(p, slot);
+			continue;
+		}
+		slot->pixels = pixels;
+		slot->desc.width = width;
+		slot->desc.height = height;
+		slot->desc.components = components;
+		slot->desc.channel_order = channel_order;
+		slot->desc.channel_type = CL_UNSIGNED_INT8;
+		slot->state = SLOT_DECODED;
+		pthread_cond_broadcast(&p->changed);
+	}
+	pthread_mutex_unlock(&p->lock);
+
+	return NULL;
+}
+
+/*!
+ * @function clut_pipelineEncoder
+ * Encoder thread: waits for the download of submitted frames, and writes
+ * them to their output file, until all frames are finished.
+ */
+static void * clut_pipelineEncoder(void *arg)
+{
+	struct clut_pipeline *p = arg;
+	struct clut_pipeline_slot *slot;
+	cl_int cl_ret, status;
+	cl_ulong started;
+	int ret;
+	unsigned int i;
+
+	pthread_mutex_lock(&p->lock);
+	while (p->n_finished < p->n_frames) {
+		for (slot = NULL, i = 0; i < p->n_slots; ++i) {
+			if (SLOT_SUBMITTED == p->slots[i].state) {
+				slot = &p->slots[i];
+				break;
+			}
+		}
+		if (NULL == slot) {
+			pthread_cond_wait(&p->changed, &p->lock);
+			continue;
+		}
+
+		slot->state = SLOT_ENCODING;
+		pthread_mutex_unlock(&p->lock);
+
+		ret = 0;
+		cl_ret = clWaitForEvents(1, &slot->downloaded);
+		if (clut_returnSuccess(cl_ret)) {
+			cl_ret = clGetEventInfo(slot->downloaded, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL);
+		}
+		clReleaseEvent(slot->downloaded);
+		slot->downloaded = NULL;
+		if (clut_returnSuccess(cl_ret) && (CL_COMPLETE == status)) {
+			started = clut_getHostTime_ns();
+			ret = stbi_write_png(p->outputs[slot->frame],
+					     (int) slot->desc.width,
+					     (int) slot->desc.height,
+					     slot->desc.components,
+					     slot->encoded,
+					     (int) slot->encoded_pitch);
+			if (NULL != p->config->trace) {
+				clut_traceAddHostSpan(p->config->trace, "encode", (unsigned int) (slot - p->slots), started, clut_getHostTime_ns());
+			}
+		}
+		if (slot->staged) {
+			clut_stagingRelease(p->config->staging, slot->download_stage, NULL);
+			slot->staged = 0;
+		}
+
+		pthread_mutex_lock(&p->lock);
+		if (0 == ret) {
+			clut_pipelineFailFrame(p, slot);
+			continue;
+		}
+		clut_freeImageData(slot->pixels);
+		slot->pixels = NULL;
+		slot->state = SLOT_FREE;
+		++p->n_finished;
+		pthread_cond_broadcast(&p->changed);
+	}
+	pthread_mutex_unlock(&p->lock);
+
+	return NULL;
+}
+
+/*!
+ * @function clut_pipelineCreateStorage
+ * Creates an image or a buffer for a frame laid out as [desc], and completes
+ * [desc] with the storage kind and row pitch.
+ */
+static cl_mem clut_pipelineCreateStorage(struct clut_pipeline *p, clut_image_desc *desc)
+{
+	cl_image_format image_format = {0, 0};
+	cl_image_desc image_desc = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+	cl_int cl_ret;
+	cl_mem result;
+
+	if (CL_MEM_OBJECT_BUFFER == p->storage) {
+		return clut_createImageBuffer(p->config->context, CL_MEM_READ_WRITE, desc, p->alignment);
+	}
+
+	image_format.image_channel_order = desc->channel_order;
+	image_format.image_channel_data_type = desc->channel_type;
+	image_desc.image_type = CL_MEM_OBJECT_IMAGE2D;
+	image_desc.image_width = desc->width;
+	image_desc.image_height = desc->height;
+
+	desc->storage = CL_MEM_OBJECT_IMAGE2D;
+	desc->row_pitch = desc->width * desc->components;
+	result = clut_createTrackedImage(p->config->context, CL_MEM_READ_WRITE, &image_format, &image_desc, NULL, "pipeline", p, &cl_ret);
+	CLUT_CHECK_ERROR(cl_ret, "Unable to create frame image", error);
+	return result;
+
+error:	return NULL;
+}
+
+/*!
+ * @function clut_pipelinePrepareSlot
+ * Makes sure the device storage and the download buffer of [slot] fit the
+ * decoded frame, reusing those of the previous frame when possible.
+ */
+static cl_int clut_pipelinePrepareSlot(struct clut_pipeline *p, struct clut_pipeline_slot *slot)
+{
+	const size_t size = slot->desc.width * slot->desc.components * slot->desc.height;
+	unsigned char *result;
+
+	if ((NULL != slot->input) &&
+	    ((slot->storage_desc.width != slot->desc.width) ||
+	     (slot->storage_desc.height != slot->desc.height) ||
+	     (slot->storage_desc.components != slot->desc.components) ||
+	     (slot->storage_desc.channel_order != slot->desc.channel_order))) {
+		clReleaseMemObject(slot->input);
+		clReleaseMemObject(slot->output);
+		slot->input = slot->output = NULL;
+	}
+
+	if (NULL == slot->input) {
+		slot->input = clut_pipelineCreateStorage(p, &slot->desc);
+		slot->output = clut_pipelineCreateStorage(p, &slot->desc);
+		if ((NULL == slot->input) || (NULL == slot->output)) {
+			if (NULL != slot->input) {
+				clReleaseMemObject(slot->input);
+			}
+			if (NULL != slot->output) {
+				clReleaseMemObject(slot->output);
+			}
+			slot->input = slot->output = NULL;
+			return CL_MEM_OBJECT_ALLOCATION_FAILURE;
+		}
+		slot->storage_desc = slot->desc;
+	} else {
+		slot->desc.storage = slot->storage_desc.storage;
+		slot->desc.row_pitch = slot->storage_desc.row_pitch;
+	}
+
+	if (size > slot->result_size) {
+		result = realloc(slot->result, size);
+		if (NULL == result) {
+			return CL_OUT_OF_HOST_MEMORY;
+		}
+		slot->result = result;
+		slot->result_size = size;
+	}
+
+	return CL_SUCCESS;
+}
+
+/*!
+ * @function clut_pipelineSubmit
+ * Enqueues upload, compute and download of the frame in [slot], chained by
+ * events, and flushes the queues. Nothing here blocks, except on failure.
+ */
+static cl_int clut_pipelineSubmit(struct clut_pipeline *p, struct clut_pipeline_slot *slot)
+{
+	const clut_pipeline_config *config = p->config;
+	cl_command_queue upload_queue, compute_queue, download_queue;
+	cl_event uploaded = NULL, computed = NULL;
+	const size_t zero[3] = {0, 0, 0};
+	size_t host_pitch, transfer_pitch, i;
+	unsigned char *pinned;
+	unsigned int stage;
+	int staged;
+	cl_int cl_ret;
+
+	/* pick queues for each stage */
+	if (1 == config->n_queues) {
+		upload_queue = compute_queue = download_queue = config->queues[0];
+	} else if (2 == config->n_queues) {
+		/* queues[0] only uploads, so the next frame uploads during this one */
+		upload_queue = config->queues[0];
+		compute_queue = download_queue = config->queues[1];
+	} else {
+		upload_queue = config->queues[0];
+		compute_queue = config->queues[1];
+		download_queue = config->queues[2];
+	}
+
+	cl_ret = clut_pipelinePrepareSlot(p, slot);
+	CLUT_CHECK_ERROR(cl_ret, "Unable to prepare frame storage", error);
+	host_pitch = slot->desc.width * slot->desc.components;
+
+	/* frames fitting a slot of the staging ring move through pinned memory, with device padding */
+	transfer_pitch = (CL_MEM_OBJECT_BUFFER == slot->desc.storage) ? slot->desc.row_pitch : host_pitch;
+	staged = (NULL != config->staging) &&
+		 (slot->desc.height * transfer_pitch <= clut_getStagingSlotSize(config->staging));
+
+	/* upload */
+	if (staged) {
+		pinned = clut_stagingAcquire(config->staging, slot->desc.height * transfer_pitch, &stage);
+		for (i = 0; i < slot->desc.height; ++i) {
+			memcpy(pinned + i * transfer_pitch, slot->pixels + i * host_pitch, host_pitch);
+		}
+		if (CL_MEM_OBJECT_BUFFER == slot->desc.storage) {
+			cl_ret = clut_stagingWriteBuffer(config->staging, stage, upload_queue, slot->input,
+							 0, slot->desc.height * transfer_pitch, 0, NULL, &uploaded);
+		} else {
+			const size_t region[3] = {slot->desc.width, slot->desc.height, 1};
+			cl_ret = clut_stagingWriteImage(config->staging, stage, upload_queue, slot->input,
+							zero, region, transfer_pitch, 0, NULL, &uploaded);
+		}
+	} else if (CL_MEM_OBJECT_BUFFER == slot->desc.storage) {
+		const size_t rect[3] = {host_pitch, slot->desc.height, 1};
+		cl_ret = clut_enqueueWriteBufferRect(upload_queue, slot->input, CL_FALSE,
+						  zero, zero, rect,
+						  slot->desc.row_pitch, 0, host_pitch, 0,
+						  slot->pixels, 0, NULL, &uploaded);
+	} else {
+		const size_t region[3] = {slot->desc.width, slot->desc.height, 1};
+		cl_ret = clut_enqueueWriteImage(upload_queue, slot->input, CL_FALSE, zero, region,
+					     host_pitch, 0, slot->pixels, 0, NULL, &uploaded);
+	}
+	CLUT_CHECK_ERROR(cl_ret, "Unable to enqueue frame upload", error);
+
+	/* compute */
+	cl_ret = config->compute(compute_queue, slot->input, slot->output, &slot->desc,
+				 1, &uploaded, &computed, config->user_data);
+	CLUT_CHECK_ERROR(cl_ret, "Unable to enqueue frame compute", error);
+
+	/* download */
+	if (staged) {
+		slot->encoded = clut_stagingAcquire(config->staging, slot->desc.height * transfer_pitch, &slot->download_stage);
+		slot->encoded_pitch = transfer_pitch;
+		slot->staged = 1;
+		if (CL_MEM_OBJECT_BUFFER == slot->desc.storage) {
+			cl_ret = clut_enqueueReadBuffer(download_queue, slot->output, CL_FALSE,
+							0, slot->desc.height * transfer_pitch, slot->encoded,
+							1, &computed, &slot->downloaded);
+		} else {
+			const size_t region[3] = {slot->desc.width, slot->desc.height, 1};
+			cl_ret = clut_enqueueReadImage(download_queue, slot->output, CL_FALSE, zero, region,
+						       transfer_pitch, 0, slot->encoded, 1, &computed, &slot->downloaded);
+		}
+	} else if (CL_MEM_OBJECT_BUFFER == slot->desc.storage) {
+		slot->encoded = slot->result;
+		slot->encoded_pitch = host_pitch;
+		const size_t rect[3] = {host_pitch, slot->desc.height, 1};
+		cl_ret = clut_enqueueReadBufferRect(download_queue, slot->output, CL_FALSE,
+						 zero, zero, rect,
+						 slot->desc.row_pitch, 0, host_pitch, 0,
+						 slot->result, 1, &computed, &slot->downloaded);
+	} else {
+		const size_t region[3] = {slot->desc.width, slot->desc.height, 1};
+		slot->encoded = slot->result;
+		slot->encoded_pitch = host_pitch;
+		cl_ret = clut_enqueueReadImage(download_queue, slot->output, CL_FALSE, zero, region,
+					    host_pitch, 0, slot->result, 1, &computed, &slot->downloaded);
+	}
+	CLUT_CHECK_ERROR(cl_ret, "Unable to enqueue frame download", error);
+
+	if (NULL != config->trace) {
+		clut_traceEvent(config->trace, uploaded, "upload");
+		clut_traceEvent(config->trace, computed, "compute");
+		clut_traceEvent(config->trace, slot->downloaded, "download");
+	}
+
+	clFlush(upload_queue);
+	if (compute_queue != upload_queue) {
+		clFlush(compute_queue);
+	}
+	if ((download_queue != upload_queue) && (download_queue != compute_queue)) {
+		clFlush(download_queue);
+	}
+
+	clReleaseEvent(uploaded);
+	clReleaseEvent(computed);
+	return CL_SUCCESS;
+
+error:
+	/* the frame pixels are freed on failure, so wait for whatever reads them */
+	if (NULL != computed) {
+		clWaitForEvents(1, &computed);
+		clReleaseEvent(computed);
+	}
+	if (NULL != uploaded) {
+		clWaitForEvents(1, &uploaded);
+		clReleaseEvent(uploaded);
+	}
+	if (slot->staged) {
+		clut_stagingRelease(config->staging, slot->download_stage, NULL);
+		slot->staged = 0;
+	}
+	return cl_ret;
+}
+
+/*!
+ * @function clut_pipelineSubmitter
+ * Submits decoded frames to the device as soon as they are available, until
+ * no frame is left to decode.
+ */
+static void clut_pipelineSubmitter(struct clut_pipeline *p)
+{
+	struct clut_pipeline_slot *slot;
+	int decoding;
+	cl_int cl_ret;
+	unsigned int i;
+
+	pthread_mutex_lock(&p->lock);
+	for (;;) {
+		for (slot = NULL, decoding = 0, i = 0; i < p->n_slots; ++i) {
+			if ((NULL == slot) && (SLOT_DECODED == p->slots[i].state)) {
+				slot = &p->slots[i];
+			}
+			if (SLOT_DECODING == p->slots[i].state) {
+				decoding = 1;
+			}
+		}
+		if (NULL == slot) {
+			if ((p->next_decode == p->n_frames) && !decoding) {
+				break;
+			}
+			pthread_cond_wait(&p->changed, &p->lock);
+			continue;
+		}
+
+		slot->state = SLOT_SUBMITTING;
+		pthread_mutex_unlock(&p->lock);
+
+		cl_ret = clut_pipelineSubmit(p, slot);
+
+		pthread_mutex_lock(&p->lock);
+		if (!clut_returnSuccess(cl_ret)) {
+			clut_pipelineFailFrame(p, slot);
+			continue;
+		}
+		slot->state = SLOT_SUBMITTED;
+		pthread_cond_broadcast(&p->changed);
+	}
+	pthread_mutex_unlock(&p->lock);
+}
+
+/*!
+ * @function clut_runPipeline
+ * Processes [n_frames] images: each of [inputs] is decoded, uploaded,
+ * processed by config->compute, downloaded and saved, with png format, to the
+ * file with the same index in [outputs]. Up to config->in_flight frames are
+ * processed at the same time, so that in steady state the throughput is the
+ * one of the slowest stage. Frames may complete out of order.
+ * The output of the compute stage must have the same layout as its input.
+ * @param config
+ * The pipeline configuration.
+ * @param inputs
+ * The paths of the frames to process.
+ * @param outputs
+ * The paths where the processed frames will be saved.
+ * @param n_frames
+ * The number of frames.
+ * @return
+ * The number of frames that failed, or -1 if the pipeline couldn't start.
+ */
+int clut_runPipeline(const clut_pipeline_config *config,
+		     const char * const *inputs,
+		     const char * const *outputs,
+		     size_t n_frames)
+{
+	const char * const fname = "clut_runPipeline";
+	struct clut_pipeline p;
+	pthread_t *threads;
+	unsigned int n_decoders, n_encoders, n_started, i;
+	cl_device_id device;
+	int result = -1;
+
+	if ((NULL == config) || (NULL == config->queues) || (0 == config->n_queues) ||
+	    (NULL == config->compute) || (NULL == inputs) || (NULL == outputs)) {
+		Debug_out(DEBUG_PIPELINE, "%s: invalid configuration.\n", fname);
+		goto error1;
+	}
+
+	memset(&p, 0, sizeof(p));
+	p.config = config;
+	p.inputs = inputs;
+	p.outputs = outputs;
+	p.n_frames = n_frames;
+	p.n_slots = (0 != config->in_flight) ? config->in_flight : DEFAULT_IN_FLIGHT;
+	n_decoders = (0 != config->n_decoders) ? config->n_decoders : 1;
+	n_encoders = (0 != config->n_encoders) ? config->n_encoders : 1;
+
+	/* the storage the policy picks for the compute stage, unless set */
+	device = clut_getQueueDevice(config->queues[0]);
+	if (NULL == device) {
+		goto error1;
+	}
+	p.alignment = clut_getDeviceAlignment(device);
+	p.storage = config->storage;
+	if (0 == p.storage) {
+		p.storage = clut_getStoragePolicy(config->context, device, config->access);
+	}
+
+	p.slots = calloc(p.n_slots, sizeof(struct clut_pipeline_slot));
+	if (NULL == p.slots) {
+		Debug_out(DEBUG_PIPELINE, "%s: calloc failed.\n", fname);
+		goto error1;
+	}
+	threads = calloc(n_decoders + n_encoders, sizeof(pthread_t));
+	if (NULL == threads) {
+		Debug_out(DEBUG_PIPELINE, "%s: calloc failed.\n", fname);
+		goto error2;
+	}
+	pthread_mutex_init(&p.lock, NULL);
+	pthread_cond_init(&p.changed, NULL);
+
+	Debug_out(DEBUG_PIPELINE, "%s: processing %zu frames, %u in flight, with %u decoders and %u encoders.\n",
+		  fname, n_frames, p.n_slots, n_decoders, n_encoders);
+
+	/* start workers */
+	for (n_started = 0; n_started < n_decoders + n_encoders; ++n_started) {
+		if (0 != pthread_create(&threads[n_started], NULL,
+					(n_started < n_decoders) ? clut_pipelineDecoder : clut_pipelineEncoder,
+					&p)) {
+			Debug_out(DEBUG_PIPELINE, "%s: unable to start worker thread.\n", fname);
+			break;
+		}
+	}
+
+	if (n_started == n_decoders + n_encoders) {
+		clut_pipelineSubmitter(&p);
+		result = 0;
+	} else {
+		/* make every started worker give up */
+		pthread_mutex_lock(&p.lock);
+		p.next_decode = p.n_frames;
+		p.n_finished = p.n_frames;
+		pthread_cond_broadcast(&p.changed);
+		pthread_mutex_unlock(&p.lock);
+	}
+
+	for (i = 0; i < n_started; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	if (0 == result) {
+		result = (int) p.n_failed;
+	}
+	Debug_out(DEBUG_PIPELINE, "%s: %zu frames processed, %zu failed.\n", fname, n_frames, p.n_failed);
+
+	for (i = 0; i < p.n_slots; ++i) {
+		if (NULL != p.slots[i].input) {
+			clReleaseMemObject(p.slots[i].input);
+			clReleaseMemObject(p.slots[i].output);
+		}
+		if (NULL != p.slots[i].pixels) {
+			clut_freeImageData(p.slots[i].pixels);
+		}
+		free(p.slots[i].result);
+	}
+	pthread_cond_destroy(&p.changed);
+	pthread_mutex_destroy(&p.lock);
+	free(threads);
+error2:
+	free(p.slots);
+error1:
+	return result;
+}
@@ -0,0 +1,868 @@
+/**
+ * @file
+ * @author Michele Laurenti
+ * @language c
+ *
+ * Data-parallel primitives: reduce, scan, compact, radix sort, histogram.
+ * The kernels are embedded in the library, and specialized for the element
+ * type and the device through -D build options: the program cache keeps one
+ * build per (context, options).
+ */
+
+#include "mlclut_primitives.h"
+#include "mlclut_descriptions.h"
+#include "mlclut_interpose.h"
+#include "mlclut_memory.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <Debug.h>
+#include <ArrayUtils.h>
+
+#define DEBUG_PRIMITIVES	"mlclut_debug_primitives"
+
+/* work-groups of the strided kernels (reduce, histogram) per compute unit */
+#define CLUT_PRIM_GROUPS_PER_CU	4
+
+/* bits sorted by each radix sort pass */
+#define CLUT_RADIX_BITS		4
+#define CLUT_RADIX		(1 << CLUT_RADIX_BITS)
+
+/*!
+ Embedded kernels
+ T	element type
+ WG	work-group size (a power of two)
+ VW	vector width of the reduction loads (1, 2 or 4)
+ K	consecutive elements per work-item of the tiled kernels
+ OP	reduction operator (0 sum, 1 min, 2 max), IDENTITY its identity
+ */
+
+static const char *primitives_sources[] =
+{
+	"#if OP == 1\n"
+	"#define COMBINE(a,b)	min((a), (b))\n"
+	"#elif OP == 2\n"
+	"#define COMBINE(a,b)	max((a), (b))\n"
+	"#else\n"
+	"#define COMBINE(a,b)	((a) + (b))\n"
+	"#endif\n"
+	"\n"
+	"#if VW == 4\n"
+	"#define VLOAD(i,p)	vload4((i), (p))\n"
+	"#define HREDUCE(v)	COMBINE(COMBINE((v).s0, (v).s1), COMBINE((v).s2, (v).s3))\n"
+	"#elif VW == 2\n"
+	"#define VLOAD(i,p)	vload2((i), (p))\n"
+	"#define HREDUCE(v)	COMBINE((v).s0, (v).s1)\n"
+	"#else\n"
+	"#define VLOAD(i,p)	((p)[i])\n"
+	"#define HREDUCE(v)	(v)\n"
+	"#endif\n"
+	"\n"
+	"#define RADIX_BITS	4\n"
+	"#define RADIX		(1 << RADIX_BITS)\n"
+	"\n"
+	"__kernel __attribute__((reqd_work_group_size(WG, 1, 1)))\n"
+	"void clut_reduce(__global const T *in, const uint n, __global T *out)\n"
+	"{\n"
+	"	__local T scratch[WG];\n"
+	"	const uint lid = get_local_id(0);\n"
+	"	const uint n_vectors = n / VW;\n"
+	"	T acc = IDENTITY;\n"
+	"	uint i, s;\n"
+	"\n"
+	"	for (i = get_global_id(0); i < n_vectors; i += get_global_size(0)) {\n"
+	"		acc = COMBINE(acc, HREDUCE(VLOAD(i, in)));\n"
+	"	}\n"
+	"	for (i = n_vectors * VW + get_global_id(0); i < n; i += get_global_size(0)) {\n"
+	"		acc = COMBINE(acc, in[i]);\n"
+	"	}\n"
+	"	scratch[lid] = acc;\n"
+	"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+	"	for (s = WG / 2; s > 0; s >>= 1) {\n"
+	"		if (lid < s) {\n"
+	"			scratch[lid] = COMBINE(scratch[lid], scratch[lid + s]);\n"
+	"		}\n"
+	"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+	"	}\n"
+	"	if (0 == lid) {\n"
+	"		out[get_group_id(0)] = scratch[0];\n"
+	"	}\n"
+	"}\n"
+	"\n"
+	"/* scans a tile of WG * K elements, and stores its total in sums */\n"
+	"__kernel __attribute__((reqd_work_group_size(WG, 1, 1)))\n"
+	"void clut_scan_blocks(__global const T *in, const uint n, __global T *out,\n"
+	"		      __global T *sums, const uint inclusive)\n"
+	"{\n"
+	"	__local T scratch[WG];\n"
+	"	const uint lid = get_local_id(0);\n"
+	"	const uint base = get_group_id(0) * (WG * K) + lid * K;\n"
+	"	T v[K], total = 0, x, prefix;\n"
+	"	uint k, s;\n"
+	"\n"
+	"	for (k = 0; k < K; ++k) {\n"
+	"		v[k] = (base + k < n) ? in[base + k] : (T) 0;\n"
+	"		total += v[k];\n"
+	"	}\n"
+	"	scratch[lid] = total;\n"
+	"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+	"	for (s = 1; s < WG; s <<= 1) {\n"
+	"		x = (lid >= s) ? scratch[lid - s] : (T) 0;\n"
+	"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+	"		scratch[lid] += x;\n"
+	"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+	"	}\n"
+	"	prefix = (0 < lid) ? scratch[lid - 1] : (T) 0;\n"
+	"	for (k = 0; k < K; ++k) {\n"
+	"		if (inclusive) {\n"
+	"			prefix += v[k];\n"
+	"		}\n"
+	"		if (base + k < n) {\n"
+	"			out[base + k] = prefix;\n"
+	"		}\n"
+	"		if (!inclusive) {\n"
+	"			prefix += v[k];\n"
+	"		}\n"
+	"	}\n"
+	"	if (WG - 1 == lid) {\n"
+	"		sums[get_group_id(0)] = scratch[WG - 1];\n"
+	"	}\n"
+	"}\n"
+	"\n"
+	"__kernel __attribute__((reqd_work_group_size(WG, 1, 1)))\n"
+	"void clut_scan_add(__global T *out, const uint n, __global const T *offsets)\n"
+	"{\n"
+	"	const uint i = get_global_id(0);\n"
+	"	if (i < n) {\n"
+	"		out[i] += offsets[i / (WG * K)];\n"
+	"	}\n"
+	"}\n",
+
+	"__kernel void clut_compact_flags(__global const uint *flags, const uint n, __global uint *indices)\n"
+	"{\n"
+	"	const uint i = get_global_id(0);\n"
+	"	if (i < n) {\n"
+	"		indices[i] = (0 != flags[i]);\n"
+	"	}\n"
+	"}\n"
+	"\n"
+	"__kernel void clut_compact_scatter(__global const T *in, __global const uint *flags,\n"
+	"				   __global const uint *indices, const uint n,\n"
+	"				   __global T *out, __global uint *count)\n"
+	"{\n"
+	"	const uint i = get_global_id(0);\n"
+	"	if (i >= n) {\n"
+	"		return;\n"
+	"	}\n"
+	"	if (0 != flags[i]) {\n"
+	"		out[indices[i]] = in[i];\n"
+	"	}\n"
+	"	if (n - 1 == i) {\n"
+	"		*count = indices[i] + (0 != flags[i]);\n"
+	"	}\n"
+	"}\n"
+	"\n"
+	"__kernel __attribute__((reqd_work_group_size(WG, 1, 1)))\n"
+	"void clut_histogram(__global const T *in, const uint n, const uint bins,\n"
+	"		    __global uint *histogram, __local uint *counts)\n"
+	"{\n"
+	"	const uint lid = get_local_id(0), local_size = get_local_size(0);\n"
+	"	uint i;\n"
+	"\n"
+	"	for (i = lid; i < bins; i += local_size) {\n"
+	"		counts[i] = 0;\n"
+	"	}\n"
+	"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+	"	for (i = get_global_id(0); i < n; i += get_global_size(0)) {\n"
+	"		atomic_inc(&counts[min((uint) in[i], bins - 1)]);\n"
+	"	}\n"
+	"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+	"	for (i = lid; i < bins; i += local_size) {\n"
+	"		if (0 != counts[i]) {\n"
+	"			atomic_add(&histogram[i], counts[i]);\n"
+	"		}\n"
+	"	}\n"
+	"}\n"
+	"\n"
+	"/* counts the digits of a tile, digit-major: one scan gives the destinations */\n"
+	"__kernel __attribute__((reqd_work_group_size(WG, 1, 1)))\n"
+	"void clut_radix_count(__global const uint *keys, const uint n, const uint shift,\n"
+	"		      const uint n_groups, __global uint *counts)\n"
+	"{\n"
+	"	__local uint digits[RADIX];\n"
+	"	const uint lid = get_local_id(0);\n"
+	"	const uint base = get_group_id(0) * (WG * K) + lid * K;\n"
+	"	uint k, d;\n"
+	"\n"
+	"	for (d = lid; d < RADIX; d += WG) {\n"
+	"		digits[d] = 0;\n"
+	"	}\n"
+	"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+	"	for (k = 0; (k < K) && (base + k < n); ++k) {\n"
+	"		atomic_inc(&digits[(keys[base + k] >> shift) & (RADIX - 1)]);\n"
+	"	}\n"
+	"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+	"	for (d = lid; d < RADIX; d += WG) {\n"
+	"		counts[d * n_groups + get_group_id(0)] = digits[d];\n"
+	"	}\n"
+	"}\n",
+
+	"/*\n"
+	" * moves the keys of a tile to their destination, keeping their order: ranks\n"
+	" * holds, digit-major, how many keys of the tile come before each work-item's\n"
+	" * keys with a given digit\n"
+	" */\n"
+	"__kernel __attribute__((reqd_work_group_size(WG, 1, 1)))\n"
+	"void clut_radix_scatter(__global const uint *keys, __global const uint *values,\n"
+	"			const uint with_values, const uint n, const uint shift,\n"
+	"			const uint n_groups, __global const uint *offsets,\n"
+	"			__global uint *keys_out, __global uint *values_out)\n"
+	"{\n"
+	"	__local uint ranks[RADIX * WG];\n"
+	"	__local uint totals[WG];\n"
+	"	const uint lid = get_local_id(0);\n"
+	"	const uint base = get_group_id(0) * (WG * K) + lid * K;\n"
+	"	uint key[K], count[RADIX], k, d, s, x, sum, position;\n"
+	"\n"
+	"	for (d = 0; d < RADIX; ++d) {\n"
+	"		count[d] = 0;\n"
+	"	}\n"
+	"	for (k = 0; k < K; ++k) {\n"
+	"		key[k] = (base + k < n) ? keys[base + k] : 0;\n"
+	"		if (base + k < n) {\n"
+	"			count[(key[k] >> shift) & (RADIX - 1)]++;\n"
+	"		}\n"
+	"	}\n"
+	"	for (d = 0; d < RADIX; ++d) {\n"
+	"		ranks[d * WG + lid] = count[d];\n"
+	"	}\n"
+	"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+	"\n"
+	"	/* exclusive scan of ranks, each work-item owning RADIX consecutive entries */\n"
+	"	sum = 0;\n"
+	"	for (d = 0; d < RADIX; ++d) {\n"
+	"		x = ranks[lid * RADIX + d];\n"
+	"		ranks[lid * RADIX + d] = sum;\n"
+	"		sum += x;\n"
+	"	}\n"
+	"	totals[lid] = sum;\n"
+	"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+	"	for (s = 1; s < WG; s <<= 1) {\n"
+	"		x = (lid >= s) ? totals[lid - s] : 0;\n"
+	"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+	"		totals[lid] += x;\n"
+	"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+	"	}\n"
+	"	x = (0 < lid) ? totals[lid - 1] : 0;\n"
+	"	for (d = 0; d < RADIX; ++d) {\n"
+	"		ranks[lid * RADIX + d] += x;\n"
+	"	}\n"
+	"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+	"\n"
+	"	for (d = 0; d < RADIX; ++d) {\n"
+	"		count[d] = 0;\n"
+	"	}\n"
+	"	for (k = 0; (k < K) && (base + k < n); ++k) {\n"
+	"		d = (key[k] >> shift) & (RADIX - 1);\n"
+	"		position = offsets[d * n_groups + get_group_id(0)] + (ranks[d * WG + lid] - ranks[d * WG]) + count[d]++;\n"
+	"		keys_out[position] = key[k];\n"
+	"		if (with_values) {\n"
+	"			values_out[position] = values[base + k];\n"
+	"		}\n"
+	"	}\n"
+	"}\n",
+};
+
+struct clut_prim_type_info {
+	const char *name;
+	size_t size;
+	const char *min_identity;
+	const char *max_identity;
+};
+
+/* indexed by clut_prim_type */
+static const struct clut_prim_type_info prim_types[] =
+{
+	{"uint", sizeof(cl_uint), "0xFFFFFFFFu", "0u"},
+	{"int", sizeof(cl_int), "INT_MAX", "INT_MIN"},
+	{"float", sizeof(cl_float), "INFINITY", "(-INFINITY)"},
+	{"uchar", sizeof(cl_uchar), "UCHAR_MAX", "0"}
+};
+
+/*!
+ * Launch parameters of a primitive on a device.
+ */
+struct clut_prim_params {
+	cl_command_queue command_queue;
+	cl_context context;
+	cl_uint wg;		/* work-group size */
+	cl_uint vw;		/* vector width of the loads */
+	cl_uint k;		/* elements per work-item of the tiled kernels */
+	cl_uint groups;		/* work-groups of the strided kernels */
+	cl_ulong local_mem;
+};
+
+/*!
+ * Commands of a primitive: the first waits for the caller's list, each
+ * following one for the previous, so the queue may be out of order.
+ */
+struct clut_prim_chain {
+	cl_uint n_wait;
+	const cl_event *wait_list;
+	cl_event last;
+};
+
+/**
+ * Function declaration
+ */
+
+static int clut_getPrimParams(cl_command_queue command_queue, clut_prim_type type,
+			      struct clut_prim_params *params);
+static cl_kernel clut_getPrimKernel(const struct clut_prim_params *params,
+				    clut_prim_type type, clut_reduce_op op, const char * const name);
+static cl_int clut_primLaunch(const struct clut_prim_params *params, cl_kernel kernel,
+			      size_t global, struct clut_prim_chain *chain);
+static cl_int clut_primFinish(struct clut_prim_chain *chain, cl_int ret, cl_event *event);
+static cl_int clut_primReduce(const struct clut_prim_params *params, clut_prim_type type, clut_reduce_op op,
+			      cl_mem input, cl_uint n, cl_mem output, cl_uint groups,
+			      struct clut_prim_chain *chain);
+static cl_int clut_primScan(const struct clut_prim_params *params, clut_prim_type type, cl_uint inclusive,
+			    cl_mem input, cl_mem output, cl_uint n,
+			    struct clut_prim_chain *chain);
+
+/**
+ * Function definition
+ */
+
+/*!
+ * @function clut_getPrimParams
+ * Picks the launch parameters for [type] on the device of [command_queue]:
+ * the largest power of two work-group size up to 256 allowed by the device
+ * and whose radix sort tiles fit in local memory, the preferred vector width
+ * (capped to 4), and longer serial runs per work-item on CPUs.
+ */
+static int clut_getPrimParams(cl_command_queue command_queue, clut_prim_type type,
+			      struct clut_prim_params *params)
+{
+	const char * const fname = "clut_getPrimParams";
+	cl_device_id device;
+	cl_device_type device_type;
+	cl_ulong local_mem;
+	size_t max_wg;
+	cl_uint units, width;
+	cl_int ret;
+
+	device = clut_getQueueDevice(command_queue);
+	if (NULL == device) {
+		goto error;
+	}
+	ret = clGetCommandQueueInfo(command_queue, CL_QUEUE_CONTEXT, sizeof(params->context), &params->context, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to get queue context", error);
+	if (!clut_returnSuccess(clGetDeviceInfo(device, CL_DEVICE_TYPE, sizeof(device_type), &device_type, NULL)) ||
+	    !clut_returnSuccess(clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(max_wg), &max_wg, NULL)) ||
+	    !clut_returnSuccess(clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(units), &units, NULL)) ||
+	    !clut_returnSuccess(clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(local_mem), &local_mem, NULL)) ||
+	    !clut_returnSuccess(clGetDeviceInfo(device,
+						(CLUT_PRIM_FLOAT == type) ? CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT : CL_DEVICE_PREFERRED_VECTOR_WIDTH_INT,
+						sizeof(width), &width, NULL))) {
+		Debug_out(DEBUG_PRIMITIVES, "%s: unable to get device limits.\n", fname);
+		goto error;
+	}
+
+	params->command_queue = command_queue;
+	params->wg = 256;
+	while ((1 < params->wg) &&
+	       ((params->wg > max_wg) || ((CLUT_RADIX + 1) * params->wg * sizeof(cl_uint) > local_mem))) {
+		params->wg >>= 1;
+	}
+	params->vw = (4 <= width) ? 4 : ((2 <= width) ? 2 : 1);
+	params->k = (CL_DEVICE_TYPE_CPU & device_type) ? 4 * params->vw : 4;
+	params->groups = ((0 != units) ? units : 1) * CLUT_PRIM_GROUPS_PER_CU;
+	params->local_mem = local_mem;
+
+	Debug_out(DEBUG_PRIMITIVES, "%s: work-group %u, vector width %u, %u elements per work-item, %u groups.\n",
+		  fname, params->wg, params->vw, params->k, params->groups);
+	return 1;
+
+error:	return 0;
+}
+
+/*!
+ * @function clut_getPrimKernel
+ * Returns the kernel [name] specialized for [type], [op] and [params],
+ * building the embedded program the first time, and reusing the kernels
+ * given back to the program cache.
+ * @warning Result should be given back with clut_releaseCachedKernel.
+ */
+static cl_kernel clut_getPrimKernel(const struct clut_prim_params *params,
+				    clut_prim_type type, clut_reduce_op op, const char * const name)
+{
+	const char * const fname = "clut_getPrimKernel";
+	const char *identity;
+	char flags[256];
+	cl_kernel kernel;
+
+	switch (op) {
+	case CLUT_REDUCE_MIN:
+		identity = prim_types[type].min_identity;
+		break;
+	case CLUT_REDUCE_MAX:
+		identity = prim_types[type].max_identity;
+		break;
+	default:
+		identity = "0";
+		break;
+	}
+	snprintf(flags, sizeof(flags), "-DT=%s -DWG=%u -DVW=%u -DK=%u -DOP=%d -DIDENTITY=%s",
+		 prim_types[type].name, params->wg, params->vw, params->k, (int) op, identity);
+
+	kernel = clut_acquireCachedKernel(params->context, ARRAY_LEN(primitives_sources), primitives_sources, flags, name);
+	if (NULL == kernel) {
+		Debug_out(DEBUG_PRIMITIVES, "%s: unable to build '%s' with '%s'.\n", fname, name, flags);
+	}
+	return kernel;
+}
+
+/*!
+ * @function clut_primLaunch
+ * Launches [kernel] over [global] work-items in work-groups of the chosen
+ * size after the previous command of [chain], then gives it back.
+ */
+static cl_int clut_primLaunch(const struct clut_prim_params *params, cl_kernel kernel,
+			      size_t global, struct clut_prim_chain *chain)
+{
+	const size_t local = params->wg;
+	const cl_event *wait_list = (NULL != chain->last) ? &chain->last : chain->wait_list;
+	cl_uint n_wait = (NULL != chain->last) ? 1 : chain->n_wait;
+	cl_event event;
+	cl_int ret;
+
+	global = CLUT_ROUND_UP(global, local);
+	ret = clut_enqueueNDRangeKernel(params->command_queue, kernel, 1, NULL, &global, &local,
+					n_wait, wait_list, &event);
+	clut_releaseCachedKernel(kernel);
+	if (clut_returnSuccess(ret)) {
+		if (NULL != chain->last) {
+			clReleaseEvent(chain->last);
+		}
+		chain->last = event;
+	}
+	return ret;
+}
+
+/*!
+ * @function clut_primFinish
+ * Hands the last command of [chain] to [event] on success, or releases it.
+ */
+static cl_int clut_primFinish(struct clut_prim_chain *chain, cl_int ret, cl_event *event)
+{
+	if (clut_returnSuccess(ret) && (NULL != event)) {
+		*event = chain->last;
+	} else if (NULL != chain->last) {
+		clReleaseEvent(chain->last);
+	}
+	return ret;
+}
+
+/*!
+ * @function clut_primReduce
+ * Reduces [n] elements of [input] with [groups] work-groups, each writing
+ * its result to [output].
+ */
+static cl_int clut_primReduce(const struct clut_prim_params *params, clut_prim_type type, clut_reduce_op op,
+			      cl_mem input, cl_uint n, cl_mem output, cl_uint groups,
+			      struct clut_prim_chain *chain)
+{
+	cl_kernel kernel;
+	cl_int ret;
+
+	kernel = clut_getPrimKernel(params, type, op, "clut_reduce");
+	if (NULL == kernel) {
+		return CL_INVALID_KERNEL_NAME;
+	}
+	if (!clut_returnSuccess(ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), &input)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 1, sizeof(cl_uint), &n)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 2, sizeof(cl_mem), &output))) {
+		clut_releaseCachedKernel(kernel);
+		return ret;
+	}
+	return clut_primLaunch(params, kernel, (size_t) groups * params->wg, chain);
+}
+
+/*!
+ * @function clut_primScan
+ * Scans [n] elements of [input] to [output] a tile per work-group, then, if
+ * there is more than one tile, scans the tile totals (recursively) and adds
+ * them back.
+ */
+static cl_int clut_primScan(const struct clut_prim_params *params, clut_prim_type type, cl_uint inclusive,
+			    cl_mem input, cl_mem output, cl_uint n,
+			    struct clut_prim_chain *chain)
+{
+	const cl_uint tile = params->wg * params->k;
+	const cl_uint groups = (n + tile - 1) / tile;
+	const cl_uint exclusive = 0;
+	cl_mem sums, offsets = NULL;
+	cl_kernel kernel;
+	cl_int ret;
+
+	sums = clut_createTrackedBuffer(params->context, CL_MEM_READ_WRITE, groups * prim_types[type].size, NULL, "primitives", NULL, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create scan sums buffer", error1);
+
+	kernel = clut_getPrimKernel(params, type, CLUT_REDUCE_SUM, "clut_scan_blocks");
+	if (NULL == kernel) {
+		ret = CL_INVALID_KERNEL_NAME;
+		goto error2;
+	}
+	if (!clut_returnSuccess(ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), &input)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 1, sizeof(cl_uint), &n)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 2, sizeof(cl_mem), &output)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 3, sizeof(cl_mem), &sums)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 4, sizeof(cl_uint), &inclusive))) {
+		clut_releaseCachedKernel(kernel);
+		goto error2;
+	}
+	ret = clut_primLaunch(params, kernel, (size_t) groups * params->wg, chain);
+	if (!clut_returnSuccess(ret) || (1 == groups)) {
+		goto error2;
+	}
+
+	offsets = clut_createTrackedBuffer(params->context, CL_MEM_READ_WRITE, groups * prim_types[type].size, NULL, "primitives", NULL, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create scan offsets buffer", error2);
+	ret = clut_primScan(params, type, exclusive, sums, offsets, groups, chain);
+	if (!clut_returnSuccess(ret)) {
+		goto error3;
+	}
+
+	kernel = clut_getPrimKernel(params, type, CLUT_REDUCE_SUM, "clut_scan_add");
+	if (NULL == kernel) {
+		ret = CL_INVALID_KERNEL_NAME;
+		goto error3;
+	}
+	if (!clut_returnSuccess(ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), &output)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 1, sizeof(cl_uint), &n)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 2, sizeof(cl_mem), &offsets))) {
+		clut_releaseCachedKernel(kernel);
+		goto error3;
+	}
+	ret = clut_primLaunch(params, kernel, n, chain);
+
+	/* the buffers live until the commands using them complete */
+error3:	clReleaseMemObject(offsets);
+error2:	clReleaseMemObject(sums);
+error1:	return ret;
+}
+
+/*!
+ * @function clut_checkPrimSize
+ * Checks that [n] elements can be indexed by the kernels.
+ */
+static int clut_checkPrimSize(const char * const fname, size_t n)
+{
+	if ((0 == n) || ((size_t) CL_UINT_MAX < n)) {
+		Debug_out(DEBUG_PRIMITIVES, "%s: unsupported number of elements %lu.\n", fname, (unsigned long) n);
+		return 0;
+	}
+	return 1;
+}
+
+/*!
+ * @function clut_reduce
+ * Reduces [input] in two passes: every work-group accumulates a strided
+ * share of the elements with vector loads and reduces it in local memory,
+ * then a single work-group reduces the partial results.
+ */
+cl_int clut_reduce(cl_command_queue command_queue,
+		   clut_prim_type type, clut_reduce_op op,
+		   cl_mem input, size_t n, cl_mem result,
+		   cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	const char * const fname = "clut_reduce";
+	struct clut_prim_chain chain = {n_wait, wait_list, NULL};
+	struct clut_prim_params params;
+	cl_mem partial;
+	size_t groups;
+	cl_int ret = CL_INVALID_VALUE;
+
+	if (!clut_checkPrimSize(fname, n) || (CLUT_PRIM_UCHAR == type) || (NULL == input) || (NULL == result)) {
+		goto error;
+	}
+	if (!clut_getPrimParams(command_queue, type, &params)) {
+		goto error;
+	}
+
+	groups = (n + (size_t) params.wg * params.vw - 1) / ((size_t) params.wg * params.vw);
+	if (groups > params.groups) {
+		groups = params.groups;
+	}
+	if (1 == groups) {
+		ret = clut_primReduce(&params, type, op, input, (cl_uint) n, result, 1, &chain);
+		goto error;
+	}
+
+	partial = clut_createTrackedBuffer(params.context, CL_MEM_READ_WRITE, groups * prim_types[type].size, NULL, "primitives", NULL, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create partial results buffer", error);
+	ret = clut_primReduce(&params, type, op, input, (cl_uint) n, partial, (cl_uint) groups, &chain);
+	if (clut_returnSuccess(ret)) {
+		ret = clut_primReduce(&params, type, op, partial, (cl_uint) groups, result, 1, &chain);
+	}
+	clReleaseMemObject(partial);
+
+error:	return clut_primFinish(&chain, ret, event);
+}
+
+/*!
+ * @function clut_scan
+ * Computes the inclusive or exclusive prefix sums of [input] into [output].
+ */
+cl_int clut_scan(cl_command_queue command_queue,
+		 clut_prim_type type, cl_bool inclusive,
+		 cl_mem input, cl_mem output, size_t n,
+		 cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	const char * const fname = "clut_scan";
+	struct clut_prim_chain chain = {n_wait, wait_list, NULL};
+	struct clut_prim_params params;
+	cl_int ret = CL_INVALID_VALUE;
+
+	if (!clut_checkPrimSize(fname, n) || (CLUT_PRIM_UCHAR == type) || (NULL == input) || (NULL == output)) {
+		goto error;
+	}
+	if (!clut_getPrimParams(command_queue, type, &params)) {
+		goto error;
+	}
+	ret = clut_primScan(&params, type, inclusive ? 1 : 0, input, output, (cl_uint) n, &chain);
+
+error:	return clut_primFinish(&chain, ret, event);
+}
+
+/*!
+ * @function clut_compact
+ * Compacts [input]: the flags become 0 or 1, their exclusive scan gives the
+ * destination of each kept element, and the last work-item writes the count.
+ */
+cl_int clut_compact(cl_command_queue command_queue,
+		    clut_prim_type type,
+		    cl_mem input, cl_mem flags, size_t n,
+		    cl_mem output, cl_mem count,
+		    cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	const char * const fname = "clut_compact";
+	struct clut_prim_chain chain = {n_wait, wait_list, NULL};
+	struct clut_prim_params params;
+	cl_uint count_n = (cl_uint) n;
+	cl_mem indices;
+	cl_kernel kernel;
+	cl_int ret = CL_INVALID_VALUE;
+
+	if (!clut_checkPrimSize(fname, n) || (NULL == input) || (NULL == flags) || (NULL == output) || (NULL == count)) {
+		goto error1;
+	}
+	if (!clut_getPrimParams(command_queue, type, &params)) {
+		goto error1;
+	}
+
+	indices = clut_createTrackedBuffer(params.context, CL_MEM_READ_WRITE, n * sizeof(cl_uint), NULL, "primitives", NULL, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create compaction indices buffer", error1);
+
+	kernel = clut_getPrimKernel(&params, CLUT_PRIM_UINT, CLUT_REDUCE_SUM, "clut_compact_flags");
+	if (NULL == kernel) {
+		ret = CL_INVALID_KERNEL_NAME;
+		goto error2;
+	}
+	if (!clut_returnSuccess(ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), &flags)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 1, sizeof(cl_uint), &count_n)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 2, sizeof(cl_mem), &indices))) {
+		clut_releaseCachedKernel(kernel);
+		goto error2;
+	}
+	ret = clut_primLaunch(&params, kernel, n, &chain);
+	if (!clut_returnSuccess(ret)) {
+		goto error2;
+	}
+
+	ret = clut_primScan(&params, CLUT_PRIM_UINT, 0, indices, indices, count_n, &chain);
+	if (!clut_returnSuccess(ret)) {
+		goto error2;
+	}
+
+	kernel = clut_getPrimKernel(&params, type, CLUT_REDUCE_SUM, "clut_compact_scatter");
+	if (NULL == kernel) {
+		ret = CL_INVALID_KERNEL_NAME;
+		goto error2;
+	}
+	if (!clut_returnSuccess(ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), &input)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 1, sizeof(cl_mem), &flags)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 2, sizeof(cl_mem), &indices)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 3, sizeof(cl_uint), &count_n)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 4, sizeof(cl_mem), &output)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 5, sizeof(cl_mem), &count))) {
+		clut_releaseCachedKernel(kernel);
+		goto error2;
+	}
+	ret = clut_primLaunch(&params, kernel, n, &chain);
+
+error2:	clReleaseMemObject(indices);
+error1:	return clut_primFinish(&chain, ret, event);
+}
+
+/*!
+ * @function clut_radixSort
+ * Sorts [keys] CLUT_RADIX_BITS at a time, least significant first. Each
+ * pass counts the digits of every tile, scans the counts (digit-major, so
+ * the scan gives each tile's first destination for each digit), and moves
+ * the keys, ping-ponging with a temporary buffer: the number of passes is
+ * even, so the result ends up in [keys].
+ */
+cl_int clut_radixSort(cl_command_queue command_queue,
+		      cl_mem keys, cl_mem values, size_t n,
+		      cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	const char * const fname = "clut_radixSort";
+	struct clut_prim_chain chain = {n_wait, wait_list, NULL};
+	struct clut_prim_params params;
+	cl_mem tmp_keys, tmp_values = NULL, counts, offsets;
+	cl_mem src_keys, src_values, dst_keys, dst_values;
+	cl_uint count_n = (cl_uint) n, n_groups, with_values = (NULL != values), shift;
+	cl_kernel kernel;
+	cl_int ret = CL_INVALID_VALUE;
+
+	if (!clut_checkPrimSize(fname, n) || (NULL == keys)) {
+		goto error1;
+	}
+	if (!clut_getPrimParams(command_queue, CLUT_PRIM_UINT, &params)) {
+		goto error1;
+	}
+	n_groups = (count_n + params.wg * params.k - 1) / (params.wg * params.k);
+
+	tmp_keys = clut_createTrackedBuffer(params.context, CL_MEM_READ_WRITE, n * sizeof(cl_uint), NULL, "primitives", NULL, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create temporary keys buffer", error1);
+	if (with_values) {
+		tmp_values = clut_createTrackedBuffer(params.context, CL_MEM_READ_WRITE, n * sizeof(cl_uint), NULL, "primitives", NULL, &ret);
+		CLUT_CHECK_ERROR(ret, "Unable to create temporary values buffer", error2);
+	}
+	counts = clut_createTrackedBuffer(params.context, CL_MEM_READ_WRITE, (size_t) CLUT_RADIX * n_groups * sizeof(cl_uint), NULL, "primitives", NULL, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create digit counts buffer", error3);
+	offsets = clut_createTrackedBuffer(params.context, CL_MEM_READ_WRITE, (size_t) CLUT_RADIX * n_groups * sizeof(cl_uint), NULL, "primitives", NULL, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create digit offsets buffer", error4);
+
+	for (shift = 0; shift < 8 * sizeof(cl_uint); shift += CLUT_RADIX_BITS) {
+		const int even = (0 == (shift / CLUT_RADIX_BITS) % 2);
+
+		src_keys = even ? keys : tmp_keys;
+		src_values = even ? values : tmp_values;
+		dst_keys = even ? tmp_keys : keys;
+		dst_values = even ? tmp_values : values;
+
+		kernel = clut_getPrimKernel(&params, CLUT_PRIM_UINT, CLUT_REDUCE_SUM, "clut_radix_count");
+		if (NULL == kernel) {
+			ret = CL_INVALID_KERNEL_NAME;
+			goto error5;
+		}
+		if (!clut_returnSuccess(ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), &src_keys)) ||
+		    !clut_returnSuccess(ret = clSetKernelArg(kernel, 1, sizeof(cl_uint), &count_n)) ||
+		    !clut_returnSuccess(ret = clSetKernelArg(kernel, 2, sizeof(cl_uint), &shift)) ||
+		    !clut_returnSuccess(ret = clSetKernelArg(kernel, 3, sizeof(cl_uint), &n_groups)) ||
+		    !clut_returnSuccess(ret = clSetKernelArg(kernel, 4, sizeof(cl_mem), &counts))) {
+			clut_releaseCachedKernel(kernel);
+			goto error5;
+		}
+		ret = clut_primLaunch(&params, kernel, (size_t) n_groups * params.wg, &chain);
+		if (!clut_returnSuccess(ret)) {
+			goto error5;
+		}
+
+		ret = clut_primScan(&params, CLUT_PRIM_UINT, 0, counts, offsets, CLUT_RADIX * n_groups, &chain);
+		if (!clut_returnSuccess(ret)) {
+			goto error5;
+		}
+
+		kernel = clut_getPrimKernel(&params, CLUT_PRIM_UINT, CLUT_REDUCE_SUM, "clut_radix_scatter");
+		if (NULL == kernel) {
+			ret = CL_INVALID_KERNEL_NAME;
+			goto error5;
+		}
+		if (!clut_returnSuccess(ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), &src_keys)) ||
+		    !clut_returnSuccess(ret = clSetKernelArg(kernel, 1, sizeof(cl_mem), &src_values)) ||
+		    !clut_returnSuccess(ret = clSetKernelArg(kernel, 2, sizeof(cl_uint), &with_values)) ||
+		    !clut_returnSuccess(ret = clSetKernelArg(kernel, 3, sizeof(cl_uint), &count_n)) ||
+		    !clut_returnSuccess(ret = clSetKernelArg(kernel, 4, sizeof(cl_uint), &shift)) ||
+		    !clut_returnSuccess(ret = clSetKernelArg(kernel, 5, sizeof(cl_uint), &n_groups)) ||
+		    !clut_returnSuccess(ret = clSetKernelArg(kernel, 6, sizeof(cl_mem), &offsets)) ||
+		    !clut_returnSuccess(ret = clSetKernelArg(kernel, 7, sizeof(cl_mem), &dst_keys)) ||
+		    !clut_returnSuccess(ret = clSetKernelArg(kernel, 8, sizeof(cl_mem), &dst_values))) {
+			clut_releaseCachedKernel(kernel);
+			goto error5;
+		}
+		ret = clut_primLaunch(&params, kernel, (size_t) n_groups * params.wg, &chain);
+		if (!clut_returnSuccess(ret)) {
+			goto error5;
+		}
+	}
+
+error5:	clReleaseMemObject(offsets);
+error4:	clReleaseMemObject(counts);
+error3:	if (NULL != tmp_values) {
+		clReleaseMemObject(tmp_values);
+	}
+error2:	clReleaseMemObject(tmp_keys);
+error1:	return clut_primFinish(&chain, ret, event);
+}
+
+/*!
+ * @function clut_histogram
+ * Counts [input] into [histogram]: every work-group accumulates a strided
+ * share of the elements in local memory, then adds its counters to the
+ * global ones.
+ */
+cl_int clut_histogram(cl_command_queue command_queue,
+		      clut_prim_type type,
+		      cl_mem input, size_t n,
+		      cl_uint bins, cl_mem histogram,
+		      cl_uint n_wait, const cl_event *wait_list, cl_event *event)
+{
+	const char * const fname = "clut_histogram";
+	struct clut_prim_chain chain = {n_wait, wait_list, NULL};
+	struct clut_prim_params params;
+	const cl_uint zero = 0;
+	cl_uint count_n = (cl_uint) n;
+	cl_event fill;
+	cl_kernel kernel;
+	cl_int ret = CL_INVALID_VALUE;
+
+	if (!clut_checkPrimSize(fname, n) || ((CLUT_PRIM_UCHAR != type) && (CLUT_PRIM_UINT != type)) ||
+	    (0 == bins) || (NULL == input) || (NULL == histogram)) {
+		goto error;
+	}
+	if (!clut_getPrimParams(command_queue, type, &params)) {
+		goto error;
+	}
+	if ((cl_ulong) bins * sizeof(cl_uint) > params.local_mem) {
+		Debug_out(DEBUG_PRIMITIVES, "%s: %u bins don't fit in local memory.\n", fname, bins);
+		goto error;
+	}
+
+	ret = clut_enqueueFillBuffer(command_queue, histogram, &zero, sizeof(zero), 0, bins * sizeof(cl_uint),
+				     n_wait, wait_list, &fill);
+	CLUT_CHECK_ERROR(ret, "Unable to clear histogram", error);
+	chain.last = fill;
+
+	kernel = clut_getPrimKernel(&params, type, CLUT_REDUCE_SUM, "clut_histogram");
+	if (NULL == kernel) {
+		ret = CL_INVALID_KERNEL_NAME;
+		goto error;
+	}
+	if (!clut_returnSuccess(ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), &input)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 1, sizeof(cl_uint), &count_n)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 2, sizeof(cl_uint), &bins)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 3, sizeof(cl_mem), &histogram)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(kernel, 4, bins * sizeof(cl_uint), NULL))) {
+		clut_releaseCachedKernel(kernel);
+		goto error;
+	}
+	ret = clut_primLaunch(&params, kernel, (size_t) params.groups * params.wg, &chain);
+
+error:	return clut_primFinish(&chain, ret, event);
+}
@@ -0,0 +1,616 @@
+/**
+ * @file
+ * @author Michele Laurenti
+ * @language c
+ *
+ * Roofline analysis: per kernel achieved bandwidth and flop rate, against
+ * the peaks of a device.
+ *
+ * Nominal peaks come from the device info (OpenCL 1.2 reports neither the
+ * memory clock nor the lanes per compute unit, so they are partial);
+ * measured peaks come from two embedded micro benchmarks, a streaming copy
+ * and a chain of independent multiply-adds.
+ */
+
+#include "mlclut_roofline.h"
+#include "mlclut_descriptions.h"
+#include "mlclut_interpose.h"
+#include "mlclut_memory.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include <Debug.h>
+#include <ArrayUtils.h>
+#include <StringUtils.h>
+
+#define DEBUG_ROOFLINE	"mlclut_debug_roofline"
+
+#define PEAK_RUNS		5
+#define PEAK_COPY_MAX_BYTES	(64 << 20)
+#define PEAK_FMA_ITEMS		(1 << 20)
+#define PEAK_FMA_ITERATIONS	256
+/* 4 chains of float4 multiply-adds, 2 flops each */
+#define PEAK_FMA_FLOPS_PER_ITEM	(PEAK_FMA_ITERATIONS * 4 * 4 * 2)
+
+/*!
+ Embedded kernels
+ */
+
+static const char *peak_sources[] =
+{
+	"__kernel void clut_peak_copy(__global const float4 *src, __global float4 *dst)\n"
+	"{\n"
+	"	const size_t i = get_global_id(0);\n"
+	"	dst[i] = src[i];\n"
+	"}\n"
+	"\n"
+	"__kernel void clut_peak_fma(__global float4 *dst, const float a, const float b)\n"
+	"{\n"
+	"	const size_t i = get_global_id(0);\n"
+	"	float4 x = (float4) (i * 1e-6f), y = x + 1.0f, z = x + 2.0f, w = x + 3.0f;\n"
+	"	int k;\n"
+	"	for (k = 0; k < ITERATIONS; ++k) {\n"
+	"		x = mad(x, a, b);\n"
+	"		y = mad(y, a, b);\n"
+	"		z = mad(z, a, b);\n"
+	"		w = mad(w, a, b);\n"
+	"	}\n"
+	"	dst[i] = x + y + z + w;\n"
+	"}\n",
+};
+
+struct clut_roofline_entry {
+	char *name;
+	struct clut_roofline *roofline;
+	cl_ulong count;
+	cl_ulong time;
+	cl_ulong bytes;
+	cl_ulong flops;
+	struct clut_roofline_entry *next;
+};
+
+struct clut_roofline_launch {
+	struct clut_roofline_entry *entry;
+	cl_ulong bytes;
+	cl_ulong flops;
+};
+
+struct clut_roofline {
+	struct clut_roofline_entry *entries;
+	size_t n_entries;
+	size_t pending;
+	pthread_mutex_t lock;
+	pthread_cond_t drained;
+};
+
+/**
+ * Function declaration
+ */
+
+static cl_ulong clut_measureKernel(cl_command_queue command_queue, cl_kernel kernel, size_t global);
+static struct clut_roofline_entry * clut_rooflineGetEntry(clut_roofline *roofline, const char * const name);
+static void clut_rooflineCallback(cl_event event, cl_int status, void *user_data);
+static const char * clut_rooflineBoundName(clut_roofline_bound bound);
+
+/**
+ * Function definition
+ */
+
+/*!
+ * @function clut_getNominalPeaks
+ * Fills [peaks] with the flop rate given by the compute units and maximum
+ * clock of [device], assuming [lanes_per_compute_unit] single precision
+ * lanes each doing a multiply-add per cycle. If [lanes_per_compute_unit] is
+ * 0, the native float vector width is used, which fits CPUs but grossly
+ * underestimates GPUs. The bandwidth is left unknown.
+ * @return
+ * 0 on success, a negative value on failure.
+ */
+int clut_getNominalPeaks(cl_device_id device, cl_uint lanes_per_compute_unit, clut_device_peaks *peaks)
+{
+	cl_uint compute_units, clock_mhz, lanes = lanes_per_compute_unit;
+	cl_int ret;
+
+	ret = clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(compute_units), &compute_units, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to get compute units", error);
+	ret = clGetDeviceInfo(device, CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof(clock_mhz), &clock_mhz, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to get clock frequency", error);
+	if (0 == lanes) {
+		ret = clGetDeviceInfo(device, CL_DEVICE_NATIVE_VECTOR_WIDTH_FLOAT, sizeof(lanes), &lanes, NULL);
+		CLUT_CHECK_ERROR(ret, "Unable to get native float vector width", error);
+	}
+
+	peaks->bandwidth = 0;
+	peaks->flops = (cl_double) compute_units * clock_mhz * 1e6 * (lanes > 0 ? lanes : 1) * 2;
+	peaks->measured = 0;
+
+	return 0;
+
+error:	return -1;
+}
+
+/*!
+ * @function clut_measureKernel
+ * Runs [kernel] PEAK_RUNS times over [global] work items, and returns the
+ * fastest run in nanoseconds, 0 on failure.
+ */
+static cl_ulong clut_measureKernel(cl_command_queue command_queue, cl_kernel kernel, size_t global)
+{
+	cl_ulong best = 0, duration;
+	cl_event event;
+	cl_int ret;
+	int i;
+
+	for (i = 0; i < PEAK_RUNS; ++i) {
+		ret = clEnqueueNDRangeKernel(command_queue, kernel, 1, NULL, &global, NULL, 0, NULL, &event);
+		CLUT_CHECK_ERROR(ret, "Unable to enqueue benchmark kernel", error);
+		ret = clWaitForEvents(1, &event);
+		duration = clut_getEventDuration_ns(event);
+		clReleaseEvent(event);
+		CLUT_CHECK_ERROR(ret, "Unable to wait for benchmark kernel", error);
+		/* the first run pays for warm up */
+		if ((0 < i) && (0 != duration) && ((0 == best) || (duration < best))) {
+			best = duration;
+		}
+	}
+	return best;
+
+error:	return 0;
+}
+
+/*!
+ * @function clut_measurePeaks
+ * Measures the peak bandwidth (as a device to device copy, counting both
+ * the read and the write) and the peak single precision flop rate of the
+ * device of [command_queue], which must have been created with
+ * CL_QUEUE_PROFILING_ENABLE, and stores them in [peaks].
+ * @return
+ * 0 on success, a negative value on failure.
+ */
+int clut_measurePeaks(cl_command_queue command_queue, clut_device_peaks *peaks)
+{
+	const char * const fname = "clut_measurePeaks";
+	const cl_float a = 0.999f, b = 0.001f;
+	cl_context context;
+	cl_device_id device;
+	cl_program program;
+	cl_kernel copy = NULL, fma = NULL;
+	cl_mem src = NULL, dst = NULL;
+	cl_ulong max_alloc, size, ns;
+	char flags[64];
+	cl_int ret;
+	int result = -1;
+
+	ret = clGetCommandQueueInfo(command_queue, CL_QUEUE_CONTEXT, sizeof(context), &context, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to get queue context", error1);
+	device = clut_getQueueDevice(command_queue);
+	ret = clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to get max allocation size", error1);
+
+	sprintf(flags, "-DITERATIONS=%d", PEAK_FMA_ITERATIONS);
+	program = clut_getCachedProgram(context, ARRAY_LEN(peak_sources), peak_sources, flags);
+	if (NULL == program) {
+		Debug_out(DEBUG_ROOFLINE, "%s: unable to build benchmark kernels.\n", fname);
+		goto error1;
+	}
+	copy = clCreateKernel(program, "clut_peak_copy", &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create copy kernel", error2);
+	fma = clCreateKernel(program, "clut_peak_fma", &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create fma kernel", error2);
+
+	/* big enough to defeat caches, small enough to fit */
+	size = max_alloc / 4;
+	if (size > PEAK_COPY_MAX_BYTES) {
+		size = PEAK_COPY_MAX_BYTES;
+	}
+	size -= size % 16;
+	if (size < PEAK_FMA_ITEMS * 16) {
+		size = PEAK_FMA_ITEMS * 16;
+	}
+
+	src = clut_createTrackedBuffer(context, CL_MEM_READ_ONLY, size, NULL, "roofline", NULL, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create benchmark buffer", error2);
+	dst = clut_createTrackedBuffer(context, CL_MEM_READ_WRITE, size, NULL, "roofline", NULL, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create benchmark buffer", error3);
+
+	if (!clut_returnSuccess(ret = clSetKernelArg(copy, 0, sizeof(cl_mem), &src)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(copy, 1, sizeof(cl_mem), &dst)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(fma, 0, sizeof(cl_mem), &dst)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(fma, 1, sizeof(cl_float), &a)) ||
+	    !clut_returnSuccess(ret = clSetKernelArg(fma, 2, sizeof(cl_float), &b))) {
+		CLUT_CHECK_ERROR(ret, "Unable to set benchmark kernel arguments", error4);
+	}
+
+	ns = clut_measureKernel(command_queue, copy, (size_t) (size / 16));
+	if (0 == ns) {
+		goto error4;
+	}
+	peaks->bandwidth = 2.0 * size / (ns * 1e-9);
+
+	ns = clut_measureKernel(command_queue, fma, PEAK_FMA_ITEMS);
+	if (0 == ns) {
+		goto error4;
+	}
+	peaks->flops = (cl_double) PEAK_FMA_ITEMS * PEAK_FMA_FLOPS_PER_ITEM / (ns * 1e-9);
+	peaks->measured = 1;
+
+	Debug_out(DEBUG_ROOFLINE, "%s: %.2f GB/s, %.2f GFLOP/s.\n", fname, peaks->bandwidth * 1e-9, peaks->flops * 1e-9);
+	result = 0;
+
+error4:	clReleaseMemObject(dst);
+error3:	clReleaseMemObject(src);
+error2:	if (NULL != copy) {
+		clReleaseKernel(copy);
+	}
+	if (NULL != fma) {
+		clReleaseKernel(fma);
+	}
+error1:	return result;
+}
+
+/*!
+ * @function clut_createRoofline
+ * Creates an empty roofline collector.
+ * @warning Result should be released with clut_releaseRoofline.
+ */
+clut_roofline * clut_createRoofline(void)
+{
+	const char * const fname = "clut_createRoofline";
+	clut_roofline *roofline;
+
+	roofline = calloc(1, sizeof(clut_roofline));
+	if (NULL == roofline) {
+		Debug_out(DEBUG_ROOFLINE, "%s: calloc failed.\n", fname);
+		return NULL;
+	}
+	pthread_mutex_init(&roofline->lock, NULL);
+	pthread_cond_init(&roofline->drained, NULL);
+
+	return roofline;
+}
+
+/*!
+ * @function clut_releaseRoofline
+ * Waits for the pending events of [roofline], then releases it.
+ */
+void clut_releaseRoofline(clut_roofline *roofline)
+{
+	struct clut_roofline_entry *entry, *next;
+
+	if (NULL == roofline) {
+		return;
+	}
+	clut_rooflineWait(roofline);
+	for (entry = roofline->entries; NULL != entry; entry = next) {
+		next = entry->next;
+		free(entry->name);
+		free(entry);
+	}
+	pthread_cond_destroy(&roofline->drained);
+	pthread_mutex_destroy(&roofline->lock);
+	free(roofline);
+}
+
+/*!
+ * @function clut_rooflineGetEntry
+ * Returns the entry of [name], creating it if needed.
+ * Must be called with the lock held.
+ */
+static struct clut_roofline_entry * clut_rooflineGetEntry(clut_roofline *roofline, const char * const name)
+{
+	const char * const fname = "clut_rooflineGetEntry";
+	struct clut_roofline_entry *entry;
+
+	for (entry = roofline->entries; NULL != entry; entry = entry->next) {
+		if (0 == strcmp(entry->name, name)) {
+			return entry;
+		}
+	}
+
+	entry = calloc(1, sizeof(struct clut_roofline_entry));
+	if (NULL == entry) {
+		Debug_out(DEBUG_ROOFLINE, "%s: calloc failed.\n", fname);
+		return NULL;
+	}
+	entry->name = StringUtils_clone(name);
+	if (NULL == entry->name) {
+		free(entry);
+		return NULL;
+	}
+	entry->roofline = roofline;
+	entry->next = roofline->entries;
+	roofline->entries = entry;
+	roofline->n_entries++;
+
+	return entry;
+}
+
+/*!
+ * @function clut_rooflineCallback
+ * Completion callback: adds the duration of [event], with the bytes and flops
+ * of its launch, to its entry.
+ */
+static void clut_rooflineCallback(cl_event event, cl_int status, void *user_data)
+{
+	struct clut_roofline_launch *launch = user_data;
+	struct clut_roofline_entry *entry = launch->entry;
+	clut_roofline *roofline = entry->roofline;
+	cl_ulong start, end;
+	int valid;
+
+	valid = (CL_COMPLETE == status) &&
+		clut_returnSuccess(clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL)) &&
+		clut_returnSuccess(clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL)) &&
+		(end >= start);
+
+	pthread_mutex_lock(&roofline->lock);
+	if (valid) {
+		entry->count++;
+		entry->time += end - start;
+		entry->bytes += launch->bytes;
+		entry->flops += launch->flops;
+	}
+	if (0 == --roofline->pending) {
+		pthread_cond_broadcast(&roofline->drained);
+	}
+	pthread_mutex_unlock(&roofline->lock);
+
+	free(launch);
+}
+
+/*!
+ * @function clut_rooflineRecordEvent
+ * Annotates the command of [event] as [name], moving [bytes] bytes to or
+ * from global memory and performing [flops] floating point operations.
+ * Its duration is recorded once it completes, without waiting for it.
+ * @return
+ * 0 on success, a negative value on failure.
+ */
+int clut_rooflineRecordEvent(clut_roofline *roofline, cl_event event, const char * const name, cl_ulong bytes, cl_ulong flops)
+{
+	const char * const fname = "clut_rooflineRecordEvent";
+	struct clut_roofline_launch *launch;
+	cl_int ret;
+
+	if ((NULL == roofline) || (NULL == event) || (NULL == name)) {
+		Debug_out(DEBUG_ROOFLINE, "%s: NULL pointer argument.\n", fname);
+		goto error1;
+	}
+
+	launch = malloc(sizeof(struct clut_roofline_launch));
+	if (NULL == launch) {
+		Debug_out(DEBUG_ROOFLINE, "%s: malloc failed.\n", fname);
+		goto error1;
+	}
+	launch->bytes = bytes;
+	launch->flops = flops;
+
+	pthread_mutex_lock(&roofline->lock);
+	launch->entry = clut_rooflineGetEntry(roofline, name);
+	if (NULL != launch->entry) {
+		roofline->pending++;
+	}
+	pthread_mutex_unlock(&roofline->lock);
+	if (NULL == launch->entry) {
+		goto error2;
+	}
+
+	ret = clSetEventCallback(event, CL_COMPLETE, clut_rooflineCallback, launch);
+	CLUT_CHECK_ERROR(ret, "Unable to set event callback", error3);
+
+	return 0;
+
+error3:
+	pthread_mutex_lock(&roofline->lock);
+	if (0 == --roofline->pending) {
+		pthread_cond_broadcast(&roofline->drained);
+	}
+	pthread_mutex_unlock(&roofline->lock);
+error2:
+	free(launch);
+error1:
+	return -1;
+}
+
+/*!
+ * @function clut_rooflineEnqueueNDRangeKernel
+ * Same as clEnqueueNDRangeKernel, but annotates the launch with [bytes] and
+ * [flops] under the kernel function name. [event] can be NULL.
+ */
+cl_int clut_rooflineEnqueueNDRangeKernel(clut_roofline *roofline, cl_ulong bytes, cl_ulong flops,
+					 cl_command_queue command_queue,
+					 cl_kernel kernel,
+					 cl_uint work_dim,
+					 const size_t *global_work_offset,
+					 const size_t *global_work_size,
+					 const size_t *local_work_size,
+					 cl_uint n_wait,
+					 const cl_event *wait_list,
+					 cl_event *event)
+{
+	cl_event l_event;
+	cl_int ret;
+	char *name;
+
+	ret = clut_enqueueNDRangeKernel(command_queue, kernel, work_dim,
+					global_work_offset, global_work_size, local_work_size,
+					n_wait, wait_list, &l_event);
+	if (!clut_returnSuccess(ret)) {
+		return ret;
+	}
+
+	name = clut_getKernelName(kernel);
+	if (NULL != name) {
+		clut_rooflineRecordEvent(roofline, l_event, name, bytes, flops);
+		free(name);
+	}
+
+	if (NULL != event) {
+		*event = l_event;
+	} else {
+		clReleaseEvent(l_event);
+	}
+	return ret;
+}
+
+/*!
+ * @function clut_rooflineWait
+ * Waits until all the events recorded in [roofline] have completed.
+ */
+void clut_rooflineWait(clut_roofline *roofline)
+{
+	if (NULL == roofline) {
+		return;
+	}
+	pthread_mutex_lock(&roofline->lock);
+	while (0 != roofline->pending) {
+		pthread_cond_wait(&roofline->drained, &roofline->lock);
+	}
+	pthread_mutex_unlock(&roofline->lock);
+}
+
+/*!
+ * @function clut_rooflineSnapshot
+ * Returns the roofline position of each kernel recorded in [roofline]
+ * against [peaks] (which can be NULL), and stores their number in
+ * [n_kernels]. A kernel is memory bound if its intensity is below the
+ * ridge point (peak flops / peak bandwidth); its efficiency is its achieved
+ * rate over the roof at its intensity. A kernel performing flops but moving
+ * no bytes has infinite intensity, so it is compute bound against the peak
+ * flop rate. Without the peak bandwidth, the ridge is unknown: the bound is CLUT_BOUND_UNKNOWN, and the efficiency is taken
+ * against the peak flop rate alone.
+ * @warning Result should be released with clut_freeRooflineSnapshot.
+ */
+clut_kernel_roofline * clut_rooflineSnapshot(clut_roofline *roofline, const clut_device_peaks *peaks, size_t *n_kernels)
+{
+	const char * const fname = "clut_rooflineSnapshot";
+	const cl_double peak_bandwidth = (NULL != peaks) ? peaks->bandwidth : 0;
+	const cl_double peak_flops = (NULL != peaks) ? peaks->flops : 0;
+	struct clut_roofline_entry *entry;
+	clut_kernel_roofline *snapshot, *k;
+	cl_double roof;
+	size_t i;
+
+	if ((NULL == roofline) || (NULL == n_kernels)) {
+		Debug_out(DEBUG_ROOFLINE, "%s: NULL pointer argument.\n", fname);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&roofline->lock);
+	snapshot = calloc(roofline->n_entries + 1, sizeof(clut_kernel_roofline));
+	if (NULL == snapshot) {
+		pthread_mutex_unlock(&roofline->lock);
+		Debug_out(DEBUG_ROOFLINE, "%s: calloc failed.\n", fname);
+		return NULL;
+	}
+	for (entry = roofline->entries, i = 0; NULL != entry; entry = entry->next, ++i) {
+		k = &snapshot[i];
+		k->name = StringUtils_clone(entry->name);
+		k->count = entry->count;
+		k->time = entry->time * 1e-9;
+		if (0 == entry->time) {
+			continue;
+		}
+		k->bandwidth = entry->bytes / k->time;
+		k->flops = entry->flops / k->time;
+		/* flops without global memory traffic sit at infinite intensity */
+		if (0 != entry->bytes) {
+			k->intensity = (cl_double) entry->flops / entry->bytes;
+		} else {
+			k->intensity = (0 != entry->flops) ? HUGE_VAL : 0;
+		}
+
+		if ((0 < peak_bandwidth) && (0 < peak_flops) && (0 != entry->flops)) {
+			k->bound = (k->intensity < peak_flops / peak_bandwidth) ? CLUT_BOUND_MEMORY : CLUT_BOUND_COMPUTE;
+			roof = (CLUT_BOUND_MEMORY == k->bound) ? k->intensity * peak_bandwidth : peak_flops;
+			k->efficiency = k->flops / roof;
+		} else if ((0 < peak_bandwidth) && (0 == entry->flops)) {
+			k->bound = CLUT_BOUND_MEMORY;
+			k->efficiency = k->bandwidth / peak_bandwidth;
+		} else if (0 < peak_flops) {
+			/* no bandwidth, no ridge: the bound stays unknown */
+			k->efficiency = k->flops / peak_flops;
+		}
+	}
+	*n_kernels = roofline->n_entries;
+	pthread_mutex_unlock(&roofline->lock);
+
+	return snapshot;
+}
+
+/*!
+ * @function clut_freeRooflineSnapshot
+ * Frees a snapshot returned by clut_rooflineSnapshot.
+ */
+void clut_freeRooflineSnapshot(clut_kernel_roofline *snapshot, size_t n_kernels)
+{
+	size_t i;
+
+	if (NULL == snapshot) {
+		return;
+	}
+	for (i = 0; i < n_kernels; ++i) {
+		free(snapshot[i].name);
+	}
+	free(snapshot);
+}
+
+/*!
+ * @function clut_rooflineBoundName
+ * Returns the name of [bound] for the report.
+ */
+static const char * clut_rooflineBoundName(clut_roofline_bound bound)
+{
+	switch (bound) {
+		case CLUT_BOUND_MEMORY:
+			return "memory";
+		case CLUT_BOUND_COMPUTE:
+			return "compute";
+		default:
+			return "unknown";
+	}
+}
+
+/*!
+ * @function clut_rooflinePrint
+ * Prints the roofline position of each kernel in [roofline] to [f],
+ * against [peaks] (which can be NULL).
+ */
+void clut_rooflinePrint(clut_roofline *roofline, const clut_device_peaks *peaks, FILE *f)
+{
+	clut_kernel_roofline *snapshot;
+	size_t n, i;
+
+	snapshot = clut_rooflineSnapshot(roofline, peaks, &n);
+	if (NULL == snapshot) {
+		return;
+	}
+
+	if (NULL != peaks) {
+		fprintf(f, "Peaks (%s): %.2f GB/s, %.2f GFLOP/s, ridge at %.2f flop/byte.\n",
+			peaks->measured ? "measured" : "nominal",
+			peaks->bandwidth * 1e-9,
+			peaks->flops * 1e-9,
+			(0 < peaks->bandwidth) ? peaks->flops / peaks->bandwidth : 0);
+	}
+	fprintf(f, "%-32s %8s %12s %10s %10s %10s %8s %8s\n",
+		"kernel", "count", "mean (us)", "GB/s", "GFLOP/s", "flop/B", "bound", "% roof");
+	for (i = 0; i < n; ++i) {
+		const clut_kernel_roofline *k = &snapshot[i];
+		fprintf(f, "%-32s %8llu %12.3f %10.2f %10.2f %10.3f %8s %8.1f\n",
+			k->name,
+			(unsigned long long) k->count,
+			(0 != k->count) ? k->time / k->count * 1e6 : 0,
+			k->bandwidth * 1e-9,
+			k->flops * 1e-9,
+			k->intensity,
+			clut_rooflineBoundName(k->bound),
+			k->efficiency * 100);
+	}
+
+	clut_freeRooflineSnapshot(snapshot, n);
+}
@@ -0,0 +1,306 @@
+/**
+ * @file
+ * @author Michele Laurenti
+ * @language c
+ *
+ * Pinned host staging rings.
+ *
+ * Slots are handed out in order, like a ring buffer: an acquire takes the
+ * slot after the last one taken, waiting for it to be released if needed,
+ * and then for its fence. Waiting for fences happens out of the lock.
+ */
+
+#include "mlclut_staging.h"
+#include "mlclut_descriptions.h"
+#include "mlclut_interpose.h"
+#include "mlclut_memory.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <Debug.h>
+
+#define DEBUG_STAGING	"mlclut_debug_staging"
+
+#define SLOT_ALIGNMENT	4096	/* a page, DMA engines like it */
+
+struct clut_staging_slot {
+	int acquired;
+	cl_event fence;
+};
+
+struct clut_staging {
+	cl_command_queue queue;
+	cl_mem buffer;
+	unsigned char *mapped;
+	size_t slot_size;
+	unsigned int n_slots;
+	unsigned int head;
+	struct clut_staging_slot *slots;
+	pthread_mutex_t lock;
+	pthread_cond_t released;
+};
+
+/**
+ * Function definition
+ */
+
+/*!
+ * @function clut_createStaging
+ * Creates a ring of [n_slots] slots of [slot_size] bytes (rounded up to a
+ * page) in the context of [command_queue], and maps it with [command_queue].
+ */
+clut_staging * clut_createStaging(cl_command_queue command_queue, size_t slot_size, unsigned int n_slots, cl_int *ret)
+{
+	const char * const fname = "clut_createStaging";
+	clut_staging *staging;
+	cl_context context;
+	cl_int err;
+
+	if ((NULL == command_queue) || (0 == slot_size) || (0 == n_slots)) {
+		Debug_out(DEBUG_STAGING, "%s: invalid argument.\n", fname);
+		err = CL_INVALID_VALUE;
+		goto error1;
+	}
+	staging = calloc(1, sizeof(*staging));
+	if (NULL == staging) {
+		Debug_out(DEBUG_STAGING, "%s: calloc failed.\n", fname);
+		err = CL_OUT_OF_HOST_MEMORY;
+		goto error1;
+	}
+	staging->slots = calloc(n_slots, sizeof(struct clut_staging_slot));
+	if (NULL == staging->slots) {
+		Debug_out(DEBUG_STAGING, "%s: calloc failed.\n", fname);
+		err = CL_OUT_OF_HOST_MEMORY;
+		goto error2;
+	}
+	staging->slot_size = CLUT_ROUND_UP(slot_size, SLOT_ALIGNMENT);
+	staging->n_slots = n_slots;
+
+	err = clGetCommandQueueInfo(command_queue, CL_QUEUE_CONTEXT, sizeof(context), &context, NULL);
+	CLUT_CHECK_ERROR(err, "Unable to get command queue context", error3);
+	staging->buffer = clut_createTrackedBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+						   staging->slot_size * n_slots, NULL, "staging", staging, &err);
+	CLUT_CHECK_ERROR(err, "Unable to create staging buffer", error3);
+	staging->mapped = clut_enqueueMapBuffer(command_queue, staging->buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE,
+						0, staging->slot_size * n_slots, 0, NULL, NULL, &err);
+	CLUT_CHECK_ERROR(err, "Unable to map staging buffer", error4);
+
+	clRetainCommandQueue(command_queue);
+	staging->queue = command_queue;
+	pthread_mutex_init(&staging->lock, NULL);
+	pthread_cond_init(&staging->released, NULL);
+
+	Debug_out(DEBUG_STAGING, "%s: %u slots of %zu bytes.\n", fname, n_slots, staging->slot_size);
+	if (NULL != ret) {
+		*ret = CL_SUCCESS;
+	}
+	return staging;
+
+error4:	clReleaseMemObject(staging->buffer);
+error3:	free(staging->slots);
+error2:	free(staging);
+error1:	if (NULL != ret) {
+		*ret = err;
+	}
+	return NULL;
+}
+
+/*!
+ * @function clut_releaseStaging
+ * Waits for every fence of [staging], unmaps it and releases it. No slot may
+ * be acquired.
+ */
+void clut_releaseStaging(clut_staging *staging)
+{
+	cl_event unmapped = NULL;
+	unsigned int i;
+
+	if (NULL == staging) {
+		return;
+	}
+	for (i = 0; i < staging->n_slots; ++i) {
+		if (NULL != staging->slots[i].fence) {
+			clWaitForEvents(1, &staging->slots[i].fence);
+			clReleaseEvent(staging->slots[i].fence);
+		}
+	}
+	if (clut_returnSuccess(clut_enqueueUnmapMemObject(staging->queue, staging->buffer, staging->mapped, 0, NULL, &unmapped))) {
+		clWaitForEvents(1, &unmapped);
+		clReleaseEvent(unmapped);
+	}
+	clReleaseMemObject(staging->buffer);
+	clReleaseCommandQueue(staging->queue);
+	pthread_cond_destroy(&staging->released);
+	pthread_mutex_destroy(&staging->lock);
+	free(staging->slots);
+	free(staging);
+}
+
+/*!
+ * @function clut_getStagingSlotSize
+ * Returns the size of the slots of [staging], in bytes.
+ */
+size_t clut_getStagingSlotSize(clut_staging *staging)
+{
+	return (NULL != staging) ? staging->slot_size : 0;
+}
+
+/*!
+ * @function clut_stagingAcquire
+ * Takes the next slot of [staging], waiting until it is released and its
+ * fence completes, and stores its index in [slot].
+ * @return
+ * The pinned host memory of the slot, or NULL if [size] doesn't fit a slot.
+ */
+void * clut_stagingAcquire(clut_staging *staging, size_t size, unsigned int *slot)
+{
+	const char * const fname = "clut_stagingAcquire";
+	struct clut_staging_slot *s;
+	unsigned int index;
+	cl_event fence;
+
+	if ((NULL == staging) || (NULL == slot) || (size > staging->slot_size)) {
+		Debug_out(DEBUG_STAGING, "%s: invalid argument.\n", fname);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&staging->lock);
+	while (staging->slots[staging->head].acquired) {
+		pthread_cond_wait(&staging->released, &staging->lock);
+	}
+	index = staging->head;
+	staging->head = (staging->head + 1) % staging->n_slots;
+	s = &staging->slots[index];
+	s->acquired = 1;
+	fence = s->fence;
+	s->fence = NULL;
+	pthread_mutex_unlock(&staging->lock);
+
+	if (NULL != fence) {
+		clWaitForEvents(1, &fence);
+		clReleaseEvent(fence);
+	}
+
+	*slot = index;
+	return staging->mapped + index * staging->slot_size;
+}
+
+/*!
+ * @function clut_stagingRelease
+ * Gives [slot] back to [staging]. It won't be handed out again before
+ * [fence] completes; [fence] can be NULL if nothing uses the slot anymore.
+ */
+void clut_stagingRelease(clut_staging *staging, unsigned int slot, cl_event fence)
+{
+	struct clut_staging_slot *s;
+
+	if ((NULL == staging) || (slot >= staging->n_slots)) {
+		return;
+	}
+	if (NULL != fence) {
+		clRetainEvent(fence);
+	}
+
+	pthread_mutex_lock(&staging->lock);
+	s = &staging->slots[slot];
+	s->fence = fence;
+	s->acquired = 0;
+	pthread_cond_broadcast(&staging->released);
+	pthread_mutex_unlock(&staging->lock);
+}
+
+/*!
+ * @function clut_stagingWriteBuffer
+ * Enqueues a non-blocking write of the first [size] bytes of [slot] into
+ * [buffer], and releases [slot] fenced by the write.
+ * The slot is released even if the write fails.
+ */
+cl_int clut_stagingWriteBuffer(clut_staging *staging,
+			       unsigned int slot,
+			       cl_command_queue command_queue,
+			       cl_mem buffer,
+			       size_t offset,
+			       size_t size,
+			       cl_uint n_wait,
+			       const cl_event *wait_list,
+			       cl_event *event)
+{
+	cl_event written = NULL;
+	cl_int ret;
+
+	if ((NULL == staging) || (slot >= staging->n_slots)) {
+		return CL_INVALID_VALUE;
+	}
+	if (size > staging->slot_size) {
+		clut_stagingRelease(staging, slot, NULL);
+		return CL_INVALID_VALUE;
+	}
+	ret = clut_enqueueWriteBuffer(command_queue, buffer, CL_FALSE, offset, size,
+				      staging->mapped + slot * staging->slot_size,
+				      n_wait, wait_list, &written);
+	clut_stagingRelease(staging, slot, written);
+	if (NULL != written) {
+		if (NULL != event) {
+			*event = written;
+		} else {
+			clReleaseEvent(written);
+		}
+	}
+	return ret;
+}
+
+/*!
+ * @function clut_stagingWriteImage
+ * Enqueues a non-blocking write of [region] of [image] from [slot], whose
+ * rows start every [row_pitch] bytes (0 for tightly packed rows), and
+ * releases [slot] fenced by the write. The slot is released even if the
+ * write fails.
+ */
+cl_int clut_stagingWriteImage(clut_staging *staging,
+			      unsigned int slot,
+			      cl_command_queue command_queue,
+			      cl_mem image,
+			      const size_t origin[3],
+			      const size_t region[3],
+			      size_t row_pitch,
+			      cl_uint n_wait,
+			      const cl_event *wait_list,
+			      cl_event *event)
+{
+	cl_event written = NULL;
+	size_t element_size = 0, rows;
+	cl_int ret;
+
+	if ((NULL == staging) || (slot >= staging->n_slots)) {
+		return CL_INVALID_VALUE;
+	}
+	if (0 == row_pitch) {
+		ret = clGetImageInfo(image, CL_IMAGE_ELEMENT_SIZE, sizeof(element_size), &element_size, NULL);
+		if (!clut_returnSuccess(ret)) {
+			clut_stagingRelease(staging, slot, NULL);
+			return ret;
+		}
+		row_pitch = element_size * region[0];
+	}
+	/* slices are tightly packed too */
+	rows = region[1] * region[2];
+	if ((0 != rows) && (row_pitch > staging->slot_size / rows)) {
+		clut_stagingRelease(staging, slot, NULL);
+		return CL_INVALID_VALUE;
+	}
+	ret = clut_enqueueWriteImage(command_queue, image, CL_FALSE, origin, region, row_pitch, 0,
+				     staging->mapped + slot * staging->slot_size,
+				     n_wait, wait_list, &written);
+	clut_stagingRelease(staging, slot, written);
+	if (NULL != written) {
+		if (NULL != event) {
+			*event = written;
+		} else {
+			clReleaseEvent(written);
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,514 @@
+/**
+ * @file
+ * @author Michele Laurenti
+ * @language c
+ *
+ * Per kernel latency histograms.
+ *
+ * Each histogram is log-linear: values below 2^SUB_BITS have a bucket each,
+ * larger values are bucketed by their most significant bit and the SUB_BITS
+ * bits that follow it. Recording is a handful of shifts and an increment,
+ * and percentiles are exact up to the width of a bucket.
+ */
+
+#include "mlclut_stats.h"
+#include "mlclut_descriptions.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <Debug.h>
+#include <StringUtils.h>
+
+#define DEBUG_STATS	"mlclut_debug_stats"
+
+#define SUB_BITS	5
+#define SUB_COUNT	(1 << SUB_BITS)
+#define N_BUCKETS	((64 - SUB_BITS + 1) * SUB_COUNT)
+
+struct clut_stats_entry {
+	char *name;
+	struct clut_stats *stats;
+	cl_ulong count;
+	cl_ulong sum;
+	cl_ulong min;
+	cl_ulong max;
+	cl_ulong buckets[N_BUCKETS];
+	struct clut_stats_entry *next;
+};
+
+struct clut_stats {
+	struct clut_stats_entry *entries;
+	size_t n_entries;
+	size_t pending;
+	pthread_mutex_t lock;
+	pthread_cond_t drained;
+};
+
+/**
+ * Function declaration
+ */
+
+static size_t clut_statsBucket(cl_ulong value);
+static cl_ulong clut_statsBucketHighest(size_t bucket);
+static cl_ulong clut_statsPercentile(const struct clut_stats_entry *entry, double percentile);
+static struct clut_stats_entry * clut_statsGetEntry(clut_stats *stats, const char * const name);
+static void clut_statsAdd(struct clut_stats_entry *entry, cl_ulong value);
+static void clut_statsCallback(cl_event event, cl_int status, void *user_data);
+
+/**
+ * Function definition
+ */
+
+/*!
+ * @function clut_statsBucket
+ * Returns the histogram bucket of [value].
+ */
+static size_t clut_statsBucket(cl_ulong value)
+{
+	unsigned int msb = 0, shift;
+
+	if (value < SUB_COUNT) {
+		return (size_t) value;
+	}
+	for (shift = 32; shift > 0; shift /= 2) {
+		if (value >> (msb + shift)) {
+			msb += shift;
+		}
+	}
+	return (size_t) (msb - SUB_BITS + 1) * SUB_COUNT + (size_t) ((value >> (msb - SUB_BITS)) - SUB_COUNT);
+}
+
+/*!
+ * @function clut_statsBucketHighest
+ * Returns the highest value that falls in [bucket].
+ */
+static cl_ulong clut_statsBucketHighest(size_t bucket)
+{
+	const size_t k = bucket / SUB_COUNT;
+	cl_ulong sub;
+
+	if (0 == k) {
+		return (cl_ulong) bucket;
+	}
+	sub = (cl_ulong) (bucket % SUB_COUNT + SUB_COUNT);
+	return ((sub + 1) << (k - 1)) - 1;
+}
+
+/*!
+ * @function clut_statsPercentile
+ * Returns the value below which [percentile] (in [0, 100]) of the values
+ * recorded in [entry] fall, clamped to the recorded range.
+ */
+static cl_ulong clut_statsPercentile(const struct clut_stats_entry *entry, double percentile)
+{
+	cl_ulong target, seen = 0, value;
+	size_t i;
+
+	if (0 == entry->count) {
+		return 0;
+	}
+	target = (cl_ulong) (percentile / 100.0 * (double) entry->count + 0.5);
+	if (target < 1) {
+		target = 1;
+	}
+	for (i = 0; i < N_BUCKETS; ++i) {
+		seen += entry->buckets[i];
+		if (seen >= target) {
+			break;
+		}
+	}
+	value = clut_statsBucketHighest(i);
+	if (value > entry->max) {
+		value = entry->max;
+	}
+	if (value < entry->min) {
+		value = entry->min;
+	}
+	return value;
+}
+
+/*!
+ * @function clut_createStats
+ * Creates an empty statistics collector.
+ * @warning Result should be released with clut_releaseStats.
+ */
+clut_stats * clut_createStats(void)
+{
+	const char * const fname = "clut_createStats";
+	clut_stats *stats;
+
+	stats = calloc(1, sizeof(clut_stats));
+	if (NULL == stats) {
+		Debug_out(DEBUG_STATS, "%s: calloc failed.\n", fname);
+		return NULL;
+	}
+	pthread_mutex_init(&stats->lock, NULL);
+	pthread_cond_init(&stats->drained, NULL);
+
+	return stats;
+}
+
+/*!
+ * @function clut_releaseStats
+ * Waits for the pending events of [stats], then releases it.
+ */
+void clut_releaseStats(clut_stats *stats)
+{
+	struct clut_stats_entry *entry, *next;
+
+	if (NULL == stats) {
+		return;
+	}
+	clut_statsWait(stats);
+	for (entry = stats->entries; NULL != entry; entry = next) {
+		next = entry->next;
+		free(entry->name);
+		free(entry);
+	}
+	pthread_cond_destroy(&stats->drained);
+	pthread_mutex_destroy(&stats->lock);
+	free(stats);
+}
+
+/*!
+ * @function clut_statsGetEntry
+ * Returns the entry of [name], creating it if needed.
+ * Must be called with the lock held. Entries live as long as [stats].
+ */
+static struct clut_stats_entry * clut_statsGetEntry(clut_stats *stats, const char * const name)
+{
+	const char * const fname = "clut_statsGetEntry";
+	struct clut_stats_entry *entry;
+
+	for (entry = stats->entries; NULL != entry; entry = entry->next) {
+		if (0 == strcmp(entry->name, name)) {
+			return entry;
+		}
+	}
+
+	entry = calloc(1, sizeof(struct clut_stats_entry));
+	if (NULL == entry) {
+		Debug_out(DEBUG_STATS, "%s: calloc failed.\n", fname);
+		return NULL;
+	}
+	entry->name = StringUtils_clone(name);
+	if (NULL == entry->name) {
+		Debug_out(DEBUG_STATS, "%s: unable to clone name.\n", fname);
+		free(entry);
+		return NULL;
+	}
+	entry->stats = stats;
+	entry->next = stats->entries;
+	stats->entries = entry;
+	stats->n_entries++;
+
+	return entry;
+}
+
+/*!
+ * @function clut_statsAdd
+ * Adds [value] to [entry]. Must be called with the lock held.
+ */
+static void clut_statsAdd(struct clut_stats_entry *entry, cl_ulong value)
+{
+	if ((0 == entry->count) || (value < entry->min)) {
+		entry->min = value;
+	}
+	if (value > entry->max) {
+		entry->max = value;
+	}
+	entry->count++;
+	entry->sum += value;
+	entry->buckets[clut_statsBucket(value)]++;
+}
+
+/*!
+ * @function clut_statsRecord
+ * Records a duration of [duration_ns] nanoseconds for [name].
+ * @return
+ * 0 on success, a negative value on failure.
+ */
+int clut_statsRecord(clut_stats *stats, const char * const name, cl_ulong duration_ns)
+{
+	struct clut_stats_entry *entry;
+
+	if ((NULL == stats) || (NULL == name)) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&stats->lock);
+	entry = clut_statsGetEntry(stats, name);
+	if (NULL != entry) {
+		clut_statsAdd(entry, duration_ns);
+	}
+	pthread_mutex_unlock(&stats->lock);
+
+	return (NULL != entry) ? 0 : -1;
+}
+
+/*!
+ * @function clut_statsCallback
+ * Completion callback: records the duration of [event] in the entry passed
+ * as [user_data]. Commands that failed are not recorded.
+ */
+static void clut_statsCallback(cl_event event, cl_int status, void *user_data)
+{
+	struct clut_stats_entry *entry = user_data;
+	clut_stats *stats = entry->stats;
+	cl_ulong start, end;
+	int valid;
+
+	valid = (CL_COMPLETE == status) &&
+		clut_returnSuccess(clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL)) &&
+		clut_returnSuccess(clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL)) &&
+		(end >= start);
+
+	pthread_mutex_lock(&stats->lock);
+	if (valid) {
+		clut_statsAdd(entry, end - start);
+	}
+	if (0 == --stats->pending) {
+		pthread_cond_broadcast(&stats->drained);
+	}
+	pthread_mutex_unlock(&stats->lock);
+}
+
+/*!
+ * @function clut_statsRecordEvent
+ * Records the duration of [event] for [name] once it completes, without
+ * waiting for it.
+ * @return
+ * 0 on success, a negative value on failure.
+ */
+int clut_statsRecordEvent(clut_stats *stats, cl_event event, const char * const name)
+{
+	const char * const fname = "clut_statsRecordEvent";
+	struct clut_stats_entry *entry;
+	cl_int ret;
+
+	if ((NULL == stats) || (NULL == event) || (NULL == name)) {
+		Debug_out(DEBUG_STATS, "%s: NULL pointer argument.\n", fname);
+		goto error1;
+	}
+
+	pthread_mutex_lock(&stats->lock);
+	entry = clut_statsGetEntry(stats, name);
+	if (NULL != entry) {
+		stats->pending++;
+	}
+	pthread_mutex_unlock(&stats->lock);
+	if (NULL == entry) {
+		goto error1;
+	}
+
+	ret = clSetEventCallback(event, CL_COMPLETE, clut_statsCallback, entry);
+	CLUT_CHECK_ERROR(ret, "Unable to set event callback", error2);
+
+	return 0;
+
+error2:
+	pthread_mutex_lock(&stats->lock);
+	if (0 == --stats->pending) {
+		pthread_cond_broadcast(&stats->drained);
+	}
+	pthread_mutex_unlock(&stats->lock);
+error1:
+	return -1;
+}
+
+/*!
+ * @function clut_statsRecordKernelEvent
+ * Same as clut_statsRecordEvent, using the function name of [kernel].
+ */
+int clut_statsRecordKernelEvent(clut_stats *stats, cl_event event, cl_kernel kernel)
+{
+	char *name;
+	int result;
+
+	name = clut_getKernelName(kernel);
+	if (NULL == name) {
+		return -1;
+	}
+	result = clut_statsRecordEvent(stats, event, name);
+	free(name);
+
+	return result;
+}
+
+/*!
+ * @function clut_statsWait
+ * Waits until all the events recorded in [stats] have completed.
+ * The commands must have been flushed.
+ */
+void clut_statsWait(clut_stats *stats)
+{
+	if (NULL == stats) {
+		return;
+	}
+	pthread_mutex_lock(&stats->lock);
+	while (0 != stats->pending) {
+		pthread_cond_wait(&stats->drained, &stats->lock);
+	}
+	pthread_mutex_unlock(&stats->lock);
+}
+
+/*!
+ * @function clut_statsSnapshot
+ * Returns a summary of each kernel recorded in [stats], sorted by name,
+ * and stores their number in [n_kernels]. Pending events are not waited for.
+ * @warning Result should be released with clut_freeStatsSnapshot.
+ */
+clut_kernel_stats * clut_statsSnapshot(clut_stats *stats, size_t *n_kernels)
+{
+	const char * const fname = "clut_statsSnapshot";
+	struct clut_stats_entry *entry;
+	clut_kernel_stats *snapshot, tmp;
+	size_t i, j, n;
+
+	if ((NULL == stats) || (NULL == n_kernels)) {
+		Debug_out(DEBUG_STATS, "%s: NULL pointer argument.\n", fname);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&stats->lock);
+	n = stats->n_entries;
+	snapshot = calloc(n + 1, sizeof(clut_kernel_stats));
+	if (NULL == snapshot) {
+		pthread_mutex_unlock(&stats->lock);
+		Debug_out(DEBUG_STATS, "%s: calloc failed.\n", fname);
+		return NULL;
+	}
+	for (entry = stats->entries, i = 0; NULL != entry; entry = entry->next, ++i) {
+		snapshot[i].name = StringUtils_clone(entry->name);
+		snapshot[i].count = entry->count;
+		snapshot[i].mean = (0 != entry->count) ? (cl_double) entry->sum / (cl_double) entry->count : 0;
+		snapshot[i].min = entry->min;
+		snapshot[i].p50 = clut_statsPercentile(entry, 50);
+		snapshot[i].p90 = clut_statsPercentile(entry, 90);
+		snapshot[i].p99 = clut_statsPercentile(entry, 99);
+		snapshot[i].max = entry->max;
+	}
+	pthread_mutex_unlock(&stats->lock);
+
+	/* few kernels, insertion sort is fine */
+	for (i = 1; i < n; ++i) {
+		tmp = snapshot[i];
+		for (j = i; (j > 0) && (0 < strcmp(snapshot[j - 1].name, tmp.name)); --j) {
+			snapshot[j] = snapshot[j - 1];
+		}
+		snapshot[j] = tmp;
+	}
+
+	*n_kernels = n;
+	return snapshot;
+}
+
+/*!
+ * @function clut_freeStatsSnapshot
+ * Frees a snapshot returned by clut_statsSnapshot.
+ */
+void clut_freeStatsSnapshot(clut_kernel_stats *snapshot, size_t n_kernels)
+{
+	size_t i;
+
+	if (NULL == snapshot) {
+		return;
+	}
+	for (i = 0; i < n_kernels; ++i) {
+		free(snapshot[i].name);
+	}
+	free(snapshot);
+}
+
+/*!
+ * @function clut_statsReset
+ * Clears all histograms in [stats]. Kernel names are kept, and events still
+ * pending will be recorded after the reset.
+ */
+void clut_statsReset(clut_stats *stats)
+{
+	struct clut_stats_entry *entry;
+
+	if (NULL == stats) {
+		return;
+	}
+	pthread_mutex_lock(&stats->lock);
+	for (entry = stats->entries; NULL != entry; entry = entry->next) {
+		entry->count = 0;
+		entry->sum = 0;
+		entry->min = 0;
+		entry->max = 0;
+		memset(entry->buckets, 0, sizeof(entry->buckets));
+	}
+	pthread_mutex_unlock(&stats->lock);
+}
+
+/*!
+ * @function clut_statsPrint
+ * Prints a table with the summary of each kernel in [stats] to [f],
+ * durations in microseconds.
+ */
+void clut_statsPrint(clut_stats *stats, FILE *f)
+{
+	clut_kernel_stats *snapshot;
+	size_t n, i;
+
+	snapshot = clut_statsSnapshot(stats, &n);
+	if (NULL == snapshot) {
+		return;
+	}
+
+	fprintf(f, "%-32s %10s %12s %12s %12s %12s %12s\n",
+		"kernel", "count", "mean (us)", "p50 (us)", "p90 (us)", "p99 (us)", "max (us)");
+	for (i = 0; i < n; ++i) {
+		fprintf(f, "%-32s %10llu %12.3f %12.3f %12.3f %12.3f %12.3f\n",
+			snapshot[i].name,
+			(unsigned long long) snapshot[i].count,
+			snapshot[i].mean * 1e-3,
+			snapshot[i].p50 * 1e-3,
+			snapshot[i].p90 * 1e-3,
+			snapshot[i].p99 * 1e-3,
+			snapshot[i].max * 1e-3);
+	}
+
+	clut_freeStatsSnapshot(snapshot, n);
+}
+
+/*!
+ * @function clut_statsEnqueueNDRangeKernel
+ * Same as clEnqueueNDRangeKernel, but records the duration of the launch in
+ * [stats] under the kernel function name. [event] can be NULL.
+ */
+cl_int clut_statsEnqueueNDRangeKernel(clut_stats *stats,
+				      cl_command_queue command_queue,
+				      cl_kernel kernel,
+				      cl_uint work_dim,
+				      const size_t *global_work_offset,
+				      const size_t *global_work_size,
+				      const size_t *local_work_size,
+				      cl_uint n_wait,
+				      const cl_event *wait_list,
+				      cl_event *event)
+{
+	cl_event l_event;
+	cl_int ret;
+
+	ret = clEnqueueNDRangeKernel(command_queue, kernel, work_dim,
+				     global_work_offset, global_work_size, local_work_size,
+				     n_wait, wait_list, &l_event);
+	if (!clut_returnSuccess(ret)) {
+		return ret;
+	}
+
+	clut_statsRecordKernelEvent(stats, l_event, kernel);
+
+	if (NULL != event) {
+		*event = l_event;
+	} else {
+		clReleaseEvent(l_event);
+	}
+	return ret;
+}
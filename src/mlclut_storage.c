@@ -0,0 +1,314 @@
+/**
+ * @file
+ * @author Michele Laurenti
+ * @language c
+ *
+ * Image or buffer storage policy, with a persistent per device cache.
+ *
+ * The cache file has one line per decision:
+ *   device <TAB> access class <TAB> image|buffer
+ * in the format of mlclut_cache.h, as the autotune cache.
+ *
+ * The benchmark reads an RGBA8 image with read_imageui, or a buffer of
+ * uchar4 with clamped indices, and writes one uint per pixel. The streaming
+ * kernel reads its own pixel; the gather kernel reads a 3 x 3 neighbourhood
+ * around the transposed position, so neighbouring work-items read down
+ * columns, where the 2D caching of images pays off.
+ */
+
+#include "mlclut_storage.h"
+#include "mlclut_descriptions.h"
+#include "mlclut_interpose.h"
+#include "mlclut_memory.h"
+#include "mlclut_images.h"
+#include "mlclut_cache.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <Debug.h>
+#include <ArrayUtils.h>
+
+#define DEBUG_STORAGE		"mlclut_debug_storage"
+
+#define STORAGE_ENV		"CLUT_STORAGE_CACHE"
+#define BENCH_SIZE		1024
+#define BENCH_RUNS		3
+
+static const char *access_names[] = {"streaming", "gather"};
+static const char *access_kernels[] = {"clut_storage_streaming", "clut_storage_gather"};
+
+static const char *storage_sources[] = {
+	"#ifdef IMAGE\n"
+	"__constant sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;\n"
+	"#define SRC_PARAMS __read_only image2d_t src\n"
+	"#define LOAD(x, y) read_imageui(src, sampler, (int2) ((x), (y)))\n"
+	"#else\n"
+	"#define SRC_PARAMS __global const uchar4 *src, int pitch\n"
+	"#define LOAD(x, y) convert_uint4(src[clamp((y), 0, h - 1) * pitch + clamp((x), 0, w - 1)])\n"
+	"#endif\n"
+	"\n"
+	"__kernel void clut_storage_streaming(SRC_PARAMS, int w, int h, __global uint *dst)\n"
+	"{\n"
+	"	const int x = get_global_id(0), y = get_global_id(1);\n"
+	"	uint4 v;\n"
+	"\n"
+	"	if ((x >= w) || (y >= h)) {\n"
+	"		return;\n"
+	"	}\n"
+	"	v = LOAD(x, y);\n"
+	"	dst[y * w + x] = v.x + v.y + v.z + v.w;\n"
+	"}\n"
+	"\n"
+	"__kernel void clut_storage_gather(SRC_PARAMS, int w, int h, __global uint *dst)\n"
+	"{\n"
+	"	const int x = get_global_id(0), y = get_global_id(1);\n"
+	"	uint4 v = (uint4) (0);\n"
+	"	int i, j, tx, ty;\n"
+	"\n"
+	"	if ((x >= w) || (y >= h)) {\n"
+	"		return;\n"
+	"	}\n"
+	"	tx = y * w / h;\n"
+	"	ty = x * h / w;\n"
+	"	for (j = -1; j <= 1; ++j) {\n"
+	"		for (i = -1; i <= 1; ++i) {\n"
+	"			v += LOAD(tx + i, ty + j);\n"
+	"		}\n"
+	"	}\n"
+	"	dst[y * w + x] = v.x + v.y + v.z + v.w;\n"
+	"}\n"
+};
+
+static clut_cache storage_cache = CLUT_CACHE_INITIALIZER(STORAGE_ENV, DEBUG_STORAGE);
+/* held while benchmarking, so a device is never benchmarked twice */
+static pthread_mutex_t storage_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Function declaration
+ */
+
+static int clut_storageKey(cl_device_id device, clut_access_class access, char *key);
+static cl_ulong clut_storageTime(cl_command_queue command_queue, cl_mem src, cl_int pitch,
+				 cl_mem dst, clut_access_class access, int image);
+static cl_mem_object_type clut_storageBenchmark(cl_context context, cl_device_id device, clut_access_class access);
+
+/**
+ * Function definition
+ */
+
+/*!
+ * @function clut_setStorageCacheFile
+ * Makes the policy load and store its decisions in [filename], instead of
+ * the file named by CLUT_STORAGE_CACHE. NULL keeps decisions in memory
+ * only. Decisions in memory are discarded.
+ */
+void clut_setStorageCacheFile(const char * const filename)
+{
+	clut_setCacheFile(&storage_cache, filename);
+}
+
+/*!
+ * @function clut_releaseStorageCache
+ * Forgets all decisions in memory, and any file set with
+ * clut_setStorageCacheFile. The cache file is left untouched.
+ */
+void clut_releaseStorageCache(void)
+{
+	clut_releaseCache(&storage_cache);
+}
+
+/*!
+ * @function clut_storageKey
+ * Writes the device and access class fields of the cache line to [key],
+ * CLUT_CACHE_MAX_KEY long.
+ * @return
+ * 0 on success, a negative value on failure.
+ */
+static int clut_storageKey(cl_device_id device, clut_access_class access, char *key)
+{
+	char device_key[CLUT_CACHE_DEVICE_KEY];
+
+	if (((size_t) access >= ARRAY_LEN(access_names)) ||
+	    (0 != clut_getDeviceKey(device, device_key, sizeof(device_key)))) {
+		return -1;
+	}
+	snprintf(key, CLUT_CACHE_MAX_KEY, "%s\t%s", device_key, access_names[access]);
+	return 0;
+}
+
+/*!
+ * @function clut_storageTime
+ * Runs the [access] benchmark kernel on [src] (an image if [image], else a
+ * buffer of rows of [pitch] pixels) BENCH_RUNS times, and returns the
+ * fastest run in nanoseconds, 0 on failure.
+ */
+static cl_ulong clut_storageTime(cl_command_queue command_queue, cl_mem src, cl_int pitch,
+				 cl_mem dst, clut_access_class access, int image)
+{
+	const cl_int size = BENCH_SIZE;
+	const size_t global[2] = {BENCH_SIZE, BENCH_SIZE};
+	cl_context context;
+	cl_kernel kernel;
+	cl_event event;
+	cl_ulong best = 0, duration;
+	cl_uint index = 0;
+	cl_int ret;
+	int i;
+
+	if (!clut_returnSuccess(clGetCommandQueueInfo(command_queue, CL_QUEUE_CONTEXT, sizeof(context), &context, NULL))) {
+		return 0;
+	}
+	kernel = clut_acquireCachedKernel(context, ARRAY_LEN(storage_sources), storage_sources,
+					  image ? "-DIMAGE" : "", access_kernels[access]);
+	if (NULL == kernel) {
+		return 0;
+	}
+	ret = clSetKernelArg(kernel, index++, sizeof(cl_mem), &src);
+	if (!image && clut_returnSuccess(ret)) {
+		ret = clSetKernelArg(kernel, index++, sizeof(cl_int), &pitch);
+	}
+	if (!clut_returnSuccess(ret) ||
+	    !clut_returnSuccess(clSetKernelArg(kernel, index++, sizeof(cl_int), &size)) ||
+	    !clut_returnSuccess(clSetKernelArg(kernel, index++, sizeof(cl_int), &size)) ||
+	    !clut_returnSuccess(clSetKernelArg(kernel, index++, sizeof(cl_mem), &dst))) {
+		goto error1;
+	}
+
+	/* the first run warms up caches and the driver, and counts like the others */
+	for (i = 0; i < BENCH_RUNS; ++i) {
+		ret = clut_enqueueNDRangeKernel(command_queue, kernel, 2, NULL, global, NULL, 0, NULL, &event);
+		if (!clut_returnSuccess(ret)) {
+			best = 0;
+			break;
+		}
+		ret = clWaitForEvents(1, &event);
+		duration = clut_returnSuccess(ret) ? clut_getEventDuration_ns(event) : 0;
+		clReleaseEvent(event);
+		if ((0 != duration) && ((0 == best) || (duration < best))) {
+			best = duration;
+		}
+	}
+
+error1:	clut_releaseCachedKernel(kernel);
+	return best;
+}
+
+/*!
+ * @function clut_storageBenchmark
+ * Times the [access] kernel with both storages on [device].
+ * @return
+ * The faster storage, buffers on ties; the one that ran if the other
+ * failed; 0 if neither could be timed.
+ */
+static cl_mem_object_type clut_storageBenchmark(cl_context context, cl_device_id device, clut_access_class access)
+{
+	const char * const fname = "clut_storageBenchmark";
+	cl_image_format image_format = {CL_RGBA, CL_UNSIGNED_INT8};
+	cl_image_desc image_desc = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+	clut_image_desc buffer_desc;
+	cl_mem_object_type storage = 0;
+	cl_command_queue queue;
+	cl_mem image, buffer, dst;
+	cl_ulong image_time, buffer_time;
+	cl_int ret;
+
+	queue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create benchmark queue", error1);
+
+	image_desc.image_type = CL_MEM_OBJECT_IMAGE2D;
+	image_desc.image_width = BENCH_SIZE;
+	image_desc.image_height = BENCH_SIZE;
+	image = clut_createTrackedImage(context, CL_MEM_READ_ONLY, &image_format, &image_desc, NULL, "storage", NULL, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create benchmark image", error2);
+	memset(&buffer_desc, 0, sizeof(buffer_desc));
+	buffer_desc.width = BENCH_SIZE;
+	buffer_desc.height = BENCH_SIZE;
+	buffer_desc.components = 4;
+	buffer_desc.channel_order = CL_RGBA;
+	buffer_desc.channel_type = CL_UNSIGNED_INT8;
+	buffer = clut_createImageBuffer(context, CL_MEM_READ_ONLY, &buffer_desc, clut_getDeviceAlignment(device));
+	if (NULL == buffer) {
+		goto error3;
+	}
+	dst = clut_createTrackedBuffer(context, CL_MEM_WRITE_ONLY, (size_t) BENCH_SIZE * BENCH_SIZE * sizeof(cl_uint),
+				       NULL, "storage", NULL, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create benchmark buffer", error4);
+
+	image_time = clut_storageTime(queue, image, 0, dst, access, 1);
+	buffer_time = clut_storageTime(queue, buffer, (cl_int) (buffer_desc.row_pitch / 4), dst, access, 0);
+	if ((0 != buffer_time) && ((0 == image_time) || (buffer_time <= image_time))) {
+		storage = CL_MEM_OBJECT_BUFFER;
+	} else if (0 != image_time) {
+		storage = CL_MEM_OBJECT_IMAGE2D;
+	}
+	Debug_out(DEBUG_STORAGE, "%s: %s access, image %llu ns, buffer %llu ns.\n", fname, access_names[access],
+		  (unsigned long long) image_time, (unsigned long long) buffer_time);
+
+	clReleaseMemObject(dst);
+error4:	clReleaseMemObject(buffer);
+error3:	clReleaseMemObject(image);
+error2:	clReleaseCommandQueue(queue);
+error1:	return storage;
+}
+
+/*!
+ * @function clut_getStoragePolicy
+ * Returns the storage, CL_MEM_OBJECT_IMAGE2D or CL_MEM_OBJECT_BUFFER, that
+ * [device] reads faster with [access] kernels, benchmarking it in [context]
+ * the first time.
+ * @return
+ * The storage, or 0 if it is unknown because the benchmark failed: nothing
+ * is stored then, so the next call benchmarks again.
+ */
+cl_mem_object_type clut_getStoragePolicy(cl_context context, cl_device_id device, clut_access_class access)
+{
+	const char * const fname = "clut_getStoragePolicy";
+	cl_bool image_support = CL_FALSE;
+	cl_mem_object_type storage;
+	char key[CLUT_CACHE_MAX_KEY], value[CLUT_CACHE_MAX_VALUE];
+
+	clGetDeviceInfo(device, CL_DEVICE_IMAGE_SUPPORT, sizeof(image_support), &image_support, NULL);
+	if (CL_FALSE == image_support) {
+		return CL_MEM_OBJECT_BUFFER;
+	}
+	if (0 != clut_storageKey(device, access, key)) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&storage_lock);
+	if (clut_cacheLookup(&storage_cache, key, value, sizeof(value)) &&
+	    ((0 == strcmp(value, "image")) || (0 == strcmp(value, "buffer")))) {
+		storage = (0 == strcmp(value, "image")) ? CL_MEM_OBJECT_IMAGE2D : CL_MEM_OBJECT_BUFFER;
+	} else {
+		storage = clut_storageBenchmark(context, device, access);
+		if (0 == storage) {
+			Debug_out(DEBUG_STORAGE, "%s: '%s' couldn't be benchmarked for %s access.\n", fname, key,
+				  access_names[access]);
+		} else {
+			clut_cacheStore(&storage_cache, key, (CL_MEM_OBJECT_IMAGE2D == storage) ? "image" : "buffer");
+			Debug_out(DEBUG_STORAGE, "%s: '%s' uses %s for %s access.\n", fname, key,
+				  (CL_MEM_OBJECT_IMAGE2D == storage) ? "images" : "buffers", access_names[access]);
+		}
+	}
+	pthread_mutex_unlock(&storage_lock);
+	return storage;
+}
+
+/*!
+ * @function clut_setStoragePolicy
+ * Makes [device] use [storage] for [access] kernels, without benchmarking.
+ * The decision is stored like a measured one.
+ */
+void clut_setStoragePolicy(cl_device_id device, clut_access_class access, cl_mem_object_type storage)
+{
+	char key[CLUT_CACHE_MAX_KEY];
+
+	if ((0 != clut_storageKey(device, access, key)) ||
+	    ((CL_MEM_OBJECT_IMAGE2D != storage) && (CL_MEM_OBJECT_BUFFER != storage))) {
+		return;
+	}
+	clut_cacheStore(&storage_cache, key, (CL_MEM_OBJECT_IMAGE2D == storage) ? "image" : "buffer");
+}
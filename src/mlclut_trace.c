@@ -0,0 +1,562 @@
+/**
+ * @file
+ * @author Michele Laurenti
+ * @language c
+ *
+ * Event timeline recorder, with Chrome trace export.
+ *
+ * Registered events are retained until they complete; clut_traceCollect
+ * turns completed events into plain timestamps and releases them, so long
+ * running programs should call it every now and then.
+ */
+
+#include "mlclut_trace.h"
+#include "mlclut_descriptions.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <Debug.h>
+#include <StringUtils.h>
+
+#define DEBUG_TRACE	"mlclut_debug_trace"
+
+#define INITIAL_CAPACITY	256
+#define MAX_CLOCKS		16
+
+struct clut_trace_record {
+	char *label;
+	cl_event event;
+	cl_command_type command_type;
+	cl_command_queue queue;
+	cl_device_id device;
+	cl_ulong queued;
+	cl_ulong submit;
+	cl_ulong start;
+	cl_ulong end;
+	int host;
+	unsigned int track;
+};
+
+struct clut_trace {
+	struct clut_trace_record *records;
+	size_t n_records;
+	size_t capacity;
+	clut_clock *clocks[MAX_CLOCKS];
+	size_t n_clocks;
+	pthread_mutex_t lock;
+};
+
+/**
+ * Function declaration
+ */
+
+static int clut_traceAppend(clut_trace *trace, const struct clut_trace_record *record);
+static int clut_traceResolve(struct clut_trace_record *record);
+static cl_ulong clut_traceToHost(clut_clock *clock, cl_ulong device_ns);
+static void clut_tracePrintString(FILE *f, const char *s);
+static size_t clut_traceIndexOf(const void **values, size_t *n_values, const void *value);
+
+/**
+ * Function definition
+ */
+
+/*!
+ * @function clut_createTrace
+ * Creates an empty trace.
+ * @warning Result should be released with clut_releaseTrace.
+ */
+clut_trace * clut_createTrace(void)
+{
+	const char * const fname = "clut_createTrace";
+	clut_trace *trace;
+
+	trace = calloc(1, sizeof(clut_trace));
+	if (NULL == trace) {
+		Debug_out(DEBUG_TRACE, "%s: calloc failed.\n", fname);
+		goto error1;
+	}
+	trace->records = calloc(INITIAL_CAPACITY, sizeof(struct clut_trace_record));
+	if (NULL == trace->records) {
+		Debug_out(DEBUG_TRACE, "%s: calloc failed.\n", fname);
+		goto error2;
+	}
+	trace->capacity = INITIAL_CAPACITY;
+	pthread_mutex_init(&trace->lock, NULL);
+
+	return trace;
+
+error2:	free(trace);
+error1:	return NULL;
+}
+
+/*!
+ * @function clut_releaseTrace
+ * Releases [trace], and all the events it still retains.
+ */
+void clut_releaseTrace(clut_trace *trace)
+{
+	size_t i;
+
+	if (NULL == trace) {
+		return;
+	}
+	for (i = 0; i < trace->n_records; ++i) {
+		if (NULL != trace->records[i].event) {
+			clReleaseEvent(trace->records[i].event);
+		}
+		free(trace->records[i].label);
+	}
+	pthread_mutex_destroy(&trace->lock);
+	free(trace->records);
+	free(trace);
+}
+
+/*!
+ * @function clut_traceAppend
+ * Appends a copy of [record] to [trace], growing it if needed.
+ * @return
+ * 0 on success, a negative value on failure.
+ */
+static int clut_traceAppend(clut_trace *trace, const struct clut_trace_record *record)
+{
+	const char * const fname = "clut_traceAppend";
+	struct clut_trace_record *records;
+
+	pthread_mutex_lock(&trace->lock);
+	if (trace->n_records == trace->capacity) {
+		records = realloc(trace->records, 2 * trace->capacity * sizeof(struct clut_trace_record));
+		if (NULL == records) {
+			pthread_mutex_unlock(&trace->lock);
+			Debug_out(DEBUG_TRACE, "%s: realloc failed.\n", fname);
+			return -1;
+		}
+		trace->records = records;
+		trace->capacity *= 2;
+	}
+	trace->records[trace->n_records++] = *record;
+	pthread_mutex_unlock(&trace->lock);
+
+	return 0;
+}
+
+/*!
+ * @function clut_traceEvent
+ * Registers [event] with [trace]. The event is retained until it's collected.
+ * @param label
+ * A name for the command. If NULL, the command type is used.
+ * @return
+ * 0 on success, a negative value on failure.
+ */
+int clut_traceEvent(clut_trace *trace, cl_event event, const char * const label)
+{
+	const char * const fname = "clut_traceEvent";
+	struct clut_trace_record record;
+	cl_int ret;
+
+	if ((NULL == trace) || (NULL == event)) {
+		Debug_out(DEBUG_TRACE, "%s: NULL pointer argument.\n", fname);
+		goto error1;
+	}
+
+	memset(&record, 0, sizeof(record));
+	ret = clGetEventInfo(event, CL_EVENT_COMMAND_TYPE, sizeof(record.command_type), &record.command_type, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to get event command type", error1);
+	ret = clGetEventInfo(event, CL_EVENT_COMMAND_QUEUE, sizeof(record.queue), &record.queue, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to get event command queue", error1);
+	if (NULL != record.queue) {
+		record.device = clut_getQueueDevice(record.queue);
+	}
+
+	record.label = StringUtils_clone((NULL != label) ? label : clut_get_CL_COMMAND_TYPE_Description(record.command_type));
+	if (NULL == record.label) {
+		Debug_out(DEBUG_TRACE, "%s: unable to clone label.\n", fname);
+		goto error1;
+	}
+	ret = clRetainEvent(event);
+	CLUT_CHECK_ERROR(ret, "Unable to retain event", error2);
+	record.event = event;
+
+	if (0 != clut_traceAppend(trace, &record)) {
+		goto error3;
+	}
+
+	return 0;
+
+error3:	clReleaseEvent(event);
+error2:	free(record.label);
+error1:	return -1;
+}
+
+/*!
+ * @function clut_traceAddHostSpan
+ * Adds a span of host work, from [start_ns] to [end_ns] (CLOCK_MONOTONIC, as
+ * returned by clut_getHostTime_ns), to [trace], on the host track [track].
+ * Spans on the same track should not overlap.
+ * @return
+ * 0 on success, a negative value on failure.
+ */
+int clut_traceAddHostSpan(clut_trace *trace, const char * const label, unsigned int track, cl_ulong start_ns, cl_ulong end_ns)
+{
+	const char * const fname = "clut_traceAddHostSpan";
+	struct clut_trace_record record;
+
+	if ((NULL == trace) || (NULL == label)) {
+		Debug_out(DEBUG_TRACE, "%s: NULL pointer argument.\n", fname);
+		return -1;
+	}
+
+	memset(&record, 0, sizeof(record));
+	record.label = StringUtils_clone(label);
+	if (NULL == record.label) {
+		Debug_out(DEBUG_TRACE, "%s: unable to clone label.\n", fname);
+		return -1;
+	}
+	record.host = 1;
+	record.track = track;
+	record.queued = record.submit = record.start = start_ns;
+	record.end = (end_ns > start_ns) ? end_ns : start_ns;
+
+	if (0 != clut_traceAppend(trace, &record)) {
+		free(record.label);
+		return -1;
+	}
+	return 0;
+}
+
+/*!
+ * @function clut_traceAddClock
+ * Makes [trace] place the commands of the device of [clock] on the host
+ * timeline, through [clock], when exported. [clock] must outlive [trace].
+ * @return
+ * 0 on success, a negative value on failure.
+ */
+int clut_traceAddClock(clut_trace *trace, clut_clock *clock)
+{
+	const char * const fname = "clut_traceAddClock";
+	int result = -1;
+
+	if ((NULL == trace) || (NULL == clock)) {
+		Debug_out(DEBUG_TRACE, "%s: NULL pointer argument.\n", fname);
+		return -1;
+	}
+
+	pthread_mutex_lock(&trace->lock);
+	if (trace->n_clocks < MAX_CLOCKS) {
+		trace->clocks[trace->n_clocks++] = clock;
+		result = 0;
+	}
+	pthread_mutex_unlock(&trace->lock);
+
+	if (0 != result) {
+		Debug_out(DEBUG_TRACE, "%s: too many clocks.\n", fname);
+	}
+	return result;
+}
+
+/*!
+ * @function clut_traceResolve
+ * Reads the profiling timestamps of a completed record, and releases its
+ * event. User events and events that completed with an error have no
+ * profiling info, and are dropped.
+ * @return
+ * 1 if the record was resolved, 0 if it's still pending, -1 if it must be dropped.
+ */
+static int clut_traceResolve(struct clut_trace_record *record)
+{
+	cl_int status, ret;
+
+	ret = clGetEventInfo(record->event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL);
+	if (!clut_returnSuccess(ret) || (0 > status)) {
+		goto drop;
+	}
+	if (CL_COMPLETE != status) {
+		return 0;
+	}
+
+	if (!clut_returnSuccess(clGetEventProfilingInfo(record->event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &record->queued, NULL)) ||
+	    !clut_returnSuccess(clGetEventProfilingInfo(record->event, CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &record->submit, NULL)) ||
+	    !clut_returnSuccess(clGetEventProfilingInfo(record->event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &record->start, NULL)) ||
+	    !clut_returnSuccess(clGetEventProfilingInfo(record->event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &record->end, NULL))) {
+		goto drop;
+	}
+
+	clReleaseEvent(record->event);
+	record->event = NULL;
+	return 1;
+
+drop:	clReleaseEvent(record->event);
+	record->event = NULL;
+	return -1;
+}
+
+/*!
+ * @function clut_traceCollect
+ * Resolves the timestamps of all completed events in [trace], and releases
+ * them. If [wait] is not 0, waits first for the events pending when called.
+ * The lock is not held while waiting, so other threads (and event
+ * callbacks) can keep recording into [trace].
+ */
+void clut_traceCollect(clut_trace *trace, int wait)
+{
+	const char * const fname = "clut_traceCollect";
+	cl_event *pending = NULL;
+	size_t i, kept, n_pending = 0;
+
+	if (NULL == trace) {
+		return;
+	}
+
+	if (wait) {
+		/* take a reference to each pending event, and wait unlocked */
+		pthread_mutex_lock(&trace->lock);
+		pending = malloc((trace->n_records + 1) * sizeof(cl_event));
+		for (i = 0; (NULL != pending) && (i < trace->n_records); ++i) {
+			if ((NULL != trace->records[i].event) &&
+			    clut_returnSuccess(clRetainEvent(trace->records[i].event))) {
+				pending[n_pending++] = trace->records[i].event;
+			}
+		}
+		pthread_mutex_unlock(&trace->lock);
+		if (NULL == pending) {
+			Debug_out(DEBUG_TRACE, "%s: malloc failed, not waiting.\n", fname);
+		}
+
+		/* one at a time: events can belong to different contexts */
+		for (i = 0; i < n_pending; ++i) {
+			clWaitForEvents(1, &pending[i]);
+			clReleaseEvent(pending[i]);
+		}
+		free(pending);
+	}
+
+	pthread_mutex_lock(&trace->lock);
+	for (i = 0, kept = 0; i < trace->n_records; ++i) {
+		struct clut_trace_record *record = &trace->records[i];
+		if ((NULL != record->event) && (0 > clut_traceResolve(record))) {
+			free(record->label);
+			continue;
+		}
+		trace->records[kept++] = *record;
+	}
+	trace->n_records = kept;
+	pthread_mutex_unlock(&trace->lock);
+}
+
+/*!
+ * @function clut_tracePrintString
+ * Prints [s] as a JSON string.
+ */
+static void clut_tracePrintString(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; '\0' != *s; ++s) {
+		if (('"' == *s) || ('\\' == *s)) {
+			fprintf(f, "\\%c", *s);
+		} else if ((unsigned char) *s < 0x20) {
+			fprintf(f, "\\u%04x", (unsigned char) *s);
+		} else {
+			fputc(*s, f);
+		}
+	}
+	fputc('"', f);
+}
+
+/*!
+ * @function clut_traceIndexOf
+ * Returns the index of [value] in [values], appending it if missing.
+ * [values] must have room for one more value.
+ */
+static size_t clut_traceIndexOf(const void **values, size_t *n_values, const void *value)
+{
+	size_t i;
+
+	for (i = 0; i < *n_values; ++i) {
+		if (values[i] == value) {
+			return i;
+		}
+	}
+	values[(*n_values)++] = value;
+	return i;
+}
+
+/*!
+ * @function clut_traceToHost
+ * Converts [device_ns] to host time through [clock], if not NULL.
+ */
+static cl_ulong clut_traceToHost(clut_clock *clock, cl_ulong device_ns)
+{
+	return (NULL != clock) ? clut_clockDeviceToHost(clock, device_ns) : device_ns;
+}
+
+/*!
+ * @function clut_traceExportChrome
+ * Waits for all events in [trace], then writes them to [filename] in the
+ * Chrome trace event format (chrome://tracing, ui.perfetto.dev).
+ * Host spans are in process 0, one thread per track; each device is a
+ * process and each command queue a thread. Each command is a complete event
+ * spanning START to END, with QUEUED and SUBMIT, and the time the command
+ * waited in the queue, as arguments.
+ * Commands of devices with a clock are placed on the host timeline; the
+ * others keep device timestamps, and don't line up with host spans.
+ * Timestamps are in microseconds from the earliest one.
+ * @return
+ * 0 on success, a negative value on failure.
+ */
+int clut_traceExportChrome(clut_trace *trace, const char * const filename)
+{
+	const char * const fname = "clut_traceExportChrome";
+	const void **queues = NULL, **devices = NULL;
+	size_t n_queues = 0, n_devices = 0, i, j;
+	clut_clock **clocks = NULL;
+	cl_ulong base = 0, queued, submit, start, end;
+	FILE *f;
+	int result = -1;
+
+	if ((NULL == trace) || (NULL == filename)) {
+		Debug_out(DEBUG_TRACE, "%s: NULL pointer argument.\n", fname);
+		goto error1;
+	}
+
+	clut_traceCollect(trace, 1);
+
+	f = fopen(filename, "w");
+	if (NULL == f) {
+		Debug_out(DEBUG_TRACE, "%s: unable to open '%s'.\n", fname, filename);
+		goto error1;
+	}
+
+	pthread_mutex_lock(&trace->lock);
+	queues = calloc(trace->n_records + 1, sizeof(void *));
+	devices = calloc(trace->n_records + 1, sizeof(void *));
+	clocks = calloc(trace->n_records + 1, sizeof(clut_clock *));
+	if ((NULL == queues) || (NULL == devices) || (NULL == clocks)) {
+		Debug_out(DEBUG_TRACE, "%s: calloc failed.\n", fname);
+		goto error2;
+	}
+
+	/* pick the clock of each record, and the earliest timestamp */
+	for (i = 0; i < trace->n_records; ++i) {
+		const struct clut_trace_record *r = &trace->records[i];
+		if (!r->host) {
+			for (j = 0; j < trace->n_clocks; ++j) {
+				if (clut_clockGetDevice(trace->clocks[j]) == r->device) {
+					clocks[i] = trace->clocks[j];
+					break;
+				}
+			}
+		}
+		queued = clut_traceToHost(clocks[i], r->queued);
+		if ((0 == i) || (queued < base)) {
+			base = queued;
+		}
+	}
+
+	fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	for (i = 0; i < trace->n_records; ++i) {
+		const struct clut_trace_record *r = &trace->records[i];
+
+		queued = clut_traceToHost(clocks[i], r->queued);
+		submit = clut_traceToHost(clocks[i], r->submit);
+		start = clut_traceToHost(clocks[i], r->start);
+		end = clut_traceToHost(clocks[i], r->end);
+
+		fprintf(f, "{\"name\":");
+		clut_tracePrintString(f, r->label);
+		if (r->host) {
+			fprintf(f, ",\"cat\":\"host\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,"
+				"\"ts\":%.3f,\"dur\":%.3f},\n",
+				r->track,
+				(start - base) * 1e-3,
+				(end - start) * 1e-3);
+			continue;
+		}
+		fprintf(f, ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%zu,\"tid\":%zu,"
+			"\"ts\":%.3f,\"dur\":%.3f,"
+			"\"args\":{\"queued_us\":%.3f,\"submit_us\":%.3f,\"queue_wait_us\":%.3f}},\n",
+			clut_get_CL_COMMAND_TYPE_Description(r->command_type),
+			1 + clut_traceIndexOf(devices, &n_devices, r->device),
+			clut_traceIndexOf(queues, &n_queues, r->queue),
+			(start - base) * 1e-3,
+			(end - start) * 1e-3,
+			(queued - base) * 1e-3,
+			(submit - base) * 1e-3,
+			(r->start - r->queued) * 1e-3);
+	}
+
+	/* name processes after devices, and threads after queues */
+	for (i = 0; i < n_devices; ++i) {
+		char *name = (NULL != devices[i]) ? clut_getDeviceInfo((cl_device_id) devices[i], CL_DEVICE_NAME, NULL) : NULL;
+		fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%zu,\"args\":{\"name\":", 1 + i);
+		clut_tracePrintString(f, (NULL != name) ? name : "unknown device");
+		fprintf(f, "}},\n");
+		free(name);
+	}
+	for (i = 0; i < n_queues; ++i) {
+		size_t pid = 0;
+		for (j = 0; j < trace->n_records; ++j) {
+			if (!trace->records[j].host && (trace->records[j].queue == queues[i])) {
+				pid = 1 + clut_traceIndexOf(devices, &n_devices, trace->records[j].device);
+				break;
+			}
+		}
+		fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%zu,\"tid\":%zu,\"args\":{\"name\":\"queue %zu\"}},\n",
+			pid, i, i);
+	}
+	fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"host\",\"records\":%zu}}\n]}\n", trace->n_records);
+
+	Debug_out(DEBUG_TRACE, "%s: exported %zu records, %zu queues, to '%s'.\n", fname, trace->n_records, n_queues, filename);
+	result = 0;
+
+error2:
+	pthread_mutex_unlock(&trace->lock);
+	free(queues);
+	free(devices);
+	free(clocks);
+	if (0 != fclose(f)) {
+		result = -1;
+	}
+error1:
+	return result;
+}
+
+/*!
+ * @function clut_traceEnqueueNDRangeKernel
+ * Same as clEnqueueNDRangeKernel, but registers the launch with [trace],
+ * labelled with the kernel function name. [event] can be NULL.
+ */
+cl_int clut_traceEnqueueNDRangeKernel(clut_trace *trace,
+				      cl_command_queue command_queue,
+				      cl_kernel kernel,
+				      cl_uint work_dim,
+				      const size_t *global_work_offset,
+				      const size_t *global_work_size,
+				      const size_t *local_work_size,
+				      cl_uint n_wait,
+				      const cl_event *wait_list,
+				      cl_event *event)
+{
+	cl_event l_event;
+	cl_int ret;
+	char *name;
+
+	ret = clEnqueueNDRangeKernel(command_queue, kernel, work_dim,
+				     global_work_offset, global_work_size, local_work_size,
+				     n_wait, wait_list, &l_event);
+	if (!clut_returnSuccess(ret)) {
+		return ret;
+	}
+
+	name = clut_getKernelName(kernel);
+	clut_traceEvent(trace, l_event, name);
+	free(name);
+
+	if (NULL != event) {
+		*event = l_event;
+	} else {
+		clReleaseEvent(l_event);
+	}
+	return ret;
+}
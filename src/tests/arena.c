@@ -0,0 +1,152 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <Debug.h>
+
+#include "mlclut.h"
+#include "mlclut_descriptions.h"
+#include "mlclut_arena.h"
+
+#define DEBUG_MAIN	"main"
+
+#define ARENA_SIZE	(1 << 20)
+/* enough to grow the lookup table several times */
+#define MANY		300
+
+#define CHECK(condition, what) \
+	do { \
+		if (!(condition)) { \
+			printf("%s: FAILED.\n", (what)); \
+			++failed; \
+		} else { \
+			printf("%s: ok.\n", (what)); \
+		} \
+	} while (0)
+
+/* fills [mem] with [value], and checks it reads back */
+static int fill_and_check(cl_command_queue queue, cl_mem mem, size_t size, unsigned char value)
+{
+	unsigned char *data = malloc(size);
+	size_t i;
+	int same = 0;
+
+	if (NULL == data) {
+		return 0;
+	}
+	memset(data, value, size);
+	if (clut_returnSuccess(clEnqueueWriteBuffer(queue, mem, CL_TRUE, 0, size, data, 0, NULL, NULL))) {
+		memset(data, 0, size);
+		if (clut_returnSuccess(clEnqueueReadBuffer(queue, mem, CL_TRUE, 0, size, data, 0, NULL, NULL))) {
+			for (i = 0, same = 1; (i < size) && same; ++i) {
+				same = (value == data[i]);
+			}
+		}
+	}
+	free(data);
+	return same;
+}
+
+int main(void)
+{
+	cl_uint n_platforms, n_devices;
+	clut_arena_stats stats;
+	clut_arena *arena;
+	size_t carved;
+	cl_mem a, b, c, foreign, many[MANY];
+	cl_int ret;
+	int failed = 0, ok;
+	size_t i;
+
+	cl_platform_id *platforms = clut_getAllPlatforms(&n_platforms);
+	if (NULL == platforms) {
+		Debug_out(DEBUG_MAIN, "No platforms available.\n");
+		return EXIT_FAILURE;
+	}
+
+	cl_device_id *devices = clut_getAllDevices(platforms[0], CL_DEVICE_TYPE_ALL, &n_devices);
+	if (NULL == devices) {
+		Debug_out(DEBUG_MAIN, "Platform #1 has no devices.\n");
+		return EXIT_FAILURE;
+	}
+
+	cl_context context = clCreateContext(NULL, 1, devices, clut_contextCallback, "arena", &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create context", error);
+	cl_command_queue queue = clCreateCommandQueue(context, devices[0], 0, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create command queue", error);
+
+	/* pool: freed allocations come back as they are */
+	arena = clut_createArena(context, CL_MEM_READ_WRITE, ARENA_SIZE, CLUT_ARENA_POOL, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create arena", error);
+
+	a = clut_arenaAlloc(arena, 1000, &ret);
+	b = clut_arenaAlloc(arena, 1000, &ret);
+	CHECK((NULL != a) && (NULL != b) && (a != b), "pool alloc");
+	CHECK(fill_and_check(queue, a, 1000, 0xaa) && fill_and_check(queue, b, 1000, 0x55) &&
+	      fill_and_check(queue, a, 1000, 0xaa), "allocations don't overlap");
+
+	clut_getArenaStats(arena, &stats);
+	carved = stats.carved;
+	CHECK(CL_SUCCESS == clut_arenaFree(arena, a), "pool free");
+	CHECK(CL_INVALID_MEM_OBJECT == clut_arenaFree(arena, a), "double free is rejected");
+	c = clut_arenaAlloc(arena, 900, &ret);
+	CHECK(c == a, "same class reuses the freed allocation");
+	clut_getArenaStats(arena, &stats);
+	CHECK((3 == stats.allocations) && (carved == stats.carved), "reuse carves nothing");
+
+	foreign = clCreateBuffer(context, CL_MEM_READ_WRITE, 1000, NULL, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create buffer", error);
+	CHECK(CL_INVALID_MEM_OBJECT == clut_arenaFree(arena, foreign), "foreign buffer is rejected");
+	clReleaseMemObject(foreign);
+
+	CHECK((NULL == clut_arenaAlloc(arena, 2 * ARENA_SIZE, &ret)) && (CL_MEM_OBJECT_ALLOCATION_FAILURE == ret),
+	      "oversized alloc fails");
+
+	CHECK((CL_SUCCESS == clut_arenaFree(arena, b)) && (CL_SUCCESS == clut_arenaFree(arena, c)), "pool free all");
+	clut_getArenaStats(arena, &stats);
+	CHECK(0 == stats.used, "nothing used after freeing all");
+
+	/* frees out of allocation order, past the first table sizes */
+	for (i = 0, ok = 1; i < MANY; ++i) {
+		many[i] = clut_arenaAlloc(arena, 100, &ret);
+		ok = ok && (NULL != many[i]);
+	}
+	CHECK(ok, "many allocs");
+	for (i = 0; i < MANY; i += 2) {
+		ok = ok && (CL_SUCCESS == clut_arenaFree(arena, many[i]));
+	}
+	for (i = 0; i < MANY; i += 2) {
+		ok = ok && (CL_INVALID_MEM_OBJECT == clut_arenaFree(arena, many[i]));
+	}
+	for (i = 1; i < MANY; i += 2) {
+		ok = ok && (CL_SUCCESS == clut_arenaFree(arena, many[MANY - i]));
+	}
+	clut_getArenaStats(arena, &stats);
+	CHECK(ok && (0 == stats.used), "many frees in any order");
+	clut_releaseArena(arena);
+
+	/* bump: carved one after the other, and freed all at once */
+	arena = clut_createArena(context, CL_MEM_READ_WRITE, ARENA_SIZE, CLUT_ARENA_BUMP, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create arena", error);
+
+	a = clut_arenaAlloc(arena, 1000, &ret);
+	b = clut_arenaAlloc(arena, 1000, &ret);
+	CHECK((NULL != a) && (NULL != b) && (a != b), "bump alloc");
+	CHECK(CL_INVALID_OPERATION == clut_arenaFree(arena, a), "bump free is rejected");
+	clut_arenaReset(arena);
+	clut_getArenaStats(arena, &stats);
+	CHECK((0 == stats.used) && (0 == stats.carved) && (0 < stats.high_water), "bump reset");
+	a = clut_arenaAlloc(arena, ARENA_SIZE, &ret);
+	CHECK(NULL != a, "whole arena after reset");
+	clut_releaseArena(arena);
+
+	clReleaseCommandQueue(queue);
+	clReleaseContext(context);
+	free(devices);
+	free(platforms);
+
+	printf("%s.\n", (0 == failed) ? "All checks passed" : "Some checks FAILED");
+	return (0 == failed) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+error:
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <Debug.h>
+#include <ArrayUtils.h>
+
+#include "mlclut.h"
+#include "mlclut_descriptions.h"
+#include "mlclut_autotune.h"
+
+#define DEBUG_MAIN	"main"
+
+/* odd, so most candidates pad the global size */
+#define N		100003
+#define CACHE_FILE	"autotune_test.cache"
+
+/* checks its bounds, as tuned kernels must */
+static const char *scale_sources[] = {
+	"__kernel void scale(__global const uint *src, __global uint *dst, uint n)\n"
+	"{\n"
+	"	const uint i = get_global_id(0);\n"
+	"\n"
+	"	if (i < n) {\n"
+	"		dst[i] = 3 * src[i] + i;\n"
+	"	}\n"
+	"}\n"
+};
+
+/* runs [kernel] with its tuned local size, if any, and checks the result */
+static int run_and_check(const char *what, cl_command_queue queue, cl_kernel kernel,
+			 cl_mem dst, const cl_uint *src, cl_uint *result)
+{
+	const size_t global = N;
+	size_t i;
+
+	memset(result, 0, N * sizeof(cl_uint));
+	if (!clut_returnSuccess(clEnqueueWriteBuffer(queue, dst, CL_TRUE, 0, N * sizeof(cl_uint), result, 0, NULL, NULL)) ||
+	    !clut_returnSuccess(clut_enqueueTunedNDRangeKernel(queue, kernel, 1, NULL, &global, 0, NULL, NULL)) ||
+	    !clut_returnSuccess(clEnqueueReadBuffer(queue, dst, CL_TRUE, 0, N * sizeof(cl_uint), result, 0, NULL, NULL))) {
+		printf("%s: FAILED, unable to run.\n", what);
+		return 1;
+	}
+	for (i = 0; i < N; ++i) {
+		if (result[i] != 3 * src[i] + (cl_uint) i) {
+			printf("%s: FAILED at %zu, %u instead of %u.\n", what, i, result[i], 3 * src[i] + (cl_uint) i);
+			return 1;
+		}
+	}
+	printf("%s: ok.\n", what);
+	return 0;
+}
+
+int main(void)
+{
+	cl_uint n_platforms, n_devices, n = N;
+	size_t global = N, tuned[3] = {0, 0, 0}, reloaded[3] = {0, 0, 0}, i;
+	cl_int ret;
+	int failed = 0;
+
+	cl_platform_id *platforms = clut_getAllPlatforms(&n_platforms);
+	if (NULL == platforms) {
+		Debug_out(DEBUG_MAIN, "No platforms available.\n");
+		return EXIT_FAILURE;
+	}
+
+	cl_device_id *devices = clut_getAllDevices(platforms[0], CL_DEVICE_TYPE_ALL, &n_devices);
+	if (NULL == devices) {
+		Debug_out(DEBUG_MAIN, "Platform #1 has no devices.\n");
+		return EXIT_FAILURE;
+	}
+
+	cl_context context = clCreateContext(NULL, 1, devices, clut_contextCallback, "autotune", &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create context", error);
+	cl_command_queue queue = clCreateCommandQueue(context, devices[0], CL_QUEUE_PROFILING_ENABLE, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create command queue", error);
+	cl_program program = clut_getCachedProgram(context, ARRAY_LEN(scale_sources), scale_sources, NULL);
+	if (NULL == program) {
+		Debug_out(DEBUG_MAIN, "Unable to build program.\n");
+		return EXIT_FAILURE;
+	}
+	cl_kernel kernel = clCreateKernel(program, "scale", &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create kernel", error);
+
+	cl_uint *src = malloc(N * sizeof(cl_uint));
+	cl_uint *result = malloc(N * sizeof(cl_uint));
+	if ((NULL == src) || (NULL == result)) {
+		Debug_out(DEBUG_MAIN, "malloc failed.\n");
+		return EXIT_FAILURE;
+	}
+	srand(42);
+	for (i = 0; i < N; ++i) {
+		src[i] = (cl_uint) rand();
+	}
+	cl_mem src_mem = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, N * sizeof(cl_uint), src, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create buffer", error);
+	cl_mem dst_mem = clCreateBuffer(context, CL_MEM_READ_WRITE, N * sizeof(cl_uint), NULL, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create buffer", error);
+	clSetKernelArg(kernel, 0, sizeof(cl_mem), &src_mem);
+	clSetKernelArg(kernel, 1, sizeof(cl_mem), &dst_mem);
+	clSetKernelArg(kernel, 2, sizeof(cl_uint), &n);
+
+	/* start from an empty cache file */
+	remove(CACHE_FILE);
+	clut_setAutotuneCacheFile(CACHE_FILE);
+
+	if (clut_getTunedLocalSize(queue, kernel, 1, &global, tuned)) {
+		printf("lookup before tuning: FAILED, found a local size.\n");
+		++failed;
+	}
+	failed += run_and_check("untuned launch", queue, kernel, dst_mem, src, result);
+
+	ret = clut_autotuneKernel(queue, kernel, 1, &global, tuned);
+	CLUT_CHECK_ERROR(ret, "Unable to tune kernel", error);
+	printf("Tuned local size: %zu.\n", tuned[0]);
+	failed += run_and_check("tuned launch", queue, kernel, dst_mem, src, result);
+
+	/* drop what is in memory, and read the file back */
+	clut_releaseAutotuneCache();
+	clut_setAutotuneCacheFile(CACHE_FILE);
+	if (!clut_getTunedLocalSize(queue, kernel, 1, &global, reloaded) || (reloaded[0] != tuned[0])) {
+		printf("reloaded local size: FAILED, %zu instead of %zu.\n", reloaded[0], tuned[0]);
+		++failed;
+	} else {
+		printf("reloaded local size: ok.\n");
+	}
+	failed += run_and_check("reloaded launch", queue, kernel, dst_mem, src, result);
+
+	clut_releaseAutotuneCache();
+	remove(CACHE_FILE);
+
+	clReleaseMemObject(src_mem);
+	clReleaseMemObject(dst_mem);
+	clReleaseKernel(kernel);
+	free(src);
+	free(result);
+	clReleaseCommandQueue(queue);
+	clut_releaseCachedPrograms(context);
+	clReleaseContext(context);
+	free(devices);
+	free(platforms);
+
+	printf("%s.\n", (0 == failed) ? "All checks passed" : "Some checks FAILED");
+	return (0 == failed) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+error:
+	return EXIT_FAILURE;
+}
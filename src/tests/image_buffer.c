@@ -0,0 +1,75 @@
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <Debug.h>
+
+#include "mlclut.h"
+#include "mlclut_descriptions.h"
+#include "mlclut_images.h"
+
+#include "test_utils.h"
+
+#define DEBUG_MAIN	"main"
+
+int main(int argc, char **argv)
+{
+	cl_uint n_platforms, n_devices;
+	cl_int ret;
+
+	if (3 != argc) {
+		fprintf(stderr, "Usage: %s <input image> <output png>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	cl_platform_id *platforms = clut_getAllPlatforms(&n_platforms);
+	if (NULL == platforms) {
+		Debug_out(DEBUG_MAIN, "No platforms available.\n");
+		return EXIT_FAILURE;
+	}
+
+	cl_device_id *devices = clut_getAllDevices(platforms[0], CL_DEVICE_TYPE_ALL, &n_devices);
+	if (NULL == devices) {
+		Debug_out(DEBUG_MAIN, "Platform #1 has no devices.\n");
+		return EXIT_FAILURE;
+	}
+
+	cl_context context = clCreateContext(NULL, 1, devices, clut_contextCallback, "image_buffer", &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create context", error);
+	cl_command_queue queue = clCreateCommandQueue(context, devices[0], 0, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create command queue", error);
+
+	/* always use the buffer fallback, even on devices with image support */
+	clut_image_desc desc;
+	cl_mem buffer = clut_loadImageToBuffer(context, devices[0], argv[1], &desc);
+	if (NULL == buffer) {
+		Debug_out(DEBUG_MAIN, "Unable to load '%s'.\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	printf("Loaded %zu x %zu image with %d components, row pitch is %zu bytes.\n",
+	       desc.width, desc.height, desc.components, desc.row_pitch);
+
+	if (0 > clut_saveImage(argv[2], queue, buffer, &desc)) {
+		Debug_out(DEBUG_MAIN, "Unable to save '%s'.\n", argv[2]);
+		return EXIT_FAILURE;
+	}
+	/* the round trip through the buffer must be lossless */
+	if (!same_pixels(argv[1], argv[2])) {
+		printf("FAILED: '%s' differs from '%s'.\n", argv[2], argv[1]);
+		return EXIT_FAILURE;
+	}
+	printf("'%s' matches '%s'.\n", argv[2], argv[1]);
+
+	clReleaseMemObject(buffer);
+	clReleaseCommandQueue(queue);
+	clReleaseContext(context);
+	free(devices);
+	free(platforms);
+
+	return 0;
+
+error:
+	return EXIT_FAILURE;
+}
+
@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <Debug.h>
+
+#include "mlclut.h"
+#include "mlclut_descriptions.h"
+#include "mlclut_layout.h"
+
+#define DEBUG_MAIN	"main"
+
+#define MAX_OPTIONS	256
+
+/* writes CLUT_LAYOUT_INDEX of every pixel and channel, channel-major */
+static const char *index_source =
+	"__kernel void layout_index(__global uint *dst, int width, int height, int components)\n"
+	"{\n"
+	"	const int x = get_global_id(0), y = get_global_id(1);\n"
+	"	int c;\n"
+	"\n"
+	"	if ((x >= width) || (y >= height)) {\n"
+	"		return;\n"
+	"	}\n"
+	"	for (c = 0; c < components; ++c) {\n"
+	"		dst[((size_t) c * height + y) * width + x] = (uint) CLUT_LAYOUT_INDEX(x, y, c);\n"
+	"	}\n"
+	"}\n";
+
+static const char *layout_names[] = {"planar", "tiled", "z-order"};
+
+/*
+ * compares the indices computed on the device to clut_getLayoutIndex, and
+ * checks no two pixels share an element
+ */
+static int check_layout(cl_context context, cl_command_queue queue, cl_device_id device,
+			clut_layout layout, size_t width, size_t height, int components)
+{
+	const char *sources[2];
+	char options[MAX_OPTIONS];
+	clut_layout_desc desc;
+	cl_program program;
+	cl_kernel kernel = NULL;
+	cl_mem dst = NULL;
+	cl_uint *indices = NULL;
+	unsigned char *seen = NULL;
+	size_t x, y, n_elements, global[2];
+	cl_int ret, w = (cl_int) width, h = (cl_int) height;
+	int c, failed = 1;
+
+	if ((0 != clut_getLayoutDesc(device, layout, width, height, components, &desc)) ||
+	    (0 != clut_getLayoutOptions(&desc, options, sizeof(options)))) {
+		printf("%s %zu x %zu: FAILED, no layout.\n", layout_names[layout], width, height);
+		return 1;
+	}
+	n_elements = clut_getLayoutSize(&desc) / sizeof(cl_float);
+
+	sources[0] = clut_getLayoutSource();
+	sources[1] = index_source;
+	program = clut_getCachedProgram(context, 2, sources, options);
+	if (NULL == program) {
+		printf("%s: FAILED, unable to build.\n", layout_names[layout]);
+		return 1;
+	}
+	kernel = clCreateKernel(program, "layout_index", &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create kernel", done);
+	dst = clCreateBuffer(context, CL_MEM_WRITE_ONLY, width * height * components * sizeof(cl_uint), NULL, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create buffer", done);
+
+	clSetKernelArg(kernel, 0, sizeof(cl_mem), &dst);
+	clSetKernelArg(kernel, 1, sizeof(cl_int), &w);
+	clSetKernelArg(kernel, 2, sizeof(cl_int), &h);
+	clSetKernelArg(kernel, 3, sizeof(cl_int), &components);
+	global[0] = width;
+	global[1] = height;
+	ret = clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global, NULL, 0, NULL, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to enqueue kernel", done);
+
+	indices = malloc(width * height * components * sizeof(cl_uint));
+	seen = calloc(n_elements, 1);
+	if ((NULL == indices) || (NULL == seen)) {
+		goto done;
+	}
+	ret = clEnqueueReadBuffer(queue, dst, CL_TRUE, 0, width * height * components * sizeof(cl_uint), indices, 0, NULL, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to read buffer", done);
+
+	for (c = 0; c < components; ++c) {
+		for (y = 0; y < height; ++y) {
+			for (x = 0; x < width; ++x) {
+				const size_t host = clut_getLayoutIndex(&desc, x, y, c);
+				const cl_uint device = indices[((size_t) c * height + y) * width + x];
+				if ((host != device) || (host >= n_elements) || seen[host]) {
+					printf("%s %zu x %zu: FAILED at (%zu, %zu, %d), host %zu, device %u.\n",
+					       layout_names[layout], width, height, x, y, c, host, device);
+					goto done;
+				}
+				seen[host] = 1;
+			}
+		}
+	}
+	printf("%s %zu x %zu x %d: ok.\n", layout_names[layout], width, height, components);
+	failed = 0;
+
+done:
+	free(indices);
+	free(seen);
+	if (NULL != dst) {
+		clReleaseMemObject(dst);
+	}
+	if (NULL != kernel) {
+		clReleaseKernel(kernel);
+	}
+	return failed;
+}
+
+int main(void)
+{
+	cl_uint n_platforms, n_devices;
+	cl_int ret;
+	int layout, failed = 0;
+
+	cl_platform_id *platforms = clut_getAllPlatforms(&n_platforms);
+	if (NULL == platforms) {
+		Debug_out(DEBUG_MAIN, "No platforms available.\n");
+		return EXIT_FAILURE;
+	}
+
+	cl_device_id *devices = clut_getAllDevices(platforms[0], CL_DEVICE_TYPE_ALL, &n_devices);
+	if (NULL == devices) {
+		Debug_out(DEBUG_MAIN, "Platform #1 has no devices.\n");
+		return EXIT_FAILURE;
+	}
+
+	cl_context context = clCreateContext(NULL, 1, devices, clut_contextCallback, "layout", &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create context", error);
+	cl_command_queue queue = clCreateCommandQueue(context, devices[0], 0, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create command queue", error);
+
+	/* partial tiles at the borders, and several tiles per row */
+	for (layout = CLUT_LAYOUT_PLANAR; layout <= CLUT_LAYOUT_ZORDER; ++layout) {
+		failed += check_layout(context, queue, devices[0], (clut_layout) layout, 37, 23, 3);
+		failed += check_layout(context, queue, devices[0], (clut_layout) layout, 1027, 517, 1);
+	}
+
+	clReleaseCommandQueue(queue);
+	clut_releaseCachedPrograms(context);
+	clReleaseContext(context);
+	free(devices);
+	free(platforms);
+
+	printf("%s.\n", (0 == failed) ? "All checks passed" : "Some checks FAILED");
+	return (0 == failed) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+error:
+	return EXIT_FAILURE;
+}
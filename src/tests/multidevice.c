@@ -0,0 +1,160 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <Debug.h>
+#include <ArrayUtils.h>
+
+#include "mlclut.h"
+#include "mlclut_descriptions.h"
+#include "mlclut_multidevice.h"
+
+#define DEBUG_MAIN	"main"
+
+#define ROWS		1000003
+#define MIN_CHUNK	4096
+
+/* adds its global row number plus one to each row it gets */
+static const char *rows_sources[] = {
+	"__kernel void count_rows(__global uint *rows, uint first_row, uint n_rows)\n"
+	"{\n"
+	"	const uint i = get_global_id(0);\n"
+	"\n"
+	"	if (i < n_rows) {\n"
+	"		rows[i] += first_row + i + 1;\n"
+	"	}\n"
+	"}\n"
+};
+
+static cl_int count_rows(cl_command_queue command_queue,
+			 cl_uint device_index,
+			 cl_mem input,
+			 cl_mem output,
+			 size_t first_row,
+			 size_t n_rows,
+			 cl_event *event,
+			 void *user_data)
+{
+	cl_kernel kernel = ((cl_kernel *) user_data)[device_index];
+	cl_uint first = (cl_uint) first_row, n = (cl_uint) n_rows;
+
+	clSetKernelArg(kernel, 0, sizeof(cl_mem), &output);
+	clSetKernelArg(kernel, 1, sizeof(cl_uint), &first);
+	clSetKernelArg(kernel, 2, sizeof(cl_uint), &n);
+	return clEnqueueNDRangeKernel(command_queue, kernel, 1, NULL, &n_rows, NULL, 0, NULL, event);
+}
+
+/* every row must have been computed exactly once, by someone */
+static int check_split(const char *what, const cl_uint *rows, const size_t *rows_per_device, cl_uint n_devices)
+{
+	size_t i, total = 0;
+
+	for (i = 0; i < ROWS; ++i) {
+		if (rows[i] != (cl_uint) i + 1) {
+			printf("%s: FAILED at row %zu, %u instead of %u.\n", what, i, rows[i], (cl_uint) i + 1);
+			return 1;
+		}
+	}
+	for (i = 0; i < n_devices; ++i) {
+		printf("%s: device #%zu computed %zu rows.\n", what, i + 1, rows_per_device[i]);
+		total += rows_per_device[i];
+	}
+	if (ROWS != total) {
+		printf("%s: FAILED, devices report %zu rows instead of %d.\n", what, total, ROWS);
+		return 1;
+	}
+	printf("%s: ok.\n", what);
+	return 0;
+}
+
+int main(void)
+{
+	cl_uint n_platforms, n_devices, i;
+	clut_split_config config;
+	const cl_uint zero = 0;
+	cl_int ret;
+	int run, failed = 0;
+
+	cl_platform_id *platforms = clut_getAllPlatforms(&n_platforms);
+	if (NULL == platforms) {
+		Debug_out(DEBUG_MAIN, "No platforms available.\n");
+		return EXIT_FAILURE;
+	}
+
+	cl_device_id *devices = clut_getAllDevices(platforms[0], CL_DEVICE_TYPE_ALL, &n_devices);
+	if (NULL == devices) {
+		Debug_out(DEBUG_MAIN, "Platform #1 has no devices.\n");
+		return EXIT_FAILURE;
+	}
+	printf("Splitting %d rows over %u devices.\n", ROWS, n_devices);
+
+	/* one context for all the devices, with a queue and a kernel each */
+	cl_context context = clCreateContext(NULL, n_devices, devices, clut_contextCallback, "multidevice", &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create context", error);
+	cl_program program = clut_getCachedProgram(context, ARRAY_LEN(rows_sources), rows_sources, NULL);
+	if (NULL == program) {
+		Debug_out(DEBUG_MAIN, "Unable to build program.\n");
+		return EXIT_FAILURE;
+	}
+	cl_command_queue *queues = calloc(n_devices, sizeof(cl_command_queue));
+	cl_kernel *kernels = calloc(n_devices, sizeof(cl_kernel));
+	double *speeds = calloc(n_devices, sizeof(double));
+	size_t *rows_per_device = calloc(n_devices, sizeof(size_t));
+	cl_uint *rows = malloc(ROWS * sizeof(cl_uint));
+	if ((NULL == queues) || (NULL == kernels) || (NULL == speeds) || (NULL == rows_per_device) || (NULL == rows)) {
+		Debug_out(DEBUG_MAIN, "malloc failed.\n");
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < n_devices; ++i) {
+		queues[i] = clCreateCommandQueue(context, devices[i], 0, &ret);
+		CLUT_CHECK_ERROR(ret, "Unable to create command queue", error);
+		kernels[i] = clCreateKernel(program, "count_rows", &ret);
+		CLUT_CHECK_ERROR(ret, "Unable to create kernel", error);
+	}
+	cl_mem output = clCreateBuffer(context, CL_MEM_READ_WRITE, ROWS * sizeof(cl_uint), NULL, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create buffer", error);
+
+	memset(&config, 0, sizeof(config));
+	config.queues = queues;
+	config.n_queues = n_devices;
+	config.output = output;
+	config.output_row_pitch = sizeof(cl_uint);
+	config.rows = ROWS;
+	config.min_chunk_rows = MIN_CHUNK;
+	config.compute = count_rows;
+	config.user_data = kernels;
+	config.speeds = speeds;
+
+	/* the second run starts from the speeds measured by the first */
+	for (run = 0; run < 2; ++run) {
+		ret = clEnqueueFillBuffer(queues[0], output, &zero, sizeof(zero), 0, ROWS * sizeof(cl_uint), 0, NULL, NULL);
+		CLUT_CHECK_ERROR(ret, "Unable to clear buffer", error);
+		clFinish(queues[0]);
+
+		ret = clut_runSplit(&config, rows_per_device);
+		CLUT_CHECK_ERROR(ret, "Unable to run split", error);
+		ret = clEnqueueReadBuffer(queues[0], output, CL_TRUE, 0, ROWS * sizeof(cl_uint), rows, 0, NULL, NULL);
+		CLUT_CHECK_ERROR(ret, "Unable to read buffer", error);
+		failed += check_split((0 == run) ? "first run" : "seeded run", rows, rows_per_device, n_devices);
+	}
+
+	clReleaseMemObject(output);
+	for (i = 0; i < n_devices; ++i) {
+		clReleaseKernel(kernels[i]);
+		clReleaseCommandQueue(queues[i]);
+	}
+	free(queues);
+	free(kernels);
+	free(speeds);
+	free(rows_per_device);
+	free(rows);
+	clut_releaseCachedPrograms(context);
+	clReleaseContext(context);
+	free(devices);
+	free(platforms);
+
+	printf("%s.\n", (0 == failed) ? "All checks passed" : "Some checks FAILED");
+	return (0 == failed) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+error:
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,141 @@
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <Debug.h>
+
+#include "mlclut.h"
+#include "mlclut_descriptions.h"
+#include "mlclut_pipeline.h"
+#include "mlclut_interpose.h"
+#include "mlclut_trace.h"
+#include "mlclut_clock.h"
+
+#include "test_utils.h"
+
+#define DEBUG_MAIN	"main"
+
+/* the simplest compute stage: copy the input frame to the output frame */
+static cl_int copy_frame(cl_command_queue command_queue,
+			 cl_mem input,
+			 cl_mem output,
+			 const clut_image_desc *desc,
+			 cl_uint n_wait,
+			 const cl_event *wait_list,
+			 cl_event *event,
+			 void *user_data)
+{
+	const size_t origin[3] = {0, 0, 0};
+	const size_t region[3] = {desc->width, desc->height, 1};
+
+	if (CL_MEM_OBJECT_BUFFER == desc->storage) {
+		return clut_enqueueCopyBuffer(command_queue, input, output, 0, 0,
+					   desc->height * desc->row_pitch,
+					   n_wait, wait_list, event);
+	}
+	return clut_enqueueCopyImage(command_queue, input, output, origin, origin, region,
+				  n_wait, wait_list, event);
+}
+
+int main(int argc, char **argv)
+{
+	cl_uint n_platforms, n_devices;
+	cl_int ret;
+	int i, failed;
+
+	if (2 > argc) {
+		fprintf(stderr, "Usage: %s <image> [<image> ...]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	cl_platform_id *platforms = clut_getAllPlatforms(&n_platforms);
+	if (NULL == platforms) {
+		Debug_out(DEBUG_MAIN, "No platforms available.\n");
+		return EXIT_FAILURE;
+	}
+
+	cl_device_id *devices = clut_getAllDevices(platforms[0], CL_DEVICE_TYPE_ALL, &n_devices);
+	if (NULL == devices) {
+		Debug_out(DEBUG_MAIN, "Platform #1 has no devices.\n");
+		return EXIT_FAILURE;
+	}
+
+	cl_context context = clCreateContext(NULL, 1, devices, clut_contextCallback, "pipeline", &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create context", error);
+
+	/* one queue per stage, so transfers overlap with compute, plus an idle one for the clock */
+	cl_command_queue queues[4];
+	for (i = 0; i < 4; ++i) {
+		queues[i] = clCreateCommandQueue(context, devices[0], CL_QUEUE_PROFILING_ENABLE, &ret);
+		CLUT_CHECK_ERROR(ret, "Unable to create command queue", error);
+	}
+
+	/* record decode/encode and device commands on one timeline */
+	clut_trace *trace = clut_createTrace();
+	clut_clock *clock = clut_createClock(queues[3], 0);
+	if (NULL != clock) {
+		clut_traceAddClock(trace, clock);
+	}
+
+	/* each frame is saved next to its input */
+	char **outputs = calloc(argc - 1, sizeof(char *));
+	if (NULL == outputs) {
+		return EXIT_FAILURE;
+	}
+	for (i = 1; i < argc; ++i) {
+		outputs[i - 1] = malloc(strlen(argv[i]) + strlen(".out.png") + 1);
+		if (NULL == outputs[i - 1]) {
+			return EXIT_FAILURE;
+		}
+		sprintf(outputs[i - 1], "%s.out.png", argv[i]);
+	}
+
+	clut_pipeline_config config;
+	memset(&config, 0, sizeof(config));
+	config.context = context;
+	config.queues = queues;
+	config.n_queues = 3;
+	config.in_flight = 4;
+	config.n_decoders = 2;
+	config.n_encoders = 2;
+	config.compute = copy_frame;
+	config.trace = trace;
+
+	failed = clut_runPipeline(&config, (const char * const *) argv + 1, (const char * const *) outputs, argc - 1);
+	printf("Processed %d frames, %d failed.\n", argc - 1, failed);
+	if (0 <= failed) {
+		/* the stage copies, so each output must match its input */
+		for (i = 1; i < argc; ++i) {
+			if (!same_pixels(argv[i], outputs[i - 1])) {
+				printf("FAILED: '%s' differs from '%s'.\n", outputs[i - 1], argv[i]);
+				++failed;
+			}
+		}
+	}
+
+	if (0 == clut_traceExportChrome(trace, "pipeline.trace.json")) {
+		printf("Timeline written to pipeline.trace.json.\n");
+	}
+	clut_releaseTrace(trace);
+	clut_releaseClock(clock);
+	/* with CLUT_PROFILE set, report while the queues are alive */
+	clut_profileFlush(stderr);
+	clut_releaseProfile();
+
+	for (i = 0; i < argc - 1; ++i) {
+		free(outputs[i]);
+	}
+	free(outputs);
+	for (i = 0; i < 4; ++i) {
+		clReleaseCommandQueue(queues[i]);
+	}
+	clReleaseContext(context);
+	free(devices);
+	free(platforms);
+
+	return (0 == failed) ? 0 : EXIT_FAILURE;
+
+error:
+	return EXIT_FAILURE;
+}
+
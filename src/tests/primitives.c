@@ -0,0 +1,197 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <Debug.h>
+
+#include "mlclut.h"
+#include "mlclut_descriptions.h"
+#include "mlclut_primitives.h"
+
+#define DEBUG_MAIN	"main"
+
+/* not a multiple of any work-group size, and several groups long */
+#define N		100003
+#define BINS		256
+
+typedef struct pair {
+	cl_uint key;
+	cl_uint value;
+} pair;
+
+/* by key, then by original position: a stable sort */
+static int compare_pair(const void *a, const void *b)
+{
+	const pair *x = (const pair *) a, *y = (const pair *) b;
+
+	if (x->key != y->key) {
+		return (x->key > y->key) ? 1 : -1;
+	}
+	return (x->value > y->value) - (x->value < y->value);
+}
+
+static int check_uint(const char *what, const cl_uint *result, const cl_uint *expected, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+		if (result[i] != expected[i]) {
+			printf("%s: FAILED at %zu, %u instead of %u.\n", what, i, result[i], expected[i]);
+			return 1;
+		}
+	}
+	printf("%s: ok.\n", what);
+	return 0;
+}
+
+static cl_mem create_buffer(cl_context context, size_t size, void *host)
+{
+	cl_int ret;
+	cl_mem mem;
+
+	mem = clCreateBuffer(context, CL_MEM_READ_WRITE | ((NULL != host) ? CL_MEM_COPY_HOST_PTR : 0), size, host, &ret);
+	return clut_returnSuccess(ret) ? mem : NULL;
+}
+
+static int read_uint(cl_command_queue queue, cl_mem mem, cl_uint *dst, size_t n)
+{
+	return clut_returnSuccess(clEnqueueReadBuffer(queue, mem, CL_TRUE, 0, n * sizeof(cl_uint), dst, 0, NULL, NULL));
+}
+
+int main(void)
+{
+	cl_uint n_platforms, n_devices;
+	cl_int ret;
+	size_t i, n_kept;
+	int failed = 0;
+
+	cl_platform_id *platforms = clut_getAllPlatforms(&n_platforms);
+	if (NULL == platforms) {
+		Debug_out(DEBUG_MAIN, "No platforms available.\n");
+		return EXIT_FAILURE;
+	}
+
+	cl_device_id *devices = clut_getAllDevices(platforms[0], CL_DEVICE_TYPE_ALL, &n_devices);
+	if (NULL == devices) {
+		Debug_out(DEBUG_MAIN, "Platform #1 has no devices.\n");
+		return EXIT_FAILURE;
+	}
+
+	cl_context context = clCreateContext(NULL, 1, devices, clut_contextCallback, "primitives", &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create context", error);
+	cl_command_queue queue = clCreateCommandQueue(context, devices[0], 0, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create command queue", error);
+
+	cl_uint *data = malloc(N * sizeof(cl_uint));
+	cl_uint *flags = malloc(N * sizeof(cl_uint));
+	cl_uint *expected = malloc(N * sizeof(cl_uint));
+	cl_uint *result = malloc(N * sizeof(cl_uint));
+	pair *pairs = malloc(N * sizeof(pair));
+	if ((NULL == data) || (NULL == flags) || (NULL == expected) || (NULL == result) || (NULL == pairs)) {
+		Debug_out(DEBUG_MAIN, "malloc failed.\n");
+		return EXIT_FAILURE;
+	}
+	srand(42);
+	for (i = 0; i < N; ++i) {
+		data[i] = ((cl_uint) rand() << 16) ^ (cl_uint) rand();
+		flags[i] = (0 == rand() % 3);
+	}
+
+	cl_mem input = create_buffer(context, N * sizeof(cl_uint), data);
+	cl_mem output = create_buffer(context, N * sizeof(cl_uint), NULL);
+	cl_mem mask = create_buffer(context, N * sizeof(cl_uint), flags);
+	cl_mem count = create_buffer(context, sizeof(cl_uint), NULL);
+	cl_mem values = create_buffer(context, N * sizeof(cl_uint), NULL);
+	cl_mem histogram = create_buffer(context, BINS * sizeof(cl_uint), NULL);
+	if ((NULL == input) || (NULL == output) || (NULL == mask) || (NULL == count) ||
+	    (NULL == values) || (NULL == histogram)) {
+		Debug_out(DEBUG_MAIN, "Unable to create buffers.\n");
+		return EXIT_FAILURE;
+	}
+
+	/* prefix sums, wrapping around as cl_uint does */
+	ret = clut_scan(queue, CLUT_PRIM_UINT, CL_FALSE, input, output, N, 0, NULL, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to scan", error);
+	for (i = 0, expected[0] = 0; i + 1 < N; ++i) {
+		expected[i + 1] = expected[i] + data[i];
+	}
+	failed += !read_uint(queue, output, result, N) || check_uint("exclusive scan", result, expected, N);
+
+	ret = clut_scan(queue, CLUT_PRIM_UINT, CL_TRUE, input, output, N, 0, NULL, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to scan", error);
+	for (i = 0; i < N; ++i) {
+		expected[i] += data[i];
+	}
+	failed += !read_uint(queue, output, result, N) || check_uint("inclusive scan", result, expected, N);
+
+	/* stream compaction, in order */
+	ret = clut_compact(queue, CLUT_PRIM_UINT, input, mask, N, output, count, 0, NULL, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to compact", error);
+	for (i = 0, n_kept = 0; i < N; ++i) {
+		if (flags[i]) {
+			expected[n_kept++] = data[i];
+		}
+	}
+	if (!read_uint(queue, count, result, 1) || (result[0] != n_kept)) {
+		printf("compact count: FAILED, %u instead of %zu.\n", result[0], n_kept);
+		++failed;
+	} else {
+		failed += !read_uint(queue, output, result, n_kept) || check_uint("compact", result, expected, n_kept);
+	}
+
+	/* histogram of the low bytes, so that no value falls past the last bin */
+	for (i = 0; i < N; ++i) {
+		result[i] = data[i] & (BINS - 1);
+	}
+	ret = clEnqueueWriteBuffer(queue, output, CL_TRUE, 0, N * sizeof(cl_uint), result, 0, NULL, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to write buffer", error);
+	ret = clut_histogram(queue, CLUT_PRIM_UINT, output, N, BINS, histogram, 0, NULL, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to compute histogram", error);
+	memset(expected, 0, BINS * sizeof(cl_uint));
+	for (i = 0; i < N; ++i) {
+		++expected[data[i] & (BINS - 1)];
+	}
+	failed += !read_uint(queue, histogram, result, BINS) || check_uint("histogram", result, expected, BINS);
+
+	/* stable key-value sort, values being the original positions */
+	for (i = 0; i < N; ++i) {
+		pairs[i].key = data[i];
+		pairs[i].value = (cl_uint) i;
+		result[i] = (cl_uint) i;
+	}
+	ret = clEnqueueWriteBuffer(queue, values, CL_TRUE, 0, N * sizeof(cl_uint), result, 0, NULL, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to write buffer", error);
+	ret = clut_radixSort(queue, input, values, N, 0, NULL, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to sort", error);
+	qsort(pairs, N, sizeof(pair), compare_pair);
+	for (i = 0; i < N; ++i) {
+		expected[i] = pairs[i].key;
+	}
+	failed += !read_uint(queue, input, result, N) || check_uint("sort keys", result, expected, N);
+	for (i = 0; i < N; ++i) {
+		expected[i] = pairs[i].value;
+	}
+	failed += !read_uint(queue, values, result, N) || check_uint("sort values", result, expected, N);
+
+	clReleaseMemObject(input);
+	clReleaseMemObject(output);
+	clReleaseMemObject(mask);
+	clReleaseMemObject(count);
+	clReleaseMemObject(values);
+	clReleaseMemObject(histogram);
+	free(data);
+	free(flags);
+	free(expected);
+	free(result);
+	free(pairs);
+	clReleaseCommandQueue(queue);
+	clut_releaseCachedPrograms(context);
+	clReleaseContext(context);
+	free(devices);
+	free(platforms);
+
+	printf("%s.\n", (0 == failed) ? "All checks passed" : "Some checks FAILED");
+	return (0 == failed) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+error:
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,172 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <Debug.h>
+#include <ArrayUtils.h>
+
+#include "mlclut.h"
+#include "mlclut_descriptions.h"
+#include "mlclut_roofline.h"
+
+#define DEBUG_MAIN	"main"
+
+#define N		(1 << 16)
+#define PEAK_BANDWIDTH	100e9
+#define PEAK_FLOPS	1e12
+
+static const char *work_sources[] = {
+	"__kernel void work(__global float *data)\n"
+	"{\n"
+	"	const size_t i = get_global_id(0);\n"
+	"\n"
+	"	data[i] = data[i] * 2.0f + 1.0f;\n"
+	"}\n"
+};
+
+/* equal but for rounding, without libm */
+static int close_to(cl_double value, cl_double expected)
+{
+	const cl_double error = (value > expected) ? value - expected : expected - value;
+
+	return error <= 1e-9 * expected;
+}
+
+/* the snapshot entry of kernel [name], or NULL */
+static const clut_kernel_roofline * find_kernel(const clut_kernel_roofline *snapshot, size_t n, const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+		if ((NULL != snapshot[i].name) && (0 == strcmp(snapshot[i].name, name))) {
+			return &snapshot[i];
+		}
+	}
+	return NULL;
+}
+
+/* checks [name] is placed as expected, against PEAK_BANDWIDTH and PEAK_FLOPS */
+static int check_kernel(const clut_kernel_roofline *snapshot, size_t n, const char *name,
+			clut_roofline_bound bound, cl_double intensity, cl_double roof)
+{
+	const clut_kernel_roofline *k = find_kernel(snapshot, n, name);
+
+	if ((NULL == k) || (0 == k->count) || (0 >= k->time)) {
+		printf("%s: FAILED, not recorded.\n", name);
+		return 1;
+	}
+	if (k->bound != bound) {
+		printf("%s: FAILED, bound %d instead of %d.\n", name, (int) k->bound, (int) bound);
+		return 1;
+	}
+	if ((isinf(intensity) && !isinf(k->intensity)) ||
+	    (!isinf(intensity) && !close_to(k->intensity, intensity))) {
+		printf("%s: FAILED, intensity %g instead of %g.\n", name, k->intensity, intensity);
+		return 1;
+	}
+	/* efficiency is the achieved rate over the roof, finite */
+	if (!isfinite(k->efficiency) || !close_to(k->efficiency, ((0 < k->flops) ? k->flops : k->bandwidth) / roof)) {
+		printf("%s: FAILED, efficiency %g.\n", name, k->efficiency);
+		return 1;
+	}
+	printf("%s: ok.\n", name);
+	return 0;
+}
+
+/* launches [kernel] once, and records it in [roofline] as [name] */
+static int record(const char *name, clut_roofline *roofline, cl_command_queue queue, cl_kernel kernel,
+		  cl_ulong bytes, cl_ulong flops)
+{
+	const size_t global = N;
+	cl_event event;
+	int failed;
+
+	if (!clut_returnSuccess(clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global, NULL, 0, NULL, &event))) {
+		printf("%s: FAILED, unable to launch.\n", name);
+		return 1;
+	}
+	failed = (0 > clut_rooflineRecordEvent(roofline, event, name, bytes, flops));
+	if (failed) {
+		printf("%s: FAILED, unable to record.\n", name);
+	}
+	clReleaseEvent(event);
+	return failed;
+}
+
+int main(void)
+{
+	const clut_device_peaks peaks = {PEAK_BANDWIDTH, PEAK_FLOPS, 0};
+	const cl_ulong bytes = 2 * N * sizeof(cl_float), flops = 2 * N;
+	cl_uint n_platforms, n_devices;
+	clut_kernel_roofline *snapshot;
+	clut_roofline *roofline;
+	size_t n_kernels;
+	cl_int ret;
+	int failed = 0;
+
+	cl_platform_id *platforms = clut_getAllPlatforms(&n_platforms);
+	if (NULL == platforms) {
+		Debug_out(DEBUG_MAIN, "No platforms available.\n");
+		return EXIT_FAILURE;
+	}
+
+	cl_device_id *devices = clut_getAllDevices(platforms[0], CL_DEVICE_TYPE_ALL, &n_devices);
+	if (NULL == devices) {
+		Debug_out(DEBUG_MAIN, "Platform #1 has no devices.\n");
+		return EXIT_FAILURE;
+	}
+
+	cl_context context = clCreateContext(NULL, 1, devices, clut_contextCallback, "roofline", &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create context", error);
+	cl_command_queue queue = clCreateCommandQueue(context, devices[0], CL_QUEUE_PROFILING_ENABLE, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create command queue", error);
+	cl_kernel kernel = clut_acquireCachedKernel(context, ARRAY_LEN(work_sources), work_sources, NULL, "work");
+	if (NULL == kernel) {
+		Debug_out(DEBUG_MAIN, "Unable to build kernel.\n");
+		return EXIT_FAILURE;
+	}
+	cl_mem data = clCreateBuffer(context, CL_MEM_READ_WRITE, N * sizeof(cl_float), NULL, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create buffer", error);
+	clSetKernelArg(kernel, 0, sizeof(cl_mem), &data);
+
+	roofline = clut_createRoofline();
+	if (NULL == roofline) {
+		Debug_out(DEBUG_MAIN, "Unable to create roofline.\n");
+		return EXIT_FAILURE;
+	}
+
+	/* the same launch, annotated three ways under three names */
+	failed += record("balanced", roofline, queue, kernel, bytes, flops);
+	failed += record("streaming", roofline, queue, kernel, bytes, 0);
+	failed += record("registers only", roofline, queue, kernel, 0, flops);
+	clFinish(queue);
+	clut_rooflineWait(roofline);
+
+	snapshot = clut_rooflineSnapshot(roofline, &peaks, &n_kernels);
+	if (NULL == snapshot) {
+		Debug_out(DEBUG_MAIN, "Unable to take snapshot.\n");
+		return EXIT_FAILURE;
+	}
+	/* 0.5 flop/byte is below the 10 flop/byte ridge */
+	failed += check_kernel(snapshot, n_kernels, "balanced", CLUT_BOUND_MEMORY,
+			       (cl_double) flops / bytes, (cl_double) flops / bytes * PEAK_BANDWIDTH);
+	failed += check_kernel(snapshot, n_kernels, "streaming", CLUT_BOUND_MEMORY, 0, PEAK_BANDWIDTH);
+	failed += check_kernel(snapshot, n_kernels, "registers only", CLUT_BOUND_COMPUTE, HUGE_VAL, PEAK_FLOPS);
+	clut_rooflinePrint(roofline, &peaks, stdout);
+	clut_freeRooflineSnapshot(snapshot, n_kernels);
+
+	clut_releaseRoofline(roofline);
+	clReleaseMemObject(data);
+	clut_releaseCachedKernel(kernel);
+	clReleaseCommandQueue(queue);
+	clut_releaseCachedPrograms(context);
+	clReleaseContext(context);
+	free(devices);
+	free(platforms);
+
+	printf("%s.\n", (0 == failed) ? "All checks passed" : "Some checks FAILED");
+	return (0 == failed) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+error:
+	return EXIT_FAILURE;
+}
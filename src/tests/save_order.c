@@ -0,0 +1,150 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <Debug.h>
+
+#include "mlclut.h"
+#include "mlclut_descriptions.h"
+#include "mlclut_images.h"
+
+#define DEBUG_MAIN	"main"
+
+#define WIDTH		7
+#define HEIGHT		5
+#define OUTPUT		"save_order_test.png"
+
+/* the RGBA value of channel c of pixel i, exact both in 8 bit and as k / 255 */
+static unsigned char rgba_value(size_t i, int c)
+{
+	return (unsigned char) ((i * 37 + (size_t) c * 61 + 11) % 256);
+}
+
+/* where channel c of RGBA is stored, for each source order */
+static int source_channel(cl_channel_order order, int c)
+{
+	static const int from_bgra[4] = {2, 1, 0, 3};
+	static const int from_argb[4] = {1, 2, 3, 0};
+
+	switch (order) {
+		case CL_BGRA:
+			return from_bgra[c];
+		case CL_ARGB:
+			return from_argb[c];
+		default:
+			return c;
+	}
+}
+
+/* saves a WIDTH x HEIGHT buffer in [order] and [type], and checks the png pixels */
+static int save_and_check(const char *what, cl_context context, cl_command_queue queue,
+			  cl_channel_order order, cl_channel_type type)
+{
+	clut_image_desc desc;
+	unsigned char *data, *saved = NULL;
+	size_t i, channel_size = (CL_FLOAT == type) ? sizeof(cl_float) : 1;
+	int c, width, height, components, failed = 1;
+	cl_channel_order saved_order;
+	cl_mem buffer;
+	cl_int ret;
+
+	desc.storage = CL_MEM_OBJECT_BUFFER;
+	desc.width = WIDTH;
+	desc.height = HEIGHT;
+	desc.row_pitch = WIDTH * 4 * channel_size;
+	desc.components = 4;
+	desc.channel_order = order;
+	desc.channel_type = type;
+
+	data = malloc(HEIGHT * desc.row_pitch);
+	if (NULL == data) {
+		printf("%s: FAILED, malloc failed.\n", what);
+		return 1;
+	}
+	for (i = 0; i < WIDTH * HEIGHT; ++i) {
+		for (c = 0; c < 4; ++c) {
+			const size_t at = i * 4 + (size_t) source_channel(order, c);
+			if (CL_FLOAT == type) {
+				((cl_float *) data)[at] = rgba_value(i, c) / 255.0f;
+			} else {
+				data[at] = rgba_value(i, c);
+			}
+		}
+	}
+	buffer = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, HEIGHT * desc.row_pitch, data, &ret);
+	free(data);
+	if (!clut_returnSuccess(ret)) {
+		printf("%s: FAILED, unable to create buffer.\n", what);
+		return 1;
+	}
+
+	remove(OUTPUT);
+	if (0 > clut_saveImageBufferToFile(OUTPUT, queue, buffer, &desc)) {
+		printf("%s: FAILED, unable to save.\n", what);
+		goto end;
+	}
+	saved = clut_readImageFile(OUTPUT, &width, &height, &components, &saved_order);
+	if ((NULL == saved) || (WIDTH != width) || (HEIGHT != height) || (4 != components)) {
+		printf("%s: FAILED, unable to read back a %d x %d RGBA png.\n", what, WIDTH, HEIGHT);
+		goto end;
+	}
+	for (i = 0; i < WIDTH * HEIGHT; ++i) {
+		for (c = 0; c < 4; ++c) {
+			if (saved[i * 4 + c] != rgba_value(i, c)) {
+				printf("%s: FAILED at pixel %zu, channel %d is %u instead of %u.\n",
+				       what, i, c, saved[i * 4 + c], rgba_value(i, c));
+				goto end;
+			}
+		}
+	}
+	printf("%s: ok.\n", what);
+	failed = 0;
+
+end:
+	clut_freeImageData(saved);
+	remove(OUTPUT);
+	clReleaseMemObject(buffer);
+	return failed;
+}
+
+int main(void)
+{
+	cl_uint n_platforms, n_devices;
+	cl_int ret;
+	int failed = 0;
+
+	cl_platform_id *platforms = clut_getAllPlatforms(&n_platforms);
+	if (NULL == platforms) {
+		Debug_out(DEBUG_MAIN, "No platforms available.\n");
+		return EXIT_FAILURE;
+	}
+
+	cl_device_id *devices = clut_getAllDevices(platforms[0], CL_DEVICE_TYPE_ALL, &n_devices);
+	if (NULL == devices) {
+		Debug_out(DEBUG_MAIN, "Platform #1 has no devices.\n");
+		return EXIT_FAILURE;
+	}
+
+	cl_context context = clCreateContext(NULL, 1, devices, clut_contextCallback, "save_order", &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create context", error);
+	cl_command_queue queue = clCreateCommandQueue(context, devices[0], 0, &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create command queue", error);
+
+	/* buffers are saved in RGBA order, whatever order they are in */
+	failed += save_and_check("float RGBA buffer", context, queue, CL_RGBA, CL_FLOAT);
+	failed += save_and_check("float BGRA buffer", context, queue, CL_BGRA, CL_FLOAT);
+	failed += save_and_check("float ARGB buffer", context, queue, CL_ARGB, CL_FLOAT);
+	failed += save_and_check("8 bit BGRA buffer", context, queue, CL_BGRA, CL_UNSIGNED_INT8);
+	failed += save_and_check("8 bit ARGB buffer", context, queue, CL_ARGB, CL_UNSIGNED_INT8);
+
+	clReleaseCommandQueue(queue);
+	clut_releaseCachedPrograms(context);
+	clReleaseContext(context);
+	free(devices);
+	free(platforms);
+
+	printf("%s.\n", (0 == failed) ? "All checks passed" : "Some checks FAILED");
+	return (0 == failed) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+error:
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,126 @@
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <Debug.h>
+
+#include "mlclut.h"
+#include "mlclut_stats.h"
+
+#define DEBUG_MAIN	"main"
+
+#define N_SAMPLES	100000
+
+static int compare_ulong(const void *a, const void *b)
+{
+	const cl_ulong x = *(const cl_ulong *) a, y = *(const cl_ulong *) b;
+	return (x > y) - (x < y);
+}
+
+/* the exact percentile, with the rank used by the histograms */
+static cl_ulong exact_percentile(const cl_ulong *sorted, size_t n, double percentile)
+{
+	size_t target = (size_t) (percentile / 100.0 * (double) n + 0.5);
+	return sorted[(target < 1) ? 0 : target - 1];
+}
+
+/* checks a percentile is within the documented 1/32 relative error */
+static int check_percentile(const char *name, const char *which, cl_ulong value, cl_ulong exact)
+{
+	const cl_ulong error = (value > exact) ? value - exact : exact - value;
+
+	if (32 * error > exact) {
+		printf("%s %s: FAILED, %llu instead of %llu.\n",
+		       name, which, (unsigned long long) value, (unsigned long long) exact);
+		return 1;
+	}
+	return 0;
+}
+
+static int check_kernel(const clut_kernel_stats *k, cl_ulong *samples, size_t n)
+{
+	int failed = 0;
+
+	qsort(samples, n, sizeof(cl_ulong), compare_ulong);
+	if (k->count != n) {
+		printf("%s: FAILED, %llu samples instead of %zu.\n", k->name, (unsigned long long) k->count, n);
+		++failed;
+	}
+	if ((k->min != samples[0]) || (k->max != samples[n - 1])) {
+		printf("%s: FAILED, range [%llu, %llu] instead of [%llu, %llu].\n", k->name,
+		       (unsigned long long) k->min, (unsigned long long) k->max,
+		       (unsigned long long) samples[0], (unsigned long long) samples[n - 1]);
+		++failed;
+	}
+	failed += check_percentile(k->name, "p50", k->p50, exact_percentile(samples, n, 50));
+	failed += check_percentile(k->name, "p90", k->p90, exact_percentile(samples, n, 90));
+	failed += check_percentile(k->name, "p99", k->p99, exact_percentile(samples, n, 99));
+	return failed;
+}
+
+/* host only: feeds synthetic durations, with a slow tail, to the histograms */
+int main(void)
+{
+	clut_kernel_stats *snapshot;
+	size_t n_kernels, i;
+	clut_stats *stats;
+	cl_ulong *blur, *copy;
+	int failed = 0;
+
+	stats = clut_createStats();
+	blur = malloc(N_SAMPLES * sizeof(cl_ulong));
+	copy = malloc(N_SAMPLES * sizeof(cl_ulong));
+	if ((NULL == stats) || (NULL == blur) || (NULL == copy)) {
+		Debug_out(DEBUG_MAIN, "Unable to create stats.\n");
+		return EXIT_FAILURE;
+	}
+
+	srand(42);
+	for (i = 0; i < N_SAMPLES; ++i) {
+		cl_ulong fast = 20000 + (cl_ulong) (rand() % 2000);
+		cl_ulong slow = 150000 + (cl_ulong) (rand() % 50000);
+		blur[i] = (0 == i % 50) ? slow : fast;
+		copy[i] = 1000 + (cl_ulong) (rand() % 100);
+		clut_statsRecord(stats, "blur", blur[i]);
+		clut_statsRecord(stats, "copy", copy[i]);
+	}
+
+	clut_statsPrint(stats, stdout);
+
+	/* the snapshot is sorted by name */
+	snapshot = clut_statsSnapshot(stats, &n_kernels);
+	if ((NULL == snapshot) || (2 != n_kernels) ||
+	    (0 != strcmp(snapshot[0].name, "blur")) || (0 != strcmp(snapshot[1].name, "copy"))) {
+		printf("Snapshot: FAILED, wrong kernels.\n");
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < n_kernels; ++i) {
+		printf("%s: %llu samples, p99/p50 = %.2f.\n",
+		       snapshot[i].name,
+		       (unsigned long long) snapshot[i].count,
+		       (double) snapshot[i].p99 / (double) snapshot[i].p50);
+	}
+	failed += check_kernel(&snapshot[0], blur, N_SAMPLES);
+	failed += check_kernel(&snapshot[1], copy, N_SAMPLES);
+	clut_freeStatsSnapshot(snapshot, n_kernels);
+
+	clut_statsReset(stats);
+	printf("After reset:\n");
+	clut_statsPrint(stats, stdout);
+
+	snapshot = clut_statsSnapshot(stats, &n_kernels);
+	for (i = 0; (NULL != snapshot) && (i < n_kernels); ++i) {
+		if (0 != snapshot[i].count) {
+			printf("%s: FAILED, %llu samples after reset.\n", snapshot[i].name, (unsigned long long) snapshot[i].count);
+			++failed;
+		}
+	}
+	clut_freeStatsSnapshot(snapshot, n_kernels);
+
+	clut_releaseStats(stats);
+	free(blur);
+	free(copy);
+
+	printf("%s.\n", (0 == failed) ? "All checks passed" : "Some checks FAILED");
+	return (0 == failed) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,22 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "mlclut.h"
+#include "mlclut_images.h"
+
+#include "test_utils.h"
+
+/* decodes both files, and compares their pixels */
+int same_pixels(const char *a, const char *b)
+{
+	int wa, ha, ca, wb, hb, cb, same;
+	unsigned char *pa, *pb;
+
+	pa = clut_readImageFile(a, &wa, &ha, &ca, NULL);
+	pb = clut_readImageFile(b, &wb, &hb, &cb, NULL);
+	same = (NULL != pa) && (NULL != pb) && (wa == wb) && (ha == hb) && (ca == cb) &&
+	       (0 == memcmp(pa, pb, (size_t) wa * ha * ca));
+	clut_freeImageData(pa);
+	clut_freeImageData(pb);
+	return same;
+}
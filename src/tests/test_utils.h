@@ -0,0 +1,11 @@
+
+#ifndef __ML_CLUT_TEST_UTILS_H
+#define __ML_CLUT_TEST_UTILS_H
+
+/*!
+ * Helpers shared by the test programs, linked into each of them.
+ */
+
+int same_pixels(const char *a, const char *b);
+
+#endif
@@ -0,0 +1,275 @@
+/**
+ * @file
+ * @author Michele Laurenti
+ * @language c
+ *
+ * Generates a header with one typed launch function per kernel of an OpenCL
+ * source file.
+ *
+ * The program is built (with the library default options, which keep the
+ * argument metadata) on the first device of the first platform, and every
+ * kernel's arguments are read back: __global and __constant pointers and
+ * images become cl_mem parameters, __local pointers a size, samplers a
+ * cl_sampler, scalars and vectors the matching cl_ type, and anything else
+ * (structs) a pointer and a size. Each function sets the arguments with
+ * their index known at compile time, and enqueues the kernel.
+ * Names starting with "clut_" are reserved for the parameters and locals of
+ * the generated functions: kernels with such argument names are rejected.
+ *
+ * Usage: gen_launchers <kernels.cl> <output.h> [<build options>]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <Debug.h>
+#include <ArrayUtils.h>
+
+#include "mlclut.h"
+#include "mlclut_descriptions.h"
+
+#define DEBUG_MAIN	"main"
+
+struct type_name {
+	const char *opencl;
+	const char *c;
+};
+
+static const struct type_name scalar_types[] = {
+	{"char", "cl_char"}, {"uchar", "cl_uchar"},
+	{"short", "cl_short"}, {"ushort", "cl_ushort"}, {"half", "cl_half"},
+	{"int", "cl_int"}, {"uint", "cl_uint"}, {"float", "cl_float"},
+	{"long", "cl_long"}, {"ulong", "cl_ulong"}, {"double", "cl_double"}
+};
+
+enum arg_kind {
+	ARG_MEM,
+	ARG_LOCAL,
+	ARG_SAMPLER,
+	ARG_VALUE,
+	ARG_BYTES
+};
+
+struct arg {
+	char name[256];
+	char c_type[64];
+	enum arg_kind kind;
+};
+
+/* stores in [arg] how an argument of [type_name] with [address] is passed */
+static void classify_arg(struct arg *arg, const char *type_name, cl_kernel_arg_address_qualifier address)
+{
+	size_t len = 0, i;
+
+	if (CL_KERNEL_ARG_ADDRESS_LOCAL == address) {
+		arg->kind = ARG_LOCAL;
+		return;
+	}
+	if ((CL_KERNEL_ARG_ADDRESS_GLOBAL == address) || (CL_KERNEL_ARG_ADDRESS_CONSTANT == address) ||
+	    (NULL != strchr(type_name, '*')) || (0 == strncmp(type_name, "image", 5))) {
+		arg->kind = ARG_MEM;
+		strcpy(arg->c_type, "cl_mem");
+		return;
+	}
+	if (0 == strcmp(type_name, "sampler_t")) {
+		arg->kind = ARG_SAMPLER;
+		strcpy(arg->c_type, "cl_sampler");
+		return;
+	}
+
+	while (isalpha((unsigned char) type_name[len])) {
+		++len;
+	}
+	for (i = 0; i < ARRAY_LEN(scalar_types); ++i) {
+		if ((strlen(scalar_types[i].opencl) == len) && (0 == strncmp(scalar_types[i].opencl, type_name, len))) {
+			/* vectors keep their width: float4 -> cl_float4 */
+			arg->kind = ARG_VALUE;
+			snprintf(arg->c_type, sizeof(arg->c_type), "%s%s", scalar_types[i].c, type_name + len);
+			return;
+		}
+	}
+	arg->kind = ARG_BYTES;
+}
+
+/* writes the launch function of [kernel] to [f] */
+static int write_launcher(FILE *f, cl_kernel kernel)
+{
+	struct arg *args = NULL;
+	char *kernel_name, type_name[256];
+	cl_kernel_arg_address_qualifier address;
+	cl_uint n_args, i;
+	cl_int ret;
+
+	kernel_name = clut_getKernelName(kernel);
+	if (NULL == kernel_name) {
+		return -1;
+	}
+	ret = clGetKernelInfo(kernel, CL_KERNEL_NUM_ARGS, sizeof(n_args), &n_args, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to get kernel arguments number", error1);
+	args = calloc(n_args + 1, sizeof(struct arg));
+	if (NULL == args) {
+		goto error1;
+	}
+	for (i = 0; i < n_args; ++i) {
+		ret = clGetKernelArgInfo(kernel, i, CL_KERNEL_ARG_NAME, sizeof(args[i].name), args[i].name, NULL);
+		CLUT_CHECK_ERROR(ret, "Unable to get kernel argument name", error2);
+		ret = clGetKernelArgInfo(kernel, i, CL_KERNEL_ARG_TYPE_NAME, sizeof(type_name), type_name, NULL);
+		CLUT_CHECK_ERROR(ret, "Unable to get kernel argument type", error2);
+		ret = clGetKernelArgInfo(kernel, i, CL_KERNEL_ARG_ADDRESS_QUALIFIER, sizeof(address), &address, NULL);
+		CLUT_CHECK_ERROR(ret, "Unable to get kernel argument address qualifier", error2);
+		if (0 == strncmp(args[i].name, "clut_", 5)) {
+			fprintf(stderr, "%s: argument '%s' uses the reserved prefix 'clut_'.\n", kernel_name, args[i].name);
+			goto error2;
+		}
+		classify_arg(&args[i], type_name, address);
+	}
+
+	/* argument indices */
+	fprintf(f, "/* %s */\n", kernel_name);
+	if (0 != n_args) {
+		fprintf(f, "enum {\n");
+		for (i = 0; i < n_args; ++i) {
+			fprintf(f, "\tCLUT_ARG_%s_%s = %u%s\n", kernel_name, args[i].name, i, (i + 1 < n_args) ? "," : "");
+		}
+		fprintf(f, "};\n\n");
+	}
+
+	/* launch function */
+	fprintf(f, "static inline cl_int clut_launch_%s(cl_command_queue clut_queue,\n", kernel_name);
+	fprintf(f, "\t\tcl_kernel clut_kernel,\n");
+	fprintf(f, "\t\tcl_uint clut_work_dim,\n");
+	fprintf(f, "\t\tconst size_t *clut_global_work_size,\n");
+	fprintf(f, "\t\tconst size_t *clut_local_work_size,\n");
+	fprintf(f, "\t\tcl_uint clut_n_wait,\n");
+	fprintf(f, "\t\tconst cl_event *clut_wait_list,\n");
+	fprintf(f, "\t\tcl_event *clut_event");
+	for (i = 0; i < n_args; ++i) {
+		switch (args[i].kind) {
+		case ARG_LOCAL:
+			fprintf(f, ",\n\t\tsize_t %s_size", args[i].name);
+			break;
+		case ARG_BYTES:
+			fprintf(f, ",\n\t\tconst void *%s,\n\t\tsize_t %s_size", args[i].name, args[i].name);
+			break;
+		default:
+			fprintf(f, ",\n\t\t%s %s", args[i].c_type, args[i].name);
+			break;
+		}
+	}
+	fprintf(f, ")\n{\n");
+
+	if (0 != n_args) {
+		fprintf(f, "\tcl_int clut_ret;\n\n");
+		for (i = 0; i < n_args; ++i) {
+			fprintf(f, "%s", (0 == i) ? "\tif (" : " ||\n\t    ");
+			switch (args[i].kind) {
+			case ARG_LOCAL:
+				fprintf(f, "(CL_SUCCESS != (clut_ret = clSetKernelArg(clut_kernel, %u, %s_size, NULL)))", i, args[i].name);
+				break;
+			case ARG_BYTES:
+				fprintf(f, "(CL_SUCCESS != (clut_ret = clSetKernelArg(clut_kernel, %u, %s_size, %s)))", i, args[i].name, args[i].name);
+				break;
+			default:
+				fprintf(f, "(CL_SUCCESS != (clut_ret = clSetKernelArg(clut_kernel, %u, sizeof(%s), &%s)))", i, args[i].c_type, args[i].name);
+				break;
+			}
+		}
+		fprintf(f, ") {\n\t\treturn clut_ret;\n\t}\n");
+	}
+	fprintf(f, "\treturn clut_enqueueNDRangeKernel(clut_queue, clut_kernel, clut_work_dim, NULL,\n");
+	fprintf(f, "\t\t\tclut_global_work_size, clut_local_work_size,\n");
+	fprintf(f, "\t\t\tclut_n_wait, clut_wait_list, clut_event);\n}\n\n");
+
+	free(args);
+	free(kernel_name);
+	return 0;
+
+error2:	free(args);
+error1:	free(kernel_name);
+	return -1;
+}
+
+int main(int argc, char **argv)
+{
+	cl_uint n_platforms, n_devices, n_kernels, i;
+	cl_kernel *kernels;
+	const char *base;
+	char guard[256];
+	size_t j;
+	FILE *f;
+	cl_int ret;
+
+	if (3 > argc) {
+		fprintf(stderr, "Usage: %s <kernels.cl> <output.h> [<build options>]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	cl_platform_id *platforms = clut_getAllPlatforms(&n_platforms);
+	if (NULL == platforms) {
+		Debug_out(DEBUG_MAIN, "No platforms available.\n");
+		return EXIT_FAILURE;
+	}
+	cl_device_id *devices = clut_getAllDevices(platforms[0], CL_DEVICE_TYPE_ALL, &n_devices);
+	if (NULL == devices) {
+		Debug_out(DEBUG_MAIN, "Platform #1 has no devices.\n");
+		return EXIT_FAILURE;
+	}
+	cl_context context = clCreateContext(NULL, 1, devices, clut_contextCallback, "gen_launchers", &ret);
+	CLUT_CHECK_ERROR(ret, "Unable to create context", error);
+
+	cl_program program = clut_createProgramFromFile(context, argv[1], (3 < argc) ? argv[3] : NULL);
+	if (NULL == program) {
+		fprintf(stderr, "Unable to build '%s'.\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	ret = clCreateKernelsInProgram(program, 0, NULL, &n_kernels);
+	CLUT_CHECK_ERROR(ret, "Unable to count kernels", error);
+	kernels = calloc(n_kernels + 1, sizeof(cl_kernel));
+	if (NULL == kernels) {
+		return EXIT_FAILURE;
+	}
+	ret = clCreateKernelsInProgram(program, n_kernels, kernels, NULL);
+	CLUT_CHECK_ERROR(ret, "Unable to create kernels", error);
+
+	f = fopen(argv[2], "w");
+	if (NULL == f) {
+		fprintf(stderr, "Unable to open '%s'.\n", argv[2]);
+		return EXIT_FAILURE;
+	}
+
+	/* include guard from the output file name */
+	base = strrchr(argv[2], '/');
+	base = (NULL != base) ? base + 1 : argv[2];
+	for (j = 0; ('\0' != base[j]) && (j + 1 < sizeof(guard)); ++j) {
+		guard[j] = isalnum((unsigned char) base[j]) ? (char) toupper((unsigned char) base[j]) : '_';
+	}
+	guard[j] = '\0';
+
+	fprintf(f, "/* Generated by gen_launchers from %s: do not edit. */\n\n", argv[1]);
+	fprintf(f, "#ifndef __ML_CLUT_GEN_%s\n#define __ML_CLUT_GEN_%s\n\n", guard, guard);
+	fprintf(f, "#include \"mlclut.h\"\n#include \"mlclut_interpose.h\"\n\n");
+	for (i = 0; i < n_kernels; ++i) {
+		if (0 != write_launcher(f, kernels[i])) {
+			fclose(f);
+			remove(argv[2]);
+			return EXIT_FAILURE;
+		}
+		clReleaseKernel(kernels[i]);
+	}
+	fprintf(f, "#endif\n");
+	fclose(f);
+
+	Debug_out(DEBUG_MAIN, "%u launchers written to '%s'.\n", n_kernels, argv[2]);
+
+	free(kernels);
+	clReleaseProgram(program);
+	clReleaseContext(context);
+	free(devices);
+	free(platforms);
+	return EXIT_SUCCESS;
+
+error:
+	return EXIT_FAILURE;
+}